@@ -38,6 +38,7 @@
 #include <profiles/gnome-media-profiles.h>
 #include <gtk/gtk.h>
 #include <gio/gio.h>
+#include <glib/gstdio.h>
 
 #include "rhythmdb.h"
 #include "eel-gconf-extensions.h"
@@ -69,6 +70,17 @@ struct _RBEncoderGstPrivate {
 	char *dest_uri;
 
 	GOutputStream *outstream;
+
+	/* for copying files directly, without a pipeline */
+	GCancellable *copy_cancel;
+	GFile *copy_source;
+	GFile *copy_dest;
+	gboolean copy_overwrite;
+
+	/* transcode cache file for the current track */
+	char *cache_path;
+	char *cache_partial_path;
+	gboolean transcode_complete;
 };
 
 G_DEFINE_TYPE_WITH_CODE(RBEncoderGst, rb_encoder_gst, G_TYPE_OBJECT,
@@ -86,7 +98,11 @@ static gboolean rb_encoder_gst_get_preferred_mimetype (RBEncoder *encoder,
 						       char **mime,
 						       char **extension);
 static void rb_encoder_gst_emit_completed (RBEncoderGst *encoder);
+static void transcode_cache_store (RBEncoderGst *encoder);
+static void transcode_cache_discard (RBEncoderGst *encoder);
 
+static GMutex *transcode_cache_lock = NULL;
+static gint64 transcode_cache_size = -1;	/* -1 means not known yet */
 
 static void
 rb_encoder_gst_class_init (RBEncoderGstClass *klass)
@@ -98,6 +114,8 @@ rb_encoder_gst_class_init (RBEncoderGstClass *klass)
 
         g_type_class_add_private (klass, sizeof (RBEncoderGstPrivate));
 
+	transcode_cache_lock = g_mutex_new ();
+
 	/* create the mimetype -> GstCaps lookup table
 	 *
 	 * The strings are static data for now, but if we allow dynamic changing
@@ -163,7 +181,19 @@ rb_encoder_gst_finalize (GObject *object)
 		encoder->priv->outstream = NULL;
 	}
 
+	if (encoder->priv->copy_cancel) {
+		g_object_unref (encoder->priv->copy_cancel);
+	}
+	if (encoder->priv->copy_source) {
+		g_object_unref (encoder->priv->copy_source);
+	}
+	if (encoder->priv->copy_dest) {
+		g_object_unref (encoder->priv->copy_dest);
+	}
+
 	g_free (encoder->priv->dest_uri);
+	g_free (encoder->priv->cache_path);
+	g_free (encoder->priv->cache_partial_path);
 
         G_OBJECT_CLASS (rb_encoder_gst_parent_class)->finalize (object);
 }
@@ -225,6 +255,17 @@ rb_encoder_gst_emit_completed (RBEncoderGst *encoder)
 	}
 	g_object_unref (file);
 
+	/* only keep the output if the whole track was transcoded */
+	if (encoder->priv->cache_partial_path != NULL) {
+		if (encoder->priv->transcode_complete &&
+		    encoder->priv->error_emitted == FALSE &&
+		    encoder->priv->decoded_pads > 0) {
+			transcode_cache_store (encoder);
+		} else {
+			transcode_cache_discard (encoder);
+		}
+	}
+
 	encoder->priv->completion_emitted = TRUE;
 	_rb_encoder_emit_completed (RB_ENCODER (encoder), dest_size);
 }
@@ -278,6 +319,7 @@ bus_watch_cb (GstBus *bus, GstMessage *message, gpointer data)
 
 	case GST_MESSAGE_EOS:
 
+		encoder->priv->transcode_complete = encoder->priv->transcoding;
 		gst_element_set_state (encoder->priv->pipeline, GST_STATE_NULL);
 		if (encoder->priv->outstream != NULL) {
 			rb_debug ("received EOS, closing output stream");
@@ -898,6 +940,232 @@ create_pipeline_and_source (RBEncoderGst *encoder,
 	return src;
 }
 
+/*
+ * When both files can be reached directly, tracks that don't need to be
+ * transcoded are copied with gio rather than streamed through a pipeline,
+ * which lets the copy happen in large chunks (or entirely in the kernel).
+ */
+
+#define VERIFY_BUFFER_SIZE	(64 * 1024)
+
+static void start_file_copy (RBEncoderGst *encoder);
+
+static void
+finish_file_copy (RBEncoderGst *encoder)
+{
+	g_object_unref (encoder->priv->copy_cancel);
+	encoder->priv->copy_cancel = NULL;
+
+	rb_encoder_gst_emit_completed (encoder);
+	g_object_unref (encoder);
+}
+
+static gboolean
+compare_files (GFile *a, GFile *b, GCancellable *cancel, GError **error)
+{
+	GInputStream *astream;
+	GInputStream *bstream = NULL;
+	guchar *abuf;
+	guchar *bbuf;
+	gsize aread;
+	gsize bread;
+	gboolean same = FALSE;
+
+	astream = G_INPUT_STREAM (g_file_read (a, cancel, error));
+	if (astream == NULL)
+		return FALSE;
+	bstream = G_INPUT_STREAM (g_file_read (b, cancel, error));
+	if (bstream == NULL) {
+		g_object_unref (astream);
+		return FALSE;
+	}
+
+	abuf = g_malloc (VERIFY_BUFFER_SIZE);
+	bbuf = g_malloc (VERIFY_BUFFER_SIZE);
+	while (TRUE) {
+		if (g_input_stream_read_all (astream, abuf, VERIFY_BUFFER_SIZE, &aread, cancel, error) == FALSE ||
+		    g_input_stream_read_all (bstream, bbuf, VERIFY_BUFFER_SIZE, &bread, cancel, error) == FALSE)
+			break;
+
+		if (aread != bread || memcmp (abuf, bbuf, aread) != 0) {
+			g_set_error (error,
+				     RB_ENCODER_ERROR, RB_ENCODER_ERROR_FILE_ACCESS,
+				     "copied file doesn't match the original");
+			break;
+		}
+
+		if (aread < VERIFY_BUFFER_SIZE) {
+			same = TRUE;
+			break;
+		}
+	}
+
+	g_free (abuf);
+	g_free (bbuf);
+	g_input_stream_close (astream, NULL, NULL);
+	g_input_stream_close (bstream, NULL, NULL);
+	g_object_unref (astream);
+	g_object_unref (bstream);
+	return same;
+}
+
+typedef struct {
+	RBEncoderGst *encoder;
+	GError *error;
+} VerifyData;
+
+static gboolean
+verify_done_cb (VerifyData *data)
+{
+	RBEncoderGst *encoder = data->encoder;
+
+	if (data->error != NULL) {
+		if (g_error_matches (data->error, G_IO_ERROR, G_IO_ERROR_CANCELLED) == FALSE) {
+			rb_debug ("verifying copy to %s failed: %s", encoder->priv->dest_uri, data->error->message);
+			rb_encoder_gst_emit_error (encoder, data->error);
+		}
+		g_file_delete (encoder->priv->copy_dest, NULL, NULL);
+		g_error_free (data->error);
+	} else {
+		rb_debug ("copy to %s verified", encoder->priv->dest_uri);
+	}
+
+	finish_file_copy (encoder);
+	g_free (data);
+	return FALSE;
+}
+
+static gboolean
+verify_copy_job (GIOSchedulerJob *job, GCancellable *cancel, VerifyData *data)
+{
+	RBEncoderGstPrivate *priv = data->encoder->priv;
+
+	compare_files (priv->copy_source, priv->copy_dest, cancel, &data->error);
+	g_io_scheduler_job_send_to_mainloop_async (job, (GSourceFunc) verify_done_cb, data, NULL);
+	return FALSE;
+}
+
+static void
+file_copy_progress_cb (goffset current, goffset total, RBEncoderGst *encoder)
+{
+	if (total > 0) {
+		_rb_encoder_emit_progress (RB_ENCODER (encoder), ((double) current) / total);
+	}
+}
+
+static void
+file_copy_done_cb (GFile *source, GAsyncResult *result, RBEncoderGst *encoder)
+{
+	GError *error = NULL;
+
+	if (g_file_copy_finish (source, result, &error)) {
+		rb_debug ("finished copying to %s", encoder->priv->dest_uri);
+		if (eel_gconf_get_boolean (CONF_TRANSFER_VERIFY_COPIES)) {
+			VerifyData *data;
+
+			data = g_new0 (VerifyData, 1);
+			data->encoder = encoder;
+			g_io_scheduler_push_job ((GIOSchedulerJobFunc) verify_copy_job,
+						 data,
+						 NULL,
+						 G_PRIORITY_DEFAULT,
+						 encoder->priv->copy_cancel);
+			return;
+		}
+	} else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_EXISTS) &&
+		   encoder->priv->copy_overwrite == FALSE &&
+		   prompt_for_overwrite (encoder->priv->copy_dest)) {
+		g_error_free (error);
+		encoder->priv->copy_overwrite = TRUE;
+		start_file_copy (encoder);
+		return;
+	} else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_EXISTS)) {
+		rb_encoder_gst_emit_error (encoder, error);
+		g_error_free (error);
+	} else {
+		if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			rb_debug ("copy to %s cancelled", encoder->priv->dest_uri);
+		} else {
+			rb_debug ("copy to %s failed: %s", encoder->priv->dest_uri, error->message);
+			rb_encoder_gst_emit_error (encoder, error);
+		}
+		g_error_free (error);
+
+		/* don't leave partial copies lying around */
+		g_file_delete (encoder->priv->copy_dest, NULL, NULL);
+	}
+
+	finish_file_copy (encoder);
+}
+
+static void
+start_file_copy (RBEncoderGst *encoder)
+{
+	GFileCopyFlags flags = G_FILE_COPY_NONE;
+
+	if (encoder->priv->copy_overwrite)
+		flags |= G_FILE_COPY_OVERWRITE;
+
+	g_file_copy_async (encoder->priv->copy_source,
+			   encoder->priv->copy_dest,
+			   flags,
+			   G_PRIORITY_DEFAULT,
+			   encoder->priv->copy_cancel,
+			   (GFileProgressCallback) file_copy_progress_cb,
+			   encoder,
+			   (GAsyncReadyCallback) file_copy_done_cb,
+			   encoder);
+}
+
+/* takes ownership of the two files */
+static void
+start_copy_from (RBEncoderGst *encoder, GFile *source, GFile *dest)
+{
+	encoder->priv->copy_source = source;
+	encoder->priv->copy_dest = dest;
+	encoder->priv->copy_overwrite = FALSE;
+	encoder->priv->copy_cancel = g_cancellable_new ();
+
+	/* the ref is released when the copy finishes */
+	g_object_ref (encoder);
+	start_file_copy (encoder);
+}
+
+static gboolean
+copy_file (RBEncoderGst *encoder,
+	   RhythmDBEntry *entry,
+	   const char *dest,
+	   GError **error)
+{
+	GFile *source;
+	GFile *dest_file;
+	char *uri;
+
+	g_assert (encoder->priv->pipeline == NULL);
+	g_assert (encoder->priv->copy_cancel == NULL);
+
+	uri = rhythmdb_entry_get_playback_uri (entry);
+	if (uri == NULL) {
+		return FALSE;
+	}
+
+	/* anything that isn't a plain file may need the prepare-source
+	 * and prepare-sink hooks, so it has to go through a pipeline.
+	 */
+	source = g_file_new_for_uri (uri);
+	dest_file = g_file_new_for_uri (dest);
+	g_free (uri);
+	if (g_file_is_native (source) == FALSE || g_file_is_native (dest_file) == FALSE) {
+		g_object_unref (source);
+		g_object_unref (dest_file);
+		return FALSE;
+	}
+
+	rb_debug ("copying file directly to %s", dest);
+	start_copy_from (encoder, source, dest_file);
+	return TRUE;
+}
+
 static gboolean
 copy_track (RBEncoderGst *encoder,
 	    RhythmDBEntry *entry,
@@ -922,6 +1190,305 @@ copy_track (RBEncoderGst *encoder,
 	return TRUE;
 }
 
+/*
+ * Transcoded files are kept in a cache so that transferring the same
+ * track with the same encoding profile again (to another device, or to
+ * the same device after it's been wiped) is just a copy.  Cached files
+ * are named after a hash of the source location, size and modification
+ * time and the encoding profile.  The modification time of each cached
+ * file is updated when it's used, and the least recently used files are
+ * removed when the cache grows beyond its size limit.
+ */
+
+static const char *
+get_transcode_cache_dir (void)
+{
+	static char *cache_dir = NULL;
+
+	if (cache_dir == NULL) {
+		cache_dir = g_build_filename (rb_user_cache_dir (), "transcode", NULL);
+		if (g_mkdir_with_parents (cache_dir, 0700) != 0) {
+			rb_debug ("unable to create transcode cache directory %s", cache_dir);
+		}
+	}
+	return cache_dir;
+}
+
+static gint64
+get_transcode_cache_limit (void)
+{
+	/* in megabytes */
+	return ((gint64) eel_gconf_get_integer (CONF_TRANSFER_CACHE_SIZE)) * 1024 * 1024;
+}
+
+static char *
+get_transcode_cache_path (RhythmDBEntry *entry, GMAudioProfile *profile)
+{
+	GChecksum *checksum;
+	char *key;
+	char *name;
+	char *path;
+
+	key = g_strdup_printf ("%s\n%" G_GUINT64_FORMAT "\n%lu\n%s\n%s",
+			       rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LOCATION),
+			       rhythmdb_entry_get_uint64 (entry, RHYTHMDB_PROP_FILE_SIZE),
+			       rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_MTIME),
+			       gm_audio_profile_get_id (profile),
+			       gm_audio_profile_get_pipeline (profile));
+	checksum = g_checksum_new (G_CHECKSUM_SHA1);
+	g_checksum_update (checksum, (const guchar *) key, -1);
+	name = g_strdup_printf ("%s.%s",
+				g_checksum_get_string (checksum),
+				gm_audio_profile_get_extension (profile));
+	path = g_build_filename (get_transcode_cache_dir (), name, NULL);
+
+	g_checksum_free (checksum);
+	g_free (key);
+	g_free (name);
+	return path;
+}
+
+typedef struct {
+	GFileInfo *info;
+	guint64 mtime;
+} CacheFile;
+
+static int
+compare_cache_files (CacheFile *a, CacheFile *b)
+{
+	if (a->mtime < b->mtime)
+		return -1;
+	return (a->mtime > b->mtime) ? 1 : 0;
+}
+
+/* must be called with the transcode cache lock held */
+static void
+trim_transcode_cache (GCancellable *cancel)
+{
+	GFileEnumerator *e;
+	GFileInfo *info;
+	GFile *dir;
+	GList *files = NULL;
+	GList *l;
+	gint64 limit;
+	gint64 size = 0;
+
+	limit = get_transcode_cache_limit ();
+	if (transcode_cache_size != -1 && transcode_cache_size <= limit)
+		return;
+
+	dir = g_file_new_for_path (get_transcode_cache_dir ());
+	e = g_file_enumerate_children (dir,
+				       G_FILE_ATTRIBUTE_STANDARD_NAME ","
+				       G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+				       G_FILE_ATTRIBUTE_TIME_MODIFIED,
+				       G_FILE_QUERY_INFO_NONE,
+				       cancel,
+				       NULL);
+	if (e == NULL) {
+		g_object_unref (dir);
+		return;
+	}
+
+	while ((info = g_file_enumerator_next_file (e, cancel, NULL)) != NULL) {
+		CacheFile *file;
+
+		if (g_str_has_suffix (g_file_info_get_name (info), ".partial")) {
+			g_object_unref (info);
+			continue;
+		}
+
+		file = g_new0 (CacheFile, 1);
+		file->info = info;
+		file->mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+		files = g_list_prepend (files, file);
+		size += g_file_info_get_size (info);
+	}
+	g_file_enumerator_close (e, NULL, NULL);
+	g_object_unref (e);
+
+	/* remove the least recently used files */
+	files = g_list_sort (files, (GCompareFunc) compare_cache_files);
+	for (l = files; l != NULL; l = l->next) {
+		CacheFile *file = l->data;
+
+		if (size > limit) {
+			GFile *child;
+
+			child = g_file_get_child (dir, g_file_info_get_name (file->info));
+			if (g_file_delete (child, NULL, NULL)) {
+				rb_debug ("removed %s from the transcode cache", g_file_info_get_name (file->info));
+				size -= g_file_info_get_size (file->info);
+			}
+			g_object_unref (child);
+		}
+
+		g_object_unref (file->info);
+		g_free (file);
+	}
+	g_list_free (files);
+	g_object_unref (dir);
+
+	transcode_cache_size = size;
+}
+
+typedef struct {
+	char *partial_path;
+	char *cache_path;
+} CacheStoreData;
+
+static gboolean
+transcode_cache_store_job (GIOSchedulerJob *job, GCancellable *cancel, CacheStoreData *data)
+{
+	GFileInfo *info;
+	GFile *partial;
+	GFile *cached;
+	GError *error = NULL;
+
+	partial = g_file_new_for_path (data->partial_path);
+	cached = g_file_new_for_path (data->cache_path);
+
+	/* the pipeline wrote the file under a temporary name, so a partial
+	 * file is never used.  this is just a rename.
+	 */
+	if (g_file_move (partial, cached, G_FILE_COPY_OVERWRITE, cancel, NULL, NULL, &error)) {
+		rb_debug ("stored %s in the transcode cache", data->cache_path);
+
+		g_mutex_lock (transcode_cache_lock);
+		info = g_file_query_info (cached, G_FILE_ATTRIBUTE_STANDARD_SIZE, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+		if (info != NULL) {
+			if (transcode_cache_size != -1)
+				transcode_cache_size += g_file_info_get_size (info);
+			g_object_unref (info);
+		}
+		trim_transcode_cache (cancel);
+		g_mutex_unlock (transcode_cache_lock);
+	} else {
+		rb_debug ("unable to store %s in the transcode cache: %s", data->cache_path, error->message);
+		g_error_free (error);
+		g_file_delete (partial, NULL, NULL);
+	}
+
+	g_object_unref (partial);
+	g_object_unref (cached);
+
+	g_free (data->partial_path);
+	g_free (data->cache_path);
+	g_free (data);
+	return FALSE;
+}
+
+static void
+transcode_cache_store (RBEncoderGst *encoder)
+{
+	CacheStoreData *data;
+
+	data = g_new0 (CacheStoreData, 1);
+	data->partial_path = encoder->priv->cache_partial_path;
+	data->cache_path = g_strdup (encoder->priv->cache_path);
+	encoder->priv->cache_partial_path = NULL;
+	g_io_scheduler_push_job ((GIOSchedulerJobFunc) transcode_cache_store_job,
+				 data,
+				 NULL,
+				 G_PRIORITY_LOW,
+				 NULL);
+}
+
+static void
+transcode_cache_discard (RBEncoderGst *encoder)
+{
+	rb_debug ("discarding incomplete transcode cache file %s", encoder->priv->cache_partial_path);
+	if (g_unlink (encoder->priv->cache_partial_path) != 0) {
+		rb_debug ("unable to remove %s", encoder->priv->cache_partial_path);
+	}
+	g_free (encoder->priv->cache_partial_path);
+	encoder->priv->cache_partial_path = NULL;
+}
+
+/*
+ * splits the encoded output so it's written to the cache as well as the
+ * destination, without having to read it back from the destination
+ * (which is usually a slow device) afterwards.
+ */
+static GstElement *
+add_cache_output (RBEncoderGst *encoder, GstElement *end)
+{
+	GstElement *tee;
+	GstElement *queue;
+	GstElement *sink;
+	char *partial_path;
+
+	tee = gst_element_factory_make ("tee", NULL);
+	queue = gst_element_factory_make ("queue", NULL);
+	sink = gst_element_factory_make ("filesink", NULL);
+	if (tee == NULL || queue == NULL || sink == NULL) {
+		rb_debug ("unable to create elements for the transcode cache output");
+		if (tee != NULL)
+			gst_object_unref (tee);
+		if (queue != NULL)
+			gst_object_unref (queue);
+		if (sink != NULL)
+			gst_object_unref (sink);
+		return end;
+	}
+
+	/* transfers to several devices can be writing the same track */
+	partial_path = g_strdup_printf ("%s.%p.partial", encoder->priv->cache_path, encoder);
+	g_object_set (sink, "location", partial_path, NULL);
+
+	gst_bin_add_many (GST_BIN (encoder->priv->pipeline), tee, queue, sink, NULL);
+	if (gst_element_link_many (tee, queue, sink, NULL) == FALSE ||
+	    gst_element_link (end, tee) == FALSE) {
+		rb_debug ("unable to link transcode cache output");
+		gst_bin_remove_many (GST_BIN (encoder->priv->pipeline), tee, queue, sink, NULL);
+		g_free (partial_path);
+		return end;
+	}
+
+	rb_debug ("writing transcoded file to the cache as %s", partial_path);
+	encoder->priv->cache_partial_path = partial_path;
+	return tee;
+}
+
+static gboolean
+transcode_cache_lookup (RBEncoderGst *encoder, const char *dest)
+{
+	GFile *cached;
+	GFile *dest_file;
+	GTimeVal now;
+	GError *error = NULL;
+
+	dest_file = g_file_new_for_uri (dest);
+	if (g_file_is_native (dest_file) == FALSE) {
+		g_object_unref (dest_file);
+		return FALSE;
+	}
+
+	/* setting the modification time tells us whether the file is there,
+	 * and keeps it from being thrown out of the cache.
+	 */
+	cached = g_file_new_for_path (encoder->priv->cache_path);
+	g_get_current_time (&now);
+	if (g_file_set_attribute_uint64 (cached,
+					 G_FILE_ATTRIBUTE_TIME_MODIFIED,
+					 now.tv_sec,
+					 G_FILE_QUERY_INFO_NONE,
+					 NULL,
+					 &error) == FALSE) {
+		if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND) == FALSE) {
+			rb_debug ("unable to use cached file %s: %s", encoder->priv->cache_path, error->message);
+		}
+		g_error_free (error);
+		g_object_unref (cached);
+		g_object_unref (dest_file);
+		return FALSE;
+	}
+
+	rb_debug ("copying transcoded file from cache: %s", encoder->priv->cache_path);
+	start_copy_from (encoder, cached, dest_file);
+	return TRUE;
+}
+
 static gboolean
 transcode_track (RBEncoderGst *encoder,
 	 	 RhythmDBEntry *entry,
@@ -947,6 +1514,12 @@ transcode_track (RBEncoderGst *encoder,
 		rb_debug ("selected profile %s", gm_audio_profile_get_name (profile));
 	}
 
+	if (get_transcode_cache_limit () > 0) {
+		encoder->priv->cache_path = get_transcode_cache_path (entry, profile);
+		if (transcode_cache_lookup (encoder, dest))
+			return TRUE;
+	}
+
 	src = create_pipeline_and_source (encoder, entry, error);
 	if (src == NULL)
 		goto error;
@@ -964,6 +1537,9 @@ transcode_track (RBEncoderGst *encoder,
 	if (end == NULL)
 		goto error;
 
+	if (encoder->priv->cache_path != NULL)
+		end = add_cache_output (encoder, end);
+
 	if (!attach_output_pipeline (encoder, end, dest, error))
 		goto error;
 	if (!add_tags_from_entry (encoder, entry, error))
@@ -984,6 +1560,12 @@ rb_encoder_gst_cancel (RBEncoder *encoder)
 {
 	RBEncoderGstPrivate *priv = RB_ENCODER_GST (encoder)->priv;
 
+	if (priv->copy_cancel != NULL) {
+		/* completion is emitted when the copy stops */
+		g_cancellable_cancel (priv->copy_cancel);
+		return;
+	}
+
 	if (priv->pipeline == NULL)
 		return;
 
@@ -1019,6 +1601,7 @@ rb_encoder_gst_encode (RBEncoder *encoder,
 	GError *error = NULL;
 
 	g_return_val_if_fail (priv->pipeline == NULL, FALSE);
+	g_return_val_if_fail (priv->copy_cancel == NULL, FALSE);
 
 	entry_mime_type = rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_MIMETYPE);
 	was_raw = g_str_has_prefix (entry_mime_type, "audio/x-raw");
@@ -1071,7 +1654,10 @@ rb_encoder_gst_encode (RBEncoder *encoder,
 		priv->total_length = rhythmdb_entry_get_uint64 (entry, RHYTHMDB_PROP_FILE_SIZE);
 		priv->position_format = GST_FORMAT_BYTES;
 
-		result = copy_track (RB_ENCODER_GST (encoder), entry, dest, &error);
+		result = copy_file (RB_ENCODER_GST (encoder), entry, dest, &error);
+		if (result == FALSE && error == NULL) {
+			result = copy_track (RB_ENCODER_GST (encoder), entry, dest, &error);
+		}
 	} else {
 		priv->total_length = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_DURATION);
 		priv->position_format = GST_FORMAT_TIME;
@@ -70,6 +70,12 @@ G_BEGIN_DECLS
 #define CONF_LIBRARY_LAYOUT_PATH	CONF_PREFIX "/library_layout_path"
 #define CONF_LIBRARY_LAYOUT_FILENAME	CONF_PREFIX "/library_layout_filename"
 #define CONF_LIBRARY_PREFERRED_FORMAT	CONF_PREFIX "/library_preferred_format"
+#define CONF_LIBRARY_SHARD_DB		CONF_PREFIX "/library_shard_db"
+#define CONF_LIBRARY_LAZY_CHILD_SOURCES	CONF_PREFIX "/library_lazy_child_sources"
+#define CONF_LIBRARY_CHILD_RELEASE_DELAY	CONF_PREFIX "/library_child_release_delay"
+#define CONF_TRANSFER_VERIFY_COPIES	CONF_PREFIX "/transfer_verify_copies"
+#define CONF_TRANSFER_CACHE_SIZE	CONF_PREFIX "/transfer_cache_size"
+#define CONF_TRANSFER_MAX_PER_DESTINATION	CONF_PREFIX "/transfer_max_per_destination"
 
 #define CONF_PLUGINS_PREFIX		CONF_PREFIX "/plugins"
 #define CONF_PLUGIN_DISABLE_USER	CONF_PLUGINS_PREFIX "/no_user_plugins"
@@ -31,6 +31,7 @@
 #include "config.h"
 
 #include <string.h>
+#include <stdlib.h>
 
 #include <gtk/gtk.h>
 #include <glib/gi18n.h>
@@ -67,6 +68,8 @@ static void impl_get_property (GObject *object,
 			       GParamSpec *pspec);
 
 static void load_songs (RBGenericPlayerSource *source);
+static char *get_device_catalog_path (RBGenericPlayerSource *source);
+static void save_device_catalog (RBGenericPlayerSource *source);
 
 static gboolean impl_show_popup (RBSource *source);
 static void impl_delete_thyself (RBSource *source);
@@ -83,6 +86,7 @@ static char* impl_build_dest_uri (RBRemovableMediaSource *source,
 static guint64 impl_get_capacity (RBMediaPlayerSource *source);
 static guint64 impl_get_free_space (RBMediaPlayerSource *source);
 static void impl_get_entries (RBMediaPlayerSource *source, const char *category, GHashTable *map);
+static const char *impl_get_entry_category (RBMediaPlayerSource *source, RhythmDBEntry *entry);
 static void impl_delete_entries (RBMediaPlayerSource *source,
 				 GList *entries,
 				 RBMediaPlayerSourceDeleteCallback callback,
@@ -128,6 +132,11 @@ typedef struct
 
 	MPIDDevice *device_info;
 
+	/* cached snapshot of the device contents */
+	char *catalog_path;
+	GList *catalog_entries;
+	gulong catalog_load_time;
+
 } RBGenericPlayerSourcePrivate;
 
 RB_PLUGIN_DEFINE_TYPE(RBGenericPlayerSource, rb_generic_player_source, RB_TYPE_MEDIA_PLAYER_SOURCE)
@@ -156,6 +165,7 @@ rb_generic_player_source_class_init (RBGenericPlayerSourceClass *klass)
 	source_class->impl_get_status = impl_get_status;
 
 	mps_class->impl_get_entries = impl_get_entries;
+	mps_class->impl_get_entry_category = impl_get_entry_category;
 	mps_class->impl_get_capacity = impl_get_capacity;
 	mps_class->impl_get_free_space = impl_get_free_space;
 	mps_class->impl_delete_entries = impl_delete_entries;
@@ -260,6 +270,8 @@ impl_constructed (GObject *object)
 	}
 	g_strfreev (playlist_formats);
 
+	priv->catalog_path = get_device_catalog_path (source);
+
         rb_media_player_source_load (RB_MEDIA_PLAYER_SOURCE (source));
 	load_songs (source);
 }
@@ -343,6 +355,9 @@ impl_dispose (GObject *object)
 		priv->device_info = NULL;
 	}
 
+	rb_list_destroy_free (priv->catalog_entries, (GDestroyNotify) rhythmdb_entry_unref);
+	priv->catalog_entries = NULL;
+
 	G_OBJECT_CLASS (rb_generic_player_source_parent_class)->dispose (object);
 }
 
@@ -353,6 +368,11 @@ impl_finalize (GObject *object)
 
 	g_return_if_fail (RB_IS_GENERIC_PLAYER_SOURCE (object));
 	priv = GET_PRIVATE (object);
+
+	g_free (priv->catalog_path);
+	g_free (priv->mount_path);
+
+	G_OBJECT_CLASS (rb_generic_player_source_parent_class)->finalize (object);
 }
 
 RBRemovableMediaSource *
@@ -426,9 +446,320 @@ impl_delete_thyself (RBSource *source)
 		priv->import_errors = NULL;
 	}
 
+	/* the device is going away, so this is the last chance to record
+	 * what we know about its contents.
+	 */
+	save_device_catalog (RB_GENERIC_PLAYER_SOURCE (source));
+
 	RB_SOURCE_CLASS (rb_generic_player_source_parent_class)->impl_delete_thyself (source);
 }
 
+/* device catalog snapshots
+ *
+ * Scanning a large device means reading tags from every file on it, which
+ * takes a long time over USB.  To avoid doing that on every mount, we keep
+ * a snapshot of the entries for each device we've seen.  When the device is
+ * mounted again, entries are created from the snapshot straight away, and
+ * the import job only has to stat the files: rhythmdb skips reading tags
+ * for files whose mtime and size match the entry.  Snapshot entries that
+ * the scan didn't find are checked again once the import completes, which
+ * removes them if the file is gone.
+ */
+
+#define DEVICE_CATALOG_HEADER	"rhythmbox-device-catalog 1"
+
+static const RhythmDBPropType catalog_props[] = {
+	RHYTHMDB_PROP_TITLE,
+	RHYTHMDB_PROP_GENRE,
+	RHYTHMDB_PROP_ARTIST,
+	RHYTHMDB_PROP_ALBUM,
+	RHYTHMDB_PROP_TRACK_NUMBER,
+	RHYTHMDB_PROP_DISC_NUMBER,
+	RHYTHMDB_PROP_DURATION,
+	RHYTHMDB_PROP_FILE_SIZE,
+	RHYTHMDB_PROP_MTIME,
+	RHYTHMDB_PROP_BITRATE,
+	RHYTHMDB_PROP_DATE,
+	RHYTHMDB_PROP_MIMETYPE
+};
+
+static char *
+get_device_catalog_path (RBGenericPlayerSource *source)
+{
+	RBGenericPlayerSourcePrivate *priv = GET_PRIVATE (source);
+	GMount *mount;
+	GVolume *volume;
+	char *id = NULL;
+	char *checksum;
+	char *filename;
+	char *dir;
+	char *path;
+
+	/* identify the device by its serial number if we know it, otherwise
+	 * by the filesystem it contains.  if we get this wrong, the import
+	 * job will still find and correct any differences.
+	 */
+	g_object_get (priv->device_info, "serial", &id, NULL);
+	if (id == NULL || id[0] == '\0') {
+		g_free (id);
+		g_object_get (source, "mount", &mount, NULL);
+		id = g_mount_get_uuid (mount);
+		if (id == NULL) {
+			volume = g_mount_get_volume (mount);
+			if (volume != NULL) {
+				id = g_volume_get_uuid (volume);
+				g_object_unref (volume);
+			}
+		}
+		if (id == NULL) {
+			id = g_mount_get_name (mount);
+		}
+		g_object_unref (mount);
+	}
+
+	if (id == NULL) {
+		return NULL;
+	}
+
+	dir = g_build_filename (rb_user_cache_dir (), "devices", NULL);
+	if (g_mkdir_with_parents (dir, 0700) != 0) {
+		rb_debug ("unable to create device catalog directory %s", dir);
+		g_free (dir);
+		g_free (id);
+		return NULL;
+	}
+
+	checksum = g_compute_checksum_for_string (G_CHECKSUM_MD5, id, -1);
+	filename = g_strdup_printf ("%s.catalog", checksum);
+	path = g_build_filename (dir, filename, NULL);
+	rb_debug ("device catalog for %s: %s", id, path);
+
+	g_free (filename);
+	g_free (checksum);
+	g_free (dir);
+	g_free (id);
+	return path;
+}
+
+static void
+load_device_catalog (RBGenericPlayerSource *source, RhythmDBEntryType entry_type, const char *mount_path)
+{
+	RBGenericPlayerSourcePrivate *priv = GET_PRIVATE (source);
+	GTimeVal now;
+	GError *error = NULL;
+	char *contents;
+	char **lines;
+	int count = 0;
+	int i;
+
+	g_get_current_time (&now);
+	priv->catalog_load_time = now.tv_sec;
+
+	if (priv->catalog_path == NULL) {
+		return;
+	}
+
+	if (g_file_get_contents (priv->catalog_path, &contents, NULL, &error) == FALSE) {
+		rb_debug ("unable to read device catalog: %s", error->message);
+		g_error_free (error);
+		return;
+	}
+
+	lines = g_strsplit (contents, "\n", 0);
+	g_free (contents);
+
+	if (lines[0] == NULL || strcmp (lines[0], DEVICE_CATALOG_HEADER) != 0) {
+		rb_debug ("ignoring device catalog with unknown format");
+		g_strfreev (lines);
+		return;
+	}
+
+	for (i = 1; lines[i] != NULL; i++) {
+		RhythmDBEntry *entry;
+		char **fields;
+		char *uri;
+		char *str;
+		int p;
+
+		if (lines[i][0] == '\0')
+			continue;
+
+		fields = g_strsplit (lines[i], "\t", 0);
+		if (g_strv_length (fields) != G_N_ELEMENTS (catalog_props) + 1) {
+			g_strfreev (fields);
+			continue;
+		}
+
+		/* locations are stored relative to the mount point, as it
+		 * may be mounted somewhere else next time.
+		 */
+		str = g_strcompress (fields[0]);
+		uri = g_strconcat (mount_path, str, NULL);
+		g_free (str);
+		if (rhythmdb_entry_lookup_by_location (priv->db, uri) != NULL) {
+			g_free (uri);
+			g_strfreev (fields);
+			continue;
+		}
+
+		entry = rhythmdb_entry_new (priv->db, entry_type, uri);
+		g_free (uri);
+		if (entry == NULL) {
+			g_strfreev (fields);
+			continue;
+		}
+
+		for (p = 0; p < G_N_ELEMENTS (catalog_props); p++) {
+			GValue value = {0,};
+			GType type;
+
+			type = rhythmdb_get_property_type (priv->db, catalog_props[p]);
+			g_value_init (&value, type);
+			switch (type) {
+			case G_TYPE_STRING:
+				str = g_strcompress (fields[p+1]);
+				g_value_take_string (&value, str);
+				break;
+			case G_TYPE_ULONG:
+				g_value_set_ulong (&value, strtoul (fields[p+1], NULL, 10));
+				break;
+			case G_TYPE_UINT64:
+				g_value_set_uint64 (&value, g_ascii_strtoull (fields[p+1], NULL, 10));
+				break;
+			default:
+				g_assert_not_reached ();
+				break;
+			}
+			rhythmdb_entry_set (priv->db, entry, catalog_props[p], &value);
+			g_value_unset (&value);
+		}
+
+		priv->catalog_entries = g_list_prepend (priv->catalog_entries, rhythmdb_entry_ref (entry));
+		count++;
+	}
+	g_strfreev (lines);
+
+	rb_debug ("created %d entries from device catalog", count);
+	rhythmdb_commit (priv->db);
+}
+
+static void
+check_device_catalog_entries (RBGenericPlayerSource *source)
+{
+	RBGenericPlayerSourcePrivate *priv = GET_PRIVATE (source);
+	RhythmDBEntryType entry_type;
+	GList *l;
+	int count = 0;
+
+	g_object_get (source, "entry-type", &entry_type, NULL);
+
+	/* any snapshot entry that hasn't been seen yet either doesn't exist
+	 * any more or just hasn't been reached by the scan.  ask the database
+	 * to look at each of them again; missing files will be removed.
+	 */
+	for (l = priv->catalog_entries; l != NULL; l = l->next) {
+		RhythmDBEntry *entry = l->data;
+
+		if (rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_LAST_SEEN) < priv->catalog_load_time) {
+			rhythmdb_add_uri_with_types (priv->db,
+						     rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LOCATION),
+						     entry_type,
+						     priv->ignore_type,
+						     priv->error_type);
+			count++;
+		}
+		rhythmdb_entry_unref (entry);
+	}
+	g_list_free (priv->catalog_entries);
+	priv->catalog_entries = NULL;
+
+	rb_debug ("checking %d device catalog entries not found by the import", count);
+	g_boxed_free (RHYTHMDB_TYPE_ENTRY_TYPE, entry_type);
+}
+
+typedef struct {
+	RhythmDB *db;
+	GString *str;
+	const char *mount_path;
+	gsize mount_path_len;
+} SaveCatalogData;
+
+static void
+save_catalog_entry (RhythmDBEntry *entry, SaveCatalogData *data)
+{
+	const char *location;
+	const char *str;
+	char *escaped;
+	int p;
+
+	if (rhythmdb_entry_get_boolean (entry, RHYTHMDB_PROP_HIDDEN))
+		return;
+
+	location = rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LOCATION);
+	if (g_str_has_prefix (location, data->mount_path) == FALSE)
+		return;
+
+	/* escape the location too, just in case */
+	escaped = g_strescape (location + data->mount_path_len, NULL);
+	g_string_append (data->str, escaped);
+	g_free (escaped);
+
+	for (p = 0; p < G_N_ELEMENTS (catalog_props); p++) {
+		switch (rhythmdb_get_property_type (data->db, catalog_props[p])) {
+		case G_TYPE_STRING:
+			str = rhythmdb_entry_get_string (entry, catalog_props[p]);
+			escaped = g_strescape (str ? str : "", NULL);
+			g_string_append_printf (data->str, "\t%s", escaped);
+			g_free (escaped);
+			break;
+		case G_TYPE_ULONG:
+			g_string_append_printf (data->str, "\t%lu", rhythmdb_entry_get_ulong (entry, catalog_props[p]));
+			break;
+		case G_TYPE_UINT64:
+			g_string_append_printf (data->str, "\t%" G_GUINT64_FORMAT, rhythmdb_entry_get_uint64 (entry, catalog_props[p]));
+			break;
+		default:
+			g_assert_not_reached ();
+			break;
+		}
+	}
+	g_string_append_c (data->str, '\n');
+}
+
+static void
+save_device_catalog (RBGenericPlayerSource *source)
+{
+	RBGenericPlayerSourcePrivate *priv = GET_PRIVATE (source);
+	RhythmDBEntryType entry_type;
+	SaveCatalogData data;
+	GError *error = NULL;
+	char *mount_path;
+
+	if (priv->catalog_path == NULL || priv->db == NULL)
+		return;
+
+	mount_path = rb_generic_player_source_get_mount_path (source);
+	if (mount_path == NULL)
+		return;
+
+	data.db = priv->db;
+	data.str = g_string_new (DEVICE_CATALOG_HEADER "\n");
+	data.mount_path = mount_path;
+	data.mount_path_len = strlen (mount_path);
+
+	g_object_get (source, "entry-type", &entry_type, NULL);
+	rhythmdb_entry_foreach_by_type (priv->db, entry_type, (GFunc) save_catalog_entry, &data);
+	g_boxed_free (RHYTHMDB_TYPE_ENTRY_TYPE, entry_type);
+
+	if (g_file_set_contents (priv->catalog_path, data.str->str, data.str->len, &error) == FALSE) {
+		rb_debug ("unable to save device catalog: %s", error->message);
+		g_error_free (error);
+	}
+
+	g_string_free (data.str, TRUE);
+	g_free (mount_path);
+}
+
 static void
 import_complete_cb (RhythmDBImportJob *job, int total, RBGenericPlayerSource *source)
 {
@@ -445,6 +776,9 @@ import_complete_cb (RhythmDBImportJob *job, int total, RBGenericPlayerSource *so
 	if (klass->impl_load_playlists)
 		klass->impl_load_playlists (source);
 
+	check_device_catalog_entries (source);
+	save_device_catalog (source);
+
 	g_object_unref (priv->import_job);
 	priv->import_job = NULL;
 	
@@ -470,6 +804,11 @@ load_songs (RBGenericPlayerSource *source)
 	mount_path = rb_generic_player_source_get_mount_path (source);
 	g_object_get (source, "entry-type", &entry_type, NULL);
 
+	/* create entries for what we found on the device last time, so
+	 * the import job only needs to look for changes.
+	 */
+	load_device_catalog (source, entry_type, mount_path);
+
 	/* if we have a set of folders on the device containing audio files,
 	 * load only those folders, otherwise add the whole volume.
 	 */
@@ -1198,6 +1537,15 @@ impl_get_entries (RBMediaPlayerSource *source,
 	g_object_unref (model);
 }
 
+static const char *
+impl_get_entry_category (RBMediaPlayerSource *source, RhythmDBEntry *entry)
+{
+	/* same as above */
+	if (g_str_equal (rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_GENRE), "Podcast"))
+		return SYNC_CATEGORY_PODCAST;
+	return SYNC_CATEGORY_MUSIC;
+}
+
 static void
 impl_delete_entries (RBMediaPlayerSource *source,
 		     GList *entries,
@@ -37,8 +37,11 @@
  * to hide it as much as possible from RbIpodSource.
  * 
  * When a save request for the iPod metadata is requested through 
- * rb_ipod_db_save_async, we start by delaying the saving by a few seconds
- * (using g_timeout_add) in case we'd get a bunch of very close save requests.
+ * rb_ipod_db_save_async, we start by delaying the saving until no changes
+ * have been made for a few seconds (using g_timeout_add), in case we'd get a
+ * bunch of very close save requests, such as when a lot of tracks are being
+ * transferred.  The save is only postponed for so long, though, so a long
+ * transfer still gets written out from time to time.
  * When the timeout callback triggers, we start by marking the IpodDB object
  * as read-only, ie while the async save is going on *NO MODIFICATIONS AT ALL
  * MUST BE MADE TO THE ITDB_ITUNESDB OBJECT*. Once the IpodDB is marked as 
@@ -49,7 +52,10 @@
  * Since the UI is not blocked during the async database saving (that's the 
  * whole point of this exercise after all ;), we log all IpodDB modifications
  * attempts in IpodDB::delayed_actions, and we'll replay them once the 
- * async saving is done. When these IpodDB modifications should trigger changes
+ * async saving is done. Queued actions that cancel each other out (eg a
+ * track being added then removed again) are dropped from the queue, and
+ * repeated renames only keep the last name. When these IpodDB modifications
+ * should trigger changes
  * in what RB displays (eg, it may be a song removal/addition from/to 
  * the iPod), RbIpodSource should update the GUI immediatly even if the IpodDB
  * hasn't been updated yet (actually, RbIpodSource shouldn't even know if
@@ -112,8 +118,25 @@ typedef struct {
 	guint save_timeout_id;
 	guint save_idle_id;
 
+	/* save coalescing */
+	GTimeVal first_change;
+	GTimeVal last_change;
+	guint pending_changes;
+	guint saving_changes;
+
+	/* statistics */
+	guint write_count;
+	guint merged_actions;
+	gulong last_write_msec;
+	gulong total_write_msec;
+
 } RbIpodDbPrivate;
 
+/* wait until the database hasn't been changed for this long before saving */
+#define SAVE_QUIET_PERIOD	3
+/* but don't postpone the save longer than this after the first change */
+#define SAVE_MAX_DELAY		60
+
 G_DEFINE_TYPE (RbIpodDb, rb_ipod_db, G_TYPE_OBJECT)
 
 #define IPOD_DB_GET_PRIVATE(o)   (G_TYPE_INSTANCE_GET_PRIVATE ((o), RB_TYPE_IPOD_DB, RbIpodDbPrivate))
@@ -124,7 +147,7 @@ rb_itdb_save (RbIpodDb *ipod_db, GError **error)
 	RbIpodDbPrivate *priv = IPOD_DB_GET_PRIVATE (ipod_db);
 	GError *err = NULL;
 
-	rb_debug ("Writing iPod database to disk");
+	rb_debug ("Writing iPod database to disk (%u changes)", priv->saving_changes);
 	if (itdb_write (priv->itdb, &err) == FALSE) {
 		g_warning ("Could not write database to iPod: %s", err->message);
 		g_propagate_error (error, err);
@@ -188,8 +211,11 @@ rb_ipod_db_dispose (GObject *object)
 
  	if (priv->itdb != NULL) {
 		if (db_dirty) {
+			priv->saving_changes = priv->pending_changes;
 			rb_itdb_save (RB_IPOD_DB (object), NULL);
 		}
+		rb_debug ("iPod database written %u times, taking %lu ms; %u queued actions merged",
+			  priv->write_count, priv->total_write_msec, priv->merged_actions);
  		itdb_free (priv->itdb);
 
  		priv->itdb = NULL;
@@ -601,6 +627,123 @@ rb_ipod_db_process_delayed_actions (RbIpodDb *ipod_db)
 	}
 }
 
+static gboolean
+action_uses_track (RbIpodDelayedAction *action, Itdb_Track *track)
+{
+	switch (action->type) {
+	case RB_IPOD_ACTION_ADD_TRACK:
+	case RB_IPOD_ACTION_REMOVE_TRACK:
+		return (action->track == track);
+	case RB_IPOD_ACTION_SET_THUMBNAIL:
+		return (action->thumbnail_data.track == track);
+	case RB_IPOD_ACTION_ADD_TO_PLAYLIST:
+	case RB_IPOD_ACTION_REMOVE_FROM_PLAYLIST:
+		return (action->playlist_op.track == track);
+	default:
+		return FALSE;
+	}
+}
+
+static gboolean
+action_uses_playlist (RbIpodDelayedAction *action, Itdb_Playlist *playlist)
+{
+	switch (action->type) {
+	case RB_IPOD_ACTION_ADD_PLAYLIST:
+	case RB_IPOD_ACTION_REMOVE_PLAYLIST:
+	case RB_IPOD_ACTION_RENAME_PLAYLIST:
+		return (action->playlist == playlist);
+	case RB_IPOD_ACTION_ADD_TO_PLAYLIST:
+	case RB_IPOD_ACTION_REMOVE_FROM_PLAYLIST:
+		return (action->playlist_op.playlist == playlist);
+	default:
+		return FALSE;
+	}
+}
+
+static RbIpodDelayedAction *
+rb_ipod_db_find_queued_action (RbIpodDb *ipod_db,
+			       RbIpodDelayedActionType type,
+			       Itdb_Playlist *playlist,
+			       Itdb_Track *track)
+{
+	RbIpodDbPrivate *priv = IPOD_DB_GET_PRIVATE (ipod_db);
+	GList *l;
+
+	/* look for the most recent matching action */
+	for (l = priv->delayed_actions->tail; l != NULL; l = l->prev) {
+		RbIpodDelayedAction *action = l->data;
+
+		if (action->type != type)
+			continue;
+		if (playlist != NULL && action_uses_playlist (action, playlist) == FALSE)
+			continue;
+		if (track != NULL && action_uses_track (action, track) == FALSE)
+			continue;
+		return action;
+	}
+	return NULL;
+}
+
+/*
+ * Drops all queued actions involving a track that's about to be removed.
+ * Returns TRUE if one of them added the track, in which case the
+ * track was never in the database and can just be freed.
+ */
+static gboolean
+rb_ipod_db_drop_track_actions (RbIpodDb *ipod_db, Itdb_Track *track)
+{
+	RbIpodDbPrivate *priv = IPOD_DB_GET_PRIVATE (ipod_db);
+	gboolean added = FALSE;
+	GList *l;
+	GList *next;
+
+	for (l = priv->delayed_actions->head; l != NULL; l = next) {
+		RbIpodDelayedAction *action = l->data;
+
+		next = l->next;
+		if (action_uses_track (action, track) == FALSE)
+			continue;
+
+		if (action->type == RB_IPOD_ACTION_ADD_TRACK) {
+			/* we'll free the track ourselves */
+			action->track = NULL;
+			added = TRUE;
+		}
+		g_queue_delete_link (priv->delayed_actions, l);
+		rb_ipod_free_delayed_action (action);
+		priv->merged_actions++;
+	}
+
+	return added;
+}
+
+/* same as above, for playlists */
+static gboolean
+rb_ipod_db_drop_playlist_actions (RbIpodDb *ipod_db, Itdb_Playlist *playlist)
+{
+	RbIpodDbPrivate *priv = IPOD_DB_GET_PRIVATE (ipod_db);
+	gboolean added = FALSE;
+	GList *l;
+	GList *next;
+
+	for (l = priv->delayed_actions->head; l != NULL; l = next) {
+		RbIpodDelayedAction *action = l->data;
+
+		next = l->next;
+		if (action_uses_playlist (action, playlist) == FALSE)
+			continue;
+
+		if (action->type == RB_IPOD_ACTION_ADD_PLAYLIST) {
+			added = TRUE;
+		}
+		g_queue_delete_link (priv->delayed_actions, l);
+		rb_ipod_free_delayed_action (action);
+		priv->merged_actions++;
+	}
+
+	return added;
+}
+
 static void
 rb_ipod_db_queue_remove_track (RbIpodDb *ipod_db,
 			       Itdb_Track *track)
@@ -609,6 +752,12 @@ rb_ipod_db_queue_remove_track (RbIpodDb *ipod_db,
 	RbIpodDbPrivate *priv = IPOD_DB_GET_PRIVATE (ipod_db);
 	
 	g_assert (priv->read_only);
+	if (rb_ipod_db_drop_track_actions (ipod_db, track)) {
+		rb_debug ("Dropping queued actions for track added while the iPod database was read-only");
+		itdb_track_free (track);
+		return;
+	}
+
 	rb_debug ("Queueing track remove action since the iPod database is currently read-only");
 	action = g_new0 (RbIpodDelayedAction, 1);
 	action->type = RB_IPOD_ACTION_REMOVE_TRACK;
@@ -624,6 +773,15 @@ rb_ipod_db_queue_set_ipod_name (RbIpodDb *ipod_db,
 	RbIpodDbPrivate *priv = IPOD_DB_GET_PRIVATE (ipod_db);
 		
 	g_assert (priv->read_only);
+	action = rb_ipod_db_find_queued_action (ipod_db, RB_IPOD_ACTION_SET_NAME, NULL, NULL);
+	if (action != NULL) {
+		rb_debug ("Replacing queued set name action");
+		g_free (action->name);
+		action->name = g_strdup (new_name);
+		priv->merged_actions++;
+		return;
+	}
+
 	rb_debug ("Queueing set name action since the iPod database is currently read-only");
 	action = g_new0 (RbIpodDelayedAction, 1);
 	action->type = RB_IPOD_ACTION_SET_NAME;
@@ -654,6 +812,12 @@ rb_ipod_db_queue_remove_playlist (RbIpodDb *ipod_db,
 	RbIpodDbPrivate *priv = IPOD_DB_GET_PRIVATE (ipod_db);
 	
 	g_assert (priv->read_only);
+	if (rb_ipod_db_drop_playlist_actions (ipod_db, playlist)) {
+		rb_debug ("Dropping queued actions for playlist added while the iPod database was read-only");
+		itdb_playlist_free (playlist);
+		return;
+	}
+
 	rb_debug ("Queueing remove playlist action since the iPod database is currently read-only");
 	action = g_new0 (RbIpodDelayedAction, 1);
 	action->type = RB_IPOD_ACTION_REMOVE_PLAYLIST;
@@ -670,6 +834,15 @@ rb_ipod_db_queue_rename_playlist (RbIpodDb *ipod_db,
 	RbIpodDbPrivate *priv = IPOD_DB_GET_PRIVATE (ipod_db);
 	
 	g_assert (priv->read_only);
+	action = rb_ipod_db_find_queued_action (ipod_db, RB_IPOD_ACTION_RENAME_PLAYLIST, playlist, NULL);
+	if (action != NULL) {
+		rb_debug ("Replacing queued rename playlist action");
+		g_free (action->name);
+		action->name = g_strdup (name);
+		priv->merged_actions++;
+		return;
+	}
+
 	rb_debug ("Queueing rename playlist action since the iPod database is currently read-only");
 	action = g_new0 (RbIpodDelayedAction, 1);
 	action->type = RB_IPOD_ACTION_RENAME_PLAYLIST;
@@ -718,6 +891,15 @@ rb_ipod_db_queue_remove_from_playlist (RbIpodDb *ipod_db,
 	RbIpodDbPrivate *priv = IPOD_DB_GET_PRIVATE (ipod_db);
 	
 	g_assert (priv->read_only);
+	action = rb_ipod_db_find_queued_action (ipod_db, RB_IPOD_ACTION_ADD_TO_PLAYLIST, playlist, track);
+	if (action != NULL) {
+		rb_debug ("Cancelling queued add to playlist action");
+		g_queue_remove (priv->delayed_actions, action);
+		rb_ipod_free_delayed_action (action);
+		priv->merged_actions++;
+		return;
+	}
+
 	rb_debug ("Queueing remove from playlist action since the iPod database is currently read-only");
 	action = g_new0 (RbIpodDelayedAction, 1);
 	action->type = RB_IPOD_ACTION_REMOVE_FROM_PLAYLIST;
@@ -735,6 +917,15 @@ rb_ipod_db_queue_set_thumbnail (RbIpodDb *ipod_db,
 	RbIpodDbPrivate *priv = IPOD_DB_GET_PRIVATE (ipod_db);
 	
 	g_assert (priv->read_only);
+	action = rb_ipod_db_find_queued_action (ipod_db, RB_IPOD_ACTION_SET_THUMBNAIL, NULL, track);
+	if (action != NULL) {
+		rb_debug ("Replacing queued set thumbnail action");
+		g_object_unref (action->thumbnail_data.pixbuf);
+		action->thumbnail_data.pixbuf = g_object_ref (pixbuf);
+		priv->merged_actions++;
+		return;
+	}
+
 	rb_debug ("Queueing set thumbnail action since the iPod database is currently read-only");
 	action = g_new0 (RbIpodDelayedAction, 1);
 	action->type = RB_IPOD_ACTION_SET_THUMBNAIL;
@@ -812,6 +1003,12 @@ ipod_db_saved_idle_cb (RbIpodDb *ipod_db)
 	priv->read_only = FALSE;
 	rb_debug ("Switching iPod database to read-write");
 
+	priv->write_count++;
+	priv->total_write_msec += priv->last_write_msec;
+	rb_debug ("iPod database write %u took %lu ms for %u changes (%lu ms in total)",
+		  priv->write_count, priv->last_write_msec,
+		  priv->saving_changes, priv->total_write_msec);
+
 	rb_ipod_db_process_delayed_actions (ipod_db);
 
 	priv->save_idle_id = 0;
@@ -824,10 +1021,15 @@ static gpointer
 saving_thread (RbIpodDb *ipod_db)
 {
 	RbIpodDbPrivate *priv = IPOD_DB_GET_PRIVATE (ipod_db);
+	GTimer *timer;
 
 	g_assert (priv->read_only);
 
+	timer = g_timer_new ();
 	rb_itdb_save (ipod_db, NULL);
+	priv->last_write_msec = (gulong) (g_timer_elapsed (timer, NULL) * 1000);
+	g_timer_destroy (timer);
+
 	priv->save_idle_id = g_idle_add ((GSourceFunc)ipod_db_saved_idle_cb, 
 					 ipod_db);
 	
@@ -838,14 +1040,34 @@ static gboolean
 save_timeout_cb (RbIpodDb *ipod_db)
 {
 	RbIpodDbPrivate *priv = IPOD_DB_GET_PRIVATE (ipod_db);
+	GTimeVal now;
+	glong quiet;
+	glong waiting;
 
 	if (priv->read_only) {
-		g_warning ("Database is read-only, not saving");
+		rb_debug ("Database is being saved, trying again later");
 		return TRUE;
 	}
+
+	/* if changes are still coming in, wait for them to stop, unless
+	 * we've already been waiting too long.
+	 */
+	g_get_current_time (&now);
+	quiet = now.tv_sec - priv->last_change.tv_sec;
+	waiting = now.tv_sec - priv->first_change.tv_sec;
+	if (quiet < SAVE_QUIET_PERIOD && waiting < SAVE_MAX_DELAY) {
+		rb_debug ("iPod database still changing, postponing save");
+		priv->save_timeout_id = g_timeout_add_seconds (SAVE_QUIET_PERIOD - quiet,
+							       (GSourceFunc)save_timeout_cb,
+							       ipod_db);
+		return FALSE;
+	}
+
 	rb_debug ("Starting iPod database save");
 	rb_debug ("Switching iPod database to read-only");
 	priv->read_only = TRUE;
+	priv->saving_changes = priv->pending_changes;
+	priv->pending_changes = 0;
 	
 	priv->saving_thread = g_thread_create ((GThreadFunc)saving_thread,
 					       ipod_db, TRUE, NULL);
@@ -858,9 +1080,14 @@ rb_ipod_db_save_async (RbIpodDb *ipod_db)
 {
 	RbIpodDbPrivate *priv = IPOD_DB_GET_PRIVATE (ipod_db);
 
+	g_get_current_time (&priv->last_change);
+	if (priv->pending_changes++ == 0) {
+		priv->first_change = priv->last_change;
+	}
+
 	if (priv->save_timeout_id == 0) {
-		rb_debug ("Scheduling iPod database save in 15 seconds");
-		priv->save_timeout_id = g_timeout_add_seconds (15, 
+		rb_debug ("Scheduling iPod database save in %d seconds", SAVE_QUIET_PERIOD);
+		priv->save_timeout_id = g_timeout_add_seconds (SAVE_QUIET_PERIOD,
 							       (GSourceFunc)save_timeout_cb,
 							       ipod_db);
 	} else {
@@ -95,6 +95,7 @@ static gboolean rb_ipod_song_artwork_add_cb (RhythmDB *db,
 static guint64 impl_get_capacity (RBMediaPlayerSource *source);
 static guint64 impl_get_free_space (RBMediaPlayerSource *source);
 static void impl_get_entries (RBMediaPlayerSource *source, const char *category, GHashTable *map);
+static const char *impl_get_entry_category (RBMediaPlayerSource *source, RhythmDBEntry *entry);
 static void impl_delete_entries (RBMediaPlayerSource *source, GList *entries, RBMediaPlayerSourceDeleteCallback callback, gpointer callback_data, GDestroyNotify destroy_data);
 static void impl_add_playlist (RBMediaPlayerSource *source, gchar *name, GList *entries);
 static void impl_remove_playlists (RBMediaPlayerSource *source);
@@ -183,6 +184,7 @@ rb_ipod_source_class_init (RBiPodSourceClass *klass)
 	source_class->impl_can_paste = (RBSourceFeatureFunc) rb_true_function;
 
 	mps_class->impl_get_entries = impl_get_entries;
+	mps_class->impl_get_entry_category = impl_get_entry_category;
 	mps_class->impl_get_capacity = impl_get_capacity;
 	mps_class->impl_get_free_space = impl_get_free_space;
 	mps_class->impl_delete_entries = impl_delete_entries;
@@ -2004,3 +2006,23 @@ impl_get_entries (RBMediaPlayerSource *source, const char *category, GHashTable
 		}
 	}
 }
+
+static const char *
+impl_get_entry_category (RBMediaPlayerSource *source, RhythmDBEntry *entry)
+{
+	RBiPodSourcePrivate *priv = IPOD_SOURCE_GET_PRIVATE (source);
+	Itdb_Track *track;
+
+	track = g_hash_table_lookup (priv->entry_map, entry);
+	if (track == NULL)
+		return NULL;
+
+	switch (track->mediatype) {
+	case ITDB_MEDIATYPE_AUDIO:
+		return SYNC_CATEGORY_MUSIC;
+	case ITDB_MEDIATYPE_PODCAST:
+		return SYNC_CATEGORY_PODCAST;
+	default:
+		return NULL;
+	}
+}
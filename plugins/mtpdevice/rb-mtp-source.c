@@ -109,6 +109,7 @@ static void artwork_notify_cb (RhythmDB *db,
 			       RBMtpSource *source);
 
 static void		impl_get_entries	(RBMediaPlayerSource *source, const char *category, GHashTable *map);
+static const char *	impl_get_entry_category	(RBMediaPlayerSource *source, RhythmDBEntry *entry);
 static guint64		impl_get_capacity	(RBMediaPlayerSource *source);
 static guint64		impl_get_free_space	(RBMediaPlayerSource *source);
 static void		impl_delete_entries	(RBMediaPlayerSource *source,
@@ -214,6 +215,7 @@ rb_mtp_source_class_init (RBMtpSourceClass *klass)
 	rms_class->impl_should_paste = rb_removable_media_source_should_paste_no_duplicate;
 
 	mps_class->impl_get_entries = impl_get_entries;
+	mps_class->impl_get_entry_category = impl_get_entry_category;
 	mps_class->impl_get_capacity = impl_get_capacity;
 	mps_class->impl_get_free_space = impl_get_free_space;
 	mps_class->impl_delete_entries = impl_delete_entries;
@@ -1312,6 +1314,21 @@ impl_get_entries (RBMediaPlayerSource *source, const char *category, GHashTable
 	}
 }
 
+static const char *
+impl_get_entry_category (RBMediaPlayerSource *source, RhythmDBEntry *entry)
+{
+	RBMtpSourcePrivate *priv = MTP_SOURCE_GET_PRIVATE (source);
+	LIBMTP_track_t *track;
+
+	track = g_hash_table_lookup (priv->entry_map, entry);
+	if (track == NULL)
+		return NULL;
+
+	if (g_strcmp0 (track->genre, "Podcast") == 0)
+		return SYNC_CATEGORY_PODCAST;
+	return SYNC_CATEGORY_MUSIC;
+}
+
 static guint64
 impl_get_capacity	(RBMediaPlayerSource *source)
 {
@@ -206,9 +206,10 @@ write_album_to_device (RBMtpThread *thread, LIBMTP_album_t *album, gboolean new_
 {
 	if (new_album) {
 		if (LIBMTP_Create_New_Album (thread->device, album) != 0) {
-			LIBMTP_destroy_album_t (album);
 			rb_debug ("LIBMTP_Create_New_Album failed..");
 			rb_mtp_thread_report_errors (thread, FALSE);
+			/* this frees the album */
+			g_hash_table_remove (thread->albums, album->name);
 		}
 	} else {
 		if (LIBMTP_Update_Album (thread->device, album) != 0) {
@@ -221,11 +222,54 @@ write_album_to_device (RBMtpThread *thread, LIBMTP_album_t *album, gboolean new_
 static void
 add_track_to_album_and_update (RBMtpThread *thread, RBMtpThreadTask *task)
 {
-	LIBMTP_album_t *album;
 	gboolean new_album = FALSE;
 
-	album = add_track_to_album (thread, task->album, task->track_id, task->storage_id, &new_album);
-	write_album_to_device (thread, album, new_album);
+	/* when a bunch of tracks are being added, they're usually from a small
+	 * number of albums, so rather than writing the album out each time,
+	 * we mark it as dirty and write it once the queue has been quiet for
+	 * a while (see task_thread and flush_album_updates).
+	 */
+	if (g_hash_table_size (thread->dirty_albums) == 0)
+		g_get_current_time (&thread->albums_dirty_since);
+
+	add_track_to_album (thread, task->album, task->track_id, task->storage_id, &new_album);
+	if (new_album) {
+		g_hash_table_insert (thread->dirty_albums, g_strdup (task->album), GINT_TO_POINTER (TRUE));
+	} else if (g_hash_table_lookup_extended (thread->dirty_albums, task->album, NULL, NULL) == FALSE) {
+		g_hash_table_insert (thread->dirty_albums, g_strdup (task->album), GINT_TO_POINTER (FALSE));
+	}
+}
+
+static void
+flush_album_updates (RBMtpThread *thread)
+{
+	GHashTableIter iter;
+	gpointer name;
+	gpointer new_album;
+	GTimer *timer;
+	int count = 0;
+
+	if (g_hash_table_size (thread->dirty_albums) == 0 || thread->device == NULL) {
+		return;
+	}
+
+	timer = g_timer_new ();
+	g_hash_table_iter_init (&iter, thread->dirty_albums);
+	while (g_hash_table_iter_next (&iter, &name, &new_album)) {
+		LIBMTP_album_t *album;
+
+		album = g_hash_table_lookup (thread->albums, name);
+		if (album != NULL) {
+			write_album_to_device (thread, album, GPOINTER_TO_INT (new_album));
+			count++;
+		}
+	}
+	g_hash_table_remove_all (thread->dirty_albums);
+
+	thread->album_writes += count;
+	thread->album_write_time += g_timer_elapsed (timer, NULL);
+	rb_debug ("wrote %d albums to the device in %.2f seconds", count, g_timer_elapsed (timer, NULL));
+	g_timer_destroy (timer);
 }
 
 static void
@@ -513,7 +557,10 @@ upload_track (RBMtpThread *thread, RBMtpThreadTask *task)
 	RBMtpUploadCallback cb = (RBMtpUploadCallback) task->callback;
 	LIBMTP_error_t *stack;
 	GError *error = NULL;
+	GTimer *timer;
+	gdouble elapsed;
 
+	timer = g_timer_new ();
 	if (LIBMTP_Send_Track_From_File (thread->device, task->filename, task->track, NULL, NULL)) {
 		stack = LIBMTP_Get_Errorstack (thread->device);
 		rb_debug ("unable to send track: %s", stack->error_text);
@@ -522,7 +569,19 @@ upload_track (RBMtpThread *thread, RBMtpThreadTask *task)
 				     stack->error_text);
 		LIBMTP_Clear_Errorstack (thread->device);
 		task->track->item_id = 0;		/* is this actually an invalid item ID? */
+	} else {
+		elapsed = g_timer_elapsed (timer, NULL);
+		thread->upload_count++;
+		thread->upload_bytes += task->track->filesize;
+		thread->upload_time += elapsed;
+		rb_debug ("sent %" G_GUINT64_FORMAT " bytes in %.2f seconds (%.1f KB/s); %u tracks, %.1f KB/s overall",
+			  task->track->filesize,
+			  elapsed,
+			  elapsed > 0 ? (task->track->filesize / 1024.0) / elapsed : 0.0,
+			  thread->upload_count,
+			  thread->upload_time > 0 ? (thread->upload_bytes / 1024.0) / thread->upload_time : 0.0);
 	}
+	g_timer_destroy (timer);
 	cb (task->track, error, task->user_data);
 	g_clear_error (&error);
 }
@@ -534,6 +593,19 @@ run_task (RBMtpThread *thread, RBMtpThreadTask *task)
 	rb_debug ("running task: %s", name);
 	g_free (name);
 
+	/* anything that might look at albums on the device needs to see
+	 * the pending updates first.
+	 */
+	switch (task->task) {
+	case ADD_TO_ALBUM:
+	case UPLOAD_TRACK:
+	case DOWNLOAD_TRACK:
+		break;
+	default:
+		flush_album_updates (thread);
+		break;
+	}
+
 	switch (task->task) {
 	case OPEN_DEVICE:
 		open_device (thread, task);
@@ -592,6 +664,47 @@ run_task (RBMtpThread *thread, RBMtpThreadTask *task)
 	return FALSE;
 }
 
+/* wait until no tasks have arrived for this long before writing dirty albums */
+#define ALBUM_FLUSH_QUIET_PERIOD	3
+/* but don't postpone the writes longer than this after the first change */
+#define ALBUM_FLUSH_MAX_DELAY		30
+
+static RBMtpThreadTask *
+wait_for_task (RBMtpThread *thread)
+{
+	RBMtpThreadTask *task;
+	GTimeVal now;
+	GTimeVal deadline;
+	GTimeVal latest;
+
+	if (g_hash_table_size (thread->dirty_albums) == 0)
+		return g_async_queue_pop (thread->queue);
+
+	g_get_current_time (&now);
+	latest = thread->albums_dirty_since;
+	g_time_val_add (&latest, ALBUM_FLUSH_MAX_DELAY * G_USEC_PER_SEC);
+
+	if (now.tv_sec < latest.tv_sec ||
+	    (now.tv_sec == latest.tv_sec && now.tv_usec < latest.tv_usec)) {
+		deadline = now;
+		g_time_val_add (&deadline, ALBUM_FLUSH_QUIET_PERIOD * G_USEC_PER_SEC);
+		if (latest.tv_sec < deadline.tv_sec ||
+		    (latest.tv_sec == deadline.tv_sec && latest.tv_usec < deadline.tv_usec)) {
+			deadline = latest;
+		}
+
+		task = g_async_queue_timed_pop (thread->queue, &deadline);
+		if (task != NULL)
+			return task;
+	}
+
+	/* the queue has been quiet for a while, or the albums have been
+	 * waiting long enough, so write them out now.
+	 */
+	flush_album_updates (thread);
+	return g_async_queue_pop (thread->queue);
+}
+
 static gpointer
 task_thread (RBMtpThread *thread)
 {
@@ -601,7 +714,7 @@ task_thread (RBMtpThread *thread)
 	rb_debug ("MTP device worker thread starting");
 	while (quit == FALSE) {
 
-		task = g_async_queue_pop (thread->queue);
+		task = wait_for_task (thread);
 		quit = run_task (thread, task);
 		destroy_task (task);
 	}
@@ -775,6 +888,11 @@ impl_finalize (GObject *object)
 
 	g_async_queue_unref (thread->queue);
 
+	rb_debug ("sent %u tracks (%" G_GUINT64_FORMAT " bytes) in %.1f seconds; wrote %u albums in %.1f seconds",
+		  thread->upload_count, thread->upload_bytes, thread->upload_time,
+		  thread->album_writes, thread->album_write_time);
+
+	g_hash_table_destroy (thread->dirty_albums);
 	g_hash_table_destroy (thread->albums);
 
 	if (thread->device != NULL) {
@@ -790,6 +908,7 @@ rb_mtp_thread_init (RBMtpThread *thread)
 	thread->queue = g_async_queue_new ();
 	
 	thread->albums = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) LIBMTP_destroy_album_t);
+	thread->dirty_albums = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
 	thread->thread = g_thread_create ((GThreadFunc) task_thread, thread, TRUE, NULL);		/* XXX should handle errors i guess */
 }
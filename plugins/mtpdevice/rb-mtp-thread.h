@@ -67,9 +67,18 @@ typedef struct
 	GObject parent;
 	LIBMTP_mtpdevice_t *device;
 	GHashTable *albums;
+	GHashTable *dirty_albums;
+	GTimeVal albums_dirty_since;
 
 	GThread *thread;
 	GAsyncQueue *queue;
+
+	/* transfer statistics */
+	guint upload_count;
+	guint64 upload_bytes;
+	gdouble upload_time;
+	guint album_writes;
+	gdouble album_write_time;
 } RBMtpThread;
 
 typedef struct
@@ -107,6 +107,7 @@ struct RhythmDBEntry_ {
 	gpointer last_played_str;
 	gpointer first_seen_str;
 	gpointer last_seen_str;
+	gpointer sort_order_keys[RHYTHMDB_NUM_SORT_ORDERS];
 
 	/* playback error string */
 	RBRefString *playback_error;
@@ -135,6 +136,14 @@ struct _RhythmDBPrivate
 	GAsyncQueue *restored_queue;
 	GAsyncQueue *delayed_write_queue;
 	GThreadPool *query_thread_pool;
+	GThreadPool *worker_thread_pool;
+	GMutex *query_mutex;
+	GHashTable *scheduled_queries;
+	guint query_serial;
+	guint query_count;
+	guint query_cancelled_count;
+	gdouble query_wait_time;
+	gdouble query_run_time;
 
 	GList *stat_list;
 	GList *outstanding_stats;
@@ -175,6 +184,7 @@ struct _RhythmDBPrivate
 	guint emit_entry_signals_id;
 	GList *added_entries_to_emit;
 	GList *deleted_entries_to_emit;
+	GList *deleted_batches_to_emit;
 	GHashTable *changed_entries_to_emit;
 
 	gboolean can_save;
@@ -73,6 +73,10 @@ static void rhythmdb_property_model_get_property (GObject *object,
 					       GValue *value,
 					       GParamSpec *pspec);
 static void rhythmdb_property_model_sync (RhythmDBPropertyModel *model);
+static void rhythmdb_property_model_row_changed (RhythmDBPropertyModel *model,
+						 GSequenceIter *ptr);
+static void rhythmdb_property_model_fill (RhythmDBPropertyModel *model);
+static void rhythmdb_property_model_clear (RhythmDBPropertyModel *model);
 static void rhythmdb_property_model_row_inserted_cb (GtkTreeModel *model,
 						     GtkTreePath *path,
 						     GtkTreeIter *iter,
@@ -181,6 +185,8 @@ struct RhythmDBPropertyModelPrivate
 
 	RhythmDBPropertyModelEntry *all;
 
+	/* rows whose counts changed since the last sync */
+	GHashTable *changed;
 	guint syncing_id;
 };
 
@@ -327,32 +333,6 @@ rhythmdb_property_model_drag_source_init (RbTreeDragSourceIface *iface)
 	iface->rb_drag_data_get = rhythmdb_property_model_drag_data_get;
 }
 
-static gboolean
-_remove_entry_cb (GtkTreeModel *model,
-		  GtkTreePath *path,
-		  GtkTreeIter *iter,
-		  RhythmDBPropertyModel *propmodel)
-{
-	RhythmDBEntry *entry;
-
-	entry = rhythmdb_query_model_iter_to_entry (RHYTHMDB_QUERY_MODEL (model), iter);
-	rhythmdb_property_model_entry_removed_cb (RHYTHMDB_QUERY_MODEL (model),
-						  entry,
-						  propmodel);
-	rhythmdb_entry_unref (entry);
-	return FALSE;
-}
-
-static gboolean
-_add_entry_cb (GtkTreeModel *model,
-	       GtkTreePath *path,
-	       GtkTreeIter *iter,
-	       RhythmDBPropertyModel *propmodel)
-{
-	rhythmdb_property_model_row_inserted_cb (model, path, iter, propmodel);
-	return FALSE;
-}
-
 static void
 rhythmdb_property_model_set_query_model_internal (RhythmDBPropertyModel *model,
 						  RhythmDBQueryModel    *query_model)
@@ -368,9 +348,7 @@ rhythmdb_property_model_set_query_model_internal (RhythmDBPropertyModel *model,
 						      G_CALLBACK (rhythmdb_property_model_prop_changed_cb),
 						      model);
 
-		gtk_tree_model_foreach (GTK_TREE_MODEL (model->priv->query_model),
-					(GtkTreeModelForeachFunc)_remove_entry_cb,
-					model);
+		rhythmdb_property_model_clear (model);
 
 		g_object_unref (model->priv->query_model);
 	}
@@ -396,9 +374,7 @@ rhythmdb_property_model_set_query_model_internal (RhythmDBPropertyModel *model,
 					 G_CALLBACK (rhythmdb_property_model_prop_changed_cb),
 					 model,
 					 0);
-		gtk_tree_model_foreach (GTK_TREE_MODEL (model->priv->query_model),
-					(GtkTreeModelForeachFunc)_add_entry_cb,
-					model);
+		rhythmdb_property_model_fill (model);
 	}
 }
 
@@ -490,6 +466,7 @@ rhythmdb_property_model_init (RhythmDBPropertyModel *model)
 	model->priv->properties = g_sequence_new (NULL);
 	model->priv->reverse_map = g_hash_table_new (g_str_hash, g_str_equal);
 	model->priv->entries = g_hash_table_new (g_direct_hash, g_direct_equal);
+	model->priv->changed = g_hash_table_new (g_direct_hash, g_direct_equal);
 
 	model->priv->all = g_new0 (RhythmDBPropertyModelEntry, 1);
 	model->priv->all->string = rb_refstring_new (_("All"));
@@ -552,6 +529,7 @@ rhythmdb_property_model_finalize (GObject *object)
 	g_sequence_free (model->priv->properties);
 
 	g_hash_table_destroy (model->priv->entries);
+	g_hash_table_destroy (model->priv->changed);
 
 	g_free (model->priv->all);
 
@@ -801,10 +779,7 @@ rhythmdb_property_model_insert (RhythmDBPropertyModel *model,
 			property_sort_changed (model, ptr, &iter);
 		}
 
-		path = rhythmdb_property_model_get_path (GTK_TREE_MODEL (model), &iter);
-		gtk_tree_model_row_changed (GTK_TREE_MODEL (model), path, &iter);
-		gtk_tree_path_free (path);
-
+		rhythmdb_property_model_row_changed (model, ptr);
 		return prop;
 	}
 	rb_debug ("adding new property \"%s\"", propstr);
@@ -862,9 +837,7 @@ rhythmdb_property_model_delete_prop (RhythmDBPropertyModel *model,
 	prop = g_sequence_get (ptr);
 	rb_debug ("deleting \"%s\": refcount: %d", propstr, prop->refcount);
 	if (g_atomic_int_dec_and_test (&prop->refcount) == FALSE) {
-		path = rhythmdb_property_model_get_path (GTK_TREE_MODEL (model), &iter);
-		gtk_tree_model_row_changed (GTK_TREE_MODEL (model), path, &iter);
-		gtk_tree_path_free (path);
+		rhythmdb_property_model_row_changed (model, ptr);
 		return;
 	}
 
@@ -873,6 +846,7 @@ rhythmdb_property_model_delete_prop (RhythmDBPropertyModel *model,
 	gtk_tree_model_row_deleted (GTK_TREE_MODEL (model), path);
 	gtk_tree_path_free (path);
 
+	g_hash_table_remove (model->priv->changed, ptr);
 	g_sequence_remove (ptr);
 	g_hash_table_remove (model->priv->reverse_map, propstr);
 	prop->refcount = 0xdeadbeef;
@@ -882,6 +856,134 @@ rhythmdb_property_model_delete_prop (RhythmDBPropertyModel *model,
 	g_free (prop);
 }
 
+static gint
+_prop_model_entry_ptr_compare (RhythmDBPropertyModelEntry **a,
+			       RhythmDBPropertyModelEntry **b,
+			       RhythmDBPropertyModel *model)
+{
+	return rhythmdb_property_model_compare (*a, *b, model);
+}
+
+/*
+ * adds all entries in the query model to an empty property model.  the
+ * property values are counted and sorted before any rows are added, so
+ * each row is only inserted once and never moves while filling.
+ */
+static void
+rhythmdb_property_model_fill (RhythmDBPropertyModel *model)
+{
+	RhythmDBPropertyModelEntry *prop;
+	GHashTable *props_map;
+	GPtrArray *props;
+	GtkTreeModel *query_model;
+	GtkTreeIter iter;
+	GtkTreePath *path;
+	GSequenceIter *ptr;
+	gint count = 0;
+	guint i;
+
+	g_assert (g_sequence_get_length (model->priv->properties) == 0);
+
+	query_model = GTK_TREE_MODEL (model->priv->query_model);
+	if (!gtk_tree_model_get_iter_first (query_model, &iter))
+		return;
+
+	props_map = g_hash_table_new (g_str_hash, g_str_equal);
+	props = g_ptr_array_new ();
+
+	do {
+		RhythmDBEntry *entry;
+		const char *propstr;
+
+		entry = rhythmdb_query_model_iter_to_entry (model->priv->query_model, &iter);
+		propstr = rhythmdb_entry_get_string (entry, model->priv->propid);
+
+		prop = g_hash_table_lookup (props_map, propstr);
+		if (prop == NULL) {
+			prop = g_new0 (RhythmDBPropertyModelEntry, 1);
+			prop->string = rb_refstring_new (propstr);
+			update_sort_string (model, prop, entry);
+
+			g_hash_table_insert (props_map, (gpointer)rb_refstring_get (prop->string), prop);
+			g_ptr_array_add (props, prop);
+		} else {
+			update_sort_string (model, prop, entry);
+		}
+		prop->refcount++;
+		count++;
+
+		rhythmdb_entry_unref (entry);
+	} while (gtk_tree_model_iter_next (query_model, &iter));
+
+	g_hash_table_destroy (props_map);
+
+	rb_debug ("adding %d entries with %u distinct values", count, props->len);
+	g_atomic_int_add (&model->priv->all->refcount, count);
+
+	g_ptr_array_sort_with_data (props,
+				    (GCompareDataFunc) _prop_model_entry_ptr_compare,
+				    model);
+	for (i = 0; i < props->len; i++) {
+		prop = g_ptr_array_index (props, i);
+		ptr = g_sequence_append (model->priv->properties, prop);
+		g_hash_table_insert (model->priv->reverse_map,
+				     (gpointer)rb_refstring_get (prop->string),
+				     ptr);
+	}
+
+	iter.stamp = model->priv->stamp;
+	ptr = g_sequence_get_begin_iter (model->priv->properties);
+	for (i = 0; i < props->len; i++) {
+		iter.user_data = ptr;
+		path = gtk_tree_path_new ();
+		gtk_tree_path_append_index (path, i + 1);
+		gtk_tree_model_row_inserted (GTK_TREE_MODEL (model), path, &iter);
+		gtk_tree_path_free (path);
+
+		ptr = g_sequence_iter_next (ptr);
+	}
+
+	g_ptr_array_free (props, TRUE);
+	rhythmdb_property_model_sync (model);
+}
+
+/*
+ * removes all property values, as when detaching from the query model.
+ */
+static void
+rhythmdb_property_model_clear (RhythmDBPropertyModel *model)
+{
+	RhythmDBPropertyModelEntry *prop;
+	GSequenceIter *ptr;
+	GtkTreePath *path;
+	gint length;
+
+	g_hash_table_remove_all (model->priv->entries);
+	g_hash_table_remove_all (model->priv->changed);
+
+	/* delete rows from the end so the remaining paths stay valid */
+	length = g_sequence_get_length (model->priv->properties);
+	while (length > 0) {
+		ptr = g_sequence_iter_prev (g_sequence_get_end_iter (model->priv->properties));
+		prop = g_sequence_get (ptr);
+
+		path = gtk_tree_path_new ();
+		gtk_tree_path_append_index (path, length);
+		g_signal_emit (G_OBJECT (model), rhythmdb_property_model_signals[PRE_ROW_DELETION], 0);
+		gtk_tree_model_row_deleted (GTK_TREE_MODEL (model), path);
+		gtk_tree_path_free (path);
+
+		g_hash_table_remove (model->priv->reverse_map, rb_refstring_get (prop->string));
+		g_sequence_remove (ptr);
+		_prop_model_entry_cleanup (prop, NULL);
+
+		length = g_sequence_get_length (model->priv->properties);
+	}
+
+	g_atomic_int_set (&model->priv->all->refcount, 0);
+	rhythmdb_property_model_sync (model);
+}
+
 /**
  * rhythmdb_property_model_iter_from_string:
  * @model: the #RhythmDBPropertyModel
@@ -1399,6 +1501,9 @@ rhythmdb_property_model_perform_sync (RhythmDBPropertyModel *model)
 	GtkTreeIter iter;
 	GtkTreePath *path;
 
+	GList *changed;
+	GList *l;
+
 	GDK_THREADS_ENTER ();
 
 	iter.stamp = model->priv->stamp;
@@ -1407,6 +1512,17 @@ rhythmdb_property_model_perform_sync (RhythmDBPropertyModel *model)
 	gtk_tree_model_row_changed (GTK_TREE_MODEL (model), path, &iter);
 	gtk_tree_path_free (path);
 
+	/* emit one change for each row whose count changed since the last sync */
+	changed = g_hash_table_get_keys (model->priv->changed);
+	g_hash_table_remove_all (model->priv->changed);
+	for (l = changed; l != NULL; l = l->next) {
+		iter.user_data = l->data;
+		path = rhythmdb_property_model_get_path (GTK_TREE_MODEL (model), &iter);
+		gtk_tree_model_row_changed (GTK_TREE_MODEL (model), path, &iter);
+		gtk_tree_path_free (path);
+	}
+	g_list_free (changed);
+
 	model->priv->syncing_id = 0;
 	GDK_THREADS_LEAVE ();
 	return FALSE;
@@ -1421,6 +1537,14 @@ rhythmdb_property_model_sync (RhythmDBPropertyModel *model)
 	model->priv->syncing_id = g_idle_add ((GSourceFunc)rhythmdb_property_model_perform_sync, model);
 }
 
+static void
+rhythmdb_property_model_row_changed (RhythmDBPropertyModel *model,
+				     GSequenceIter *ptr)
+{
+	g_hash_table_insert (model->priv->changed, ptr, ptr);
+	rhythmdb_property_model_sync (model);
+}
+
 /* This should really be standard. */
 #define ENUM_ENTRY(NAME, DESC) { NAME, "" #NAME "", DESC }
 
@@ -49,6 +49,29 @@ struct ReverseSortData
 	gpointer		data;
 };
 
+typedef struct {
+	struct RhythmDBQueryModelResort *resort;
+	guint start;
+	guint length;
+} RhythmDBQueryModelResortRun;
+
+struct RhythmDBQueryModelResort
+{
+	RhythmDBQueryModel *model;
+	GPtrArray *entries;
+	GHashTable *changed;
+	volatile gint cancelled;
+
+	RhythmDBQueryModelResortRun *runs;
+	guint n_runs;
+	volatile gint runs_remaining;
+
+	GCompareDataFunc sort_func;
+	gpointer sort_data;
+	GDestroyNotify sort_data_destroy;
+	gboolean sort_reverse;
+};
+
 static void rhythmdb_query_model_query_results_init (RhythmDBQueryResultsIface *iface);
 static void rhythmdb_query_model_tree_model_init (GtkTreeModelIface *iface);
 static void rhythmdb_query_model_drag_source_init (RbTreeDragSourceIface *iface);
@@ -85,11 +108,19 @@ static void rhythmdb_query_model_entry_changed_cb (RhythmDB *db, RhythmDBEntry *
 						   GValueArray *changes, RhythmDBQueryModel *model);
 static void rhythmdb_query_model_entry_deleted_cb (RhythmDB *db, RhythmDBEntry *entry,
 						   RhythmDBQueryModel *model);
+static void rhythmdb_query_model_entries_deleted_cb (RhythmDB *db, GPtrArray *entries,
+						     RhythmDBQueryModel *model);
 
 static void rhythmdb_query_model_filter_out_entry (RhythmDBQueryModel *model,
 						   RhythmDBEntry *entry);
+static void rhythmdb_query_model_remove_from_main_list (RhythmDBQueryModel *model,
+							RhythmDBEntry *entry);
+static void rhythmdb_query_model_remove_from_limited_list (RhythmDBQueryModel *model,
+							   RhythmDBEntry *entry);
+static void rhythmdb_query_model_update_limited_entries (RhythmDBQueryModel *model);
 static gboolean rhythmdb_query_model_do_reorder (RhythmDBQueryModel *model, RhythmDBEntry *entry);
 static gboolean rhythmdb_query_model_emit_reorder (RhythmDBQueryModel *model, gint old_pos, gint new_pos);
+static void rhythmdb_query_model_emit_row_changed (RhythmDBQueryModel *model, RhythmDBEntry *entry);
 static gboolean rhythmdb_query_model_drag_data_get (RbTreeDragSource *dragsource,
 							  GList *paths,
 							  GtkSelectionData *selection_data);
@@ -171,7 +202,17 @@ static int rhythmdb_query_model_child_index_to_base_index (RhythmDBQueryModel *m
 static gint _reverse_sorting_func (gpointer a, gpointer b, struct ReverseSortData *model);
 static gboolean rhythmdb_query_model_within_limit (RhythmDBQueryModel *model,
 						   RhythmDBEntry *entry);
-static gboolean rhythmdb_query_model_reapply_query_cb (RhythmDBQueryModel *model);
+static gboolean rhythmdb_query_model_totals_within_limit (RhythmDBQueryModel *model,
+							  gulong count,
+							  guint64 size,
+							  gulong duration);
+static void rhythmdb_query_model_reset_expiry (RhythmDBQueryModel *model);
+static void rhythmdb_query_model_clear_expiry (RhythmDBQueryModel *model);
+static void rhythmdb_query_model_schedule_expiry (RhythmDBQueryModel *model,
+						  RhythmDBEntry *entry,
+						  gulong now);
+static gboolean rhythmdb_query_model_process_changes_cb (RhythmDBQueryModel *model);
+static void apply_updated_entry_sequence (RhythmDBQueryModel *model, GSequence *new_entries);
 
 struct RhythmDBQueryModelUpdate
 {
@@ -194,6 +235,13 @@ struct RhythmDBQueryModelUpdate
 static void rhythmdb_query_model_process_update (struct RhythmDBQueryModelUpdate *update);
 
 static void idle_process_update (struct RhythmDBQueryModelUpdate *update);
+static gboolean idle_process_updates (RhythmDBQueryModel *model);
+static void rhythmdb_query_model_flush_changes (RhythmDBQueryModel *model);
+static void rhythmdb_query_model_insert_chunk (RhythmDBQueryModel *model,
+					       struct RhythmDBQueryModelUpdate *update);
+static gint _chunk_sorting_func (RhythmDBEntry **a,
+				 RhythmDBEntry **b,
+				 RhythmDBQueryModel *model);
 
 enum {
 	TARGET_ENTRIES,
@@ -236,13 +284,39 @@ struct _RhythmDBQueryModelPrivate
 	GHashTable *hidden_entry_map;
 
 	gint pending_update_count;
+	GAsyncQueue *pending_updates;
+	volatile gint pending_updates_queued;
+
+	GHashTable *pending_changes;
+	guint pending_changes_id;
 
 	gboolean reorder_drag_and_drop;
 	gboolean show_hidden;
 
-	gint query_reapply_timeout_id;
+	/* entries that may start or stop matching a time-relative query,
+	 * mapped to the time they need to be checked again, and a heap
+	 * ordered by that time.
+	 */
+	GHashTable *expiry_map;
+	GArray *expiry_heap;
+	guint expiry_timeout_id;
+	gulong expiry_timeout_time;
+
+	struct RhythmDBQueryModelResort *resort;
 };
 
+/* result chunks smaller than this are inserted one entry at a time */
+#define BULK_INSERT_MIN_ENTRIES	16
+
+/* models at least this large are resorted on worker threads,
+ * in runs of this many entries that are then merged.
+ */
+#define RESORT_ASYNC_MIN_ENTRIES	5000
+#define RESORT_RUN_ENTRIES		8192
+
+/* most entries applied from queued updates per main loop iteration */
+#define UPDATE_BATCH_MAX_ENTRIES	1000
+
 #define RHYTHMDB_QUERY_MODEL_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), RHYTHMDB_TYPE_QUERY_MODEL, RhythmDBQueryModelPrivate))
 
 enum
@@ -557,18 +631,11 @@ rhythmdb_query_model_set_query_internal (RhythmDBQueryModel *model,
 	model->priv->original_query = rhythmdb_query_copy (model->priv->query);
 	rhythmdb_query_preprocess (model->priv->db, model->priv->query);
 
-	/* if the query contains time-relative criteria, re-run it periodically.
-	 * currently it's just every minute, but perhaps it could be smarter.
+	/* if the query contains time-relative criteria, work out when
+	 * entries will start or stop matching it.
 	 */
-	if (rhythmdb_query_is_time_relative (model->priv->db, model->priv->query)) {
-		if (model->priv->query_reapply_timeout_id == 0) {
-			model->priv->query_reapply_timeout_id =
-				g_timeout_add_seconds (60, (GSourceFunc) rhythmdb_query_model_reapply_query_cb, model);
-		}
-	} else if (model->priv->query_reapply_timeout_id) {
-		g_source_remove (model->priv->query_reapply_timeout_id);
-		model->priv->query_reapply_timeout_id = 0;
-	}
+	if (model->priv->db != NULL)
+		rhythmdb_query_model_reset_expiry (model);
 }
 
 static void
@@ -601,6 +668,8 @@ rhythmdb_query_model_set_property (GObject *object,
 		model->priv->sort_reverse  = g_value_get_boolean (value);
 		break;
 	case PROP_LIMIT_TYPE:
+		/* pending changes are handled differently with a limit */
+		rhythmdb_query_model_flush_changes (model);
 		model->priv->limit_type = g_value_get_enum (value);
 		break;
 	case PROP_LIMIT_VALUE:
@@ -690,6 +759,12 @@ rhythmdb_query_model_init (RhythmDBQueryModel *model)
 							       (GDestroyNotify)rhythmdb_entry_unref,
 							       NULL);
 
+	model->priv->pending_updates = g_async_queue_new ();
+	model->priv->pending_changes = g_hash_table_new_full (g_direct_hash,
+							      g_direct_equal,
+							      (GDestroyNotify)rhythmdb_entry_unref,
+							      NULL);
+
 	model->priv->reorder_drag_and_drop = FALSE;
 }
 
@@ -713,6 +788,13 @@ rhythmdb_query_model_constructed (GObject *object)
 				 "entry_deleted",
 				 G_CALLBACK (rhythmdb_query_model_entry_deleted_cb),
 				 model, 0);
+	g_signal_connect_object (G_OBJECT (model->priv->db),
+				 "entries_deleted",
+				 G_CALLBACK (rhythmdb_query_model_entries_deleted_cb),
+				 model, 0);
+
+	if (model->priv->expiry_map == NULL)
+		rhythmdb_query_model_reset_expiry (model);
 }
 
 static void
@@ -755,10 +837,13 @@ rhythmdb_query_model_dispose (GObject *object)
 		model->priv->base_model = NULL;
 	}
 
-	if (model->priv->query_reapply_timeout_id != 0) {
-		g_source_remove (model->priv->query_reapply_timeout_id);
-		model->priv->query_reapply_timeout_id = 0;
+	rhythmdb_query_model_clear_expiry (model);
+
+	if (model->priv->pending_changes_id != 0) {
+		g_source_remove (model->priv->pending_changes_id);
+		model->priv->pending_changes_id = 0;
 	}
+	g_hash_table_remove_all (model->priv->pending_changes);
 
 	G_OBJECT_CLASS (rhythmdb_query_model_parent_class)->dispose (object);
 }
@@ -785,6 +870,9 @@ rhythmdb_query_model_finalize (GObject *object)
 
 	g_hash_table_destroy (model->priv->hidden_entry_map);
 
+	g_hash_table_destroy (model->priv->pending_changes);
+	g_async_queue_unref (model->priv->pending_updates);
+
 	if (model->priv->query)
 		rhythmdb_query_free (model->priv->query);
 	if (model->priv->original_query)
@@ -1000,6 +1088,8 @@ rhythmdb_query_model_entry_added_cb (RhythmDB *db,
 	       }
 	}
 
+	rhythmdb_query_model_schedule_expiry (model, entry, 0);
+
 	if (model->priv->query != NULL) {
 		insert = rhythmdb_evaluate_query (db, model->priv->query, entry);
 	} else {
@@ -1108,26 +1198,207 @@ rhythmdb_query_model_entry_changed_cb (RhythmDB *db,
 		}
 	}
 
+	rhythmdb_query_model_schedule_expiry (model, entry, 0);
+
 	if (model->priv->query &&
 	    !rhythmdb_evaluate_query (db, model->priv->query, entry)) {
 		rhythmdb_query_model_filter_out_entry (model, entry);
 		return;
 	}
 
-	/* it may have moved, so we can't just emit a changed entry */
-	if (!rhythmdb_query_model_do_reorder (model, entry)) {
-		/* but if it didn't, we can */
-		GtkTreeIter iter;
-		GtkTreePath *path;
+	/* a resort in progress won't have seen this change; fix it up
+	 * once the new order is applied.
+	 */
+	if (model->priv->resort != NULL &&
+	    g_hash_table_lookup (model->priv->reverse_map, entry) != NULL) {
+		g_hash_table_insert (model->priv->resort->changed,
+				     rhythmdb_entry_ref (entry),
+				     entry);
+	}
 
-		if (rhythmdb_query_model_entry_to_iter (model, entry, &iter)) {
-			path = rhythmdb_query_model_get_path (GTK_TREE_MODEL (model),
-							      &iter);
-			gtk_tree_model_row_changed (GTK_TREE_MODEL (model),
-						     path, &iter);
-			gtk_tree_path_free (path);
+	/* moving entries across the limit boundary one at a time needs
+	 * the rest of the model to be in order, so do it right away.
+	 */
+	if (model->priv->limit_type != RHYTHMDB_QUERY_MODEL_LIMIT_NONE) {
+		if (!rhythmdb_query_model_do_reorder (model, entry))
+			rhythmdb_query_model_emit_row_changed (model, entry);
+		return;
+	}
+
+	/* the entry may have moved; work that out along with any other
+	 * changes made before the next main loop iteration.  until then,
+	 * changed entries may be out of order, so anything that relies on
+	 * the order has to flush the pending changes first.
+	 */
+	if (g_hash_table_lookup (model->priv->pending_changes, entry) == NULL) {
+		g_hash_table_insert (model->priv->pending_changes,
+				     rhythmdb_entry_ref (entry),
+				     entry);
+	}
+	if (model->priv->pending_changes_id == 0) {
+		model->priv->pending_changes_id =
+			g_idle_add ((GSourceFunc) rhythmdb_query_model_process_changes_cb, model);
+	}
+}
+
+static void
+rhythmdb_query_model_emit_row_changed (RhythmDBQueryModel *model,
+				       RhythmDBEntry *entry)
+{
+	GtkTreeIter iter;
+	GtkTreePath *path;
+
+	if (rhythmdb_query_model_entry_to_iter (model, entry, &iter)) {
+		path = rhythmdb_query_model_get_path (GTK_TREE_MODEL (model),
+						      &iter);
+		gtk_tree_model_row_changed (GTK_TREE_MODEL (model),
+					     path, &iter);
+		gtk_tree_path_free (path);
+	}
+}
+
+static void
+rhythmdb_query_model_reorder_entries (RhythmDBQueryModel *model,
+				      GPtrArray *changed)
+{
+	GSequence *new_entries;
+	GSequenceIter *ptr;
+	GSequenceIter *new_ptr;
+	GHashTable *moving;
+	GCompareDataFunc sort_func;
+	gpointer sort_data;
+	struct ReverseSortData reverse_data;
+	gboolean reordered;
+	guint i;
+
+	if (model->priv->sort_reverse) {
+		sort_func = (GCompareDataFunc) _reverse_sorting_func;
+		sort_data = &reverse_data;
+		reverse_data.func = model->priv->sort_func;
+		reverse_data.data = model->priv->sort_data;
+	} else {
+		sort_func = model->priv->sort_func;
+		sort_data = model->priv->sort_data;
+	}
+
+	moving = g_hash_table_new (g_direct_hash, g_direct_equal);
+	for (i = 0; i < changed->len; i++) {
+		g_hash_table_insert (moving, g_ptr_array_index (changed, i), NULL);
+	}
+
+	/* copy the unchanged entries across in order, then sort the changed
+	 * ones back in, so the whole batch turns into one permutation.
+	 */
+	new_entries = g_sequence_new (NULL);
+	ptr = g_sequence_get_begin_iter (model->priv->entries);
+	while (!g_sequence_iter_is_end (ptr)) {
+		RhythmDBEntry *entry = g_sequence_get (ptr);
+
+		if (!g_hash_table_lookup_extended (moving, entry, NULL, NULL))
+			g_sequence_append (new_entries, entry);
+		ptr = g_sequence_iter_next (ptr);
+	}
+	g_hash_table_destroy (moving);
+
+	for (i = 0; i < changed->len; i++) {
+		g_sequence_insert_sorted (new_entries,
+					  g_ptr_array_index (changed, i),
+					  sort_func,
+					  sort_data);
+	}
+
+	/* don't emit a reorder if nothing actually moved */
+	reordered = FALSE;
+	ptr = g_sequence_get_begin_iter (model->priv->entries);
+	new_ptr = g_sequence_get_begin_iter (new_entries);
+	while (!g_sequence_iter_is_end (ptr)) {
+		if (g_sequence_get (ptr) != g_sequence_get (new_ptr)) {
+			reordered = TRUE;
+			break;
+		}
+		ptr = g_sequence_iter_next (ptr);
+		new_ptr = g_sequence_iter_next (new_ptr);
+	}
+
+	if (reordered) {
+		rb_debug ("applying reorder for %u changed entries", changed->len);
+		apply_updated_entry_sequence (model, new_entries);
+	} else {
+		g_sequence_free (new_entries);
+	}
+
+	for (i = 0; i < changed->len; i++) {
+		rhythmdb_query_model_emit_row_changed (model, g_ptr_array_index (changed, i));
+	}
+}
+
+static void
+rhythmdb_query_model_process_changes (RhythmDBQueryModel *model)
+{
+	GHashTableIter iter;
+	GPtrArray *changed;
+	gpointer entry;
+	guint i;
+
+	/* all pending changes are handled at once, as any left behind
+	 * would leave the order inconsistent for the others.
+	 */
+	changed = g_ptr_array_sized_new (g_hash_table_size (model->priv->pending_changes));
+	g_hash_table_iter_init (&iter, model->priv->pending_changes);
+	while (g_hash_table_iter_next (&iter, &entry, NULL)) {
+		/* the array takes over the pending change's reference */
+		g_hash_table_iter_steal (&iter);
+
+		if (g_hash_table_lookup (model->priv->reverse_map, entry) != NULL) {
+			g_ptr_array_add (changed, entry);
+		} else {
+			/* removed from the model since it changed */
+			rhythmdb_entry_unref (entry);
+		}
+	}
+
+	if (changed->len > 1 &&
+	    model->priv->sort_func != NULL &&
+	    g_sequence_get_length (model->priv->limited_entries) == 0) {
+		rhythmdb_query_model_reorder_entries (model, changed);
+	} else {
+		for (i = 0; i < changed->len; i++) {
+			entry = g_ptr_array_index (changed, i);
+
+			/* it may have moved, so we can't just emit a changed entry */
+			if (!rhythmdb_query_model_do_reorder (model, entry)) {
+				/* but if it didn't, we can */
+				rhythmdb_query_model_emit_row_changed (model, entry);
+			}
 		}
 	}
+
+	for (i = 0; i < changed->len; i++) {
+		rhythmdb_entry_unref (g_ptr_array_index (changed, i));
+	}
+	g_ptr_array_free (changed, TRUE);
+}
+
+static gboolean
+rhythmdb_query_model_process_changes_cb (RhythmDBQueryModel *model)
+{
+	GDK_THREADS_ENTER ();
+	model->priv->pending_changes_id = 0;
+	rhythmdb_query_model_process_changes (model);
+	GDK_THREADS_LEAVE ();
+
+	return FALSE;
+}
+
+static void
+rhythmdb_query_model_flush_changes (RhythmDBQueryModel *model)
+{
+	if (model->priv->pending_changes_id == 0)
+		return;
+
+	g_source_remove (model->priv->pending_changes_id);
+	model->priv->pending_changes_id = 0;
+	rhythmdb_query_model_process_changes (model);
 }
 
 static void
@@ -1151,29 +1422,113 @@ rhythmdb_query_model_entry_deleted_cb (RhythmDB *db,
 				       RhythmDBEntry *entry,
 				       RhythmDBQueryModel *model)
 {
+	if (model->priv->expiry_map != NULL)
+		g_hash_table_remove (model->priv->expiry_map, entry);
 
 	if (g_hash_table_lookup (model->priv->reverse_map, entry) ||
 	    g_hash_table_lookup (model->priv->limited_reverse_map, entry))
 		rhythmdb_query_model_remove_entry (model, entry);
 }
 
+static void
+rhythmdb_query_model_entries_deleted_cb (RhythmDB *db,
+					 GPtrArray *entries,
+					 RhythmDBQueryModel *model)
+{
+	RhythmDBEntry *entry;
+	gboolean removed = FALSE;
+	guint i;
+
+	if (model->priv->expiry_map != NULL) {
+		for (i = 0; i < entries->len; i++) {
+			g_hash_table_remove (model->priv->expiry_map,
+					     g_ptr_array_index (entries, i));
+		}
+	}
+
+	/* chained models see the removals through their base model */
+	if (model->priv->base_model != NULL)
+		return;
+
+	for (i = 0; i < entries->len; i++) {
+		entry = g_ptr_array_index (entries, i);
+
+		if (g_hash_table_lookup (model->priv->reverse_map, entry)) {
+			g_signal_emit (G_OBJECT (model),
+				       rhythmdb_query_model_signals[ENTRY_REMOVED], 0,
+				       entry);
+			rhythmdb_query_model_remove_from_main_list (model, entry);
+			removed = TRUE;
+		} else if (g_hash_table_lookup (model->priv->limited_reverse_map, entry)) {
+			g_signal_emit (G_OBJECT (model),
+				       rhythmdb_query_model_signals[ENTRY_REMOVED], 0,
+				       entry);
+			rhythmdb_query_model_remove_from_limited_list (model, entry);
+			removed = TRUE;
+		}
+	}
+
+	/* only refill from the limited entries once the whole set is gone */
+	if (removed)
+		rhythmdb_query_model_update_limited_entries (model);
+}
+
 static gboolean
-idle_process_update_idle (struct RhythmDBQueryModelUpdate *update)
+idle_process_updates (RhythmDBQueryModel *model)
 {
+	struct RhythmDBQueryModelUpdate *update;
+	guint processed = 0;
+	gboolean more = FALSE;
+
 	GDK_THREADS_ENTER ();
-	idle_process_update (update);
+
+	/* apply as many queued updates as fit in this iteration's budget,
+	 * always making progress on at least one.
+	 */
+	while ((update = g_async_queue_try_pop (model->priv->pending_updates)) != NULL) {
+		if (update->type == RHYTHMDB_QUERY_MODEL_UPDATE_ROWS_INSERTED)
+			processed += update->entrydata.entries->len;
+		else
+			processed++;
+
+		idle_process_update (update);
+
+		if (processed >= UPDATE_BATCH_MAX_ENTRIES) {
+			more = TRUE;
+			break;
+		}
+	}
+
+	if (more == FALSE) {
+		/* catch updates queued after the queue was found to be empty */
+		g_atomic_int_set (&model->priv->pending_updates_queued, 0);
+		if (g_async_queue_length (model->priv->pending_updates) > 0 &&
+		    g_atomic_int_compare_and_exchange (&model->priv->pending_updates_queued, 0, 1))
+			more = TRUE;
+	}
+
+	if (more == FALSE)
+		g_object_unref (model);
+
 	GDK_THREADS_LEAVE ();
-	return FALSE;
+	return more;
 }
 
 static void
 rhythmdb_query_model_process_update (struct RhythmDBQueryModelUpdate *update)
 {
-	g_atomic_int_inc (&update->model->priv->pending_update_count);
-	if (rb_is_main_thread ())
+	RhythmDBQueryModel *model = update->model;
+
+	g_atomic_int_inc (&model->priv->pending_update_count);
+	if (rb_is_main_thread ()) {
 		idle_process_update (update);
-	else
-		g_idle_add ((GSourceFunc) idle_process_update_idle, update);
+		return;
+	}
+
+	/* queue it up for the model's next batch of updates */
+	g_async_queue_push (model->priv->pending_updates, update);
+	if (g_atomic_int_compare_and_exchange (&model->priv->pending_updates_queued, 0, 1))
+		g_idle_add ((GSourceFunc) idle_process_updates, g_object_ref (model));
 }
 
 static void
@@ -1182,27 +1537,9 @@ idle_process_update (struct RhythmDBQueryModelUpdate *update)
 	switch (update->type) {
 	case RHYTHMDB_QUERY_MODEL_UPDATE_ROWS_INSERTED:
 	{
-		guint i;
-
 		rb_debug ("inserting %d rows", update->entrydata.entries->len);
-
-		for (i = 0; i < update->entrydata.entries->len; i++ ) {
-			RhythmDBEntry *entry = g_ptr_array_index (update->entrydata.entries, i);
-
-			if (update->model->priv->show_hidden || !rhythmdb_entry_get_boolean (entry, RHYTHMDB_PROP_HIDDEN)) {
-				RhythmDBQueryModel *base_model = update->model->priv->base_model;
-				if (base_model &&
-				    g_hash_table_lookup (base_model->priv->reverse_map, entry) == NULL)
-					       continue;
-
-				rhythmdb_query_model_do_insert (update->model, entry, -1);
-			}
-
-			rhythmdb_entry_unref (entry);
-		}
-
+		rhythmdb_query_model_insert_chunk (update->model, update);
 		g_ptr_array_free (update->entrydata.entries, TRUE);
-
 		break;
 	}
 	case RHYTHMDB_QUERY_MODEL_UPDATE_ROW_INSERTED_INDEX:
@@ -1428,74 +1765,265 @@ rhythmdb_query_model_remove_from_limited_list (RhythmDBQueryModel *model,
 	rhythmdb_entry_unref (entry);
 }
 
+/*
+ * Returns a negative value if the last entry in the main list sorts before
+ * the first limited entry, which is the usual state of a limited model.
+ */
+static int
+rhythmdb_query_model_compare_limit_boundary (RhythmDBQueryModel *model)
+{
+	GSequenceIter *last;
+	GSequenceIter *first_limited;
+	struct ReverseSortData reverse_data;
+
+	if (model->priv->sort_func == NULL)
+		return -1;
+
+	last = g_sequence_get_end_iter (model->priv->entries);
+	first_limited = g_sequence_get_begin_iter (model->priv->limited_entries);
+	if (g_sequence_iter_is_begin (last) || g_sequence_iter_is_end (first_limited))
+		return -1;
+	last = g_sequence_iter_prev (last);
+
+	if (model->priv->sort_reverse) {
+		reverse_data.func = model->priv->sort_func;
+		reverse_data.data = model->priv->sort_data;
+		return _reverse_sorting_func (g_sequence_get (last),
+					      g_sequence_get (first_limited),
+					      &reverse_data);
+	} else {
+		return (model->priv->sort_func) (g_sequence_get (last),
+						 g_sequence_get (first_limited),
+						 model->priv->sort_data);
+	}
+}
+
+/*
+ * Moves the entries from @start to the end of the main list over to the
+ * limited list.  Row deletions are announced from the end of the list
+ * while the rows are still present, then the entries move across in one go.
+ */
 static void
-rhythmdb_query_model_update_limited_entries (RhythmDBQueryModel *model)
+rhythmdb_query_model_move_range_to_limited_list (RhythmDBQueryModel *model,
+						 GSequenceIter *start)
 {
-	RhythmDBEntry *entry;
+	GPtrArray *entries;
 	GSequenceIter *ptr;
+	GtkTreePath *path;
+	gboolean sorted;
+	int index;
+	guint i;
 
-	/* make it fit inside the limits */
-	while (!rhythmdb_query_model_within_limit (model, NULL)) {
-		ptr = g_sequence_iter_prev (g_sequence_get_end_iter (model->priv->entries));
-		entry = (RhythmDBEntry*) g_sequence_get (ptr);
-
+	entries = g_ptr_array_new ();
+	for (ptr = start; !g_sequence_iter_is_end (ptr); ptr = g_sequence_iter_next (ptr)) {
 		/* take temporary ref */
-		rhythmdb_entry_ref (entry);
-		rhythmdb_query_model_remove_from_main_list (model, entry);
-		rhythmdb_query_model_insert_into_limited_list (model, entry);
-		/* release temporary ref */
-		rhythmdb_entry_unref (entry);
+		g_ptr_array_add (entries, rhythmdb_entry_ref (g_sequence_get (ptr)));
 	}
 
-	/* move entries that were previously limited, back to the main list */
-	while (TRUE) {
-		GtkTreePath *path;
-		GtkTreeIter iter;
+	rb_debug ("moving %u entries to the limited list", entries->len);
 
-		ptr = g_sequence_get_begin_iter (model->priv->limited_entries);
-		if (!ptr || ptr == g_sequence_get_end_iter (model->priv->limited_entries))
-			break;
-		entry = (RhythmDBEntry*) g_sequence_get (ptr);
-		if (!entry)
-			break;
+	index = g_sequence_iter_get_position (start);
+	for (i = entries->len; i > 0; i--) {
+		path = gtk_tree_path_new ();
+		gtk_tree_path_append_index (path, index + i - 1);
+		gtk_tree_model_row_deleted (GTK_TREE_MODEL (model), path);
+		gtk_tree_path_free (path);
+	}
 
-		if (!rhythmdb_query_model_within_limit (model, entry))
-			break;
+	/* the whole range can be moved if it all sorts before the
+	 * entries that are already limited.
+	 */
+	sorted = (rhythmdb_query_model_compare_limit_boundary (model) <= 0);
 
-		/* take temporary ref */
-		rhythmdb_entry_ref (entry);
-		rhythmdb_query_model_remove_from_limited_list (model, entry);
-		rhythmdb_query_model_insert_into_main_list (model, entry, -1);
-		/* release temporary ref */
-		rhythmdb_entry_unref (entry);
+	for (i = 0; i < entries->len; i++) {
+		RhythmDBEntry *entry = g_ptr_array_index (entries, i);
 
+		model->priv->total_duration -= rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_DURATION);
+		model->priv->total_size -= rhythmdb_entry_get_uint64 (entry, RHYTHMDB_PROP_FILE_SIZE);
+
+		/* find the sequence pointer again in case a row-deleted
+		 * signal handler moved it.
+		 */
 		ptr = g_hash_table_lookup (model->priv->reverse_map, entry);
-		iter.stamp = model->priv->stamp;
-		iter.user_data = ptr;
-		path = rhythmdb_query_model_get_path (GTK_TREE_MODEL (model),
-						      &iter);
-		gtk_tree_model_row_inserted (GTK_TREE_MODEL (model),
-					     path, &iter);
-		gtk_tree_path_free (path);
+		if (sorted) {
+			/* the limited hash takes over the main hash's reference */
+			g_hash_table_steal (model->priv->reverse_map, entry);
+			g_hash_table_insert (model->priv->limited_reverse_map, entry, ptr);
+		} else {
+			g_sequence_remove (ptr);
+			g_hash_table_remove (model->priv->reverse_map, entry);
+			rhythmdb_query_model_insert_into_limited_list (model, entry);
+		}
+	}
+
+	if (sorted && entries->len > 0) {
+		start = g_hash_table_lookup (model->priv->limited_reverse_map,
+					     g_ptr_array_index (entries, 0));
+		g_sequence_move_range (g_sequence_get_begin_iter (model->priv->limited_entries),
+				       start,
+				       g_sequence_get_end_iter (model->priv->entries));
+	}
+
+	for (i = 0; i < entries->len; i++) {
+		RhythmDBEntry *entry = g_ptr_array_index (entries, i);
+
+		g_signal_emit (G_OBJECT (model), rhythmdb_query_model_signals[POST_ENTRY_DELETE], 0, entry);
+
+		/* release temporary ref */
+		rhythmdb_entry_unref (entry);
 	}
+	g_ptr_array_free (entries, TRUE);
 }
 
-static gboolean
-rhythmdb_query_model_emit_reorder (RhythmDBQueryModel *model,
-				   gint old_pos,
-				   gint new_pos)
+/*
+ * Moves the limited entries before @end back to the end of the main list.
+ */
+static void
+rhythmdb_query_model_move_range_to_main_list (RhythmDBQueryModel *model,
+					      GSequenceIter *end)
 {
-	int length, i;
-	gint *reorder_map;
+	GPtrArray *entries;
+	GSequenceIter *ptr;
 	GtkTreePath *path;
 	GtkTreeIter iter;
+	gboolean sorted;
+	guint i;
 
-	if (new_pos == old_pos) {
-		/* it hasn't moved, don't emit a re-order */
-		return FALSE;
+	entries = g_ptr_array_new ();
+	for (ptr = g_sequence_get_begin_iter (model->priv->limited_entries);
+	     ptr != end;
+	     ptr = g_sequence_iter_next (ptr)) {
+		/* take temporary ref */
+		g_ptr_array_add (entries, rhythmdb_entry_ref (g_sequence_get (ptr)));
 	}
 
-	length = g_sequence_get_length (model->priv->entries);
+	rb_debug ("moving %u entries back from the limited list", entries->len);
+
+	sorted = (rhythmdb_query_model_compare_limit_boundary (model) <= 0);
+	if (sorted) {
+		for (i = 0; i < entries->len; i++) {
+			RhythmDBEntry *entry = g_ptr_array_index (entries, i);
+
+			/* the main hash takes over the limited hash's reference */
+			ptr = g_hash_table_lookup (model->priv->limited_reverse_map, entry);
+			g_hash_table_steal (model->priv->limited_reverse_map, entry);
+			g_hash_table_insert (model->priv->reverse_map, entry, ptr);
+
+			model->priv->total_duration += rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_DURATION);
+			model->priv->total_size += rhythmdb_entry_get_uint64 (entry, RHYTHMDB_PROP_FILE_SIZE);
+		}
+
+		g_sequence_move_range (g_sequence_get_end_iter (model->priv->entries),
+				       g_sequence_get_begin_iter (model->priv->limited_entries),
+				       end);
+	} else {
+		for (i = 0; i < entries->len; i++) {
+			RhythmDBEntry *entry = g_ptr_array_index (entries, i);
+
+			rhythmdb_query_model_remove_from_limited_list (model, entry);
+			rhythmdb_query_model_insert_into_main_list (model, entry, -1);
+		}
+	}
+
+	for (i = 0; i < entries->len; i++) {
+		RhythmDBEntry *entry = g_ptr_array_index (entries, i);
+
+		iter.stamp = model->priv->stamp;
+		iter.user_data = g_hash_table_lookup (model->priv->reverse_map, entry);
+		if (iter.user_data != NULL) {
+			path = rhythmdb_query_model_get_path (GTK_TREE_MODEL (model),
+							      &iter);
+			gtk_tree_model_row_inserted (GTK_TREE_MODEL (model),
+						     path, &iter);
+			gtk_tree_path_free (path);
+		}
+
+		/* release temporary ref */
+		rhythmdb_entry_unref (entry);
+	}
+	g_ptr_array_free (entries, TRUE);
+}
+
+static void
+rhythmdb_query_model_update_limited_entries (RhythmDBQueryModel *model)
+{
+	RhythmDBEntry *entry;
+	GSequenceIter *cut;
+	gulong count;
+	guint64 size;
+	gulong duration;
+
+	count = g_hash_table_size (model->priv->reverse_map);
+	size = model->priv->total_size;
+	duration = model->priv->total_duration;
+
+	/* find the first entry that has to go to make it fit inside the limits */
+	cut = g_sequence_get_end_iter (model->priv->entries);
+	if (model->priv->limit_type == RHYTHMDB_QUERY_MODEL_LIMIT_COUNT) {
+		gulong limit_count;
+
+		limit_count = g_value_get_ulong (g_value_array_get_nth (model->priv->limit_value, 0));
+		if (count > limit_count)
+			cut = g_sequence_get_iter_at_pos (model->priv->entries, limit_count);
+	} else {
+		while (count > 0 &&
+		       !rhythmdb_query_model_totals_within_limit (model, count, size, duration)) {
+			cut = g_sequence_iter_prev (cut);
+			entry = g_sequence_get (cut);
+
+			count--;
+			size -= rhythmdb_entry_get_uint64 (entry, RHYTHMDB_PROP_FILE_SIZE);
+			duration -= rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_DURATION);
+		}
+	}
+
+	if (!g_sequence_iter_is_end (cut)) {
+		rhythmdb_query_model_move_range_to_limited_list (model, cut);
+		return;
+	}
+
+	/* find how many previously limited entries fit back into the main list */
+	cut = g_sequence_get_begin_iter (model->priv->limited_entries);
+	while (!g_sequence_iter_is_end (cut)) {
+		guint64 entry_size;
+		gulong entry_duration;
+
+		entry = g_sequence_get (cut);
+		entry_size = rhythmdb_entry_get_uint64 (entry, RHYTHMDB_PROP_FILE_SIZE);
+		entry_duration = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_DURATION);
+
+		if (!rhythmdb_query_model_totals_within_limit (model,
+							       count + 1,
+							       size + entry_size,
+							       duration + entry_duration))
+			break;
+
+		count++;
+		size += entry_size;
+		duration += entry_duration;
+		cut = g_sequence_iter_next (cut);
+	}
+
+	if (!g_sequence_iter_is_begin (cut))
+		rhythmdb_query_model_move_range_to_main_list (model, cut);
+}
+
+static gboolean
+rhythmdb_query_model_emit_reorder (RhythmDBQueryModel *model,
+				   gint old_pos,
+				   gint new_pos)
+{
+	int length, i;
+	gint *reorder_map;
+	GtkTreePath *path;
+	GtkTreeIter iter;
+
+	if (new_pos == old_pos) {
+		/* it hasn't moved, don't emit a re-order */
+		return FALSE;
+	}
+
+	length = g_sequence_get_length (model->priv->entries);
 	reorder_map = g_malloc (length * sizeof(gint));
 
 	if (new_pos > old_pos) {
@@ -1615,6 +2143,9 @@ rhythmdb_query_model_do_insert (RhythmDBQueryModel *model,
 	if (g_hash_table_lookup (model->priv->reverse_map, entry) != NULL)
 		return;
 
+	/* the new entry is placed by binary search */
+	rhythmdb_query_model_flush_changes (model);
+
 	/* take temporary ref */
 	rhythmdb_entry_ref (entry);
 
@@ -1641,6 +2172,118 @@ rhythmdb_query_model_do_insert (RhythmDBQueryModel *model,
 	rhythmdb_query_model_update_limited_entries (model);
 }
 
+/*
+ * Inserts a chunk of query results into the model.  When the chunk is
+ * large compared to the model, it is sorted and merged into the entry
+ * sequence in a single pass rather than doing a binary search for each
+ * entry.  Each row-inserted signal is emitted as its row is placed, so the
+ * model never contains rows that haven't been announced yet.
+ *
+ * The chunk is sorted here rather than on the query thread.  Sort functions
+ * read entry properties and cached sort keys, which the main thread can
+ * change at any time, and the model's sort order can change too; neither
+ * can happen while the main thread is doing the sorting itself.
+ */
+static void
+rhythmdb_query_model_insert_chunk (RhythmDBQueryModel *model,
+				   struct RhythmDBQueryModelUpdate *update)
+{
+	GPtrArray *entries = update->entrydata.entries;
+	GPtrArray *added;
+	GCompareDataFunc sort_func;
+	gpointer sort_data;
+	struct ReverseSortData reverse_data;
+	GSequenceIter *ptr;
+	GSequenceIter *new_ptr;
+	GtkTreePath *path;
+	GtkTreeIter iter;
+	guint length;
+	guint i;
+
+	/* merging needs the existing entries to be in order */
+	rhythmdb_query_model_flush_changes (model);
+
+	/* the references taken in add_results move into this array */
+	added = g_ptr_array_sized_new (entries->len);
+	for (i = 0; i < entries->len; i++) {
+		RhythmDBEntry *entry = g_ptr_array_index (entries, i);
+		RhythmDBQueryModel *base_model = model->priv->base_model;
+
+		if ((!model->priv->show_hidden && rhythmdb_entry_get_boolean (entry, RHYTHMDB_PROP_HIDDEN)) ||
+		    (base_model && g_hash_table_lookup (base_model->priv->reverse_map, entry) == NULL)) {
+			rhythmdb_entry_unref (entry);
+			continue;
+		}
+
+		g_ptr_array_add (added, entry);
+	}
+
+	length = g_sequence_get_length (model->priv->entries);
+	if (model->priv->sort_func == NULL ||
+	    added->len < BULK_INSERT_MIN_ENTRIES ||
+	    model->priv->limit_type != RHYTHMDB_QUERY_MODEL_LIMIT_NONE ||
+	    (added->len * g_bit_storage (length)) < length) {
+		for (i = 0; i < added->len; i++) {
+			RhythmDBEntry *entry = g_ptr_array_index (added, i);
+
+			rhythmdb_query_model_do_insert (model, entry, -1);
+			rhythmdb_entry_unref (entry);
+		}
+		g_ptr_array_free (added, TRUE);
+		return;
+	}
+
+	rb_debug ("merging %d sorted entries into %d", added->len, length);
+	g_ptr_array_sort_with_data (added, (GCompareDataFunc) _chunk_sorting_func, model);
+
+	if (model->priv->sort_reverse) {
+		sort_func = (GCompareDataFunc) _reverse_sorting_func;
+		sort_data = &reverse_data;
+		reverse_data.func = model->priv->sort_func;
+		reverse_data.data = model->priv->sort_data;
+	} else {
+		sort_func = model->priv->sort_func;
+		sort_data = model->priv->sort_data;
+	}
+
+	ptr = g_sequence_get_begin_iter (model->priv->entries);
+	for (i = 0; i < added->len; i++) {
+		RhythmDBEntry *entry = g_ptr_array_index (added, i);
+
+		if (g_hash_table_lookup (model->priv->reverse_map, entry) != NULL) {
+			rhythmdb_entry_unref (entry);
+			continue;
+		}
+
+		/* equal entries go after the ones already in the model,
+		 * as they would with g_sequence_insert_sorted.
+		 */
+		while (!g_sequence_iter_is_end (ptr) &&
+		       sort_func (g_sequence_get (ptr), entry, sort_data) <= 0) {
+			ptr = g_sequence_iter_next (ptr);
+		}
+
+		/* the hash now owns the reference taken in add_results */
+		new_ptr = g_sequence_insert_before (ptr, entry);
+		g_hash_table_insert (model->priv->reverse_map, entry, new_ptr);
+
+		model->priv->total_duration += rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_DURATION);
+		model->priv->total_size += rhythmdb_entry_get_uint64 (entry, RHYTHMDB_PROP_FILE_SIZE);
+
+		/* sequence iters stay valid across insertions, so the
+		 * merge can carry on from ptr after this.
+		 */
+		iter.stamp = model->priv->stamp;
+		iter.user_data = new_ptr;
+		path = rhythmdb_query_model_get_path (GTK_TREE_MODEL (model), &iter);
+		gtk_tree_model_row_inserted (GTK_TREE_MODEL (model), path, &iter);
+		gtk_tree_path_free (path);
+	}
+
+	g_ptr_array_free (added, TRUE);
+	rhythmdb_query_model_update_limited_entries (model);
+}
+
 static void
 rhythmdb_query_model_filter_out_entry (RhythmDBQueryModel *model,
 				       RhythmDBEntry *entry)
@@ -2247,7 +2890,7 @@ rhythmdb_query_model_add_results (RhythmDBQueryResults *results,
 
 	rb_debug ("adding %d entries", entries->len);
 
-	update = g_new (struct RhythmDBQueryModelUpdate, 1);
+	update = g_new0 (struct RhythmDBQueryModelUpdate, 1);
 	update->type = RHYTHMDB_QUERY_MODEL_UPDATE_ROWS_INSERTED;
 	update->entrydata.entries = entries;
 	update->model = model;
@@ -2519,6 +3162,222 @@ apply_updated_entry_sequence (RhythmDBQueryModel *model,
 	g_free (reorder_map);
 }
 
+static void
+rhythmdb_query_model_resort_free (struct RhythmDBQueryModelResort *resort)
+{
+	guint i;
+
+	for (i = 0; i < resort->entries->len; i++) {
+		rhythmdb_entry_unref (g_ptr_array_index (resort->entries, i));
+	}
+	g_ptr_array_free (resort->entries, TRUE);
+	g_hash_table_destroy (resort->changed);
+	g_free (resort->runs);
+
+	/* the sort data is only still ours if the resort wasn't applied */
+	if (resort->sort_data_destroy && resort->sort_data)
+		resort->sort_data_destroy (resort->sort_data);
+
+	g_object_unref (resort->model);
+	g_free (resort);
+}
+
+static int
+_resort_compare_func (RhythmDBEntry **a,
+		      RhythmDBEntry **b,
+		      struct RhythmDBQueryModelResort *resort)
+{
+	int ret;
+
+	/* once cancelled, let the sort finish as quickly as possible */
+	if (G_UNLIKELY (g_atomic_int_get (&resort->cancelled)))
+		return 0;
+
+	ret = resort->sort_func (*a, *b, resort->sort_data);
+	return resort->sort_reverse ? -ret : ret;
+}
+
+static gboolean
+rhythmdb_query_model_resort_done (struct RhythmDBQueryModelResort *resort)
+{
+	RhythmDBQueryModel *model = resort->model;
+	GSequence *new_entries;
+	GSequenceIter *ptr;
+	GCompareDataFunc sort_func;
+	gpointer sort_data;
+	struct ReverseSortData reverse_data;
+	gpointer entry;
+	guint count;
+	guint i;
+
+	GDK_THREADS_ENTER ();
+
+	if (model->priv->resort != resort || g_atomic_int_get (&resort->cancelled)) {
+		rb_debug ("discarding stale resort of %d entries", resort->entries->len);
+		GDK_THREADS_LEAVE ();
+		rhythmdb_query_model_resort_free (resort);
+		return FALSE;
+	}
+	model->priv->resort = NULL;
+
+	/* install the new sort order; the model owns the sort data now */
+	if (model->priv->sort_data_destroy && model->priv->sort_data)
+		model->priv->sort_data_destroy (model->priv->sort_data);
+
+	model->priv->sort_func = resort->sort_func;
+	model->priv->sort_data = resort->sort_data;
+	model->priv->sort_data_destroy = resort->sort_data_destroy;
+	model->priv->sort_reverse = resort->sort_reverse;
+	resort->sort_data_destroy = NULL;
+
+	if (model->priv->sort_reverse) {
+		reverse_data.func = model->priv->sort_func;
+		reverse_data.data = model->priv->sort_data;
+		sort_func = (GCompareDataFunc) _reverse_sorting_func;
+		sort_data = &reverse_data;
+	} else {
+		sort_func = model->priv->sort_func;
+		sort_data = model->priv->sort_data;
+	}
+
+	/* entries removed while sorting are skipped.  entries added while
+	 * sorting, and entries that changed (which may not have been sorted
+	 * consistently), are inserted into the new sequence individually.
+	 */
+	new_entries = g_sequence_new (NULL);
+	count = 0;
+	for (i = 0; i < resort->entries->len; i++) {
+		entry = g_ptr_array_index (resort->entries, i);
+		if (g_hash_table_lookup (model->priv->reverse_map, entry) != NULL &&
+		    g_hash_table_lookup (resort->changed, entry) == NULL) {
+			g_sequence_append (new_entries, entry);
+			count++;
+		}
+	}
+
+	if (count != g_sequence_get_length (model->priv->entries)) {
+		GHashTable *sorted;
+
+		sorted = g_hash_table_new (g_direct_hash, g_direct_equal);
+		for (i = 0; i < resort->entries->len; i++) {
+			entry = g_ptr_array_index (resort->entries, i);
+			if (g_hash_table_lookup (resort->changed, entry) == NULL)
+				g_hash_table_insert (sorted, entry, entry);
+		}
+
+		ptr = g_sequence_get_begin_iter (model->priv->entries);
+		while (!g_sequence_iter_is_end (ptr)) {
+			entry = g_sequence_get (ptr);
+			if (g_hash_table_lookup (sorted, entry) == NULL)
+				g_sequence_insert_sorted (new_entries, entry, sort_func, sort_data);
+			ptr = g_sequence_iter_next (ptr);
+		}
+		g_hash_table_destroy (sorted);
+	}
+
+	apply_updated_entry_sequence (model, new_entries);
+
+	GDK_THREADS_LEAVE ();
+
+	rhythmdb_query_model_resort_free (resort);
+	return FALSE;
+}
+
+/* merges the sorted runs pairwise until they're all merged */
+static void
+rhythmdb_query_model_resort_merge (struct RhythmDBQueryModelResort *resort)
+{
+	gpointer *from;
+	gpointer *to;
+	gpointer *tmp;
+	guint length;
+	guint width;
+	guint lo;
+
+	length = resort->entries->len;
+	from = resort->entries->pdata;
+	to = g_new (gpointer, length);
+	tmp = to;
+
+	/* every pass is completed, even when cancelled, so the array
+	 * always holds all the entries.
+	 */
+	for (width = RESORT_RUN_ENTRIES;
+	     width < length && g_atomic_int_get (&resort->cancelled) == 0;
+	     width *= 2) {
+		gpointer *swap;
+
+		for (lo = 0; lo < length; lo += 2 * width) {
+			guint a = lo;
+			guint b = MIN (lo + width, length);
+			guint mid = b;
+			guint end = MIN (lo + 2 * width, length);
+			guint out = lo;
+
+			while (a < mid && b < end) {
+				if (_resort_compare_func ((RhythmDBEntry **) &from[b],
+							  (RhythmDBEntry **) &from[a],
+							  resort) < 0)
+					to[out++] = from[b++];
+				else
+					to[out++] = from[a++];
+			}
+			while (a < mid)
+				to[out++] = from[a++];
+			while (b < end)
+				to[out++] = from[b++];
+		}
+
+		swap = from;
+		from = to;
+		to = swap;
+	}
+
+	if (from != resort->entries->pdata)
+		memcpy (resort->entries->pdata, from, length * sizeof (gpointer));
+	g_free (tmp);
+}
+
+static gpointer
+rhythmdb_query_model_resort_run (RhythmDBQueryModelResortRun *run)
+{
+	struct RhythmDBQueryModelResort *resort = run->resort;
+
+	/* the sort functions may use cached sort keys */
+	rhythmdb_entry_sort_order_keys_hold ();
+
+	if (g_atomic_int_get (&resort->cancelled) == 0) {
+		g_qsort_with_data (resort->entries->pdata + run->start,
+				   run->length,
+				   sizeof (gpointer),
+				   (GCompareDataFunc) _resort_compare_func,
+				   resort);
+	}
+
+	/* the last run to finish merges them all */
+	if (g_atomic_int_dec_and_test (&resort->runs_remaining)) {
+		rhythmdb_query_model_resort_merge (resort);
+		g_idle_add ((GSourceFunc) rhythmdb_query_model_resort_done, resort);
+	}
+
+	rhythmdb_entry_sort_order_keys_release ();
+	return NULL;
+}
+
+static void
+rhythmdb_query_model_cancel_resort (RhythmDBQueryModel *model)
+{
+	if (model->priv->resort == NULL)
+		return;
+
+	/* runs that haven't started yet are skipped, and the
+	 * result is freed when it comes back.
+	 */
+	rb_debug ("cancelling resort in progress");
+	g_atomic_int_set (&model->priv->resort->cancelled, 1);
+	model->priv->resort = NULL;
+}
+
 /**
  * rhythmdb_query_model_set_sort_order:
  * @model: a #RhythmDBQueryModel
@@ -2528,7 +3387,9 @@ apply_updated_entry_sequence (RhythmDBQueryModel *model,
  * @sort_reverse: if %TRUE, reverse the sort order
  *
  * Sets a new sort order on the model.  This reorders the entries
- * in the model to match the new sort order.
+ * in the model to match the new sort order.  For large models,
+ * the entries are sorted on worker threads and the model keeps
+ * its current order until the new order is ready.
  */
 void
 rhythmdb_query_model_set_sort_order (RhythmDBQueryModel *model,
@@ -2537,11 +3398,26 @@ rhythmdb_query_model_set_sort_order (RhythmDBQueryModel *model,
 				     GDestroyNotify sort_data_destroy,
 				     gboolean sort_reverse)
 {
+	struct RhythmDBQueryModelResort *resort;
 	GSequence *new_entries;
 	GSequenceIter *ptr;
 	int length, i;
 	struct ReverseSortData reverse_data;
 
+	resort = model->priv->resort;
+	if (resort != NULL &&
+	    (resort->sort_func == sort_func) &&
+	    (resort->sort_data == sort_data) &&
+	    (resort->sort_data_destroy == sort_data_destroy) &&
+	    (resort->sort_reverse == sort_reverse))
+		return;
+
+	/* any other resort still in progress is out of date now */
+	rhythmdb_query_model_cancel_resort (model);
+
+	/* settle changes against the current order before replacing it */
+	rhythmdb_query_model_flush_changes (model);
+
 	if ((model->priv->sort_func == sort_func) &&
 	    (model->priv->sort_data == sort_data) &&
 	    (model->priv->sort_data_destroy == sort_data_destroy) &&
@@ -2553,6 +3429,51 @@ rhythmdb_query_model_set_sort_order (RhythmDBQueryModel *model,
 	if (model->priv->sort_func == NULL)
 		g_assert (g_sequence_get_length (model->priv->limited_entries) == 0);
 
+	length = g_sequence_get_length (model->priv->entries);
+	if (sort_func != NULL &&
+	    model->priv->limit_type == RHYTHMDB_QUERY_MODEL_LIMIT_NONE &&
+	    length >= RESORT_ASYNC_MIN_ENTRIES) {
+		rb_debug ("resorting %d entries in the background", length);
+
+		resort = g_new0 (struct RhythmDBQueryModelResort, 1);
+		resort->model = g_object_ref (model);
+		resort->sort_func = sort_func;
+		resort->sort_data = sort_data;
+		resort->sort_data_destroy = sort_data_destroy;
+		resort->sort_reverse = sort_reverse;
+		resort->changed = g_hash_table_new_full (g_direct_hash,
+							 g_direct_equal,
+							 (GDestroyNotify) rhythmdb_entry_unref,
+							 NULL);
+
+		resort->entries = g_ptr_array_sized_new (length);
+		ptr = g_sequence_get_begin_iter (model->priv->entries);
+		while (!g_sequence_iter_is_end (ptr)) {
+			g_ptr_array_add (resort->entries, rhythmdb_entry_ref (g_sequence_get (ptr)));
+			ptr = g_sequence_iter_next (ptr);
+		}
+
+		/* the runs share the database's worker threads, so only a
+		 * few are sorted at once, and shutdown waits for them.
+		 */
+		resort->n_runs = (length + RESORT_RUN_ENTRIES - 1) / RESORT_RUN_ENTRIES;
+		resort->runs = g_new0 (RhythmDBQueryModelResortRun, resort->n_runs);
+		resort->runs_remaining = resort->n_runs;
+		for (i = 0; i < resort->n_runs; i++) {
+			resort->runs[i].resort = resort;
+			resort->runs[i].start = i * RESORT_RUN_ENTRIES;
+			resort->runs[i].length = MIN (RESORT_RUN_ENTRIES, length - resort->runs[i].start);
+		}
+
+		model->priv->resort = resort;
+		for (i = 0; i < resort->n_runs; i++) {
+			rhythmdb_push_worker_job (model->priv->db,
+						  (GThreadFunc) rhythmdb_query_model_resort_run,
+						  &resort->runs[i]);
+		}
+		return;
+	}
+
 	if (model->priv->sort_data_destroy && model->priv->sort_data)
 		model->priv->sort_data_destroy (model->priv->sort_data);
 
@@ -2569,7 +3490,6 @@ rhythmdb_query_model_set_sort_order (RhythmDBQueryModel *model,
 	}
 
 	/* create the new sorted entry sequence */
-	length = g_sequence_get_length (model->priv->entries);
 	if (length > 0) {
 		new_entries = g_sequence_new (NULL);
 		ptr = g_sequence_get_begin_iter (model->priv->entries);
@@ -2659,6 +3579,8 @@ rhythmdb_query_model_base_row_inserted (GtkTreeModel *tree_model,
 	if (!model->priv->show_hidden && rhythmdb_entry_get_boolean (entry, RHYTHMDB_PROP_HIDDEN))
 		goto out;
 
+	rhythmdb_query_model_schedule_expiry (model, entry, 0);
+
 	if (rhythmdb_evaluate_query (model->priv->db, model->priv->query, entry)) {
 		/* find the closest previous entry that is in the filter model, and it it after that */
 		prev_entry = rhythmdb_query_model_get_previous_from_entry (base_model, entry);
@@ -2835,6 +3757,48 @@ rhythmdb_query_model_reapply_query (RhythmDBQueryModel *model,
 		rhythmdb_query_model_update_limited_entries (model);
 }
 
+/**
+ * rhythmdb_query_model_refine_query:
+ * @model: a #RhythmDBQueryModel
+ * @query: the new query
+ *
+ * If @query is known to match a subset of the entries matched by the
+ * model's current query (see #rhythmdb_query_is_subset), replaces the
+ * model's query with @query and removes the entries that no longer
+ * match.  This avoids re-running the query when a search is refined,
+ * as no entries can be added.
+ *
+ * Return value: %TRUE if the model was refined, %FALSE if a new query
+ * is required.
+ */
+gboolean
+rhythmdb_query_model_refine_query (RhythmDBQueryModel *model,
+				   GPtrArray *query)
+{
+	GPtrArray *processed;
+	gboolean subset;
+
+	/* results that are still on their way in were matched against
+	 * the old query, and won't be checked against the new one.
+	 */
+	if (model->priv->query == NULL ||
+	    g_atomic_int_get (&model->priv->pending_update_count) > 0)
+		return FALSE;
+
+	processed = rhythmdb_query_copy (query);
+	rhythmdb_query_preprocess (model->priv->db, processed);
+	subset = rhythmdb_query_is_subset (model->priv->db, processed, model->priv->query);
+	rhythmdb_query_free (processed);
+
+	if (subset == FALSE)
+		return FALSE;
+
+	rb_debug ("refining query model %p in place", model);
+	g_object_set (model, "query", query, NULL);
+	rhythmdb_query_model_reapply_query (model, TRUE);
+	return TRUE;
+}
+
 static gint
 _reverse_sorting_func (gpointer a,
 		       gpointer b,
@@ -2843,6 +3807,17 @@ _reverse_sorting_func (gpointer a,
 	return - reverse_data->func (a, b, reverse_data->data);
 }
 
+static gint
+_chunk_sorting_func (RhythmDBEntry **a,
+		     RhythmDBEntry **b,
+		     RhythmDBQueryModel *model)
+{
+	gint ret;
+
+	ret = model->priv->sort_func (*a, *b, model->priv->sort_data);
+	return model->priv->sort_reverse ? -ret : ret;
+}
+
 /**
  * rhythmdb_query_model_location_sort_func:
  * @a: a #RhythmDBEntry
@@ -2930,62 +3905,8 @@ rhythmdb_query_model_album_sort_func (RhythmDBEntry *a,
 				      RhythmDBEntry *b,
 				      gpointer data)
 {
-	const char *a_val;
-	const char *b_val;
-	gulong a_num;
-	gulong b_num;
-	gint ret;
-
-	/* Sort by album name */
-	a_val = rhythmdb_entry_get_string (a, RHYTHMDB_PROP_ALBUM_SORTNAME_SORT_KEY);
-	if (a_val[0] == '\0') {
-		a_val = rhythmdb_entry_get_string (a, RHYTHMDB_PROP_ALBUM_SORT_KEY);
-	}
-	b_val = rhythmdb_entry_get_string (b, RHYTHMDB_PROP_ALBUM_SORTNAME_SORT_KEY);
-	if (b_val[0] == '\0') {
-		b_val = rhythmdb_entry_get_string (b, RHYTHMDB_PROP_ALBUM_SORT_KEY);
-	}
-
-	if (a_val == NULL) {
-		if (b_val == NULL)
-			ret = 0;
-		else
-			ret = -1;
-	} else if (b_val == NULL)
-		ret = 1;
-	else
-		ret = strcmp (a_val, b_val);
-
-	if (ret != 0)
-		return ret;
-
-	/* Then by disc number (assume 1 if non-existent) */
-	a_num = rhythmdb_entry_get_ulong (a, RHYTHMDB_PROP_DISC_NUMBER);
-	b_num = rhythmdb_entry_get_ulong (b, RHYTHMDB_PROP_DISC_NUMBER);
-	a_num = (a_num ? a_num : 1);
-	b_num = (b_num ? b_num : 1);
-	if (a_num != b_num)
-		return (a_num < b_num ? -1 : 1);
-
-	/* by track number (assume 0 if non-existent) */
-	a_num = rhythmdb_entry_get_ulong (a, RHYTHMDB_PROP_TRACK_NUMBER);
-	b_num = rhythmdb_entry_get_ulong (b, RHYTHMDB_PROP_TRACK_NUMBER);
-	if (a_num != b_num)
-		return (a_num < b_num ? -1 : 1);
-
-	/*  by title */
-	a_val = rhythmdb_entry_get_string (a, RHYTHMDB_PROP_TITLE_SORT_KEY);
-	b_val = rhythmdb_entry_get_string (b, RHYTHMDB_PROP_TITLE_SORT_KEY);
-
-	if (a_val == NULL) {
-		if (b_val == NULL)
-			return 0;
-		else
-			return -1;
-	} else if (b_val == NULL)
-		return 1;
-	else
-		return rhythmdb_query_model_location_sort_func (a, b, data);
+	return strcmp (rhythmdb_entry_get_sort_order_key (a, RHYTHMDB_SORT_ORDER_ALBUM),
+		       rhythmdb_entry_get_sort_order_key (b, RHYTHMDB_SORT_ORDER_ALBUM));
 }
 
 /**
@@ -3004,33 +3925,8 @@ rhythmdb_query_model_artist_sort_func (RhythmDBEntry *a,
 				       RhythmDBEntry *b,
 				       gpointer data)
 {
-	const char *a_val;
-	const char *b_val;
-	gint ret;
-
-	a_val = rhythmdb_entry_get_string (a, RHYTHMDB_PROP_ARTIST_SORTNAME_SORT_KEY);
-	if (a_val[0] == '\0') {
-		a_val = rhythmdb_entry_get_string (a, RHYTHMDB_PROP_ARTIST_SORT_KEY);
-	}
-	b_val = rhythmdb_entry_get_string (b, RHYTHMDB_PROP_ARTIST_SORTNAME_SORT_KEY);
-	if (b_val[0] == '\0') {
-		b_val = rhythmdb_entry_get_string (b, RHYTHMDB_PROP_ARTIST_SORT_KEY);
-	}
-
-	if (a_val == NULL) {
-		if (b_val == NULL)
-			ret = 0;
-		else
-			ret = -1;
-	} else if (b_val == NULL)
-		ret = 1;
-	else
-		ret = strcmp (a_val, b_val);
-
-	if (ret != 0)
-		return ret;
-	else
-		return rhythmdb_query_model_album_sort_func (a, b, data);
+	return strcmp (rhythmdb_entry_get_sort_order_key (a, RHYTHMDB_SORT_ORDER_ARTIST),
+		       rhythmdb_entry_get_sort_order_key (b, RHYTHMDB_SORT_ORDER_ARTIST));
 }
 
 /**
@@ -3048,27 +3944,8 @@ gint
 rhythmdb_query_model_genre_sort_func (RhythmDBEntry *a, RhythmDBEntry *b,
 				      gpointer data)
 {
-	const char *a_val;
-	const char *b_val;
-	gint ret;
-
-	a_val = rhythmdb_entry_get_string (a, RHYTHMDB_PROP_GENRE_SORT_KEY);
-	b_val = rhythmdb_entry_get_string (b, RHYTHMDB_PROP_GENRE_SORT_KEY);
-
-	if (a_val == NULL) {
-		if (b_val == NULL)
-			ret = 0;
-		else
-			ret = -1;
-	} else if (b_val == NULL)
-		ret = 1;
-	else
-		ret = strcmp (a_val, b_val);
-
-	if (ret != 0)
-		return ret;
-	else
-		return rhythmdb_query_model_artist_sort_func (a, b, data);
+	return strcmp (rhythmdb_entry_get_sort_order_key (a, RHYTHMDB_SORT_ORDER_GENRE),
+		       rhythmdb_entry_get_sort_order_key (b, RHYTHMDB_SORT_ORDER_GENRE));
 }
 
 /**
@@ -3262,8 +4139,10 @@ rhythmdb_query_model_string_sort_func (RhythmDBEntry *a,
 }
 
 static gboolean
-rhythmdb_query_model_within_limit (RhythmDBQueryModel *model,
-				   RhythmDBEntry *entry)
+rhythmdb_query_model_totals_within_limit (RhythmDBQueryModel *model,
+					  gulong count,
+					  guint64 size,
+					  gulong duration)
 {
 	gboolean result = TRUE;
 
@@ -3275,46 +4154,29 @@ rhythmdb_query_model_within_limit (RhythmDBQueryModel *model,
 	case RHYTHMDB_QUERY_MODEL_LIMIT_COUNT:
 		{
 			gulong limit_count;
-			gulong current_count;
 
 			limit_count = g_value_get_ulong (g_value_array_get_nth (model->priv->limit_value, 0));
-			current_count = g_hash_table_size (model->priv->reverse_map);
-
-			if (entry)
-				current_count++;
-
-			result = (current_count <= limit_count);
+			result = (count <= limit_count);
 			break;
 		}
 
 	case RHYTHMDB_QUERY_MODEL_LIMIT_SIZE:
 		{
 			guint64 limit_size;
-			guint64 current_size;
 
 			limit_size = g_value_get_uint64 (g_value_array_get_nth (model->priv->limit_value, 0));
-			current_size = model->priv->total_size;
-
-			if (entry)
-				current_size += rhythmdb_entry_get_uint64 (entry, RHYTHMDB_PROP_FILE_SIZE);
 
 			/* the limit is in MB */
-			result = (current_size / (1024 * 1024) <= limit_size);
+			result = (size / (1024 * 1024) <= limit_size);
 			break;
 		}
 
 	case RHYTHMDB_QUERY_MODEL_LIMIT_TIME:
 		{
 			gulong limit_time;
-			gulong current_time;
 
 			limit_time = g_value_get_ulong (g_value_array_get_nth (model->priv->limit_value, 0));
-			current_time = model->priv->total_duration;
-
-			if (entry)
-				current_time += rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_DURATION);
-
-			result = (current_time <= limit_time);
+			result = (duration <= limit_time);
 			break;
 		}
 	}
@@ -3322,6 +4184,27 @@ rhythmdb_query_model_within_limit (RhythmDBQueryModel *model,
 	return result;
 }
 
+static gboolean
+rhythmdb_query_model_within_limit (RhythmDBQueryModel *model,
+				   RhythmDBEntry *entry)
+{
+	gulong count;
+	guint64 size;
+	gulong duration;
+
+	count = g_hash_table_size (model->priv->reverse_map);
+	size = model->priv->total_size;
+	duration = model->priv->total_duration;
+
+	if (entry) {
+		count++;
+		size += rhythmdb_entry_get_uint64 (entry, RHYTHMDB_PROP_FILE_SIZE);
+		duration += rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_DURATION);
+	}
+
+	return rhythmdb_query_model_totals_within_limit (model, count, size, duration);
+}
+
 /* This should really be standard. */
 #define ENUM_ENTRY(NAME, DESC) { NAME, "" #NAME "", DESC }
 
@@ -3348,14 +4231,275 @@ rhythmdb_query_model_limit_type_get_type (void)
 	return etype;
 }
 
+typedef struct {
+	gulong time;
+	RhythmDBEntry *entry;
+} RhythmDBQueryModelExpiry;
+
+static void
+expiry_heap_push (GArray *heap,
+		  gulong time,
+		  RhythmDBEntry *entry)
+{
+	RhythmDBQueryModelExpiry item;
+	RhythmDBQueryModelExpiry *items;
+	guint i;
+
+	item.time = time;
+	item.entry = entry;
+	g_array_append_val (heap, item);
+
+	items = (RhythmDBQueryModelExpiry *) heap->data;
+	i = heap->len - 1;
+	while (i > 0 && items[(i - 1) / 2].time > time) {
+		items[i] = items[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	items[i] = item;
+}
+
+static RhythmDBQueryModelExpiry
+expiry_heap_pop (GArray *heap)
+{
+	RhythmDBQueryModelExpiry *items;
+	RhythmDBQueryModelExpiry top;
+	RhythmDBQueryModelExpiry last;
+	guint i, child;
+
+	items = (RhythmDBQueryModelExpiry *) heap->data;
+	top = items[0];
+	last = items[heap->len - 1];
+	g_array_set_size (heap, heap->len - 1);
+
+	items = (RhythmDBQueryModelExpiry *) heap->data;
+	i = 0;
+	while (heap->len > 0) {
+		child = (2 * i) + 1;
+		if (child >= heap->len)
+			break;
+		if (child + 1 < heap->len && items[child + 1].time < items[child].time)
+			child++;
+		if (items[child].time >= last.time)
+			break;
+
+		items[i] = items[child];
+		i = child;
+	}
+	if (heap->len > 0)
+		items[i] = last;
+
+	return top;
+}
+
+static void
+_rebuild_expiry_heap_cb (RhythmDBEntry *entry,
+			 gpointer expiry,
+			 GArray *heap)
+{
+	expiry_heap_push (heap, GPOINTER_TO_SIZE (expiry), entry);
+}
+
+static gboolean rhythmdb_query_model_expiry_cb (RhythmDBQueryModel *model);
+
+static void
+rhythmdb_query_model_update_expiry_timeout (RhythmDBQueryModel *model,
+					    gulong now)
+{
+	RhythmDBQueryModelExpiry *items;
+
+	if (model->priv->expiry_heap->len == 0) {
+		if (model->priv->expiry_timeout_id != 0) {
+			g_source_remove (model->priv->expiry_timeout_id);
+			model->priv->expiry_timeout_id = 0;
+		}
+		return;
+	}
+
+	items = (RhythmDBQueryModelExpiry *) model->priv->expiry_heap->data;
+	if (model->priv->expiry_timeout_id != 0) {
+		if (model->priv->expiry_timeout_time <= items[0].time)
+			return;
+		g_source_remove (model->priv->expiry_timeout_id);
+	}
+
+	model->priv->expiry_timeout_time = items[0].time;
+	model->priv->expiry_timeout_id =
+		g_timeout_add_seconds ((items[0].time > now) ? (items[0].time - now) : 1,
+				       (GSourceFunc) rhythmdb_query_model_expiry_cb,
+				       model);
+}
+
+static void
+rhythmdb_query_model_schedule_expiry (RhythmDBQueryModel *model,
+				      RhythmDBEntry *entry,
+				      gulong now)
+{
+	gpointer current;
+	gulong expiry;
+
+	if (model->priv->expiry_map == NULL)
+		return;
+
+	if (now == 0) {
+		GTimeVal current_time;
+
+		g_get_current_time (&current_time);
+		now = current_time.tv_sec;
+	}
+
+	expiry = rhythmdb_query_get_expiry_time (model->priv->db, model->priv->query, entry, now);
+	if (g_hash_table_lookup_extended (model->priv->expiry_map, entry, NULL, &current)) {
+		if (GPOINTER_TO_SIZE (current) == expiry)
+			return;
+		if (expiry == 0) {
+			/* the heap item is skipped when it comes up */
+			g_hash_table_remove (model->priv->expiry_map, entry);
+			return;
+		}
+	} else if (expiry == 0) {
+		return;
+	}
+
+	g_hash_table_replace (model->priv->expiry_map,
+			      rhythmdb_entry_ref (entry),
+			      GSIZE_TO_POINTER (expiry));
+
+	/* drop outdated heap items once they outnumber the live ones */
+	if (model->priv->expiry_heap->len > (2 * g_hash_table_size (model->priv->expiry_map)) + 64) {
+		g_array_set_size (model->priv->expiry_heap, 0);
+		g_hash_table_foreach (model->priv->expiry_map,
+				      (GHFunc) _rebuild_expiry_heap_cb,
+				      model->priv->expiry_heap);
+	} else {
+		expiry_heap_push (model->priv->expiry_heap, expiry, entry);
+	}
+
+	rhythmdb_query_model_update_expiry_timeout (model, now);
+}
+
+static void
+rhythmdb_query_model_expire_entry (RhythmDBQueryModel *model,
+				   RhythmDBEntry *entry,
+				   gulong now)
+{
+	if (g_hash_table_lookup (model->priv->reverse_map, entry) == NULL &&
+	    g_hash_table_lookup (model->priv->limited_reverse_map, entry) == NULL) {
+		/* this checks whether the entry matches now, and
+		 * when it needs to be checked again.
+		 */
+		rhythmdb_query_model_entry_added_cb (model->priv->db, entry, model);
+		return;
+	}
+
+	if (!rhythmdb_evaluate_query (model->priv->db, model->priv->query, entry)) {
+		rb_debug ("entry %s no longer matches the query",
+			  rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LOCATION));
+		if (g_hash_table_lookup (model->priv->reverse_map, entry) != NULL) {
+			g_signal_emit (G_OBJECT (model),
+				       rhythmdb_query_model_signals[ENTRY_REMOVED], 0,
+				       entry);
+		}
+		rhythmdb_query_model_filter_out_entry (model, entry);
+	}
+
+	rhythmdb_query_model_schedule_expiry (model, entry, now);
+}
+
 static gboolean
-rhythmdb_query_model_reapply_query_cb (RhythmDBQueryModel *model)
+rhythmdb_query_model_expiry_cb (RhythmDBQueryModel *model)
 {
+	RhythmDBQueryModelExpiry item;
+	GTimeVal current_time;
+	gpointer expiry;
+
 	GDK_THREADS_ENTER ();
-	rhythmdb_query_model_reapply_query (model, FALSE);
-	rhythmdb_do_full_query_async_parsed (model->priv->db,
-					     RHYTHMDB_QUERY_RESULTS (model),
-					     model->priv->original_query);
+
+	model->priv->expiry_timeout_id = 0;
+	g_get_current_time (&current_time);
+
+	/* the heap goes away if a signal handler changes the query */
+	while (model->priv->expiry_heap != NULL && model->priv->expiry_heap->len > 0) {
+		item = g_array_index (model->priv->expiry_heap, RhythmDBQueryModelExpiry, 0);
+		if (item.time > current_time.tv_sec)
+			break;
+
+		expiry_heap_pop (model->priv->expiry_heap);
+		if (!g_hash_table_lookup_extended (model->priv->expiry_map, item.entry, NULL, &expiry) ||
+		    GPOINTER_TO_SIZE (expiry) != item.time) {
+			/* rescheduled or dropped since this was queued */
+			continue;
+		}
+
+		rhythmdb_entry_ref (item.entry);
+		g_hash_table_remove (model->priv->expiry_map, item.entry);
+		rhythmdb_query_model_expire_entry (model, item.entry, current_time.tv_sec);
+		rhythmdb_entry_unref (item.entry);
+	}
+
+	if (model->priv->expiry_heap != NULL)
+		rhythmdb_query_model_update_expiry_timeout (model, current_time.tv_sec);
+
 	GDK_THREADS_LEAVE ();
-	return TRUE;
+	return FALSE;
+}
+
+static void
+rhythmdb_query_model_clear_expiry (RhythmDBQueryModel *model)
+{
+	if (model->priv->expiry_timeout_id != 0) {
+		g_source_remove (model->priv->expiry_timeout_id);
+		model->priv->expiry_timeout_id = 0;
+	}
+
+	if (model->priv->expiry_map != NULL) {
+		g_hash_table_destroy (model->priv->expiry_map);
+		model->priv->expiry_map = NULL;
+	}
+
+	if (model->priv->expiry_heap != NULL) {
+		g_array_free (model->priv->expiry_heap, TRUE);
+		model->priv->expiry_heap = NULL;
+	}
+}
+
+typedef struct {
+	RhythmDBQueryModel *model;
+	gulong now;
+} _ScheduleExpiryForeachData;
+
+static void
+_schedule_expiry_foreach_cb (RhythmDBEntry *entry,
+			     _ScheduleExpiryForeachData *data)
+{
+	rhythmdb_query_model_schedule_expiry (data->model, entry, data->now);
+}
+
+static void
+rhythmdb_query_model_reset_expiry (RhythmDBQueryModel *model)
+{
+	_ScheduleExpiryForeachData data;
+	GTimeVal current_time;
+
+	rhythmdb_query_model_clear_expiry (model);
+
+	if (!rhythmdb_query_is_time_relative (model->priv->db, model->priv->query))
+		return;
+
+	model->priv->expiry_map = g_hash_table_new_full (g_direct_hash,
+							 g_direct_equal,
+							 (GDestroyNotify)rhythmdb_entry_unref,
+							 NULL);
+	model->priv->expiry_heap = g_array_new (FALSE, FALSE, sizeof (RhythmDBQueryModelExpiry));
+
+	/* entries that will never be checked otherwise, because they
+	 * don't match yet, have to be found now.  entries that appear or
+	 * change later are scheduled as that happens.
+	 */
+	g_get_current_time (&current_time);
+	data.model = model;
+	data.now = current_time.tv_sec;
+	rhythmdb_entry_foreach (model->priv->db, (GFunc) _schedule_expiry_foreach_cb, &data);
+
+	rb_debug ("%u entries in query model %p may expire",
+		  g_hash_table_size (model->priv->expiry_map), model);
 }
@@ -152,6 +152,9 @@ void			rhythmdb_query_model_set_sort_order	(RhythmDBQueryModel *model,
 void			rhythmdb_query_model_reapply_query	(RhythmDBQueryModel *model,
 								 gboolean filter);
 
+gboolean		rhythmdb_query_model_refine_query	(RhythmDBQueryModel *model,
+								 GPtrArray *query);
+
 gint 			rhythmdb_query_model_location_sort_func (RhythmDBEntry *a,
                                                                  RhythmDBEntry *b,
 								 gpointer data);
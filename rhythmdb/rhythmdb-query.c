@@ -908,6 +908,297 @@ rhythmdb_query_is_time_relative (RhythmDB *db, GPtrArray *query)
 	return FALSE;
 }
 
+/**
+ * rhythmdb_query_get_expiry_time
+ * @db: the #RhythmDB
+ * @query: the query to check
+ * @entry: a #RhythmDBEntry
+ * @now: the current time
+ *
+ * Finds the next time after @now at which one of the time-relative
+ * criteria in the query changes its result for @entry.  The entry can
+ * only start or stop matching the query at one of these times, so there
+ * is no need to evaluate it again before then.
+ *
+ * Return value: the time, or 0 if the entry's time-relative criteria
+ * will not change
+ */
+gulong
+rhythmdb_query_get_expiry_time (RhythmDB *db,
+				GPtrArray *query,
+				RhythmDBEntry *entry,
+				gulong now)
+{
+	gulong expiry = 0;
+	gulong t;
+	int i;
+
+	if (query == NULL)
+		return 0;
+
+	for (i=0; i < query->len; i++) {
+		RhythmDBQueryData *data = g_ptr_array_index (query, i);
+
+		if (data->subquery) {
+			t = rhythmdb_query_get_expiry_time (db, data->subquery, entry, now);
+			if (t != 0 && (expiry == 0 || t < expiry))
+				expiry = t;
+			continue;
+		}
+
+		switch (data->type) {
+		case RHYTHMDB_QUERY_PROP_CURRENT_TIME_WITHIN:
+		case RHYTHMDB_QUERY_PROP_CURRENT_TIME_NOT_WITHIN:
+			/* both turn over once the value is more than the
+			 * relative time in the past.
+			 */
+			t = rhythmdb_entry_get_ulong (entry, data->propid) + g_value_get_ulong (data->val) + 1;
+			if (t > now && (expiry == 0 || t < expiry))
+				expiry = t;
+			break;
+		default:
+			break;
+		}
+	}
+
+	return expiry;
+}
+
+static GList *
+query_split_disjunctions (GPtrArray *query)
+{
+	GList *conjunctions = NULL;
+	GPtrArray *conjunction;
+	guint i;
+
+	conjunction = g_ptr_array_new ();
+	for (i = 0; i < query->len; i++) {
+		RhythmDBQueryData *data = g_ptr_array_index (query, i);
+
+		if (data->type == RHYTHMDB_QUERY_DISJUNCTION) {
+			conjunctions = g_list_prepend (conjunctions, conjunction);
+			conjunction = g_ptr_array_new ();
+		} else {
+			g_ptr_array_add (conjunction, data);
+		}
+	}
+	conjunctions = g_list_prepend (conjunctions, conjunction);
+
+	return conjunctions;
+}
+
+static gboolean
+query_values_compare (const GValue *a, const GValue *b, int *result)
+{
+	if (G_VALUE_TYPE (a) != G_VALUE_TYPE (b))
+		return FALSE;
+
+	switch (G_VALUE_TYPE (a)) {
+	case G_TYPE_ULONG:
+		*result = (g_value_get_ulong (a) > g_value_get_ulong (b)) - (g_value_get_ulong (a) < g_value_get_ulong (b));
+		return TRUE;
+	case G_TYPE_UINT64:
+		*result = (g_value_get_uint64 (a) > g_value_get_uint64 (b)) - (g_value_get_uint64 (a) < g_value_get_uint64 (b));
+		return TRUE;
+	case G_TYPE_DOUBLE:
+		*result = (g_value_get_double (a) > g_value_get_double (b)) - (g_value_get_double (a) < g_value_get_double (b));
+		return TRUE;
+	case G_TYPE_BOOLEAN:
+		*result = (g_value_get_boolean (a) != g_value_get_boolean (b));
+		return TRUE;
+	case G_TYPE_POINTER:
+		*result = (g_value_get_pointer (a) != g_value_get_pointer (b));
+		return TRUE;
+	case G_TYPE_STRING:
+		if (g_value_get_string (a) == NULL || g_value_get_string (b) == NULL)
+			return FALSE;
+		*result = strcmp (g_value_get_string (a), g_value_get_string (b));
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+static gboolean
+search_words_imply (char **words, char **base_words)
+{
+	int i, j;
+
+	/* each word matches a substring of some property, so each word in the
+	 * base query must be contained in one of the words in the new query.
+	 */
+	for (j = 0; base_words[j] != NULL; j++) {
+		gboolean found = FALSE;
+
+		for (i = 0; words[i] != NULL; i++) {
+			if (strstr (words[i], base_words[j]) != NULL) {
+				found = TRUE;
+				break;
+			}
+		}
+		if (!found)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static gboolean
+query_data_implies (RhythmDBQueryData *data, RhythmDBQueryData *base)
+{
+	const char *value;
+	const char *base_value;
+	int cmp;
+
+	if (data->propid != base->propid)
+		return FALSE;
+
+	if (data->type == base->type &&
+	    query_values_compare (data->val, base->val, &cmp) && cmp == 0)
+		return TRUE;
+
+	if (data->propid == RHYTHMDB_PROP_SEARCH_MATCH) {
+		if (data->type == RHYTHMDB_QUERY_PROP_LIKE &&
+		    base->type == RHYTHMDB_QUERY_PROP_LIKE &&
+		    G_VALUE_HOLDS (data->val, G_TYPE_STRV) &&
+		    G_VALUE_HOLDS (base->val, G_TYPE_STRV))
+			return search_words_imply (g_value_get_boxed (data->val), g_value_get_boxed (base->val));
+		return FALSE;
+	}
+
+	if (data->propid == RHYTHMDB_PROP_KEYWORD)
+		return FALSE;
+
+	if (G_VALUE_HOLDS_STRING (data->val) && G_VALUE_HOLDS_STRING (base->val)) {
+		value = g_value_get_string (data->val);
+		base_value = g_value_get_string (base->val);
+		if (value == NULL || base_value == NULL)
+			return FALSE;
+
+		switch (base->type) {
+		case RHYTHMDB_QUERY_PROP_LIKE:
+			return ((data->type == RHYTHMDB_QUERY_PROP_LIKE ||
+				 data->type == RHYTHMDB_QUERY_PROP_EQUALS ||
+				 data->type == RHYTHMDB_QUERY_PROP_PREFIX ||
+				 data->type == RHYTHMDB_QUERY_PROP_SUFFIX) &&
+				strstr (value, base_value) != NULL);
+		case RHYTHMDB_QUERY_PROP_NOT_LIKE:
+			return (data->type == RHYTHMDB_QUERY_PROP_NOT_LIKE &&
+				strstr (base_value, value) != NULL);
+		case RHYTHMDB_QUERY_PROP_PREFIX:
+			return ((data->type == RHYTHMDB_QUERY_PROP_PREFIX ||
+				 data->type == RHYTHMDB_QUERY_PROP_EQUALS) &&
+				g_str_has_prefix (value, base_value));
+		case RHYTHMDB_QUERY_PROP_SUFFIX:
+			return ((data->type == RHYTHMDB_QUERY_PROP_SUFFIX ||
+				 data->type == RHYTHMDB_QUERY_PROP_EQUALS) &&
+				g_str_has_suffix (value, base_value));
+		default:
+			return FALSE;
+		}
+	}
+
+	/* numeric ranges: a tighter bound implies a looser one */
+	if (!query_values_compare (data->val, base->val, &cmp) ||
+	    G_VALUE_HOLDS_BOOLEAN (data->val) ||
+	    G_VALUE_HOLDS_POINTER (data->val))
+		return FALSE;
+
+	switch (base->type) {
+	case RHYTHMDB_QUERY_PROP_GREATER:
+		return ((data->type == RHYTHMDB_QUERY_PROP_GREATER ||
+			 data->type == RHYTHMDB_QUERY_PROP_EQUALS) && cmp >= 0);
+	case RHYTHMDB_QUERY_PROP_LESS:
+		return ((data->type == RHYTHMDB_QUERY_PROP_LESS ||
+			 data->type == RHYTHMDB_QUERY_PROP_EQUALS) && cmp <= 0);
+	default:
+		return FALSE;
+	}
+}
+
+static gboolean
+conjunction_implies (GPtrArray *conjunction, RhythmDBQueryData *base)
+{
+	guint i;
+
+	/* a subquery is implied if the whole conjunction implies it */
+	if (base->type == RHYTHMDB_QUERY_SUBQUERY)
+		return rhythmdb_query_is_subset (NULL, conjunction, base->subquery);
+
+	for (i = 0; i < conjunction->len; i++) {
+		RhythmDBQueryData *data = g_ptr_array_index (conjunction, i);
+
+		if (data->type == RHYTHMDB_QUERY_SUBQUERY) {
+			GPtrArray *single;
+			gboolean implied;
+
+			single = g_ptr_array_new ();
+			g_ptr_array_add (single, base);
+			implied = rhythmdb_query_is_subset (NULL, data->subquery, single);
+			g_ptr_array_free (single, TRUE);
+			if (implied)
+				return TRUE;
+		} else if (query_data_implies (data, base)) {
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/**
+ * rhythmdb_query_is_subset:
+ * @db: the #RhythmDB
+ * @query: a query
+ * @base: the query to compare against
+ *
+ * Checks whether every entry matching @query must also match @base,
+ * for example because @query is @base with more search words or
+ * additional criteria.  The check is conservative: %FALSE means the
+ * subset relationship could not be proven, not that it doesn't hold.
+ * Both queries should have been preprocessed with
+ * #rhythmdb_query_preprocess.
+ *
+ * Return value: %TRUE if @query is known to match a subset of @base
+ */
+gboolean
+rhythmdb_query_is_subset (RhythmDB *db, GPtrArray *query, GPtrArray *base)
+{
+	GList *conjunctions;
+	GList *base_conjunctions;
+	GList *l, *bl;
+	gboolean subset = TRUE;
+
+	conjunctions = query_split_disjunctions (query);
+	base_conjunctions = query_split_disjunctions (base);
+
+	/* each alternative in the query must fall within one of the base alternatives */
+	for (l = conjunctions; l != NULL && subset; l = l->next) {
+		GPtrArray *conjunction = l->data;
+		gboolean found = FALSE;
+
+		for (bl = base_conjunctions; bl != NULL && !found; bl = bl->next) {
+			GPtrArray *base_conjunction = bl->data;
+			guint i;
+
+			found = TRUE;
+			for (i = 0; i < base_conjunction->len && found; i++) {
+				found = conjunction_implies (conjunction, g_ptr_array_index (base_conjunction, i));
+			}
+		}
+
+		subset = found;
+	}
+
+	for (l = conjunctions; l != NULL; l = l->next)
+		g_ptr_array_free (l->data, TRUE);
+	g_list_free (conjunctions);
+	for (l = base_conjunctions; l != NULL; l = l->next)
+		g_ptr_array_free (l->data, TRUE);
+	g_list_free (base_conjunctions);
+
+	return subset;
+}
+
 /**
  * rhythmdb_query_to_string:
  * @db: a #RhythmDB instance
@@ -54,6 +54,8 @@
 #include "rb-debug.h"
 #include "rb-util.h"
 #include "rb-file-helpers.h"
+#include "rb-preferences.h"
+#include "eel-gconf-extensions.h"
 
 typedef struct RhythmDBTreeProperty
 {
@@ -79,6 +81,8 @@ static gboolean rhythmdb_tree_entry_set (RhythmDB *db, RhythmDBEntry *entry,
 
 static void rhythmdb_tree_entry_delete (RhythmDB *db, RhythmDBEntry *entry);
 static void rhythmdb_tree_entry_delete_by_type (RhythmDB *adb, RhythmDBEntryType type);
+static void rhythmdb_tree_entry_delete_by_location_prefix (RhythmDB *adb, RhythmDBEntryType type,
+							    const char *prefix, GPtrArray *deleted);
 
 static RhythmDBEntry * rhythmdb_tree_entry_lookup_by_location (RhythmDB *db, RBRefString *uri);
 static RhythmDBEntry * rhythmdb_tree_entry_lookup_by_id (RhythmDB *db, gint id);
@@ -131,7 +135,36 @@ static void remove_entry_from_keywords (RhythmDBTree *db, RhythmDBEntry *entry);
 
 static GList *split_query_by_disjunctions (RhythmDBTree *db, GPtrArray *query);
 static gboolean evaluate_conjunctive_subquery (RhythmDBTree *db, GPtrArray *query,
-					       guint base, guint max, RhythmDBEntry *entry);
+					       guint base, guint max, RhythmDBEntry *entry,
+					       glong *now);
+
+static void mark_location_dirty (RhythmDBTree *db, RBRefString *location);
+static void mark_all_dirty (RhythmDBTree *db);
+static void rhythmdb_tree_sync_shards (RhythmDBTree *db);
+
+/* When sharding is enabled (CONF_LIBRARY_SHARD_DB), entries under each library
+ * location are stored in a separate file, so they can be loaded in parallel,
+ * saved independently, and left unloaded while the location is unavailable.
+ * Everything else stays in the main database file.
+ */
+typedef struct
+{
+	char *root;		/* library location URI, with trailing slash */
+	char *filename;
+	gboolean loading;
+	gboolean loaded;
+	gboolean dirty;
+} RhythmDBTreeShard;
+
+typedef struct
+{
+	RhythmDBTree *db;
+	char *filename;
+	char *root;		/* NULL for shard files that don't match a library location */
+	gboolean check_available;
+	char *reveal_mountpoint;	/* root of a newly added mount, or NULL */
+	GCancellable *cancel;
+} RhythmDBTreeShardLoad;
 
 struct RhythmDBTreePrivate
 {
@@ -149,6 +182,17 @@ struct RhythmDBTreePrivate
 	gboolean finalizing;
 
 	guint idle_load_id;
+
+	GMutex *shards_lock;	/* leaf lock, protects everything below */
+	GList *shards;
+	GList *stale_shard_files;
+	GList *mount_roots;	/* URIs of mounted volumes, kept up to date on the main thread */
+	gboolean main_dirty;
+	gboolean load_complete;
+
+	guint library_location_notify_id;
+	guint shard_db_notify_id;
+	GVolumeMonitor *volume_monitor;
 };
 
 typedef struct
@@ -196,6 +240,7 @@ rhythmdb_tree_class_init (RhythmDBTreeClass *klass)
 	rhythmdb_class->impl_entry_set = rhythmdb_tree_entry_set;
 	rhythmdb_class->impl_entry_delete = rhythmdb_tree_entry_delete;
 	rhythmdb_class->impl_entry_delete_by_type = rhythmdb_tree_entry_delete_by_type;
+	rhythmdb_class->impl_entry_delete_by_location_prefix = rhythmdb_tree_entry_delete_by_location_prefix;
 	rhythmdb_class->impl_lookup_by_location = rhythmdb_tree_entry_lookup_by_location;
 	rhythmdb_class->impl_lookup_by_id = rhythmdb_tree_entry_lookup_by_id;
 	rhythmdb_class->impl_entry_foreach = rhythmdb_tree_entry_foreach;
@@ -231,6 +276,8 @@ rhythmdb_tree_init (RhythmDBTree *db)
 						  NULL, (GDestroyNotify)g_hash_table_destroy);
 
 	db->priv->unknown_entry_types = g_hash_table_new (rb_refstring_hash, rb_refstring_equal);
+
+	db->priv->shards_lock = g_mutex_new ();
 }
 
 /* must be called with the genres lock held */
@@ -270,6 +317,151 @@ free_unknown_entries (RBRefString *name,
 	g_list_free (entries);
 }
 
+static char *
+get_shard_dir (RhythmDBTree *db)
+{
+	char *name;
+	char *dir;
+
+	g_object_get (G_OBJECT (db), "name", &name, NULL);
+	dir = g_strconcat (name, ".shards", NULL);
+	g_free (name);
+	return dir;
+}
+
+static RhythmDBTreeShard *
+shard_new (RhythmDBTree *db, const char *root)
+{
+	RhythmDBTreeShard *shard;
+	char *dir;
+	char *checksum;
+	char *basename;
+
+	shard = g_new0 (RhythmDBTreeShard, 1);
+	if (g_str_has_suffix (root, "/")) {
+		shard->root = g_strdup (root);
+	} else {
+		shard->root = g_strconcat (root, "/", NULL);
+	}
+
+	dir = get_shard_dir (db);
+	checksum = g_compute_checksum_for_string (G_CHECKSUM_MD5, shard->root, -1);
+	basename = g_strconcat (checksum, ".xml", NULL);
+	shard->filename = g_build_filename (dir, basename, NULL);
+	g_free (basename);
+	g_free (checksum);
+	g_free (dir);
+
+	return shard;
+}
+
+static void
+shard_free (RhythmDBTreeShard *shard)
+{
+	g_free (shard->root);
+	g_free (shard->filename);
+	g_free (shard);
+}
+
+/* must be called with the shards lock held */
+static RhythmDBTreeShard *
+find_shard_by_root (RhythmDBTree *db, const char *root)
+{
+	GList *l;
+
+	rb_assert_locked (db->priv->shards_lock);
+
+	for (l = db->priv->shards; l != NULL; l = l->next) {
+		RhythmDBTreeShard *shard = l->data;
+		if (strcmp (shard->root, root) == 0)
+			return shard;
+	}
+	return NULL;
+}
+
+/* must be called with the shards lock held */
+static RhythmDBTreeShard *
+find_shard_for_location (RhythmDBTree *db, const char *location)
+{
+	GList *l;
+	RhythmDBTreeShard *found = NULL;
+
+	rb_assert_locked (db->priv->shards_lock);
+
+	/* library locations may be nested, so use the longest match */
+	for (l = db->priv->shards; l != NULL; l = l->next) {
+		RhythmDBTreeShard *shard = l->data;
+		if (g_str_has_prefix (location, shard->root) &&
+		    (found == NULL || strlen (shard->root) > strlen (found->root))) {
+			found = shard;
+		}
+	}
+	return found;
+}
+
+static void
+mark_location_dirty (RhythmDBTree *db, RBRefString *location)
+{
+	RhythmDBTreeShard *shard = NULL;
+
+	g_mutex_lock (db->priv->shards_lock);
+	if (location != NULL)
+		shard = find_shard_for_location (db, rb_refstring_get (location));
+
+	/* entries added while the shard is loading belong to the shard too;
+	 * if the load doesn't succeed, the dirty state is moved to the main file.
+	 */
+	if (shard != NULL && (shard->loaded || shard->loading)) {
+		shard->dirty = TRUE;
+	} else {
+		db->priv->main_dirty = TRUE;
+	}
+	g_mutex_unlock (db->priv->shards_lock);
+}
+
+static void
+mark_all_dirty (RhythmDBTree *db)
+{
+	GList *l;
+
+	g_mutex_lock (db->priv->shards_lock);
+	for (l = db->priv->shards; l != NULL; l = l->next) {
+		RhythmDBTreeShard *shard = l->data;
+		if (shard->loaded)
+			shard->dirty = TRUE;
+	}
+	db->priv->main_dirty = TRUE;
+	g_mutex_unlock (db->priv->shards_lock);
+}
+
+/* must be called with the shards lock held */
+static void
+add_stale_shard_file (RhythmDBTree *db, const char *filename)
+{
+	rb_assert_locked (db->priv->shards_lock);
+
+	if (g_list_find_custom (db->priv->stale_shard_files, filename, (GCompareFunc) strcmp) == NULL) {
+		db->priv->stale_shard_files = g_list_prepend (db->priv->stale_shard_files, g_strdup (filename));
+	}
+}
+
+/* must be called with the shards lock held */
+static gboolean
+remove_stale_shard_file (RhythmDBTree *db, const char *filename)
+{
+	GList *l;
+
+	rb_assert_locked (db->priv->shards_lock);
+
+	l = g_list_find_custom (db->priv->stale_shard_files, filename, (GCompareFunc) strcmp);
+	if (l == NULL)
+		return FALSE;
+
+	g_free (l->data);
+	db->priv->stale_shard_files = g_list_delete_link (db->priv->stale_shard_files, l);
+	return TRUE;
+}
+
 static void
 rhythmdb_tree_finalize (GObject *object)
 {
@@ -303,6 +495,22 @@ rhythmdb_tree_finalize (GObject *object)
 			      NULL);
 	g_hash_table_destroy (db->priv->unknown_entry_types);
 
+	if (db->priv->library_location_notify_id != 0) {
+		eel_gconf_notification_remove (db->priv->library_location_notify_id);
+	}
+	if (db->priv->shard_db_notify_id != 0) {
+		eel_gconf_notification_remove (db->priv->shard_db_notify_id);
+	}
+	if (db->priv->volume_monitor != NULL) {
+		g_object_unref (db->priv->volume_monitor);
+	}
+
+	g_list_foreach (db->priv->shards, (GFunc) shard_free, NULL);
+	g_list_free (db->priv->shards);
+	rb_list_deep_free (db->priv->stale_shard_files);
+	rb_list_deep_free (db->priv->mount_roots);
+	g_mutex_free (db->priv->shards_lock);
+
 	G_OBJECT_CLASS (rhythmdb_tree_parent_class)->finalize (object);
 }
 
@@ -334,6 +542,11 @@ struct RhythmDBTreeLoadContext
 	guint canonicalise_uris : 1;
 	guint reload_all_metadata : 1;
 	guint update_podcasts : 1;
+
+	/* shard loading */
+	guint keep_existing : 1;
+	guint modified : 1;
+	const char *reveal_mountpoint;
 };
 
 /* Returns the version as an int, multiplied by 100,
@@ -537,6 +750,12 @@ rhythmdb_tree_parser_end_element (struct RhythmDBTreeLoadContext *ctx,
 			}
 		}
 
+		if (ctx->reveal_mountpoint != NULL && ctx->entry->mountpoint != NULL &&
+		    strcmp (rb_refstring_get (ctx->entry->mountpoint), ctx->reveal_mountpoint) == 0) {
+			/* the volume containing the entry has just been mounted */
+			ctx->entry->flags &= ~RHYTHMDB_ENTRY_HIDDEN;
+		}
+
 		if (ctx->entry->location != NULL && rb_refstring_get (ctx->entry->location)[0] != '\0') {
 			RhythmDBEntry *entry;
 
@@ -549,6 +768,14 @@ rhythmdb_tree_parser_end_element (struct RhythmDBTreeLoadContext *ctx,
 					rhythmdb_commit (RHYTHMDB (ctx->db));
 					ctx->batch_count = 0;
 				}
+			} else if (ctx->keep_existing) {
+				/* the main database file can only contain entries for a shard
+				 * if the shard couldn't be written, so its copy is newer.
+				 */
+				rb_debug ("dropping shard entry with duplicate location %s",
+					  rb_refstring_get (ctx->entry->location));
+				rhythmdb_entry_unref (ctx->entry);
+				ctx->modified = TRUE;
 			} else if (ctx->entry->type == RHYTHMDB_ENTRY_TYPE_PODCAST_POST &&
 				   entry->type == RHYTHMDB_ENTRY_TYPE_SONG) {
 				rb_debug ("found song entry with duplicate location for Podcast post %s. merging metadata",
@@ -720,15 +947,17 @@ rhythmdb_tree_parser_characters (struct RhythmDBTreeLoadContext *ctx,
 }
 
 static gboolean
-rhythmdb_tree_load (RhythmDB *rdb,
-		    GCancellable *cancel,
-		    GError **error)
+rhythmdb_tree_load_file (RhythmDBTree *db,
+			 const char *filename,
+			 gboolean shard,
+			 const char *reveal_mountpoint,
+			 GCancellable *cancel,
+			 gboolean *modified,
+			 GError **error)
 {
-	RhythmDBTree *db = RHYTHMDB_TREE (rdb);
 	xmlParserCtxtPtr ctxt;
 	xmlSAXHandlerPtr sax_handler;
 	struct RhythmDBTreeLoadContext *ctx;
-	char *name;
 	GError *local_error;
 	gboolean ret;
 
@@ -746,11 +975,11 @@ rhythmdb_tree_load (RhythmDB *rdb,
 	ctx->cancel = cancel;
 	ctx->buf = g_string_sized_new (RHYTHMDB_TREE_PARSER_INITIAL_BUFFER_SIZE);
 	ctx->error = &local_error;
+	ctx->keep_existing = shard;
+	ctx->reveal_mountpoint = reveal_mountpoint;
 
-	g_object_get (G_OBJECT (db), "name", &name, NULL);
-
-	if (g_file_test (name, G_FILE_TEST_EXISTS)) {
-		ctxt = xmlCreateFileParserCtxt (name);
+	if (g_file_test (filename, G_FILE_TEST_EXISTS)) {
+		ctxt = xmlCreateFileParserCtxt (filename);
 		ctx->xmlctx = ctxt;
 		xmlFree (ctxt->sax);
 		ctxt->userData = ctx;
@@ -763,6 +992,13 @@ rhythmdb_tree_load (RhythmDB *rdb,
 			rhythmdb_commit (RHYTHMDB (ctx->db));
 	}
 
+	if (modified != NULL) {
+		*modified = (ctx->modified ||
+			     ctx->canonicalise_uris ||
+			     ctx->reload_all_metadata ||
+			     ctx->update_podcasts);
+	}
+
 	ret = TRUE;
 	if (local_error != NULL) {
 		g_propagate_error (error, local_error);
@@ -770,20 +1006,307 @@ rhythmdb_tree_load (RhythmDB *rdb,
 	}
 
 	g_string_free (ctx->buf, TRUE);
-	g_free (name);
 	g_free (sax_handler);
 	g_free (ctx);
 
 	return ret;
 }
 
+static void
+rhythmdb_tree_shard_load_free (RhythmDBTreeShardLoad *load)
+{
+	g_free (load->filename);
+	g_free (load->root);
+	g_free (load->reveal_mountpoint);
+	g_free (load);
+}
+
+static gboolean
+uri_is_under_mount (const char *uri, const char *mount_root)
+{
+	gsize len;
+
+	len = strlen (mount_root);
+	if (len > 0 && mount_root[len - 1] == '/')
+		len--;
+
+	return (strncmp (uri, mount_root, len) == 0 &&
+		(uri[len] == '\0' || uri[len] == '/'));
+}
+
+/* Checks whether a library location can be read without blocking on it:
+ * locations on mounted volumes are available, remote locations that aren't
+ * on a mounted volume aren't, and local paths only need a stat.
+ * Locations that become available later are loaded from the mount-added
+ * handler.
+ */
+static gboolean
+location_is_available (RhythmDBTree *db, const char *uri)
+{
+	gboolean ret = FALSE;
+	GList *l;
+
+	g_mutex_lock (db->priv->shards_lock);
+	for (l = db->priv->mount_roots; l != NULL; l = l->next) {
+		if (uri_is_under_mount (uri, l->data)) {
+			ret = TRUE;
+			break;
+		}
+	}
+	g_mutex_unlock (db->priv->shards_lock);
+
+	if (ret == FALSE && g_str_has_prefix (uri, "file://")) {
+		char *path;
+
+		path = g_filename_from_uri (uri, NULL, NULL);
+		ret = (path != NULL && g_file_test (path, G_FILE_TEST_IS_DIR));
+		g_free (path);
+	}
+
+	return ret;
+}
+
+static gpointer
+rhythmdb_tree_load_shard (RhythmDBTreeShardLoad *load)
+{
+	RhythmDBTree *db = load->db;
+	RhythmDBTreeShard *shard = NULL;
+	GError *error = NULL;
+	gboolean modified = FALSE;
+	gboolean ret;
+
+	if (load->check_available && location_is_available (db, load->root) == FALSE) {
+		rb_debug ("library location %s is not available, leaving its shard unloaded", load->root);
+		g_mutex_lock (db->priv->shards_lock);
+		shard = find_shard_by_root (db, load->root);
+		if (shard != NULL) {
+			shard->loading = FALSE;
+			if (shard->dirty) {
+				shard->dirty = FALSE;
+				db->priv->main_dirty = TRUE;
+			}
+		}
+		g_mutex_unlock (db->priv->shards_lock);
+		return NULL;
+	}
+
+	rb_debug ("loading database shard %s (%s)", load->filename, load->root ? load->root : "orphaned");
+	ret = rhythmdb_tree_load_file (db, load->filename, TRUE, load->reveal_mountpoint, load->cancel, &modified, &error);
+	if (ret == FALSE) {
+		g_warning ("Couldn't load database shard %s: %s", load->filename, error->message);
+		g_error_free (error);
+	}
+
+	g_mutex_lock (db->priv->shards_lock);
+	if (load->root != NULL)
+		shard = find_shard_by_root (db, load->root);
+
+	if (shard != NULL) {
+		shard->loading = FALSE;
+		if (ret) {
+			shard->loaded = TRUE;
+			if (modified) {
+				shard->dirty = TRUE;
+				db->priv->main_dirty = TRUE;
+			}
+		} else if (shard->dirty) {
+			shard->dirty = FALSE;
+			db->priv->main_dirty = TRUE;
+		}
+	} else if (ret) {
+		/* the entries now belong in the main database file */
+		db->priv->main_dirty = TRUE;
+		add_stale_shard_file (db, load->filename);
+	}
+	g_mutex_unlock (db->priv->shards_lock);
+
+	return NULL;
+}
+
+static gpointer
+rhythmdb_tree_load_shard_thread_main (RhythmDBTreeShardLoad *load)
+{
+	RhythmDB *rdb = RHYTHMDB (load->db);
+
+	/* don't let a save run while the shard is half loaded */
+	g_mutex_lock (rdb->priv->saving_mutex);
+	rhythmdb_tree_load_shard (load);
+	g_mutex_unlock (rdb->priv->saving_mutex);
+
+	rhythmdb_tree_shard_load_free (load);
+	return NULL;
+}
+
+/* must be called with the shards lock held */
+static void
+rhythmdb_tree_load_shard_async (RhythmDBTree *db,
+				const char *filename,
+				RhythmDBTreeShard *shard,
+				gboolean check_available,
+				const char *reveal_mountpoint)
+{
+	RhythmDBTreeShardLoad *load;
+
+	rb_assert_locked (db->priv->shards_lock);
+
+	load = g_new0 (RhythmDBTreeShardLoad, 1);
+	load->db = db;
+	load->filename = g_strdup (filename);
+	load->check_available = (check_available && shard != NULL);
+	load->reveal_mountpoint = g_strdup (reveal_mountpoint);
+	load->cancel = RHYTHMDB (db)->priv->exiting;
+	if (shard != NULL) {
+		load->root = g_strdup (shard->root);
+		shard->loading = TRUE;
+	}
+
+	/* run on a database worker thread so shutdown waits for the load */
+	rhythmdb_push_worker_job (RHYTHMDB (db), (GThreadFunc) rhythmdb_tree_load_shard_thread_main, load);
+}
+
+static void
+rhythmdb_tree_load_shards (RhythmDBTree *db, GCancellable *cancel)
+{
+	GPtrArray *loads;
+	GList *threads = NULL;
+	GList *l;
+	GDir *dir;
+	char *dirname;
+	guint i;
+
+	loads = g_ptr_array_new ();
+
+	g_mutex_lock (db->priv->shards_lock);
+	for (l = db->priv->shards; l != NULL; l = l->next) {
+		RhythmDBTreeShard *shard = l->data;
+		RhythmDBTreeShardLoad *load;
+
+		if (g_file_test (shard->filename, G_FILE_TEST_EXISTS) == FALSE) {
+			/* new shard; any entries it should contain are in the main file */
+			shard->loaded = TRUE;
+			shard->dirty = TRUE;
+			db->priv->main_dirty = TRUE;
+			continue;
+		}
+
+		load = g_new0 (RhythmDBTreeShardLoad, 1);
+		load->db = db;
+		load->filename = g_strdup (shard->filename);
+		load->root = g_strdup (shard->root);
+		load->check_available = TRUE;
+		load->cancel = cancel;
+		shard->loading = TRUE;
+		g_ptr_array_add (loads, load);
+	}
+
+	/* load any shard files left over from locations that are no longer
+	 * configured (or from when sharding was enabled), so their entries
+	 * end up in the main file.
+	 */
+	dirname = get_shard_dir (db);
+	dir = g_dir_open (dirname, 0, NULL);
+	if (dir != NULL) {
+		const char *basename;
+
+		while ((basename = g_dir_read_name (dir)) != NULL) {
+			RhythmDBTreeShardLoad *load;
+			gboolean known = FALSE;
+			char *filename;
+
+			if (g_str_has_suffix (basename, ".xml") == FALSE)
+				continue;
+
+			filename = g_build_filename (dirname, basename, NULL);
+			for (l = db->priv->shards; l != NULL; l = l->next) {
+				if (strcmp (((RhythmDBTreeShard *)l->data)->filename, filename) == 0) {
+					known = TRUE;
+					break;
+				}
+			}
+
+			if (known) {
+				g_free (filename);
+				continue;
+			}
+
+			load = g_new0 (RhythmDBTreeShardLoad, 1);
+			load->db = db;
+			load->filename = filename;
+			load->cancel = cancel;
+			g_ptr_array_add (loads, load);
+		}
+		g_dir_close (dir);
+	}
+	g_free (dirname);
+	g_mutex_unlock (db->priv->shards_lock);
+
+	/* the parser contexts are independent, so the shards can be parsed concurrently */
+	xmlInitParser ();
+	for (i = 0; i < loads->len; i++) {
+		GThread *thread;
+
+		thread = g_thread_create ((GThreadFunc) rhythmdb_tree_load_shard,
+					  g_ptr_array_index (loads, i),
+					  TRUE, NULL);
+		if (thread != NULL) {
+			threads = g_list_prepend (threads, thread);
+		} else {
+			rhythmdb_tree_load_shard (g_ptr_array_index (loads, i));
+		}
+	}
+
+	for (l = threads; l != NULL; l = l->next) {
+		g_thread_join (l->data);
+	}
+	g_list_free (threads);
+
+	g_ptr_array_foreach (loads, (GFunc) rhythmdb_tree_shard_load_free, NULL);
+	g_ptr_array_free (loads, TRUE);
+}
+
+static gboolean
+rhythmdb_tree_load (RhythmDB *rdb,
+		    GCancellable *cancel,
+		    GError **error)
+{
+	RhythmDBTree *db = RHYTHMDB_TREE (rdb);
+	gboolean modified = FALSE;
+	gboolean ret;
+	char *name;
+
+	g_object_get (G_OBJECT (db), "name", &name, NULL);
+	ret = rhythmdb_tree_load_file (db, name, FALSE, NULL, cancel, &modified, error);
+	g_free (name);
+
+	if (ret && g_cancellable_is_cancelled (cancel) == FALSE) {
+		rhythmdb_tree_load_shards (db, cancel);
+	}
+
+	g_mutex_lock (db->priv->shards_lock);
+	if (modified)
+		db->priv->main_dirty = TRUE;
+	db->priv->load_complete = TRUE;
+	g_mutex_unlock (db->priv->shards_lock);
+
+	return ret;
+}
+
 struct RhythmDBTreeSaveContext
 {
 	RhythmDBTree *db;
 	FILE *handle;
 	char *error;
+	GPtrArray *shards;	/* RhythmDBTreeSaveShard, only set on the main context */
 };
 
+typedef struct
+{
+	char *root;
+	char *filename;
+	gboolean write;
+	struct RhythmDBTreeSaveContext ctx;
+} RhythmDBTreeSaveShard;
+
 #ifdef HAVE_GNU_FWRITE_UNLOCKED
 #define RHYTHMDB_FWRITE_REAL fwrite_unlocked
 #define RHYTHMDB_FPUTC_REAL fputc_unlocked
@@ -927,9 +1450,9 @@ save_entry_double (struct RhythmDBTreeSaveContext *ctx,
  * readability cost.  Sorry about that.
  */
 static void
-save_entry (RhythmDBTree *db,
-	    RhythmDBEntry *entry,
-	    struct RhythmDBTreeSaveContext *ctx)
+write_entry (RhythmDBTree *db,
+	     RhythmDBEntry *entry,
+	     struct RhythmDBTreeSaveContext *ctx)
 {
 	RhythmDBPropType i;
 	RhythmDBPodcastFields *podcast = NULL;
@@ -1128,6 +1651,32 @@ save_entry (RhythmDBTree *db,
 	RHYTHMDB_FWRITE_STATICSTR ("  </entry>\n", ctx->handle, ctx->error);
 }
 
+static void
+save_entry (RhythmDBTree *db,
+	    RhythmDBEntry *entry,
+	    struct RhythmDBTreeSaveContext *ctx)
+{
+	RhythmDBTreeSaveShard *shard = NULL;
+	const char *location;
+	guint i;
+
+	location = rb_refstring_get (entry->location);
+	for (i = 0; ctx->shards != NULL && i < ctx->shards->len; i++) {
+		RhythmDBTreeSaveShard *s = g_ptr_array_index (ctx->shards, i);
+		if (g_str_has_prefix (location, s->root) &&
+		    (shard == NULL || strlen (s->root) > strlen (shard->root))) {
+			shard = s;
+		}
+	}
+
+	if (shard == NULL) {
+		if (ctx->handle != NULL)
+			write_entry (db, entry, ctx);
+	} else if (shard->write) {
+		write_entry (db, entry, &shard->ctx);
+	}
+}
+
 static void
 save_entry_type (const char *name,
 		 RhythmDBEntryType entry_type,
@@ -1176,68 +1725,201 @@ save_unknown_entry_type (RBRefString *typename,
 	}
 }
 
+static gboolean
+open_save_file (struct RhythmDBTreeSaveContext *ctx,
+		const char *filename)
+{
+	char *savepath;
+
+	savepath = g_strconcat (filename, ".tmp", NULL);
+	ctx->handle = fopen (savepath, "w");
+	ctx->error = NULL;
+	g_free (savepath);
+
+	if (ctx->handle == NULL) {
+		g_warning ("Can't save XML: %s", g_strerror (errno));
+		return FALSE;
+	}
+
+	RHYTHMDB_FWRITE_STATICSTR ("<?xml version=\"1.0\" standalone=\"yes\"?>\n"
+				   "<rhythmdb version=\"" RHYTHMDB_TREE_XML_VERSION "\">\n",
+				   ctx->handle, ctx->error);
+	return TRUE;
+}
+
+static gboolean
+close_save_file (struct RhythmDBTreeSaveContext *ctx,
+		 const char *filename)
+{
+	char *savepath;
+	gboolean ret = FALSE;
+
+	savepath = g_strconcat (filename, ".tmp", NULL);
+
+	RHYTHMDB_FWRITE_STATICSTR ("</rhythmdb>\n", ctx->handle, ctx->error);
+
+	if (fclose (ctx->handle) < 0) {
+		g_warning ("Couldn't close %s: %s",
+			   savepath,
+			   g_strerror (errno));
+		unlink (savepath);
+	} else if (ctx->error != NULL) {
+		g_warning ("Writing to the database failed: %s", ctx->error);
+		unlink (savepath);
+	} else if (rename (savepath, filename) < 0) {
+		g_warning ("Couldn't rename %s to %s: %s",
+			   filename, savepath,
+			   g_strerror (errno));
+		unlink (savepath);
+	} else {
+		ret = TRUE;
+	}
+
+	ctx->handle = NULL;
+	g_free (ctx->error);
+	ctx->error = NULL;
+	g_free (savepath);
+	return ret;
+}
+
+/* takes a snapshot of the loaded shards, claiming their dirty state */
+static GPtrArray *
+get_save_shards (RhythmDBTree *db, gboolean *save_main)
+{
+	GPtrArray *shards;
+	GList *l;
+
+	shards = g_ptr_array_new ();
+
+	g_mutex_lock (db->priv->shards_lock);
+	for (l = db->priv->shards; l != NULL; l = l->next) {
+		RhythmDBTreeShard *shard = l->data;
+		RhythmDBTreeSaveShard *s;
+
+		/* entries for shards that aren't loaded stay in the main file */
+		if (shard->loaded == FALSE)
+			continue;
+
+		s = g_new0 (RhythmDBTreeSaveShard, 1);
+		s->root = g_strdup (shard->root);
+		s->filename = g_strdup (shard->filename);
+		s->write = shard->dirty;
+		s->ctx.db = db;
+		shard->dirty = FALSE;
+		g_ptr_array_add (shards, s);
+	}
+
+	/* without shards, the main file contains everything, so always write it */
+	*save_main = (db->priv->main_dirty || db->priv->shards == NULL);
+	db->priv->main_dirty = FALSE;
+	g_mutex_unlock (db->priv->shards_lock);
+
+	return shards;
+}
+
+static void
+free_save_shard (RhythmDBTreeSaveShard *shard)
+{
+	g_free (shard->root);
+	g_free (shard->filename);
+	g_free (shard);
+}
+
 static void
 rhythmdb_tree_save (RhythmDB *rdb)
 {
 	RhythmDBTree *db = RHYTHMDB_TREE (rdb);
 	char *name;
-	GString *savepath;
-	FILE *f;
 	struct RhythmDBTreeSaveContext ctx;
+	gboolean save_main;
+	gboolean main_saved = FALSE;
+	gboolean write_shards = FALSE;
+	GList *failed = NULL;
+	GList *l;
+	guint i;
 
 	g_object_get (G_OBJECT (db), "name", &name, NULL);
 
-	savepath = g_string_new (name);
-	g_string_append (savepath, ".tmp");
+	ctx.db = db;
+	ctx.handle = NULL;
+	ctx.error = NULL;
+	ctx.shards = get_save_shards (db, &save_main);
 
-	f = fopen (savepath->str, "w");
+	if (save_main && open_save_file (&ctx, name) == FALSE) {
+		g_mutex_lock (db->priv->shards_lock);
+		db->priv->main_dirty = TRUE;
+		g_mutex_unlock (db->priv->shards_lock);
+	}
 
-	if (!f) {
-		g_warning ("Can't save XML: %s", g_strerror (errno));
-		goto out;
+	for (i = 0; i < ctx.shards->len; i++) {
+		RhythmDBTreeSaveShard *shard = g_ptr_array_index (ctx.shards, i);
+		char *dirname;
+
+		if (shard->write == FALSE)
+			continue;
+
+		dirname = g_path_get_dirname (shard->filename);
+		g_mkdir_with_parents (dirname, 0700);
+		g_free (dirname);
+
+		rb_debug ("saving database shard for %s", shard->root);
+		if (open_save_file (&shard->ctx, shard->filename)) {
+			write_shards = TRUE;
+		} else {
+			shard->write = FALSE;
+			failed = g_list_prepend (failed, shard->root);
+		}
 	}
 
-	ctx.db = db;
-	ctx.handle = f;
-	ctx.error = NULL;
-	RHYTHMDB_FWRITE_STATICSTR ("<?xml version=\"1.0\" standalone=\"yes\"?>\n"
-				   "<rhythmdb version=\"" RHYTHMDB_TREE_XML_VERSION "\">\n",
-				   ctx.handle, ctx.error);
+	if (ctx.handle != NULL || write_shards) {
+		rhythmdb_entry_type_foreach (rdb, (GHFunc) save_entry_type, &ctx);
+	}
 
-	rhythmdb_entry_type_foreach (rdb, (GHFunc) save_entry_type, &ctx);
-	g_mutex_lock (RHYTHMDB_TREE(rdb)->priv->entries_lock);
-	g_hash_table_foreach (db->priv->unknown_entry_types,
-			      (GHFunc) save_unknown_entry_type,
-			      &ctx);
-	g_mutex_unlock (RHYTHMDB_TREE(rdb)->priv->entries_lock);
+	if (ctx.handle != NULL) {
+		g_mutex_lock (RHYTHMDB_TREE(rdb)->priv->entries_lock);
+		g_hash_table_foreach (db->priv->unknown_entry_types,
+				      (GHFunc) save_unknown_entry_type,
+				      &ctx);
+		g_mutex_unlock (RHYTHMDB_TREE(rdb)->priv->entries_lock);
 
-	RHYTHMDB_FWRITE_STATICSTR ("</rhythmdb>\n", ctx.handle, ctx.error);
+		main_saved = close_save_file (&ctx, name);
+		if (main_saved == FALSE) {
+			g_mutex_lock (db->priv->shards_lock);
+			db->priv->main_dirty = TRUE;
+			g_mutex_unlock (db->priv->shards_lock);
+		}
+	}
 
-	if (fclose (f) < 0) {
-		g_warning ("Couldn't close %s: %s",
-			   savepath->str,
-			   g_strerror (errno));
-		unlink (savepath->str);
-		goto out;
+	for (i = 0; i < ctx.shards->len; i++) {
+		RhythmDBTreeSaveShard *shard = g_ptr_array_index (ctx.shards, i);
+
+		if (shard->write && close_save_file (&shard->ctx, shard->filename) == FALSE) {
+			failed = g_list_prepend (failed, shard->root);
+		}
 	}
 
-	if (ctx.error != NULL) {
-		g_warning ("Writing to the database failed: %s", ctx.error);
-		g_free (ctx.error);
-		unlink (savepath->str);
-	} else {
-		if (rename (savepath->str, name) < 0) {
-			g_warning ("Couldn't rename %s to %s: %s",
-				   name, savepath->str,
-				   g_strerror (errno));
-			unlink (savepath->str);
+	g_mutex_lock (db->priv->shards_lock);
+	for (l = failed; l != NULL; l = l->next) {
+		RhythmDBTreeShard *shard = find_shard_by_root (db, l->data);
+		if (shard != NULL)
+			shard->dirty = TRUE;
+	}
+
+	/* once the main file holds their entries, old shard files can go */
+	if (main_saved) {
+		for (l = db->priv->stale_shard_files; l != NULL; l = l->next) {
+			rb_debug ("removing stale database shard %s", (char *)l->data);
+			unlink ((char *)l->data);
 		}
+		rb_list_deep_free (db->priv->stale_shard_files);
+		db->priv->stale_shard_files = NULL;
 	}
+	g_mutex_unlock (db->priv->shards_lock);
 
-out:
-	g_string_free (savepath, TRUE);
+	g_list_free (failed);
+	g_ptr_array_foreach (ctx.shards, (GFunc) free_save_shard, NULL);
+	g_ptr_array_free (ctx.shards, TRUE);
 	g_free (name);
-	return;
 }
 
 #undef RHYTHMDB_FWRITE_ENCODED_STR
@@ -1245,13 +1927,196 @@ out:
 #undef RHYTHMDB_FPUTC
 #undef RHYTHMDB_FWRITE
 
+static void
+rhythmdb_tree_shard_config_changed_cb (GConfClient *client,
+				       guint cnxn_id,
+				       GConfEntry *entry,
+				       RhythmDBTree *db)
+{
+	rb_debug ("library locations or shard setting changed");
+	rhythmdb_tree_sync_shards (db);
+}
+
+static void
+rhythmdb_tree_mount_added_cb (GVolumeMonitor *monitor,
+			      GMount *mount,
+			      RhythmDBTree *db)
+{
+	GFile *mount_root;
+	char *mount_uri;
+	GList *l;
+
+	mount_root = g_mount_get_root (mount);
+	mount_uri = g_file_get_uri (mount_root);
+
+	g_mutex_lock (db->priv->shards_lock);
+	db->priv->mount_roots = g_list_prepend (db->priv->mount_roots, g_strdup (mount_uri));
+
+	for (l = db->priv->shards; db->priv->load_complete && l != NULL; l = l->next) {
+		RhythmDBTreeShard *shard = l->data;
+		GFile *root;
+
+		if (shard->loaded || shard->loading)
+			continue;
+
+		root = g_file_new_for_uri (shard->root);
+		if (g_file_equal (root, mount_root) || g_file_has_prefix (root, mount_root)) {
+			rb_debug ("library location %s is now available, loading its shard", shard->root);
+			rhythmdb_tree_load_shard_async (db, shard->filename, shard, FALSE, mount_uri);
+		}
+		g_object_unref (root);
+	}
+	g_mutex_unlock (db->priv->shards_lock);
+
+	g_free (mount_uri);
+	g_object_unref (mount_root);
+}
+
+static void
+rhythmdb_tree_mount_removed_cb (GVolumeMonitor *monitor,
+				GMount *mount,
+				RhythmDBTree *db)
+{
+	GFile *mount_root;
+	char *mount_uri;
+	GList *l;
+
+	mount_root = g_mount_get_root (mount);
+	mount_uri = g_file_get_uri (mount_root);
+
+	g_mutex_lock (db->priv->shards_lock);
+	l = g_list_find_custom (db->priv->mount_roots, mount_uri, (GCompareFunc) strcmp);
+	if (l != NULL) {
+		g_free (l->data);
+		db->priv->mount_roots = g_list_delete_link (db->priv->mount_roots, l);
+	}
+	g_mutex_unlock (db->priv->shards_lock);
+
+	g_free (mount_uri);
+	g_object_unref (mount_root);
+}
+
+static gboolean
+shard_root_configured (GSList *locations, const char *root)
+{
+	GSList *l;
+
+	for (l = locations; l != NULL; l = l->next) {
+		const char *location = l->data;
+		if (strncmp (location, root, strlen (location)) == 0 &&
+		    (root[strlen (location)] == '\0' || strcmp (root + strlen (location), "/") == 0))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static void
+rhythmdb_tree_sync_shards (RhythmDBTree *db)
+{
+	GSList *locations = NULL;
+	GSList *l;
+	GList *s;
+
+	if (eel_gconf_get_boolean (CONF_LIBRARY_SHARD_DB))
+		locations = eel_gconf_get_string_list (CONF_LIBRARY_LOCATION);
+
+	g_mutex_lock (db->priv->shards_lock);
+
+	/* remove shards for locations that are no longer configured */
+	s = db->priv->shards;
+	while (s != NULL) {
+		RhythmDBTreeShard *shard = s->data;
+		GList *next = s->next;
+
+		if (shard_root_configured (locations, shard->root) == FALSE) {
+			rb_debug ("removing database shard for %s", shard->root);
+			db->priv->shards = g_list_delete_link (db->priv->shards, s);
+
+			if (shard->loaded) {
+				add_stale_shard_file (db, shard->filename);
+				db->priv->main_dirty = TRUE;
+			} else if (shard->loading == FALSE && db->priv->load_complete &&
+				   g_file_test (shard->filename, G_FILE_TEST_EXISTS)) {
+				/* pull the entries into the main file */
+				rhythmdb_tree_load_shard_async (db, shard->filename, NULL, FALSE, NULL);
+			}
+			/* shards that are still loading get handled when the load finishes */
+			shard_free (shard);
+		}
+		s = next;
+	}
+
+	for (l = locations; l != NULL; l = l->next) {
+		RhythmDBTreeShard *shard;
+
+		shard = shard_new (db, (const char *)l->data);
+		if (find_shard_by_root (db, shard->root) != NULL) {
+			shard_free (shard);
+			continue;
+		}
+
+		rb_debug ("adding database shard for %s", shard->root);
+		db->priv->shards = g_list_append (db->priv->shards, shard);
+		if (db->priv->load_complete == FALSE)
+			continue;
+
+		if (remove_stale_shard_file (db, shard->filename) ||
+		    g_file_test (shard->filename, G_FILE_TEST_EXISTS) == FALSE) {
+			/* the entries for this location are already loaded */
+			shard->loaded = TRUE;
+			shard->dirty = TRUE;
+			db->priv->main_dirty = TRUE;
+		} else {
+			rhythmdb_tree_load_shard_async (db, shard->filename, shard, TRUE, NULL);
+		}
+	}
+
+	g_mutex_unlock (db->priv->shards_lock);
+	rb_slist_deep_free (locations);
+}
+
 RhythmDB *
 rhythmdb_tree_new (const char *name)
 {
 	RhythmDBTree *db = g_object_new (RHYTHMDB_TYPE_TREE, "name", name, NULL);
+	GList *mounts;
+	GList *l;
 
 	g_return_val_if_fail (db->priv != NULL, NULL);
 
+	rhythmdb_tree_sync_shards (db);
+	db->priv->library_location_notify_id =
+		eel_gconf_notification_add (CONF_LIBRARY_LOCATION,
+					    (GConfClientNotifyFunc) rhythmdb_tree_shard_config_changed_cb,
+					    db);
+	db->priv->shard_db_notify_id =
+		eel_gconf_notification_add (CONF_LIBRARY_SHARD_DB,
+					    (GConfClientNotifyFunc) rhythmdb_tree_shard_config_changed_cb,
+					    db);
+
+	db->priv->volume_monitor = g_volume_monitor_get ();
+	mounts = g_volume_monitor_get_mounts (db->priv->volume_monitor);
+	g_mutex_lock (db->priv->shards_lock);
+	for (l = mounts; l != NULL; l = l->next) {
+		GFile *root;
+
+		root = g_mount_get_root (l->data);
+		db->priv->mount_roots = g_list_prepend (db->priv->mount_roots, g_file_get_uri (root));
+		g_object_unref (root);
+		g_object_unref (l->data);
+	}
+	g_mutex_unlock (db->priv->shards_lock);
+	g_list_free (mounts);
+
+	g_signal_connect_object (db->priv->volume_monitor,
+				 "mount-added",
+				 G_CALLBACK (rhythmdb_tree_mount_added_cb),
+				 db, 0);
+	g_signal_connect_object (db->priv->volume_monitor,
+				 "mount-removed",
+				 G_CALLBACK (rhythmdb_tree_mount_removed_cb),
+				 db, 0);
+
 	return RHYTHMDB (db);
 }
 
@@ -1276,6 +2141,8 @@ rhythmdb_tree_entry_new (RhythmDB *rdb,
 	g_mutex_lock (RHYTHMDB_TREE(rdb)->priv->entries_lock);
 	rhythmdb_tree_entry_new_internal (rdb, entry);
 	g_mutex_unlock (RHYTHMDB_TREE(rdb)->priv->entries_lock);
+
+	mark_location_dirty (RHYTHMDB_TREE (rdb), entry->location);
 }
 
 /* must be called with the entry lock held */
@@ -1525,6 +2392,8 @@ rhythmdb_tree_entry_set (RhythmDB *adb,
 	if (entry->flags & (RHYTHMDB_ENTRY_TREE_LOADING | RHYTHMDB_ENTRY_TREE_REMOVED))
 		return FALSE;
 
+	mark_location_dirty (db, entry->location);
+
 	/* Handle special properties */
 	switch (propid)
 	{
@@ -1545,6 +2414,8 @@ rhythmdb_tree_entry_set (RhythmDB *adb,
 		g_hash_table_insert (db->priv->entries, entry->location, entry);
 		g_mutex_unlock (db->priv->entries_lock);
 
+		/* the entry may have moved to a different shard */
+		mark_location_dirty (db, entry->location);
 		return TRUE;
 	}
 	case RHYTHMDB_PROP_ALBUM:
@@ -1637,6 +2508,8 @@ rhythmdb_tree_entry_delete (RhythmDB *adb,
 {
 	RhythmDBTree *db = RHYTHMDB_TREE (adb);
 
+	mark_location_dirty (db, entry->location);
+
 	g_mutex_lock (db->priv->genres_lock);
 	remove_entry_from_album (db, entry);
 	g_mutex_unlock (db->priv->genres_lock);
@@ -1695,6 +2568,7 @@ rhythmdb_tree_entry_delete_by_type (RhythmDB *adb,
 
 	ctxt.db = adb;
 	ctxt.type = type;
+	mark_all_dirty (db);
 	g_mutex_lock (db->priv->entries_lock);
 	g_mutex_lock (db->priv->genres_lock);
 	g_hash_table_foreach_remove (db->priv->entries,
@@ -1703,6 +2577,69 @@ rhythmdb_tree_entry_delete_by_type (RhythmDB *adb,
 	g_mutex_unlock (db->priv->entries_lock);
 }
 
+typedef struct {
+	RhythmDBTree *db;
+	RhythmDBEntryType type;
+	const char *prefix;
+	GPtrArray *deleted;
+} RbEntryPrefixRemovalCtxt;
+
+/* must be called with the entries and genres locks held */
+static gboolean
+remove_one_song_by_prefix (gpointer key,
+			   RhythmDBEntry *entry,
+			   RbEntryPrefixRemovalCtxt *ctxt)
+{
+	RhythmDBTree *db = ctxt->db;
+
+	rb_assert_locked (db->priv->entries_lock);
+	rb_assert_locked (db->priv->genres_lock);
+
+	g_return_val_if_fail (entry != NULL, FALSE);
+
+	/* entries that haven't been committed yet are left alone, as the
+	 * deletion notification for them would precede the addition.
+	 */
+	if (entry->type != ctxt->type ||
+	    (entry->flags & RHYTHMDB_ENTRY_INSERTED) == 0 ||
+	    g_str_has_prefix (rb_refstring_get (entry->location), ctxt->prefix) == FALSE)
+		return FALSE;
+
+	mark_location_dirty (db, entry->location);
+
+	g_mutex_lock (db->priv->keywords_lock);
+	remove_entry_from_keywords (db, entry);
+	g_mutex_unlock (db->priv->keywords_lock);
+	remove_entry_from_album (db, entry);
+	g_assert (g_hash_table_remove (db->priv->entry_ids, GINT_TO_POINTER (entry->id)));
+
+	/* the tree's reference is handed over to the deleted array */
+	entry->flags |= RHYTHMDB_ENTRY_TREE_REMOVED;
+	g_ptr_array_add (ctxt->deleted, entry);
+	return TRUE;
+}
+
+static void
+rhythmdb_tree_entry_delete_by_location_prefix (RhythmDB *adb,
+					       RhythmDBEntryType type,
+					       const char *prefix,
+					       GPtrArray *deleted)
+{
+	RhythmDBTree *db = RHYTHMDB_TREE (adb);
+	RbEntryPrefixRemovalCtxt ctxt;
+
+	ctxt.db = db;
+	ctxt.type = type;
+	ctxt.prefix = prefix;
+	ctxt.deleted = deleted;
+	g_mutex_lock (db->priv->entries_lock);
+	g_mutex_lock (db->priv->genres_lock);
+	g_hash_table_foreach_remove (db->priv->entries,
+				     (GHRFunc) remove_one_song_by_prefix, &ctxt);
+	g_mutex_unlock (db->priv->genres_lock);
+	g_mutex_unlock (db->priv->entries_lock);
+}
+
 static void
 destroy_tree_property (RhythmDBTreeProperty *prop)
 {
@@ -1723,6 +2660,7 @@ struct RhythmDBTreeTraversalData
 	RhythmDBTreeTraversalFunc func;
 	gpointer data;
 	gboolean *cancel;
+	glong now;
 };
 
 static gboolean
@@ -1733,18 +2671,19 @@ rhythmdb_tree_evaluate_query (RhythmDB *adb,
 	RhythmDBTree *db = RHYTHMDB_TREE (adb);
 	guint i;
 	guint last_disjunction;
+	glong now = 0;
 
 	for (i = 0, last_disjunction = 0; i < query->len; i++) {
 		RhythmDBQueryData *data = g_ptr_array_index (query, i);
 
 		if (data->type == RHYTHMDB_QUERY_DISJUNCTION) {
-			if (evaluate_conjunctive_subquery (db, query, last_disjunction, i, entry))
+			if (evaluate_conjunctive_subquery (db, query, last_disjunction, i, entry, &now))
 				return TRUE;
 
 			last_disjunction = i + 1;
 		}
 	}
-	if (evaluate_conjunctive_subquery (db, query, last_disjunction, query->len, entry))
+	if (evaluate_conjunctive_subquery (db, query, last_disjunction, query->len, entry, &now))
 		return TRUE;
 	return FALSE;
 }
@@ -1827,7 +2766,8 @@ evaluate_conjunctive_subquery (RhythmDBTree *dbtree,
 			       GPtrArray *query,
 			       guint base,
 			       guint max,
-			       RhythmDBEntry *entry)
+			       RhythmDBEntry *entry,
+			       glong *now)
 
 {
 	RhythmDB *db = (RhythmDB *) dbtree;
@@ -1853,7 +2793,7 @@ evaluate_conjunctive_subquery (RhythmDBTree *dbtree,
 				GPtrArray *subquery = tem->data;
 				if (!matched && evaluate_conjunctive_subquery (dbtree, subquery,
 									       0, subquery->len,
-									       entry)) {
+									       entry, now)) {
 					matched = TRUE;
 				}
 				g_ptr_array_free (tem->data, TRUE);
@@ -1867,18 +2807,24 @@ evaluate_conjunctive_subquery (RhythmDBTree *dbtree,
 		case RHYTHMDB_QUERY_PROP_CURRENT_TIME_NOT_WITHIN:
 		{
 			gulong relative_time;
-			GTimeVal current_time;
 
 			g_assert (rhythmdb_get_property_type (db, data->propid) == G_TYPE_ULONG);
 
 			relative_time = g_value_get_ulong (data->val);
-			g_get_current_time  (&current_time);
+
+			/* only look at the clock once per evaluation */
+			if (*now == 0) {
+				GTimeVal current_time;
+
+				g_get_current_time (&current_time);
+				*now = current_time.tv_sec;
+			}
 
 			if (data->type == RHYTHMDB_QUERY_PROP_CURRENT_TIME_WITHIN) {
-				if (!(rhythmdb_entry_get_ulong (entry, data->propid) >= (current_time.tv_sec - relative_time)))
+				if (!(rhythmdb_entry_get_ulong (entry, data->propid) >= (*now - relative_time)))
 					return FALSE;
 			} else {
-				if (!(rhythmdb_entry_get_ulong (entry, data->propid) < (current_time.tv_sec - relative_time)))
+				if (!(rhythmdb_entry_get_ulong (entry, data->propid) < (*now - relative_time)))
 					return FALSE;
 			}
 			break;
@@ -1977,7 +2923,7 @@ do_conjunction (RhythmDBEntry *entry,
 		return;
 	/* Finally, we actually evaluate the query! */
 	if (evaluate_conjunctive_subquery (data->db, data->query, 0, data->query->len,
-					   entry)) {
+					   entry, &data->now)) {
 		data->func (data->db, entry, data->data);
 	}
 }
@@ -2163,6 +3109,7 @@ conjunctive_query (RhythmDBTree *db,
 	traversal_data->func = func;
 	traversal_data->data = data;
 	traversal_data->cancel = cancel;
+	traversal_data->now = 0;
 
 	g_mutex_lock (db->priv->genres_lock);
 	if (type_query_idx >= 0) {
@@ -2444,6 +3391,9 @@ rhythmdb_tree_entry_keyword_add (RhythmDB *rdb,
 	GHashTable *keyword_table;
 	gboolean present;
 
+	if ((entry->flags & RHYTHMDB_ENTRY_TREE_LOADING) == 0)
+		mark_location_dirty (db, entry->location);
+
 	g_mutex_lock (db->priv->keywords_lock);
 	keyword_table = g_hash_table_lookup (db->priv->keywords, keyword);
 	if (keyword_table != NULL) {
@@ -2474,6 +3424,8 @@ rhythmdb_tree_entry_keyword_remove (RhythmDB *rdb,
 	GHashTable *keyword_table;
 	gboolean ret;
 
+	mark_location_dirty (db, entry->location);
+
 	g_mutex_lock (db->priv->keywords_lock);
 	keyword_table = g_hash_table_lookup (db->priv->keywords, keyword);
 	if (keyword_table != NULL) {
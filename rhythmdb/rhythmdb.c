@@ -120,6 +120,10 @@ struct media_type_filter {
 #define REALLY_SMALL_FILE_SIZE	(4096)
 
 
+/* maximum number of queries running at once; the rest wait in priority order */
+#define QUERY_THREAD_MAX	4
+#define WORKER_THREAD_MAX	4
+
 typedef struct
 {
 	RhythmDB *db;
@@ -127,6 +131,11 @@ typedef struct
 	guint propid;
 	RhythmDBQueryResults *results;
 	gboolean cancel;
+
+	gpointer owner;
+	gint priority;
+	guint serial;
+	GTimer *timer;
 } RhythmDBQueryThreadData;
 
 typedef struct
@@ -176,6 +185,11 @@ static void rhythmdb_read_leave (RhythmDB *db);
 static void rhythmdb_process_one_event (RhythmDBEvent *event, RhythmDB *db);
 static gpointer action_thread_main (RhythmDB *db);
 static gpointer query_thread_main (RhythmDBQueryThreadData *data);
+typedef struct RhythmDBWorkerJob_ RhythmDBWorkerJob;
+static void worker_thread_main (RhythmDBWorkerJob *job, gpointer unused);
+static gint query_thread_sort_func (RhythmDBQueryThreadData *a,
+				    RhythmDBQueryThreadData *b,
+				    gpointer data);
 static void rhythmdb_entry_set_mount_point (RhythmDB *db,
  					    RhythmDBEntry *entry,
  					    const gchar *realuri);
@@ -184,6 +198,8 @@ static gboolean rhythmdb_idle_save (RhythmDB *db);
 static void rhythmdb_sync_monitored_locations (RhythmDB *db);
 static void rhythmdb_entry_sync_mirrored (RhythmDBEntry *entry,
 					  guint propid);
+static void rhythmdb_entry_invalidate_sort_order_keys (RhythmDBEntry *entry,
+						       guint propid);
 static void rhythmdb_register_core_entry_types (RhythmDB *db);
 static gboolean rhythmdb_entry_extra_metadata_accumulator (GSignalInvocationHint *ihint,
 							   GValue *return_accu,
@@ -202,6 +218,7 @@ static void rhythmdb_add_to_stat_list (RhythmDB *db,
 				       RhythmDBEntryType ignore_type,
 				       RhythmDBEntryType error_type);
 static void free_entry_changes (GSList *entry_changes);
+static void free_deleted_batch (GPtrArray *batch);
 
 enum
 {
@@ -216,6 +233,7 @@ enum
 	ENTRY_ADDED,
 	ENTRY_CHANGED,
 	ENTRY_DELETED,
+	ENTRIES_DELETED,
 	ENTRY_KEYWORD_ADDED,
 	ENTRY_KEYWORD_REMOVED,
 	ENTRY_EXTRA_METADATA_REQUEST,
@@ -313,6 +331,26 @@ rhythmdb_class_init (RhythmDBClass *klass)
 			      G_TYPE_NONE,
 			      1, RHYTHMDB_TYPE_ENTRY);
 
+	/**
+	 * RhythmDB::entries-deleted:
+	 * @db: the #RhythmDB
+	 * @entries: a #GPtrArray containing the deleted #RhythmDBEntry structures
+	 *
+	 * Emitted when a set of entries is deleted from the database in a single
+	 * operation, such as #rhythmdb_entry_delete_by_location_prefix.  This is
+	 * emitted before the individual entry-deleted signals for the entries,
+	 * so listeners can process the whole set at once.
+	 */
+	rhythmdb_signals[ENTRIES_DELETED] =
+		g_signal_new ("entries_deleted",
+			      RHYTHMDB_TYPE,
+			      G_SIGNAL_RUN_LAST,
+			      G_STRUCT_OFFSET (RhythmDBClass, entries_deleted),
+			      NULL, NULL,
+			      g_cclosure_marshal_VOID__POINTER,
+			      G_TYPE_NONE,
+			      1, G_TYPE_POINTER);
+
 	/**
 	 * RhythmDB::entry-changed:
 	 * @db: the #RhythmDB
@@ -678,7 +716,15 @@ rhythmdb_init (RhythmDB *db)
 
 	db->priv->query_thread_pool = g_thread_pool_new ((GFunc)query_thread_main,
 							 NULL,
-							 -1, FALSE, NULL);
+							 QUERY_THREAD_MAX, FALSE, NULL);
+	g_thread_pool_set_sort_function (db->priv->query_thread_pool,
+					 (GCompareDataFunc) query_thread_sort_func,
+					 NULL);
+	db->priv->worker_thread_pool = g_thread_pool_new ((GFunc)worker_thread_main,
+							  NULL,
+							  WORKER_THREAD_MAX, FALSE, NULL);
+	db->priv->query_mutex = g_mutex_new ();
+	db->priv->scheduled_queries = g_hash_table_new (g_direct_hash, g_direct_equal);
 
 	db->priv->metadata = rb_metadata_new ();
 	db->priv->metadata_blocked = FALSE;
@@ -1094,6 +1140,7 @@ rhythmdb_dispose (GObject *object)
 
 		g_list_foreach (db->priv->added_entries_to_emit, (GFunc)rhythmdb_entry_unref, NULL);
 		g_list_foreach (db->priv->deleted_entries_to_emit, (GFunc)rhythmdb_entry_unref, NULL);
+		g_list_foreach (db->priv->deleted_batches_to_emit, (GFunc)free_deleted_batch, NULL);
 		if (db->priv->changed_entries_to_emit != NULL) {
 			g_hash_table_destroy (db->priv->changed_entries_to_emit);
 		}
@@ -1129,6 +1176,9 @@ rhythmdb_finalize (GObject *object)
 	rhythmdb_finalize_monitoring (db);
 
 	g_thread_pool_free (db->priv->query_thread_pool, FALSE, TRUE);
+	g_thread_pool_free (db->priv->worker_thread_pool, FALSE, TRUE);
+	g_hash_table_destroy (db->priv->scheduled_queries);
+	g_mutex_free (db->priv->query_mutex);
 	g_async_queue_unref (db->priv->action_queue);
 	g_async_queue_unref (db->priv->event_queue);
 	g_async_queue_unref (db->priv->restored_queue);
@@ -1231,6 +1281,55 @@ rhythmdb_thread_create (RhythmDB *db,
 		g_thread_create ((GThreadFunc) func, data, FALSE, NULL);
 }
 
+struct RhythmDBWorkerJob_ {
+	RhythmDB *db;
+	GThreadFunc func;
+	gpointer data;
+};
+
+static void
+worker_thread_main (RhythmDBWorkerJob *job, gpointer unused)
+{
+	RhythmDBEvent *result;
+
+	job->func (job->data);
+
+	result = g_slice_new0 (RhythmDBEvent);
+	result->db = job->db;
+	result->type = RHYTHMDB_EVENT_THREAD_EXITED;
+	rhythmdb_push_event (job->db, result);
+
+	g_free (job);
+}
+
+/**
+ * rhythmdb_push_worker_job:
+ * @db: the #RhythmDB
+ * @func: function to call on a worker thread
+ * @data: data to pass to @func
+ *
+ * Calls @func on one of the database's worker threads.  There are only
+ * a few worker threads, shared by everything using the database, so the
+ * job may have to wait for others to finish first.  #rhythmdb_shutdown
+ * waits for all jobs to finish, so jobs that take a while should stop
+ * early once they are no longer needed.
+ */
+void
+rhythmdb_push_worker_job (RhythmDB *db,
+			  GThreadFunc func,
+			  gpointer data)
+{
+	RhythmDBWorkerJob *job;
+
+	g_return_if_fail (RHYTHMDB_IS (db));
+
+	job = g_new0 (RhythmDBWorkerJob, 1);
+	job->db = db;
+	job->func = func;
+	job->data = data;
+	rhythmdb_thread_create (db, db->priv->worker_thread_pool, NULL, job);
+}
+
 static gboolean
 rhythmdb_get_readonly (RhythmDB *db)
 {
@@ -1322,16 +1421,25 @@ copy_entry_changes (GSList *entry_changes)
 	return g_slist_reverse (r);
 }
 
-static gboolean
-rhythmdb_emit_entry_signals_idle (RhythmDB *db)
+static void
+free_deleted_batch (GPtrArray *batch)
+{
+	g_ptr_array_foreach (batch, (GFunc) rhythmdb_entry_unref, NULL);
+	g_ptr_array_free (batch, TRUE);
+}
+
+static void
+rhythmdb_emit_entry_signals (RhythmDB *db)
 {
 	GList *added_entries;
 	GList *deleted_entries;
+	GList *deleted_batches;
 	GHashTable *changed_entries;
 	GList *l;
 	GHashTableIter iter;
 	RhythmDBEntry *entry;
 	GSList *entry_changes;
+	guint i;
 
 	/* get lists of entries to emit, reset source id value */
 	g_mutex_lock (db->priv->change_mutex);
@@ -1342,6 +1450,9 @@ rhythmdb_emit_entry_signals_idle (RhythmDB *db)
 	deleted_entries = db->priv->deleted_entries_to_emit;
 	db->priv->deleted_entries_to_emit = NULL;
 
+	deleted_batches = g_list_reverse (db->priv->deleted_batches_to_emit);
+	db->priv->deleted_batches_to_emit = NULL;
+
 	changed_entries = db->priv->changed_entries_to_emit;
 	db->priv->changed_entries_to_emit = NULL;
 
@@ -1349,8 +1460,6 @@ rhythmdb_emit_entry_signals_idle (RhythmDB *db)
 
 	g_mutex_unlock (db->priv->change_mutex);
 
-	GDK_THREADS_ENTER ();
-
 	/* emit changed entries */
 	if (changed_entries != NULL) {
 		g_hash_table_iter_init (&iter, changed_entries);
@@ -1386,13 +1495,34 @@ rhythmdb_emit_entry_signals_idle (RhythmDB *db)
 		rhythmdb_entry_unref (entry);
 	}
 
-	GDK_THREADS_LEAVE ();
+	/* emit batches of deleted entries; the individual deletion signals
+	 * follow for listeners that only care about single entries.
+	 */
+	for (l = deleted_batches; l; l = g_list_next (l)) {
+		GPtrArray *batch = (GPtrArray *)l->data;
+
+		g_signal_emit (G_OBJECT (db), rhythmdb_signals[ENTRIES_DELETED], 0, batch);
+		for (i = 0; i < batch->len; i++) {
+			entry = g_ptr_array_index (batch, i);
+			g_signal_emit (G_OBJECT (db), rhythmdb_signals[ENTRY_DELETED], 0, entry);
+		}
+		free_deleted_batch (batch);
+	}
 
 	if (changed_entries != NULL) {
 		g_hash_table_destroy (changed_entries);
 	}
 	g_list_free (added_entries);
 	g_list_free (deleted_entries);
+	g_list_free (deleted_batches);
+}
+
+static gboolean
+rhythmdb_emit_entry_signals_idle (RhythmDB *db)
+{
+	GDK_THREADS_ENTER ();
+	rhythmdb_emit_entry_signals (db);
+	GDK_THREADS_LEAVE ();
 	return FALSE;
 }
 
@@ -1596,6 +1726,35 @@ rhythmdb_commit (RhythmDB *db)
 	rhythmdb_commit_internal (db, TRUE, g_thread_self ());
 }
 
+/**
+ * rhythmdb_flush_entry_signals:
+ * @db: a #RhythmDB.
+ *
+ * Commits changes made on the main thread, then emits any pending
+ * entry-added, entry-changed and entry-deleted signals immediately rather
+ * than from an idle handler.  This is useful when something needs to see
+ * the results of those signals, such as query models containing newly
+ * added entries, before returning to the main loop.
+ *
+ * This must be called from the main thread, with the GDK lock held.
+ */
+void
+rhythmdb_flush_entry_signals (RhythmDB *db)
+{
+	g_assert (rb_is_main_thread ());
+
+	rhythmdb_commit (db);
+
+	g_mutex_lock (db->priv->change_mutex);
+	if (db->priv->emit_entry_signals_id != 0) {
+		g_source_remove (db->priv->emit_entry_signals_id);
+		db->priv->emit_entry_signals_id = 0;
+	}
+	g_mutex_unlock (db->priv->change_mutex);
+
+	rhythmdb_emit_entry_signals (db);
+}
+
 /**
  * rhythmdb_error_quark:
  *
@@ -1834,6 +1993,7 @@ static void
 rhythmdb_entry_finalize (RhythmDBEntry *entry)
 {
 	RhythmDBEntryType type;
+	int i;
 
 	type = rhythmdb_entry_get_entry_type (entry);
 
@@ -1854,6 +2014,9 @@ rhythmdb_entry_finalize (RhythmDBEntry *entry)
 	rb_refstring_unref (entry->album_sortname);
 	rb_refstring_unref (entry->mimetype);
 
+	for (i = 0; i < RHYTHMDB_NUM_SORT_ORDERS; i++)
+		g_free (entry->sort_order_keys[i]);
+
 	g_free (entry);
 }
 
@@ -3711,6 +3874,8 @@ rhythmdb_entry_set_internal (RhythmDB *db,
 		}
 	}
 
+	rhythmdb_entry_invalidate_sort_order_keys (entry, propid);
+
 	/* set the dirty state */
 	db->priv->dirty = TRUE;
 }
@@ -3917,6 +4082,58 @@ rhythmdb_entry_delete_by_type (RhythmDB *db,
 	}
 }
 
+/**
+ * rhythmdb_entry_delete_by_location_prefix:
+ * @db: a #RhythmDB.
+ * @type: type of entries to delete.
+ * @prefix: location prefix of entries to delete.
+ *
+ * Deletes all entries of type @type whose locations start with @prefix,
+ * such as all songs under a library location.  The entries are removed
+ * from the database in a single operation, and listeners are notified
+ * of the deletion through a single entries-deleted signal (followed by
+ * the usual entry-deleted signal for each entry).  Entries that haven't
+ * been committed yet are not affected.
+ */
+void
+rhythmdb_entry_delete_by_location_prefix (RhythmDB *db,
+					  RhythmDBEntryType type,
+					  const char *prefix)
+{
+	RhythmDBClass *klass = RHYTHMDB_GET_CLASS (db);
+	GPtrArray *deleted;
+	guint i;
+
+	g_return_if_fail (RHYTHMDB_IS (db));
+	g_return_if_fail (prefix != NULL);
+
+	if (klass->impl_entry_delete_by_location_prefix == NULL) {
+		g_warning ("delete_by_location_prefix not implemented");
+		return;
+	}
+
+	deleted = g_ptr_array_new ();
+	klass->impl_entry_delete_by_location_prefix (db, type, prefix, deleted);
+	rb_debug ("deleted %d entries under %s", deleted->len, prefix);
+	if (deleted->len == 0) {
+		g_ptr_array_free (deleted, TRUE);
+		return;
+	}
+
+	g_mutex_lock (db->priv->change_mutex);
+	for (i = 0; i < deleted->len; i++) {
+		RhythmDBEntry *entry = g_ptr_array_index (deleted, i);
+		g_assert ((entry->flags & RHYTHMDB_ENTRY_INSERTED) != 0);
+		entry->flags &= ~(RHYTHMDB_ENTRY_INSERTED);
+	}
+	db->priv->deleted_batches_to_emit = g_list_prepend (db->priv->deleted_batches_to_emit, deleted);
+	if (db->priv->emit_entry_signals_id == 0)
+		db->priv->emit_entry_signals_id = g_idle_add ((GSourceFunc) rhythmdb_emit_entry_signals_idle, db);
+	g_mutex_unlock (db->priv->change_mutex);
+
+	db->priv->dirty = TRUE;
+}
+
 /**
  * rhythmdb_nice_elt_name_from_propid:
  * @db: the #RhythmDB
@@ -4147,14 +4364,22 @@ rhythmdb_query_internal (RhythmDBQueryThreadData *data)
 
 	rhythmdb_query_preprocess (data->db, data->query);
 
-	rb_debug ("doing query");
+	/* a query cancelled before it started doesn't need to run at all */
+	if (data->cancel == FALSE) {
+		rb_debug ("doing query");
 
-	klass->impl_do_full_query (data->db, data->query,
-				   data->results,
-				   &data->cancel);
+		klass->impl_do_full_query (data->db, data->query,
+					   data->results,
+					   &data->cancel);
+	}
 
-	rb_debug ("completed");
-	rhythmdb_query_results_query_complete (data->results);
+	/* nobody is waiting for the results of a cancelled query */
+	if (data->cancel == FALSE) {
+		rb_debug ("completed");
+		rhythmdb_query_results_query_complete (data->results);
+	} else {
+		rb_debug ("cancelled");
+	}
 
 	result = g_slice_new0 (RhythmDBEvent);
 	result->db = data->db;
@@ -4169,11 +4394,44 @@ static gpointer
 query_thread_main (RhythmDBQueryThreadData *data)
 {
 	RhythmDBEvent *result;
+	double wait_time = 0.0;
 
 	rb_debug ("entering query thread");
 
+	if (data->timer != NULL) {
+		wait_time = g_timer_elapsed (data->timer, NULL);
+		g_timer_start (data->timer);
+	}
+
 	rhythmdb_query_internal (data);
 
+	if (data->timer != NULL) {
+		RhythmDB *db = data->db;
+		double run_time;
+
+		run_time = g_timer_elapsed (data->timer, NULL);
+		g_timer_destroy (data->timer);
+
+		g_mutex_lock (db->priv->query_mutex);
+		if (g_hash_table_lookup (db->priv->scheduled_queries, data->owner) == data)
+			g_hash_table_remove (db->priv->scheduled_queries, data->owner);
+
+		db->priv->query_count++;
+		if (data->cancel)
+			db->priv->query_cancelled_count++;
+		db->priv->query_wait_time += wait_time;
+		db->priv->query_run_time += run_time;
+		rb_debug ("query for %p %s: waited %0.3fs, ran %0.3fs (%u queries, %u cancelled, average %0.3fs waiting, %0.3fs running)",
+			  data->owner,
+			  data->cancel ? "cancelled" : "complete",
+			  wait_time, run_time,
+			  db->priv->query_count,
+			  db->priv->query_cancelled_count,
+			  db->priv->query_wait_time / db->priv->query_count,
+			  db->priv->query_run_time / db->priv->query_count);
+		g_mutex_unlock (db->priv->query_mutex);
+	}
+
 	result = g_slice_new0 (RhythmDBEvent);
 	result->db = data->db;
 	result->type = RHYTHMDB_EVENT_THREAD_EXITED;
@@ -4182,6 +4440,23 @@ query_thread_main (RhythmDBQueryThreadData *data)
 	return NULL;
 }
 
+/* called with the query mutex held; the query thread data can't be
+ * freed while it's still in the scheduled query table.
+ */
+static void
+rhythmdb_cancel_scheduled_query_locked (RhythmDB *db,
+					gpointer owner)
+{
+	RhythmDBQueryThreadData *data;
+
+	data = g_hash_table_lookup (db->priv->scheduled_queries, owner);
+	if (data != NULL) {
+		rb_debug ("cancelling query for %p", owner);
+		data->cancel = TRUE;
+		g_hash_table_remove (db->priv->scheduled_queries, owner);
+	}
+}
+
 /**
  * rhythmdb_do_full_query_async_parsed:
  * @db: the #RhythmDB
@@ -4213,6 +4488,10 @@ rhythmdb_do_full_query_async_parsed (RhythmDB *db,
 
 	rhythmdb_query_results_set_query (results, query);
 
+	g_mutex_lock (db->priv->query_mutex);
+	data->serial = db->priv->query_serial++;
+	g_mutex_unlock (db->priv->query_mutex);
+
 	g_object_ref (results);
 	g_object_ref (db);
 	g_atomic_int_inc (&db->priv->outstanding_threads);
@@ -4221,6 +4500,90 @@ rhythmdb_do_full_query_async_parsed (RhythmDB *db,
 	g_thread_pool_push (db->priv->query_thread_pool, data, NULL);
 }
 
+static gint
+query_thread_sort_func (RhythmDBQueryThreadData *a,
+			RhythmDBQueryThreadData *b,
+			gpointer data)
+{
+	if (a->priority != b->priority)
+		return (a->priority < b->priority) ? -1 : 1;
+
+	/* otherwise, first come first served */
+	if (a->serial != b->serial)
+		return (a->serial < b->serial) ? -1 : 1;
+	return 0;
+}
+
+/**
+ * rhythmdb_do_full_query_async_scheduled:
+ * @db: the #RhythmDB
+ * @owner: identifies the caller, usually the source running the query
+ * @priority: the priority of the query, such as %G_PRIORITY_HIGH for
+ *   queries the user is waiting for
+ * @results: a #RhythmDBQueryResults instance to feed results to
+ * @query: the query to run
+ *
+ * Like #rhythmdb_do_full_query_async_parsed, except that any query
+ * previously scheduled by @owner is cancelled, and queries waiting
+ * for a query thread are started in order of @priority.
+ * A cancelled query stops feeding results to its #RhythmDBQueryResults
+ * and does not complete.  This can only be called from the main thread.
+ */
+void
+rhythmdb_do_full_query_async_scheduled (RhythmDB *db,
+					gpointer owner,
+					gint priority,
+					RhythmDBQueryResults *results,
+					GPtrArray *query)
+{
+	RhythmDBQueryThreadData *data;
+
+	g_return_if_fail (owner != NULL);
+
+	data = g_new0 (RhythmDBQueryThreadData, 1);
+	data->db = db;
+	data->query = rhythmdb_query_copy (query);
+	data->results = results;
+	data->cancel = FALSE;
+	data->owner = owner;
+	data->priority = priority;
+	data->timer = g_timer_new ();
+
+	rhythmdb_read_enter (db);
+
+	rhythmdb_query_results_set_query (results, query);
+
+	g_mutex_lock (db->priv->query_mutex);
+	rhythmdb_cancel_scheduled_query_locked (db, owner);
+	data->serial = db->priv->query_serial++;
+	g_hash_table_insert (db->priv->scheduled_queries, owner, data);
+	g_mutex_unlock (db->priv->query_mutex);
+
+	g_object_ref (results);
+	g_object_ref (db);
+	g_atomic_int_inc (&db->priv->outstanding_threads);
+	g_async_queue_ref (db->priv->action_queue);
+	g_async_queue_ref (db->priv->event_queue);
+	g_thread_pool_push (db->priv->query_thread_pool, data, NULL);
+}
+
+/**
+ * rhythmdb_cancel_scheduled_query:
+ * @db: the #RhythmDB
+ * @owner: the owner passed to #rhythmdb_do_full_query_async_scheduled
+ *
+ * Cancels the query most recently scheduled by @owner, if it hasn't
+ * completed yet.
+ */
+void
+rhythmdb_cancel_scheduled_query (RhythmDB *db,
+				 gpointer owner)
+{
+	g_mutex_lock (db->priv->query_mutex);
+	rhythmdb_cancel_scheduled_query_locked (db, owner);
+	g_mutex_unlock (db->priv->query_mutex);
+}
+
 /**
  * rhythmdb_do_full_query_async:
  * @db: the #RhythmDB
@@ -5468,6 +5831,215 @@ rhythmdb_entry_get_pointer (RhythmDBEntry *entry,
 	}
 }
 
+static void
+append_sort_key_field (GString *key,
+		       const char *value)
+{
+	/* fields are separated by \001\001, and \001 within a field is
+	 * escaped as \001\002, so comparing the whole key with strcmp gives
+	 * the same result as comparing the fields one at a time.
+	 */
+	if (value != NULL) {
+		for (; *value != '\0'; value++) {
+			if (*value == '\001')
+				g_string_append (key, "\001\002");
+			else
+				g_string_append_c (key, *value);
+		}
+	}
+	g_string_append (key, "\001\001");
+}
+
+static void
+append_sort_key_number (GString *key,
+			gulong value)
+{
+	g_string_append_printf (key, "%016" G_GINT64_MODIFIER "x", (guint64) value);
+	g_string_append (key, "\001\001");
+}
+
+static const char *
+get_sortname_sort_key (RhythmDBEntry *entry,
+		       RhythmDBPropType sortname_prop,
+		       RhythmDBPropType prop)
+{
+	const char *val;
+
+	val = rhythmdb_entry_get_string (entry, sortname_prop);
+	if (val == NULL || val[0] == '\0')
+		val = rhythmdb_entry_get_string (entry, prop);
+	return val;
+}
+
+static char *
+rhythmdb_entry_build_sort_order_key (RhythmDBEntry *entry,
+				     RhythmDBSortOrder order)
+{
+	GString *key;
+	gulong disc;
+
+	key = g_string_sized_new (128);
+	switch (order) {
+	case RHYTHMDB_SORT_ORDER_GENRE:
+		append_sort_key_field (key, rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_GENRE_SORT_KEY));
+		/* fall through */
+	case RHYTHMDB_SORT_ORDER_ARTIST:
+		append_sort_key_field (key, get_sortname_sort_key (entry,
+								   RHYTHMDB_PROP_ARTIST_SORTNAME_SORT_KEY,
+								   RHYTHMDB_PROP_ARTIST_SORT_KEY));
+		/* fall through */
+	case RHYTHMDB_SORT_ORDER_ALBUM:
+		append_sort_key_field (key, get_sortname_sort_key (entry,
+								   RHYTHMDB_PROP_ALBUM_SORTNAME_SORT_KEY,
+								   RHYTHMDB_PROP_ALBUM_SORT_KEY));
+
+		/* assume disc 1 if there's no disc number */
+		disc = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_DISC_NUMBER);
+		append_sort_key_number (key, disc ? disc : 1);
+		append_sort_key_number (key, rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_TRACK_NUMBER));
+		append_sort_key_field (key, rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LOCATION));
+		break;
+	default:
+		g_assert_not_reached ();
+	}
+
+	return g_string_free (key, FALSE);
+}
+
+/*
+ * Keys can be invalidated on the main thread while another thread is
+ * comparing them.  Threads using sort keys hold them for the duration,
+ * and keys invalidated while any thread is holding them are only freed
+ * once the last one lets go.
+ */
+G_LOCK_DEFINE_STATIC (sort_order_keys);
+static guint sort_order_key_holders = 0;
+static GSList *sort_order_keys_to_free = NULL;
+
+/**
+ * rhythmdb_entry_sort_order_keys_hold:
+ *
+ * Keeps sort order keys from being freed when they are invalidated,
+ * until #rhythmdb_entry_sort_order_keys_release is called.  Threads
+ * other than the main thread must hold the keys while using the
+ * strings returned by #rhythmdb_entry_get_sort_order_key, or while
+ * calling sort functions that use them.
+ */
+void
+rhythmdb_entry_sort_order_keys_hold (void)
+{
+	G_LOCK (sort_order_keys);
+	sort_order_key_holders++;
+	G_UNLOCK (sort_order_keys);
+}
+
+/**
+ * rhythmdb_entry_sort_order_keys_release:
+ *
+ * Releases a hold on the sort order keys taken by
+ * #rhythmdb_entry_sort_order_keys_hold.  Keys invalidated while they
+ * were held are freed once nothing is holding them.
+ */
+void
+rhythmdb_entry_sort_order_keys_release (void)
+{
+	GSList *keys = NULL;
+
+	G_LOCK (sort_order_keys);
+	g_assert (sort_order_key_holders > 0);
+	if (--sort_order_key_holders == 0) {
+		keys = sort_order_keys_to_free;
+		sort_order_keys_to_free = NULL;
+	}
+	G_UNLOCK (sort_order_keys);
+
+	g_slist_foreach (keys, (GFunc) g_free, NULL);
+	g_slist_free (keys);
+}
+
+static void
+free_sort_order_key (char *key)
+{
+	/* the key has already been detached from its entry, so any thread
+	 * that picked it up must have been holding the keys before now.
+	 */
+	G_LOCK (sort_order_keys);
+	if (sort_order_key_holders > 0) {
+		sort_order_keys_to_free = g_slist_prepend (sort_order_keys_to_free, key);
+		key = NULL;
+	}
+	G_UNLOCK (sort_order_keys);
+
+	g_free (key);
+}
+
+/**
+ * rhythmdb_entry_get_sort_order_key:
+ * @entry: a #RhythmDBEntry
+ * @order: the #RhythmDBSortOrder to return the key for
+ *
+ * Returns a key for @entry that can be compared with strcmp to sort
+ * entries in the specified order.  The key is built the first time it
+ * is requested and cached until one of the properties it is built
+ * from changes.  Off the main thread, the key is only valid while
+ * the keys are held (see #rhythmdb_entry_sort_order_keys_hold).
+ *
+ * Return value: sort key, must not be freed
+ */
+const char *
+rhythmdb_entry_get_sort_order_key (RhythmDBEntry *entry,
+				   RhythmDBSortOrder order)
+{
+	char *key;
+
+	g_return_val_if_fail (entry != NULL, NULL);
+	g_return_val_if_fail (order < RHYTHMDB_NUM_SORT_ORDERS, NULL);
+
+	key = g_atomic_pointer_get (&entry->sort_order_keys[order]);
+	if (key != NULL)
+		return key;
+
+	key = rhythmdb_entry_build_sort_order_key (entry, order);
+	if (g_atomic_pointer_compare_and_exchange (&entry->sort_order_keys[order], NULL, key))
+		return key;
+
+	/* someone else got there first, or the key was invalidated again */
+	g_free (key);
+	return rhythmdb_entry_get_sort_order_key (entry, order);
+}
+
+static void
+rhythmdb_entry_invalidate_sort_order_keys (RhythmDBEntry *entry,
+					   guint propid)
+{
+	int i;
+
+	switch (propid) {
+	case RHYTHMDB_PROP_GENRE:
+	case RHYTHMDB_PROP_ARTIST:
+	case RHYTHMDB_PROP_ALBUM:
+	case RHYTHMDB_PROP_ARTIST_SORTNAME:
+	case RHYTHMDB_PROP_ALBUM_SORTNAME:
+	case RHYTHMDB_PROP_TRACK_NUMBER:
+	case RHYTHMDB_PROP_DISC_NUMBER:
+	case RHYTHMDB_PROP_LOCATION:
+		break;
+	default:
+		return;
+	}
+
+	for (i = 0; i < RHYTHMDB_NUM_SORT_ORDERS; i++) {
+		gpointer old;
+
+		do {
+			old = g_atomic_pointer_get (&entry->sort_order_keys[i]);
+		} while (!g_atomic_pointer_compare_and_exchange (&entry->sort_order_keys[i], old, NULL));
+
+		if (old != NULL)
+			free_sort_order_key (old);
+	}
+}
+
 /**
  * rhythmdb_entry_get_ulong:
  * @entry: a #RhythmDBEntry
@@ -257,6 +257,13 @@ typedef struct {
 	GValue new;
 } RhythmDBEntryChange;
 
+typedef enum {
+	RHYTHMDB_SORT_ORDER_ALBUM,	/* album, disc, track, location */
+	RHYTHMDB_SORT_ORDER_ARTIST,	/* artist, then album order */
+	RHYTHMDB_SORT_ORDER_GENRE,	/* genre, then artist order */
+	RHYTHMDB_NUM_SORT_ORDERS
+} RhythmDBSortOrder;
+
 const char *rhythmdb_entry_get_string	(RhythmDBEntry *entry, RhythmDBPropType propid);
 RBRefString *rhythmdb_entry_get_refstring (RhythmDBEntry *entry, RhythmDBPropType propid);
 char *rhythmdb_entry_dup_string	(RhythmDBEntry *entry, RhythmDBPropType propid);
@@ -265,6 +272,9 @@ guint64 rhythmdb_entry_get_uint64	(RhythmDBEntry *entry, RhythmDBPropType propid
 gulong rhythmdb_entry_get_ulong		(RhythmDBEntry *entry, RhythmDBPropType propid);
 double rhythmdb_entry_get_double	(RhythmDBEntry *entry, RhythmDBPropType propid);
 gpointer rhythmdb_entry_get_pointer     (RhythmDBEntry *entry, RhythmDBPropType propid);
+const char *rhythmdb_entry_get_sort_order_key (RhythmDBEntry *entry, RhythmDBSortOrder order);
+void rhythmdb_entry_sort_order_keys_hold	(void);
+void rhythmdb_entry_sort_order_keys_release	(void);
 
 RhythmDBEntryType rhythmdb_entry_get_entry_type (RhythmDBEntry *entry);
 
@@ -355,6 +365,11 @@ struct _RhythmDBClass
 							 RBRefString *keyword);
 	GList*		(*impl_entry_keywords_get)	(RhythmDB *db,
 							 RhythmDBEntry *entry);
+
+	/* added later; kept at the end so existing members keep their offsets */
+	void	(*entries_deleted)	(RhythmDB *db, GPtrArray *entries);
+	void	(*impl_entry_delete_by_location_prefix) (RhythmDB *db, RhythmDBEntryType type,
+							 const char *prefix, GPtrArray *deleted);
 };
 
 GType		rhythmdb_get_type	(void);
@@ -369,8 +384,10 @@ void		rhythmdb_save		(RhythmDB *db);
 void		rhythmdb_save_async	(RhythmDB *db);
 
 void		rhythmdb_start_action_thread	(RhythmDB *db);
+void		rhythmdb_push_worker_job	(RhythmDB *db, GThreadFunc func, gpointer data);
 
 void		rhythmdb_commit		(RhythmDB *db);
+void		rhythmdb_flush_entry_signals	(RhythmDB *db);
 
 gboolean	rhythmdb_entry_is_editable (RhythmDB *db, RhythmDBEntry *entry);
 
@@ -398,6 +415,9 @@ gpointer	rhythmdb_entry_get_type_data (RhythmDBEntry *entry, guint expected_size
 void		rhythmdb_entry_delete	(RhythmDB *db, RhythmDBEntry *entry);
 void            rhythmdb_entry_delete_by_type (RhythmDB *db,
 					       RhythmDBEntryType type);
+void            rhythmdb_entry_delete_by_location_prefix (RhythmDB *db,
+							  RhythmDBEntryType type,
+							  const char *prefix);
 void		rhythmdb_entry_move_to_trash (RhythmDB *db,
 					      RhythmDBEntry *entry);
 
@@ -465,6 +485,13 @@ void		rhythmdb_do_full_query_async		(RhythmDB *db,
 void		rhythmdb_do_full_query_async_parsed	(RhythmDB *db,
 							 RhythmDBQueryResults *results,
 							 RhythmDBQuery *query);
+void		rhythmdb_do_full_query_async_scheduled	(RhythmDB *db,
+							 gpointer owner,
+							 gint priority,
+							 RhythmDBQueryResults *results,
+							 RhythmDBQuery *query);
+void		rhythmdb_cancel_scheduled_query		(RhythmDB *db,
+							 gpointer owner);
 
 RhythmDBQuery *	rhythmdb_query_parse			(RhythmDB *db, ...);
 void		rhythmdb_query_append			(RhythmDB *db, RhythmDBQuery *query, ...);
@@ -483,6 +510,9 @@ RhythmDBQuery *	rhythmdb_query_deserialize		(RhythmDB *db, xmlNodePtr parent);
 char *		rhythmdb_query_to_string		(RhythmDB *db, RhythmDBQuery *query);
 
 gboolean	rhythmdb_query_is_time_relative		(RhythmDB *db, RhythmDBQuery *query);
+gulong		rhythmdb_query_get_expiry_time		(RhythmDB *db, RhythmDBQuery *query,
+							 RhythmDBEntry *entry, gulong now);
+gboolean	rhythmdb_query_is_subset		(RhythmDB *db, RhythmDBQuery *query, RhythmDBQuery *base);
 
 const xmlChar *	rhythmdb_nice_elt_name_from_propid	(RhythmDB *db, RhythmDBPropType propid);
 int		rhythmdb_propid_from_nice_elt_name	(RhythmDB *db, const xmlChar *name);
@@ -33,6 +33,11 @@
  * Subclasses only need to override get_entry_weight() to return the
  * right weight for a given entry.
  *
+ * The weights of the entries in the query model are kept in a Fenwick tree
+ * (binary indexed tree), so picking an entry takes O(log N) time.  The tree is
+ * updated as entries are added to, removed from or changed in the query model,
+ * and rebuilt when the query model is replaced.
+ *
  * This class also delays committing any changes until the user moves to the
  * next or previous song. So if the user changes the entry-view to contain
  * different songs, but changes it back before the current song finishes, they
@@ -42,6 +47,7 @@
 #include "config.h"
 
 #include <string.h>
+#include <time.h>
 
 #include "rb-play-order-random-by-age.h"
 
@@ -64,16 +70,35 @@ static void rb_random_playing_entry_changed (RBPlayOrder *porder,
 					     RhythmDBEntry *old_entry,
 					     RhythmDBEntry *new_entry);
 static void rb_random_query_model_changed (RBPlayOrder *porder);
+static void rb_random_entry_added (RBPlayOrder *porder, RhythmDBEntry *entry);
+static void rb_random_entry_removed (RBPlayOrder *porder, RhythmDBEntry *entry);
+static void rb_random_entry_changed (RBPlayOrder *porder, RhythmDBEntry *entry);
 static void rb_random_db_entry_deleted (RBPlayOrder *porder, RhythmDBEntry *entry);
 
 static void rb_random_handle_query_model_changed (RBRandomPlayOrder *rorder);
+static void rb_random_clear_weights (RBRandomPlayOrder *rorder);
 static void rb_random_filter_history (RBRandomPlayOrder *rorder, RhythmDBQueryModel *model);
 
+/* weights are recalculated this often (in seconds), as they may depend
+ * on the current time.
+ */
+#define WEIGHT_REFRESH_INTERVAL		(60 * 60)
+
 struct RBRandomPlayOrderPrivate
 {
 	RBHistory *history;
 
 	gboolean query_model_changed;
+
+	/* weighted entry set */
+	gboolean weights_valid;
+	GPtrArray *entries;		/* slot -> entry */
+	GArray *weights;		/* slot -> weight */
+	GHashTable *entry_slots;	/* entry -> slot + 1 */
+	double *tree;			/* fenwick tree over slots, 1-based */
+	guint tree_size;
+	guint tree_updates;
+	time_t weights_time;
 };
 
 G_DEFINE_TYPE (RBRandomPlayOrder, rb_random_play_order, RB_TYPE_PLAY_ORDER)
@@ -90,8 +115,9 @@ rb_random_play_order_class_init (RBRandomPlayOrderClass *klass)
 	porder = RB_PLAY_ORDER_CLASS (klass);
 	porder->db_changed = rb_random_db_changed;
 	porder->playing_entry_changed = rb_random_playing_entry_changed;
-	porder->entry_added = (void (*)(RBPlayOrder*,RhythmDBEntry*))rb_random_query_model_changed;
-	porder->entry_removed = (void (*)(RBPlayOrder*,RhythmDBEntry*))rb_random_query_model_changed;
+	porder->entry_added = rb_random_entry_added;
+	porder->entry_removed = rb_random_entry_removed;
+	porder->entry_changed = rb_random_entry_changed;
 	porder->query_model_changed = rb_random_query_model_changed;
 	porder->db_entry_deleted = rb_random_db_entry_deleted;
 
@@ -115,6 +141,10 @@ rb_random_play_order_init (RBRandomPlayOrder *rorder)
 	rb_history_set_maximum_size (rorder->priv->history, 50);
 
 	rorder->priv->query_model_changed = TRUE;
+
+	rorder->priv->entries = g_ptr_array_new ();
+	rorder->priv->weights = g_array_new (FALSE, FALSE, sizeof (double));
+	rorder->priv->entry_slots = g_hash_table_new (g_direct_hash, g_direct_equal);
 }
 
 static void
@@ -129,6 +159,11 @@ rb_random_play_order_finalize (GObject *object)
 
 	g_object_unref (G_OBJECT (rorder->priv->history));
 
+	rb_random_clear_weights (rorder);
+	g_ptr_array_free (rorder->priv->entries, TRUE);
+	g_array_free (rorder->priv->weights, TRUE);
+	g_hash_table_destroy (rorder->priv->entry_slots);
+
 	G_OBJECT_CLASS (rb_random_play_order_parent_class)->finalize (object);
 }
 
@@ -147,58 +182,266 @@ get_history (RBRandomPlayOrder *rorder)
 	return rorder->priv->history;
 }
 
-typedef struct {
-	RhythmDBEntry *entry;
-	double weight;
-	double cumulative_weight;
-} EntryWeight;
+/*
+ * Fenwick tree over the entry weights.  Slot i of the tree (1-based) holds
+ * the sum of the weights of slots (i - lowbit(i), i], so prefix sums, point
+ * updates and searches by cumulative weight all take O(log N).
+ */
+
+static void
+rb_random_build_tree (RBRandomPlayOrder *rorder, guint size)
+{
+	RBRandomPlayOrderPrivate *priv = rorder->priv;
+	guint i;
+
+	g_free (priv->tree);
+	priv->tree = g_new0 (double, size + 1);
+	priv->tree_size = size;
+
+	for (i = 1; i <= size; i++) {
+		guint parent;
+
+		if (i <= priv->weights->len)
+			priv->tree[i] += g_array_index (priv->weights, double, i - 1);
+
+		parent = i + (i & -i);
+		if (parent <= size)
+			priv->tree[parent] += priv->tree[i];
+	}
+	priv->tree_updates = 0;
+}
+
+static void
+rb_random_tree_update (RBRandomPlayOrder *rorder, guint slot, double delta)
+{
+	RBRandomPlayOrderPrivate *priv = rorder->priv;
+	guint i;
+
+	for (i = slot + 1; i <= priv->tree_size; i += (i & -i))
+		priv->tree[i] += delta;
+	priv->tree_updates++;
+}
+
+static void
+rb_random_check_tree (RBRandomPlayOrder *rorder)
+{
+	RBRandomPlayOrderPrivate *priv = rorder->priv;
+
+	/* rebuild the tree every so often so rounding errors don't build up */
+	if (priv->tree_updates > MAX (1024, priv->weights->len))
+		rb_random_build_tree (rorder, priv->tree_size);
+}
+
+static double
+rb_random_get_total_weight (RBRandomPlayOrder *rorder)
+{
+	RBRandomPlayOrderPrivate *priv = rorder->priv;
+	double total = 0.0;
+	guint i;
+
+	for (i = priv->weights->len; i > 0; i -= (i & -i))
+		total += priv->tree[i];
+
+	return total;
+}
 
-static GArray *
-get_query_model_contents (RBRandomPlayOrder *rorder, RhythmDBQueryModel *model)
+/* returns the slot containing the point @value on the weight line */
+static guint
+rb_random_tree_find (RBRandomPlayOrder *rorder, double value)
 {
-	guint num_entries;
+	RBRandomPlayOrderPrivate *priv = rorder->priv;
+	guint pos = 0;
+	guint mask;
+
+	for (mask = 1; mask * 2 <= priv->tree_size; mask *= 2)
+		;
+
+	for (; mask > 0; mask >>= 1) {
+		guint next = pos + mask;
+		if (next <= priv->tree_size && priv->tree[next] <= value) {
+			pos = next;
+			value -= priv->tree[next];
+		}
+	}
+
+	/* rounding errors could take us past the last entry */
+	return MIN (pos, priv->weights->len - 1);
+}
+
+static void
+rb_random_clear_weights (RBRandomPlayOrder *rorder)
+{
+	RBRandomPlayOrderPrivate *priv = rorder->priv;
 	guint i;
+
+	for (i = 0; i < priv->entries->len; i++)
+		rhythmdb_entry_unref (g_ptr_array_index (priv->entries, i));
+
+	g_ptr_array_set_size (priv->entries, 0);
+	g_array_set_size (priv->weights, 0);
+	g_hash_table_remove_all (priv->entry_slots);
+
+	g_free (priv->tree);
+	priv->tree = NULL;
+	priv->tree_size = 0;
+	priv->weights_valid = FALSE;
+}
+
+static void
+rb_random_append_entry (RBRandomPlayOrder *rorder, RhythmDBEntry *entry, double weight)
+{
+	RBRandomPlayOrderPrivate *priv = rorder->priv;
+
+	g_hash_table_insert (priv->entry_slots, entry, GUINT_TO_POINTER (priv->entries->len + 1));
+	g_ptr_array_add (priv->entries, rhythmdb_entry_ref (entry));
+	g_array_append_val (priv->weights, weight);
+}
+
+static void
+rb_random_rebuild_weights (RBRandomPlayOrder *rorder)
+{
+	RBRandomPlayOrderPrivate *priv = rorder->priv;
+	RhythmDBQueryModel *model;
 	RhythmDB *db;
-	double weight = 0.0;
-	double cumulative_weight = 0.0;
 	GtkTreeIter iter;
-	GArray *result;
+	guint size;
 
-	if (model == NULL) {
-		return NULL;
-	}
+	rb_random_clear_weights (rorder);
 
-	num_entries = gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL);
-	if (num_entries == 0) {
-		return NULL;
+	model = rb_play_order_get_query_model (RB_PLAY_ORDER (rorder));
+	db = rb_play_order_get_db (RB_PLAY_ORDER (rorder));
+	if (model != NULL && gtk_tree_model_get_iter_first (GTK_TREE_MODEL (model), &iter)) {
+		do {
+			RhythmDBEntry *entry = rhythmdb_query_model_iter_to_entry (model, &iter);
+
+			if (entry == NULL)
+				continue;
+
+			rb_random_append_entry (rorder, entry,
+						rb_random_play_order_get_entry_weight (rorder, db, entry));
+			rhythmdb_entry_unref (entry);
+		} while (gtk_tree_model_iter_next (GTK_TREE_MODEL (model), &iter));
 	}
 
-	if (!gtk_tree_model_get_iter_first (GTK_TREE_MODEL (model), &iter))
-		return NULL;
+	/* leave some room for entries to be added */
+	for (size = 64; size < priv->entries->len; size *= 2)
+		;
+	rb_random_build_tree (rorder, size);
+
+	rb_debug ("calculated weights for %d entries", priv->entries->len);
+	time (&priv->weights_time);
+	priv->weights_valid = TRUE;
+}
+
+static void
+rb_random_refresh_weights (RBRandomPlayOrder *rorder)
+{
+	RBRandomPlayOrderPrivate *priv = rorder->priv;
+	RhythmDB *db;
+	guint i;
 
-	i = 0;
-	result = g_array_new (FALSE, FALSE, sizeof (EntryWeight));
-	g_array_set_size (result, num_entries);
 	db = rb_play_order_get_db (RB_PLAY_ORDER (rorder));
-	do {
-		RhythmDBEntry *entry = rhythmdb_query_model_iter_to_entry (model, &iter);
+	for (i = 0; i < priv->entries->len; i++) {
+		g_array_index (priv->weights, double, i) =
+			rb_random_play_order_get_entry_weight (rorder, db, g_ptr_array_index (priv->entries, i));
+	}
+	rb_random_build_tree (rorder, priv->tree_size);
 
-		if (entry == NULL)
-			continue;
+	rb_debug ("recalculated weights for %d entries", priv->entries->len);
+	time (&priv->weights_time);
+}
 
-		weight = rb_random_play_order_get_entry_weight (rorder, db, entry);
+static void
+rb_random_add_weighted_entry (RBRandomPlayOrder *rorder, RhythmDBEntry *entry)
+{
+	RBRandomPlayOrderPrivate *priv = rorder->priv;
+	double weight;
+	guint slot;
 
-		g_array_index (result, EntryWeight, i).entry = entry;
-		g_array_index (result, EntryWeight, i).weight = weight;
-		g_array_index (result, EntryWeight, i).cumulative_weight = cumulative_weight;
-		cumulative_weight += weight;
-		i++;
+	if (!priv->weights_valid || g_hash_table_lookup (priv->entry_slots, entry) != NULL)
+		return;
 
-		rhythmdb_entry_unref (entry);
+	weight = rb_random_play_order_get_entry_weight (rorder,
+							rb_play_order_get_db (RB_PLAY_ORDER (rorder)),
+							entry);
+	slot = priv->entries->len;
+	rb_random_append_entry (rorder, entry, weight);
+
+	if (slot >= priv->tree_size) {
+		rb_random_build_tree (rorder, priv->tree_size * 2);
+	} else {
+		rb_random_tree_update (rorder, slot, weight);
+		rb_random_check_tree (rorder);
+	}
+}
+
+static void
+rb_random_remove_weighted_entry (RBRandomPlayOrder *rorder, RhythmDBEntry *entry)
+{
+	RBRandomPlayOrderPrivate *priv = rorder->priv;
+	gpointer slot_ptr;
+	double weight;
+	guint slot;
+	guint last;
+
+	if (!priv->weights_valid)
+		return;
+
+	slot_ptr = g_hash_table_lookup (priv->entry_slots, entry);
+	if (slot_ptr == NULL)
+		return;
+
+	/* move the last entry into the slot being vacated, so the slots
+	 * stay contiguous.
+	 */
+	slot = GPOINTER_TO_UINT (slot_ptr) - 1;
+	last = priv->entries->len - 1;
+	weight = g_array_index (priv->weights, double, slot);
+	if (slot != last) {
+		RhythmDBEntry *moved = g_ptr_array_index (priv->entries, last);
+		double moved_weight = g_array_index (priv->weights, double, last);
+
+		rb_random_tree_update (rorder, slot, moved_weight - weight);
+		rb_random_tree_update (rorder, last, -moved_weight);
+
+		g_ptr_array_index (priv->entries, slot) = moved;
+		g_array_index (priv->weights, double, slot) = moved_weight;
+		g_hash_table_insert (priv->entry_slots, moved, GUINT_TO_POINTER (slot + 1));
+	} else {
+		rb_random_tree_update (rorder, slot, -weight);
+	}
+
+	g_ptr_array_set_size (priv->entries, last);
+	g_array_set_size (priv->weights, last);
+	g_hash_table_remove (priv->entry_slots, entry);
+	rhythmdb_entry_unref (entry);
+
+	rb_random_check_tree (rorder);
+}
+
+static void
+rb_random_update_entry_weight (RBRandomPlayOrder *rorder, RhythmDBEntry *entry)
+{
+	RBRandomPlayOrderPrivate *priv = rorder->priv;
+	gpointer slot_ptr;
+	double weight;
+	guint slot;
 
-	} while (gtk_tree_model_iter_next (GTK_TREE_MODEL (model), &iter));
+	if (!priv->weights_valid || entry == NULL)
+		return;
 
-	return result;
+	slot_ptr = g_hash_table_lookup (priv->entry_slots, entry);
+	if (slot_ptr == NULL)
+		return;
+
+	slot = GPOINTER_TO_UINT (slot_ptr) - 1;
+	weight = rb_random_play_order_get_entry_weight (rorder,
+							rb_play_order_get_db (RB_PLAY_ORDER (rorder)),
+							entry);
+	rb_random_tree_update (rorder, slot, weight - g_array_index (priv->weights, double, slot));
+	g_array_index (priv->weights, double, slot) = weight;
+
+	rb_random_check_tree (rorder);
 }
 
 static void
@@ -238,75 +481,50 @@ rb_random_filter_history (RBRandomPlayOrder *rorder, RhythmDBQueryModel *model)
 	g_ptr_array_free (history_contents, TRUE);
 }
 
-static inline double
-rb_random_get_total_weight (GArray *weights)
-{
-	EntryWeight *last;
-
-	g_return_val_if_fail (weights, 0.0);
-	if (weights->len == 0)
-		return 0.0;
-
-	last = &g_array_index (weights,
-			       EntryWeight,
-			       weights->len - 1);
-	return last->cumulative_weight + last->weight;
-}
-
 static RhythmDBEntry*
 rb_random_play_order_pick_entry (RBRandomPlayOrder *rorder)
 {
-	/* This is O(N) because we traverse the query model to get the entries
-	 * and weights.
-	 *
-	 * The general idea of this algorithm is that there is a line segment
+	/* The general idea of this algorithm is that there is a line segment
 	 * whose length is the sum of all the entries' weights. Each entry gets
 	 * a sub-segment whose length is equal to that entry's weight. A random
 	 * point is picked in the line segment, and the entry that point
 	 * belongs to is returned.
 	 *
+	 * The weights are kept in a fenwick tree, so this is O(log N) unless
+	 * the weights need to be recalculated.
+	 *
 	 * The algorithm was contributed by treed.
 	 */
+	RBRandomPlayOrderPrivate *priv = rorder->priv;
 	double total_weight, rnd;
-	int high, low;
-	GArray *entry_weights;
-	RhythmDBEntry *entry;
-	RhythmDBQueryModel *model;
+	guint slot;
+	time_t now;
+
+	time (&now);
+	if (!priv->weights_valid) {
+		rb_random_rebuild_weights (rorder);
+	} else if (now - priv->weights_time > WEIGHT_REFRESH_INTERVAL) {
+		rb_random_refresh_weights (rorder);
+	}
 
-	model = rb_play_order_get_query_model (RB_PLAY_ORDER (rorder));
-	entry_weights = get_query_model_contents (rorder, model);
-	if (entry_weights == NULL) {
+	if (priv->entries->len == 0) {
 		rb_debug ("nothing to choose from");
 		return NULL;
 	}
 
-	total_weight = rb_random_get_total_weight (entry_weights);
-	if (total_weight == 0.0) {
-		low = g_random_int_range (0, entry_weights->len);
-		rb_debug ("total weight is 0; picked entry %d of %d randomly", low, entry_weights->len);
-		entry = g_array_index (entry_weights, EntryWeight, low).entry;
-		g_array_free (entry_weights, TRUE);
-		return entry;
+	total_weight = rb_random_get_total_weight (rorder);
+	if (total_weight <= 0.0) {
+		slot = g_random_int_range (0, priv->entries->len);
+		rb_debug ("total weight is 0; picked entry %d of %d randomly", slot, priv->entries->len);
+		return g_ptr_array_index (priv->entries, slot);
 	}
 
 	rnd = g_random_double_range (0, total_weight);
-	/* Binary search for the entry with cumulative weight closest to but
-	 * less than rnd */
-	low = -1; high = entry_weights->len;
-	while (high - low > 1) {
-		int mid = (high + low) / 2;
-		if (g_array_index (entry_weights, EntryWeight, mid).cumulative_weight > rnd)
-			high = mid;
-		else
-			low = mid;
-	}
-	entry = g_array_index (entry_weights, EntryWeight, low).entry;
+	slot = rb_random_tree_find (rorder, rnd);
 	rb_debug ("picked entry %d of %d (total weight %f) for random value %f",
-		  low, entry_weights->len, total_weight, rnd);
-
-	g_array_free (entry_weights, TRUE);
+		  slot, priv->entries->len, total_weight, rnd);
 
-	return entry;
+	return g_ptr_array_index (priv->entries, slot);
 }
 
 static RhythmDBEntry*
@@ -424,6 +642,7 @@ rb_random_db_changed (RBPlayOrder *porder, RhythmDB *db)
 	g_return_if_fail (RB_IS_RANDOM_PLAY_ORDER (porder));
 
 	rb_history_clear (RB_RANDOM_PLAY_ORDER (porder)->priv->history);
+	rb_random_clear_weights (RB_RANDOM_PLAY_ORDER (porder));
 }
 
 static void
@@ -436,6 +655,10 @@ rb_random_playing_entry_changed (RBPlayOrder *porder,
 	g_return_if_fail (RB_IS_RANDOM_PLAY_ORDER (porder));
 	rorder = RB_RANDOM_PLAY_ORDER (porder);
 
+	/* weights may depend on which entry is playing */
+	rb_random_update_entry_weight (rorder, old_entry);
+	rb_random_update_entry_weight (rorder, new_entry);
+
 	if (new_entry) {
 		if (new_entry == rb_history_current (get_history (rorder))) {
 			/* Do nothing */
@@ -451,6 +674,35 @@ rb_random_query_model_changed (RBPlayOrder *porder)
 {
 	g_return_if_fail (RB_IS_RANDOM_PLAY_ORDER (porder));
 	RB_RANDOM_PLAY_ORDER (porder)->priv->query_model_changed = TRUE;
+
+	/* the weights will be calculated again when we next pick an entry */
+	rb_random_clear_weights (RB_RANDOM_PLAY_ORDER (porder));
+}
+
+static void
+rb_random_entry_added (RBPlayOrder *porder, RhythmDBEntry *entry)
+{
+	g_return_if_fail (RB_IS_RANDOM_PLAY_ORDER (porder));
+	RB_RANDOM_PLAY_ORDER (porder)->priv->query_model_changed = TRUE;
+
+	rb_random_add_weighted_entry (RB_RANDOM_PLAY_ORDER (porder), entry);
+}
+
+static void
+rb_random_entry_removed (RBPlayOrder *porder, RhythmDBEntry *entry)
+{
+	g_return_if_fail (RB_IS_RANDOM_PLAY_ORDER (porder));
+	RB_RANDOM_PLAY_ORDER (porder)->priv->query_model_changed = TRUE;
+
+	rb_random_remove_weighted_entry (RB_RANDOM_PLAY_ORDER (porder), entry);
+}
+
+static void
+rb_random_entry_changed (RBPlayOrder *porder, RhythmDBEntry *entry)
+{
+	g_return_if_fail (RB_IS_RANDOM_PLAY_ORDER (porder));
+
+	rb_random_update_entry_weight (RB_RANDOM_PLAY_ORDER (porder), entry);
 }
 
 static void
@@ -463,5 +715,6 @@ rb_random_db_entry_deleted (RBPlayOrder *porder, RhythmDBEntry *entry)
 
 	rorder = RB_RANDOM_PLAY_ORDER (porder);
 	rb_history_remove_entry (rorder->priv->history, entry);
+	rb_random_remove_weighted_entry (rorder, entry);
 }
 
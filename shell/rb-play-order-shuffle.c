@@ -59,6 +59,7 @@ static void rb_shuffle_entry_removed (RBPlayOrder *porder, RhythmDBEntry *entry)
 static void rb_shuffle_query_model_changed (RBPlayOrder *porder);
 static void rb_shuffle_db_entry_deleted (RBPlayOrder *porder, RhythmDBEntry *entry);
 static gboolean query_model_and_history_contents_match (RBShufflePlayOrder *sorder);
+static gboolean query_model_and_history_lengths_match (RBShufflePlayOrder *sorder);
 
 struct RBShufflePlayOrderPrivate
 {
@@ -305,40 +306,6 @@ rb_shuffle_play_order_go_previous (RBPlayOrder* porder)
 	}
 }
 
-static void
-handle_query_model_changed (RBShufflePlayOrder *sorder)
-{
-	GPtrArray *history;
-	RhythmDBQueryModel *model;
-	GtkTreeIter iter;
-	int i;
-
-	if (!sorder->priv->query_model_changed)
-		return;
-
-	g_hash_table_foreach_remove (sorder->priv->entries_added, (GHRFunc) rb_true_function, NULL);
-	g_hash_table_foreach_remove (sorder->priv->entries_removed, (GHRFunc) rb_true_function, NULL);
-
-	/* This simulates removing every entry in the old query model
-	 * and then adding every entry in the new one. */
-	history = rb_history_dump (sorder->priv->history);
-	for (i=0; i < history->len; ++i)
-		rb_shuffle_entry_removed (RB_PLAY_ORDER (sorder), g_ptr_array_index (history, i));
-	g_ptr_array_free (history, TRUE);
-
-	model = rb_play_order_get_query_model (RB_PLAY_ORDER (sorder));
-	if (gtk_tree_model_get_iter_first (GTK_TREE_MODEL (model), &iter)) {
-		do {
-			RhythmDBEntry *entry;
-			entry = rhythmdb_query_model_iter_to_entry (model, &iter);
-			rb_shuffle_entry_added (RB_PLAY_ORDER (sorder), entry);
-			rhythmdb_entry_unref (entry);
-		} while (gtk_tree_model_iter_next (GTK_TREE_MODEL (model), &iter));
-	}
-
-	sorder->priv->query_model_changed = FALSE;
-}
-
 static gboolean
 remove_from_history (RhythmDBEntry *entry, gpointer *unused, RBShufflePlayOrder *sorder)
 {
@@ -368,6 +335,46 @@ add_randomly_to_history (RhythmDBEntry *entry, gpointer *unused, RBShufflePlayOr
 	return TRUE;
 }
 
+static void
+handle_query_model_changed (RBShufflePlayOrder *sorder)
+{
+	GPtrArray *history;
+	RhythmDBQueryModel *model;
+	GtkTreeIter iter;
+	int i;
+
+	if (!sorder->priv->query_model_changed)
+		return;
+
+	/* pending changes from the old query model no longer matter */
+	g_hash_table_foreach_remove (sorder->priv->entries_added, (GHRFunc) rb_true_function, NULL);
+	g_hash_table_foreach_remove (sorder->priv->entries_removed, (GHRFunc) rb_true_function, NULL);
+
+	/* Remove the entries that aren't in the new query model and add the
+	 * ones that weren't in the old one, so entries in both stay where they
+	 * were in the shuffle.
+	 */
+	model = rb_play_order_get_query_model (RB_PLAY_ORDER (sorder));
+	history = rb_history_dump (sorder->priv->history);
+	for (i=0; i < history->len; ++i) {
+		RhythmDBEntry *entry = g_ptr_array_index (history, i);
+		if (model == NULL || !rhythmdb_query_model_entry_to_iter (model, entry, &iter))
+			rb_history_remove_entry (sorder->priv->history, entry);
+	}
+	g_ptr_array_free (history, TRUE);
+
+	if (model != NULL && gtk_tree_model_get_iter_first (GTK_TREE_MODEL (model), &iter)) {
+		do {
+			RhythmDBEntry *entry;
+			entry = rhythmdb_query_model_iter_to_entry (model, &iter);
+			add_randomly_to_history (entry, NULL, sorder);
+			rhythmdb_entry_unref (entry);
+		} while (gtk_tree_model_iter_next (GTK_TREE_MODEL (model), &iter));
+	}
+
+	sorder->priv->query_model_changed = FALSE;
+}
+
 static void
 rb_shuffle_sync_history_with_query_model (RBShufflePlayOrder *sorder)
 {
@@ -398,8 +405,12 @@ rb_shuffle_sync_history_with_query_model (RBShufflePlayOrder *sorder)
 		}
 	}
 
-	/* postconditions */
-	g_assert (query_model_and_history_contents_match (sorder));
+	/* postconditions.  comparing the contents of the history and the query
+	 * model is expensive, so only do that when debugging this file.
+	 */
+	g_assert (query_model_and_history_lengths_match (sorder));
+	if (rb_debug_matches ("query_model_and_history_contents_match", __FILE__))
+		g_assert (query_model_and_history_contents_match (sorder));
 	g_assert (g_hash_table_size (sorder->priv->entries_added) == 0);
 	g_assert (g_hash_table_size (sorder->priv->entries_removed) == 0);
 }
@@ -551,3 +562,16 @@ query_model_and_history_contents_match (RBShufflePlayOrder *sorder)
 	g_ptr_array_free (query_model_contents, TRUE);
 	return result;
 }
+
+static gboolean
+query_model_and_history_lengths_match (RBShufflePlayOrder *sorder)
+{
+	RhythmDBQueryModel *model;
+	int model_length = 0;
+
+	model = rb_play_order_get_query_model (RB_PLAY_ORDER (sorder));
+	if (model != NULL)
+		model_length = gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL);
+
+	return (rb_history_length (sorder->priv->history) == model_length);
+}
@@ -83,6 +83,10 @@ static void rb_play_order_entry_added_cb (GtkTreeModel *model,
 static void rb_play_order_row_deleted_cb (GtkTreeModel *model,
 					  GtkTreePath *path,
 					  RBPlayOrder *porder);
+static void rb_play_order_row_changed_cb (GtkTreeModel *model,
+					  GtkTreePath *path,
+					  GtkTreeIter *iter,
+					  RBPlayOrder *porder);
 static void rb_play_order_query_model_changed_cb (GObject *source,
 						  GParamSpec *arg,
 						  RBPlayOrder *porder);
@@ -206,6 +210,9 @@ rb_play_order_dispose (GObject *object)
 		g_signal_handlers_disconnect_by_func (G_OBJECT (porder->priv->query_model),
 						      G_CALLBACK (rb_play_order_row_deleted_cb),
 						      porder);
+		g_signal_handlers_disconnect_by_func (G_OBJECT (porder->priv->query_model),
+						      G_CALLBACK (rb_play_order_row_changed_cb),
+						      porder);
 		g_object_unref (porder->priv->query_model);
 		porder->priv->query_model = NULL;
 	}
@@ -528,6 +535,9 @@ rb_play_order_query_model_changed (RBPlayOrder *porder)
 		g_signal_handlers_disconnect_by_func (G_OBJECT (porder->priv->query_model),
 						      rb_play_order_row_deleted_cb,
 						      porder);
+		g_signal_handlers_disconnect_by_func (G_OBJECT (porder->priv->query_model),
+						      rb_play_order_row_changed_cb,
+						      porder);
 		g_object_unref (porder->priv->query_model);
 		porder->priv->query_model = NULL;
 	}
@@ -542,6 +552,10 @@ rb_play_order_query_model_changed (RBPlayOrder *porder)
 					 "row-deleted",
 					 G_CALLBACK (rb_play_order_row_deleted_cb),
 					 porder, 0);
+		g_signal_connect_object (G_OBJECT (porder->priv->query_model),
+					 "row-changed",
+					 G_CALLBACK (rb_play_order_row_changed_cb),
+					 porder, 0);
 	}
 
 	if (RB_PLAY_ORDER_GET_CLASS (porder)->query_model_changed)
@@ -616,6 +630,34 @@ rb_play_order_row_deleted_cb (GtkTreeModel *model,
 	rhythmdb_entry_unref (entry);
 }
 
+/**
+ * rb_play_order_row_changed_cb:
+ * @model: #GtkTreeModel
+ * @path: #GtkTreePath for the changed entry
+ * @iter: #GtkTreeIter for the changed entry
+ * @porder: #RBPlayOrder instance
+ *
+ * Called when an entry in the active #RhythmDBQueryModel is modified.
+ * Subclasses should implement entry_changed() if they store any state
+ * derived from the properties of the entries in the #RhythmDBQueryModel.
+ */
+static void
+rb_play_order_row_changed_cb (GtkTreeModel *model,
+			      GtkTreePath *path,
+			      GtkTreeIter *iter,
+			      RBPlayOrder *porder)
+{
+	RhythmDBEntry *entry;
+
+	if (RB_PLAY_ORDER_GET_CLASS (porder)->entry_changed == NULL)
+		return;
+
+	entry = rhythmdb_query_model_iter_to_entry (RHYTHMDB_QUERY_MODEL (model),
+						    iter);
+	RB_PLAY_ORDER_GET_CLASS (porder)->entry_changed (porder, entry);
+	rhythmdb_entry_unref (entry);
+}
+
 static gboolean
 default_has_next (RBPlayOrder *porder)
 {
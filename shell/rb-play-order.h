@@ -138,6 +138,9 @@ struct _RBPlayOrderClass
 
 	/* SIGNALS */
 	void (*have_next_previous_changed) (RBPlayOrder *porder, gboolean have_next, gboolean have_previous);
+
+	/* added later; kept at the end so existing members keep their offsets */
+	void (*entry_changed) (RBPlayOrder *porder, RhythmDBEntry *entry);
 };
 
 GType			rb_play_order_get_type		(void);
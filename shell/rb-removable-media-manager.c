@@ -38,6 +38,7 @@
 #include "config.h"
 
 #include <string.h>
+#include <unistd.h>
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
 #include <gio/gio.h>
@@ -60,6 +61,8 @@
 #include "rb-marshal.h"
 #include "rb-util.h"
 #include "rb-encoder.h"
+#include "rb-preferences.h"
+#include "eel-gconf-extensions.h"
 
 #if !GLIB_CHECK_VERSION(2,22,0)
 #define g_mount_unmount_with_operation_finish g_mount_unmount_finish
@@ -109,6 +112,7 @@ static void uevent_cb (GUdevClient *client, const char *action, GUdevDevice *dev
 #endif
 
 static void do_transfer (RBRemovableMediaManager *manager);
+static void free_transfer_destination (gpointer tdest);
 
 typedef struct
 {
@@ -125,11 +129,13 @@ typedef struct
 	GHashTable *device_mapping;
 	gboolean scanned;
 
-	GAsyncQueue *transfer_queue;
-	gboolean transfer_running;
+	GHashTable *transfer_destinations;
+	GList *running_transfers;
+	gint running_transcodes;
+	gboolean transfer_scheduling;
+	gboolean transfer_reschedule;
 	gint transfer_total;
 	gint transfer_done;
-	double transfer_fraction;
 
 	GVolumeMonitor *volume_monitor;
 	guint mount_added_id;
@@ -253,6 +259,10 @@ rb_removable_media_manager_class_init (RBRemovableMediaManagerClass *klass)
 	 * @total: total number of tracks to transfer
 	 * @progress: fraction of the current track that has been transferred
 	 *
+	 * When several tracks are being transferred at once, their progress
+	 * is combined, so @done + @progress is the number of tracks' worth of
+	 * data transferred so far.
+	 *
 	 * Emitted throughout the track transfer process to allow UI elements
 	 * showing transfer progress to be updated.
 	 */
@@ -350,7 +360,9 @@ rb_removable_media_manager_init (RBRemovableMediaManager *mgr)
 	priv->volume_mapping = g_hash_table_new (NULL, NULL);
 	priv->mount_mapping = g_hash_table_new (NULL, NULL);
 	priv->device_mapping = g_hash_table_new_full (uint64_hash, uint64_equal, g_free, NULL);
-	priv->transfer_queue = g_async_queue_new ();
+	priv->transfer_destinations = g_hash_table_new_full (g_str_hash, g_str_equal,
+							     NULL,
+							     free_transfer_destination);
 
 	/*
 	 * Monitor new (un)mounted file systems to look for new media;
@@ -462,7 +474,7 @@ rb_removable_media_manager_finalize (GObject *object)
 	g_hash_table_destroy (priv->device_mapping);
 	g_hash_table_destroy (priv->volume_mapping);
 	g_hash_table_destroy (priv->mount_mapping);
-	g_async_queue_unref (priv->transfer_queue);
+	g_hash_table_destroy (priv->transfer_destinations);
 
 	G_OBJECT_CLASS (rb_removable_media_manager_parent_class)->finalize (object);
 }
@@ -1081,6 +1093,13 @@ rb_removable_media_manager_scan (RBRemovableMediaManager *manager)
 
 /* Track transfer */
 
+typedef struct {
+	char *key;
+	GQueue *pending_copies;
+	GQueue *pending_transcodes;
+	int running;
+} TransferDestination;
+
 typedef struct {
 	RBRemovableMediaManager *manager;
 	RhythmDBEntry *entry;
@@ -1090,17 +1109,130 @@ typedef struct {
 	GError *error;
 	RBTransferCompleteCallback callback;
 	gpointer userdata;
+
+	TransferDestination *destination;
+	gboolean transcode;
+	double fraction;
 } TransferData;
 
+static void
+free_transfer_data (TransferData *data)
+{
+	g_free (data->dest);
+	rb_list_deep_free (data->mime_types);
+	g_clear_error (&data->error);
+	g_free (data);
+}
+
+static void
+free_transfer_destination (gpointer data)
+{
+	TransferDestination *tdest = data;
+
+	g_queue_foreach (tdest->pending_copies, (GFunc) free_transfer_data, NULL);
+	g_queue_free (tdest->pending_copies);
+	g_queue_foreach (tdest->pending_transcodes, (GFunc) free_transfer_data, NULL);
+	g_queue_free (tdest->pending_transcodes);
+	g_free (tdest->key);
+	g_free (tdest);
+}
+
+static int
+get_max_transcodes (void)
+{
+	static int max_transcodes = 0;
+
+	if (max_transcodes == 0) {
+#if defined(_SC_NPROCESSORS_ONLN)
+		max_transcodes = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+		if (max_transcodes < 1)
+			max_transcodes = 1;
+		rb_debug ("running up to %d transcodes at once", max_transcodes);
+	}
+	return max_transcodes;
+}
+
+/*
+ * Transfers are grouped by the mount they're writing to, so that
+ * copies to one device don't hold up copies to another, and so we
+ * don't have too many copies competing for one device.
+ */
+static char *
+get_destination_key (RBRemovableMediaManager *manager, const char *dest)
+{
+	RBRemovableMediaManagerPrivate *priv = GET_PRIVATE (manager);
+	GHashTableIter iter;
+	gpointer mount;
+	char *key = NULL;
+
+	g_hash_table_iter_init (&iter, priv->mount_mapping);
+	while (g_hash_table_iter_next (&iter, &mount, NULL)) {
+		GFile *root;
+		char *root_uri;
+
+		root = g_mount_get_root (G_MOUNT (mount));
+		root_uri = g_file_get_uri (root);
+		g_object_unref (root);
+
+		if (g_str_has_prefix (dest, root_uri) &&
+		    (key == NULL || strlen (root_uri) > strlen (key))) {
+			g_free (key);
+			key = root_uri;
+		} else {
+			g_free (root_uri);
+		}
+	}
+
+	if (key == NULL) {
+		/* everything else on the same URI scheme is lumped together */
+		key = g_uri_parse_scheme (dest);
+	}
+	return key ? key : g_strdup ("");
+}
+
+static gboolean
+transfer_needs_transcode (RhythmDBEntry *entry, GList *mime_types)
+{
+	const char *entry_mime_type;
+	GList *l;
+
+	/* this only needs to be roughly right, as it's just used to decide
+	 * which limit to apply.  the encoder makes the real decision.
+	 */
+	entry_mime_type = rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_MIMETYPE);
+	if (mime_types == NULL)
+		return g_str_has_prefix (entry_mime_type, "audio/x-raw");
+
+	for (l = mime_types; l != NULL; l = g_list_next (l)) {
+		if (rb_safe_strcmp (entry_mime_type, l->data) == 0)
+			return FALSE;
+	}
+	return TRUE;
+}
+
 static void
 emit_progress (RBRemovableMediaManager *mgr)
 {
 	RBRemovableMediaManagerPrivate *priv = GET_PRIVATE (mgr);
+	double fraction = 0.0;
+	int done;
+	GList *l;
+
+	/* the tracks in progress are added together, so the whole
+	 * tracks count as done and the rest is the fraction.
+	 */
+	for (l = priv->running_transfers; l != NULL; l = l->next) {
+		TransferData *data = l->data;
+		fraction += data->fraction;
+	}
+	done = priv->transfer_done + (int) fraction;
+	fraction -= (int) fraction;
 
 	g_signal_emit (G_OBJECT (mgr), rb_removable_media_manager_signals[TRANSFER_PROGRESS], 0,
-		       priv->transfer_done,
+		       done,
 		       priv->transfer_total,
-		       priv->transfer_fraction);
+		       fraction);
 }
 
 static void
@@ -1115,61 +1247,45 @@ error_cb (RBEncoder *encoder, GError *error, TransferData *data)
 static void
 progress_cb (RBEncoder *encoder, double fraction, TransferData *data)
 {
-	RBRemovableMediaManagerPrivate *priv = GET_PRIVATE (data->manager);
-
-	rb_debug ("transfer progress %f", (float)fraction);
-	priv->transfer_fraction = fraction;
+	rb_debug ("transfer progress %f for %s", (float)fraction, data->dest);
+	data->fraction = fraction;
 	emit_progress (data->manager);
 }
 
 static void
 completed_cb (RBEncoder *encoder, guint64 dest_size, TransferData *data)
 {
-	RBRemovableMediaManagerPrivate *priv = GET_PRIVATE (data->manager);
+	RBRemovableMediaManager *manager = data->manager;
+	RBRemovableMediaManagerPrivate *priv = GET_PRIVATE (manager);
 
 	rb_debug ("completed transferring track to %s", data->dest);
 	(data->callback) (data->entry, data->dest, dest_size, data->error, data->userdata);
 
-	priv->transfer_running = FALSE;
+	priv->running_transfers = g_list_remove (priv->running_transfers, data);
+	data->destination->running--;
+	if (data->transcode)
+		priv->running_transcodes--;
 	priv->transfer_done++;
-	priv->transfer_fraction = 0.0;
-	do_transfer (data->manager);
 
 	g_object_unref (G_OBJECT (encoder));
-	g_free (data->dest);
-	rb_list_deep_free (data->mime_types);
-	g_clear_error (&data->error);
-	g_free (data);
+	free_transfer_data (data);
+
+	do_transfer (manager);
 }
 
 static void
-do_transfer (RBRemovableMediaManager *manager)
+start_transfer (RBRemovableMediaManager *manager, TransferData *data)
 {
 	RBRemovableMediaManagerPrivate *priv = GET_PRIVATE (manager);
-	TransferData *data;
 	RBEncoder *encoder;
 
-	g_assert (rb_is_main_thread ());
-
-	emit_progress (manager);
-
-	if (priv->transfer_running) {
-		rb_debug ("already transferring something");
-		return;
-	}
-
-	data = g_async_queue_try_pop (priv->transfer_queue);
-	if (data == NULL) {
-		rb_debug ("transfer queue is empty");
-		priv->transfer_total = 0;
-		priv->transfer_done = 0;
-		emit_progress (manager);
-		return;
-	}
-
-	priv->transfer_running = TRUE;
-	priv->transfer_fraction = 0.0;
+	priv->running_transfers = g_list_prepend (priv->running_transfers, data);
+	data->destination->running++;
+	if (data->transcode)
+		priv->running_transcodes++;
+	data->fraction = 0.0;
 
+	/* each transfer gets its own encoder, so errors only cancel that transfer */
 	encoder = rb_encoder_new ();
 	g_signal_connect (G_OBJECT (encoder),
 			  "error", G_CALLBACK (error_cb),
@@ -1188,6 +1304,79 @@ do_transfer (RBRemovableMediaManager *manager)
 	}
 }
 
+static gboolean
+remove_idle_destination (gpointer key, TransferDestination *tdest, gpointer nothing)
+{
+	return (tdest->running == 0 &&
+		g_queue_is_empty (tdest->pending_copies) &&
+		g_queue_is_empty (tdest->pending_transcodes));
+}
+
+static void
+do_transfer (RBRemovableMediaManager *manager)
+{
+	RBRemovableMediaManagerPrivate *priv = GET_PRIVATE (manager);
+	GList *destinations;
+	GList *l;
+	TransferData *data;
+	int max_per_destination;
+
+	g_assert (rb_is_main_thread ());
+
+	/* transfers can complete as soon as they're started, in which
+	 * case we get called again from inside the loop below.
+	 */
+	if (priv->transfer_scheduling) {
+		priv->transfer_reschedule = TRUE;
+		return;
+	}
+
+	/* every transfer writes to its destination, so they all count
+	 * against its limit; transcodes are also limited by the number
+	 * of processors.
+	 */
+	max_per_destination = eel_gconf_get_integer (CONF_TRANSFER_MAX_PER_DESTINATION);
+	if (max_per_destination < 1)
+		max_per_destination = 1;
+
+	priv->transfer_scheduling = TRUE;
+	do {
+		priv->transfer_reschedule = FALSE;
+
+		/* completion callbacks may queue more transfers, adding
+		 * destinations as we go, so work from a copy of the list.
+		 */
+		destinations = g_hash_table_get_values (priv->transfer_destinations);
+		for (l = destinations; l != NULL; l = l->next) {
+			TransferDestination *tdest = l->data;
+
+			while (tdest->running < max_per_destination &&
+			       priv->running_transcodes < get_max_transcodes () &&
+			       (data = g_queue_pop_head (tdest->pending_transcodes)) != NULL) {
+				start_transfer (manager, data);
+			}
+
+			while (tdest->running < max_per_destination &&
+			       (data = g_queue_pop_head (tdest->pending_copies)) != NULL) {
+				start_transfer (manager, data);
+			}
+		}
+		g_list_free (destinations);
+	} while (priv->transfer_reschedule);
+	priv->transfer_scheduling = FALSE;
+
+	g_hash_table_foreach_remove (priv->transfer_destinations,
+				     (GHRFunc) remove_idle_destination,
+				     NULL);
+
+	if (g_hash_table_size (priv->transfer_destinations) == 0) {
+		rb_debug ("transfer queue is empty");
+		priv->transfer_total = 0;
+		priv->transfer_done = 0;
+	}
+	emit_progress (manager);
+}
+
 /**
  * rb_removable_media_manager_queue_transfer:
  * @manager: the #RBRemovableMediaManager
@@ -1200,6 +1389,10 @@ do_transfer (RBRemovableMediaManager *manager)
  * Initiates a track transfer.  This will transfer the track identified by the
  * #RhythmDBEntry to the given destination, transcoding it if its
  * current media type is not in the list of acceptable output types.
+ *
+ * Several transfers may run at once: each destination filesystem accepts
+ * up to the number of transfers set in the transfer_max_per_destination
+ * setting, and transcodes are also limited to the number of processors.
  */
 void
 rb_removable_media_manager_queue_transfer (RBRemovableMediaManager *manager,
@@ -1210,7 +1403,9 @@ rb_removable_media_manager_queue_transfer (RBRemovableMediaManager *manager,
 					  gpointer userdata)
 {
 	RBRemovableMediaManagerPrivate *priv = GET_PRIVATE (manager);
+	TransferDestination *tdest;
 	TransferData *data;
+	char *key;
 
 	g_assert (rb_is_main_thread ());
 
@@ -1221,9 +1416,26 @@ rb_removable_media_manager_queue_transfer (RBRemovableMediaManager *manager,
 	data->mime_types = rb_string_list_copy (mime_types);
 	data->callback = callback;
 	data->userdata = userdata;
+	data->transcode = transfer_needs_transcode (entry, mime_types);
+
+	key = get_destination_key (manager, dest);
+	tdest = g_hash_table_lookup (priv->transfer_destinations, key);
+	if (tdest == NULL) {
+		tdest = g_new0 (TransferDestination, 1);
+		tdest->key = key;
+		tdest->pending_copies = g_queue_new ();
+		tdest->pending_transcodes = g_queue_new ();
+		g_hash_table_insert (priv->transfer_destinations, tdest->key, tdest);
+	} else {
+		g_free (key);
+	}
+	data->destination = tdest;
 
-	g_async_queue_push (priv->transfer_queue, data);
+	if (data->transcode) {
+		g_queue_push_tail (tdest->pending_transcodes, data);
+	} else {
+		g_queue_push_tail (tdest->pending_copies, data);
+	}
 	priv->transfer_total++;
 	do_transfer (manager);
 }
-
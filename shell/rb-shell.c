@@ -93,6 +93,8 @@
 
 #include "eggsmclient.h"
 
+#include <dbus/dbus-glib.h>
+
 #define PLAYING_ENTRY_NOTIFY_TIME 4
 
 static void rb_shell_class_init (RBShellClass *klass);
@@ -3518,6 +3520,74 @@ rb_shell_get_song_properties (RBShell *shell,
 	return (*properties != NULL);
 }
 
+static GValue *
+add_statistic (GHashTable *map, const char *key, GType type)
+{
+	GValue *v;
+
+	v = g_slice_new0 (GValue);
+	g_value_init (v, type);
+	g_hash_table_insert (map, g_strdup (key), v);
+	return v;
+}
+
+/**
+ * rb_shell_get_library_location_statistics:
+ * @shell: the #RBShell
+ * @uri: a library location URI
+ * @statistics: returns the statistics for the location
+ * @error: returns error information
+ *
+ * Returns the song count ("songs"), total duration in seconds ("duration"),
+ * total size in bytes ("size"), time of the most recent import ("last-import")
+ * and the number of songs of each media type ("formats") for a library location.
+ *
+ * Return value: %TRUE if the URI is a library location
+ */
+gboolean
+rb_shell_get_library_location_statistics (RBShell *shell,
+					  const char *uri,
+					  GHashTable **statistics,
+					  GError **error)
+{
+	const RBLibraryLocationStats *stats;
+	GHashTable *formats;
+	GHashTableIter iter;
+	gpointer key, value;
+
+	stats = rb_library_stats_lookup (rb_library_source_get_stats (shell->priv->library_source), uri);
+	if (stats == NULL) {
+		g_set_error (error,
+			     RB_SHELL_ERROR,
+			     RB_SHELL_ERROR_NO_SUCH_URI,
+			     _("Not a library location: %s"),
+			     uri);
+		return FALSE;
+	}
+
+	*statistics = g_hash_table_new_full (g_str_hash,
+					     g_str_equal,
+					     (GDestroyNotify) g_free,
+					     (GDestroyNotify) rb_value_free);
+
+	g_value_set_uint (add_statistic (*statistics, "songs", G_TYPE_UINT), stats->n_songs);
+	g_value_set_uint64 (add_statistic (*statistics, "duration", G_TYPE_UINT64), stats->duration);
+	g_value_set_uint64 (add_statistic (*statistics, "size", G_TYPE_UINT64), stats->size);
+	g_value_set_uint64 (add_statistic (*statistics, "last-import", G_TYPE_UINT64), stats->last_import);
+
+	formats = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	g_hash_table_iter_init (&iter, stats->formats);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		g_hash_table_insert (formats, g_strdup (key), value);
+	}
+	g_value_take_boxed (add_statistic (*statistics,
+					   "formats",
+					   dbus_g_type_get_map ("GHashTable", G_TYPE_STRING, G_TYPE_UINT)),
+			    formats);
+
+	return TRUE;
+}
+
 /**
  * rb_shell_set_song_property:
  * @shell: the #RBShell
@@ -122,6 +122,11 @@ gboolean        rb_shell_get_song_properties (RBShell *shell,
 					      GHashTable **properties,
 					      GError **error);
 
+gboolean        rb_shell_get_library_location_statistics (RBShell *shell,
+							  const char *uri,
+							  GHashTable **statistics,
+							  GError **error);
+
 gboolean        rb_shell_set_song_property (RBShell *shell,
 					    const char *uri,
 					    const char *propname,
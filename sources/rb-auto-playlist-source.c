@@ -751,6 +751,11 @@ rb_auto_playlist_source_do_query (RBAutoPlaylistSource *source, gboolean subset)
 	g_assert (priv->cached_all_query);
 
 	if (priv->search_query == NULL) {
+		/* any search still running is no longer wanted */
+		rhythmdb_cancel_scheduled_query (db, source);
+		priv->query_active = FALSE;
+		priv->search_on_completion = FALSE;
+
 		rb_library_browser_set_model (priv->browser,
 					      priv->cached_all_query,
 					      FALSE);
@@ -786,9 +791,11 @@ rb_auto_playlist_source_do_query (RBAutoPlaylistSource *source, gboolean subset)
 		g_signal_connect_object (G_OBJECT (query_model),
 					 "complete", G_CALLBACK (rb_auto_playlist_source_query_complete_cb),
 					 source, 0);
-		rhythmdb_do_full_query_async_parsed (db,
-						     RHYTHMDB_QUERY_RESULTS (query_model),
-						     query);
+		rhythmdb_do_full_query_async_scheduled (db,
+							source,
+							G_PRIORITY_HIGH,
+							RHYTHMDB_QUERY_RESULTS (query_model),
+							query);
 		g_object_unref (query_model);
 	}
 
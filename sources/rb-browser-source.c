@@ -132,6 +132,7 @@ struct RBBrowserSourcePrivate
 	RhythmDBQuery *search_query;
 	RhythmDBPropType search_prop;
 	gboolean populate;
+	gboolean base_model_prepared;
 	gboolean query_active;
 	gboolean search_on_completion;
 	RBSourceSearch *default_search;
@@ -275,6 +276,7 @@ rb_browser_source_dispose (GObject *object)
 	source->priv->dispose_has_run = TRUE;
 
 	if (source->priv->db != NULL) {
+		rhythmdb_cancel_scheduled_query (source->priv->db, source);
 		g_object_unref (source->priv->db);
 		source->priv->db = NULL;
 	}
@@ -566,18 +568,27 @@ rb_browser_source_get_property (GObject *object,
 static void
 cached_all_query_complete_cb (RhythmDBQueryModel *model, RBBrowserSource *source)
 {
+	/* if the base model was released and rebuilt while a search
+	 * was active, the search needs to be run again.
+	 */
+	if (source->priv->search_query != NULL) {
+		rb_browser_source_do_query (source, FALSE);
+		return;
+	}
+
 	rb_library_browser_set_model (source->priv->browser,
 				      source->priv->cached_all_query,
 				      FALSE);
 }
 
 static void
-rb_browser_source_populate (RBBrowserSource *source)
+rb_browser_source_prepare_base_model (RBBrowserSource *source)
 {
 	RhythmDBEntryType *entry_type;
 
-	if (source->priv->populate == FALSE)
+	if (source->priv->base_model_prepared)
 		return;
+	source->priv->base_model_prepared = TRUE;
 
 	/* only connect the model to the browser when it's complete.  this avoids
 	 * thousands of row-added signals, which is ridiculously slow with a11y enabled.
@@ -595,12 +606,83 @@ rb_browser_source_populate (RBBrowserSource *source)
 				RHYTHMDB_QUERY_END);
 	}
 	g_boxed_free (RHYTHMDB_TYPE_ENTRY_TYPE, entry_type);
+}
+
+static void
+rb_browser_source_populate (RBBrowserSource *source)
+{
+	if (source->priv->populate == FALSE)
+		return;
+
+	rb_browser_source_prepare_base_model (source);
 
 	rhythmdb_do_full_query_async_parsed (source->priv->db,
 				      RHYTHMDB_QUERY_RESULTS (source->priv->cached_all_query),
 				      source->priv->base_query);
 }
 
+/**
+ * rb_browser_source_get_base_results:
+ * @source: a #RBBrowserSource
+ *
+ * Returns the results object for the source's base query model, so the
+ * caller can fill it instead of having the source run its own query against
+ * the database.  This allows a parent source to partition the results of
+ * its own query between a set of child sources.  The source must be created
+ * with the populate property set to %FALSE.
+ *
+ * The query is applied to the model before it is returned, so
+ * entries added or changed after this point are picked up by the model itself.
+ * The caller should add the initial set of entries using
+ * #rhythmdb_query_results_add_results and then call
+ * #rhythmdb_query_results_query_complete.
+ *
+ * Return value: the #RhythmDBQueryResults for the base query model
+ */
+RhythmDBQueryResults *
+rb_browser_source_get_base_results (RBBrowserSource *source)
+{
+	g_return_val_if_fail (source->priv->populate == FALSE, NULL);
+
+	rb_browser_source_prepare_base_model (source);
+	rhythmdb_query_results_set_query (RHYTHMDB_QUERY_RESULTS (source->priv->cached_all_query),
+					  source->priv->base_query);
+	return RHYTHMDB_QUERY_RESULTS (source->priv->cached_all_query);
+}
+
+/**
+ * rb_browser_source_release_base_model:
+ * @source: a #RBBrowserSource
+ *
+ * Drops the contents of the source's base query model, along with the
+ * property models and filtered models built from it.  The source shows
+ * nothing until its base model is filled again using
+ * #rb_browser_source_get_base_results.  The source must be created with
+ * the populate property set to %FALSE.
+ */
+void
+rb_browser_source_release_base_model (RBBrowserSource *source)
+{
+	RhythmDBQueryModel *model;
+
+	g_return_if_fail (source->priv->populate == FALSE);
+
+	if (source->priv->base_model_prepared == FALSE)
+		return;
+
+	rb_debug ("releasing base query model for source %p", source);
+	g_signal_handlers_disconnect_by_func (source->priv->cached_all_query,
+					      G_CALLBACK (cached_all_query_complete_cb),
+					      source);
+	g_object_unref (source->priv->cached_all_query);
+	source->priv->cached_all_query = rhythmdb_query_model_new_empty (source->priv->db);
+	source->priv->base_model_prepared = FALSE;
+
+	model = rhythmdb_query_model_new_empty (source->priv->db);
+	rb_library_browser_set_model (source->priv->browser, model, FALSE);
+	g_object_unref (model);
+}
+
 static void
 browse_property (RBBrowserSource *source, RhythmDBPropType prop)
 {
@@ -916,6 +998,11 @@ rb_browser_source_do_query (RBBrowserSource *source, gboolean subset)
 
 	/* use the cached 'all' query to optimise the no-search case */
 	if (source->priv->search_query == NULL) {
+		/* any search still running is no longer wanted */
+		rhythmdb_cancel_scheduled_query (source->priv->db, source);
+		source->priv->query_active = FALSE;
+		source->priv->search_on_completion = FALSE;
+
 		rb_library_browser_set_model (source->priv->browser,
 					      source->priv->cached_all_query,
 					      FALSE);
@@ -930,6 +1017,26 @@ rb_browser_source_do_query (RBBrowserSource *source, gboolean subset)
 				source->priv->search_query,
 				RHYTHMDB_QUERY_END);
 
+	if (source->priv->query_active == FALSE) {
+		/* if the new query can only match a subset of the current search results,
+		 * filter the search results in place.  the cached 'all' query has to stay
+		 * intact, so this only applies when a search is already active.
+		 */
+		RhythmDBQueryModel *old;
+		gboolean refined = FALSE;
+
+		g_object_get (source->priv->browser, "input-model", &old, NULL);
+		if (old != NULL && old != source->priv->cached_all_query)
+			refined = rhythmdb_query_model_refine_query (old, query);
+		if (old != NULL)
+			g_object_unref (old);
+
+		if (refined) {
+			rhythmdb_query_free (query);
+			return;
+		}
+	}
+
 	if (subset) {
 		/* if we're appending text to an existing search string, the results will be a subset
 		 * of the existing results, so rather than doing a whole new query, we can copy the
@@ -956,9 +1063,14 @@ rb_browser_source_do_query (RBBrowserSource *source, gboolean subset)
 		g_signal_connect_object (query_model,
 					 "complete", G_CALLBACK (rb_browser_source_query_complete_cb),
 					 source, 0);
-		rhythmdb_do_full_query_async_parsed (source->priv->db,
-						     RHYTHMDB_QUERY_RESULTS (query_model),
-						     query);
+		/* the user is waiting for this one, and it replaces any earlier
+		 * search that hasn't finished yet.
+		 */
+		rhythmdb_do_full_query_async_scheduled (source->priv->db,
+							source,
+							G_PRIORITY_HIGH,
+							RHYTHMDB_QUERY_RESULTS (query_model),
+							query);
 		g_object_unref (query_model);
 	}
 
@@ -72,6 +72,9 @@ GType		rb_browser_source_get_type		(void);
 char *		rb_browser_source_get_paned_key		(RBBrowserSource *source);
 gboolean	rb_browser_source_has_drop_support	(RBBrowserSource *source);
 
+RhythmDBQueryResults *rb_browser_source_get_base_results (RBBrowserSource *source);
+void		rb_browser_source_release_base_model	(RBBrowserSource *source);
+
 G_END_DECLS
 
 #endif /* __RB_BROWSER_SOURCE_H */
@@ -42,8 +42,11 @@
 #include "rb-preferences.h"
 #include "rb-library-file-helpers.h"
 #include "rb-removable-media-manager.h"
+#include "rb-shell-player.h"
 #include "rb-browser-source.h"
 #include "rb-library-child-source.h"
+#include "rb-library-source.h"
+#include "rb-library-stats.h"
 
 static void rb_library_child_source_init (RBLibraryChildSource *source);
 static void rb_library_child_source_finalize (GObject *object);
@@ -57,10 +60,6 @@ static void rb_library_child_source_get_property (GObject *object,
 							GParamSpec *pspec);
 
 static char *get_state_dir (const char *uri);
-static gboolean delete_entry (GtkTreeModel *model,
-				GtkTreePath *path,
-				GtkTreeIter *iter,
-				RhythmDB *db);
 
 /* RBSource implementations */
 static char *impl_get_browser_key (RBSource *source);
@@ -68,6 +67,11 @@ static char *impl_get_paned_key (RBBrowserSource *source);
 static gboolean impl_receive_drag (RBSource *source, GtkSelectionData *data);
 static gboolean impl_can_paste (RBSource *asource);
 static void impl_paste (RBSource *source, GList *entries);
+static void impl_get_status (RBSource *source, char **text, char **progress_text, float *progress);
+static void impl_activate (RBSource *source);
+static void impl_deactivate (RBSource *source);
+static void impl_delete_thyself (RBSource *source);
+static void schedule_release (RBLibraryChildSource *source);
 
 #define CONF_STATE_LIBRARY_DIR CONF_PREFIX "/state/library" /* Move this one to rb-preferences.h? */
 #define CONF_STATE_LIBRARY_CHILD_SORTING "/sorting"
@@ -80,6 +84,13 @@ struct _RBLibraryChildSourcePrivate
 
 	char *browser_key;
 	char *paned_key;
+
+	RBLibraryStats *stats;
+
+	RBLibrarySource *parent;
+	gboolean populated;
+	gboolean selected;
+	guint release_id;
 };
 
 enum
@@ -107,6 +118,10 @@ rb_library_child_source_class_init (RBLibraryChildSourceClass *klass)
 	source_class->impl_can_copy = (RBSourceFeatureFunc) rb_true_function;
 	source_class->impl_can_paste = (RBSourceFeatureFunc) impl_can_paste;
 	source_class->impl_paste = impl_paste;
+	source_class->impl_get_status = impl_get_status;
+	source_class->impl_activate = impl_activate;
+	source_class->impl_deactivate = impl_deactivate;
+	source_class->impl_delete_thyself = impl_delete_thyself;
 
 	browser_source_class->impl_get_paned_key = impl_get_paned_key;
 	browser_source_class->impl_has_drop_support = (RBBrowserSourceFeatureFunc) rb_true_function;
@@ -144,6 +159,10 @@ rb_library_child_source_finalize (GObject *object)
 	g_free (source->priv->browser_key);
 	g_free (source->priv->paned_key);
 
+	if (source->priv->stats != NULL) {
+		g_object_unref (source->priv->stats);
+	}
+
 	G_OBJECT_CLASS (rb_library_child_source_parent_class)->finalize (object);
 }
 
@@ -229,6 +248,14 @@ get_display_name_for_file (GFile *file)
 	return name;
 }
 
+static void
+library_stats_changed_cb (RBLibraryStats *stats, const char *location, RBLibraryChildSource *source)
+{
+	if (strcmp (location, source->priv->uri) == 0) {
+		rb_source_notify_status_changed (RB_SOURCE (source));
+	}
+}
+
 RBSource *
 rb_library_child_source_new (RBSource *parent_source, const char *uri)
 {
@@ -279,8 +306,17 @@ rb_library_child_source_new (RBSource *parent_source, const char *uri)
 					"source-group", RB_SOURCE_GROUP_LIBRARY,
 					"icon", icon,
 					"query", query,
+					"populate", FALSE,	/* filled by the parent source */
 					NULL));
 
+	RB_LIBRARY_CHILD_SOURCE (source)->priv->parent = RB_LIBRARY_SOURCE (parent_source);
+	RB_LIBRARY_CHILD_SOURCE (source)->priv->stats =
+		g_object_ref (rb_library_source_get_stats (RB_LIBRARY_SOURCE (parent_source)));
+	g_signal_connect_object (RB_LIBRARY_CHILD_SOURCE (source)->priv->stats,
+				 "changed",
+				 G_CALLBACK (library_stats_changed_cb),
+				 source, 0);
+
 	g_free (name);
 	g_object_unref (shell);
 	rhythmdb_query_free (query);
@@ -437,6 +473,8 @@ impl_paste (RBSource *asource, GList *entries)
 		return;
 	}
 
+	rb_library_child_source_ensure_populated (source);
+
 	g_object_get (source,
 		      "shell", &shell,
 		      "entry-type", &source_entry_type,
@@ -493,36 +531,12 @@ impl_paste (RBSource *asource, GList *entries)
 	g_object_unref (db);
 }
 
-static gboolean
-delete_entry (GtkTreeModel *model,
-		GtkTreePath *path,
-		GtkTreeIter *iter,
-		RhythmDB *db)
-{
-	RhythmDBEntry *entry;
-	int position;
-
-	gtk_tree_model_get (model, iter, 0, &entry, 1, &position, -1);
-
-	rb_debug ("deleting: %2d - '%s' - '%s' - '%s'",
-			position,
-			rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_ARTIST),
-			rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_ALBUM),
-			rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_TITLE));
-
-	rhythmdb_entry_delete (db, entry);
-
-	rhythmdb_entry_unref (entry);
-
-	return FALSE;
-}
-
 void
 rb_library_child_source_remove_songs_and_state (RBLibraryChildSource *source)
 {
 	RBShell *shell;
-	RhythmDBQueryModel *model;
 	RhythmDB *db;
+	RhythmDBEntryType entry_type;
 	char *uri;
 	char *state_dir;
 
@@ -530,17 +544,17 @@ rb_library_child_source_remove_songs_and_state (RBLibraryChildSource *source)
 
 	g_object_get (source,
 			"shell", &shell,
-			"base-query-model", &model,
 			"uri", &uri,
+			"entry-type", &entry_type,
 			NULL);
 	g_object_get (shell, "db", &db, NULL);
 	g_object_unref (shell);
 
-	/* remove songs from db */
-	gtk_tree_model_foreach (GTK_TREE_MODEL (model),
-			(GtkTreeModelForeachFunc)delete_entry,
-			db);
-	rhythmdb_commit (db);
+	/* remove songs from db; our own model may not be populated, so
+	 * this goes by location rather than walking the model.
+	 */
+	rhythmdb_entry_delete_by_location_prefix (db, entry_type, uri);
+	g_boxed_free (RHYTHMDB_TYPE_ENTRY_TYPE, entry_type);
 	g_object_unref (db);
 
 	state_dir = get_state_dir (uri);
@@ -551,3 +565,143 @@ rb_library_child_source_remove_songs_and_state (RBLibraryChildSource *source)
 	eel_gconf_suggest_sync ();
 	g_free (state_dir);
 }
+
+static void
+impl_get_status (RBSource *source, char **text, char **progress_text, float *progress)
+{
+	RBLibraryChildSource *csource = RB_LIBRARY_CHILD_SOURCE (source);
+	RhythmDBQueryModel *query_model;
+	RhythmDBQueryModel *base_model;
+	char *status = NULL;
+
+	RB_SOURCE_CLASS (rb_library_child_source_parent_class)->impl_get_status (source, text, progress_text, progress);
+
+	/* when nothing is filtered, the location statistics describe
+	 * exactly what the source is showing.  they also stand in for the
+	 * contents of the source while it isn't populated.
+	 */
+	g_object_get (source,
+		      "query-model", &query_model,
+		      "base-query-model", &base_model,
+		      NULL);
+	if (csource->priv->populated == FALSE || query_model == base_model) {
+		status = rb_library_stats_compute_status (csource->priv->stats, csource->priv->uri);
+	}
+	if (status != NULL) {
+		g_free (*text);
+		*text = status;
+	}
+
+	if (query_model != NULL) {
+		g_object_unref (query_model);
+	}
+	if (base_model != NULL) {
+		g_object_unref (base_model);
+	}
+}
+
+static gboolean
+release_timeout_cb (RBLibraryChildSource *source)
+{
+	RBShell *shell;
+	RBSource *playing_source;
+
+	GDK_THREADS_ENTER ();
+
+	source->priv->release_id = 0;
+
+	/* keep the contents around while the player is using them */
+	g_object_get (source, "shell", &shell, NULL);
+	playing_source = rb_shell_player_get_playing_source (RB_SHELL_PLAYER (rb_shell_get_player (shell)));
+	g_object_unref (shell);
+
+	if (playing_source == RB_SOURCE (source)) {
+		schedule_release (source);
+	} else if (source->priv->selected == FALSE && source->priv->populated) {
+		rb_debug ("releasing contents of child source for '%s'", source->priv->uri);
+		source->priv->populated = FALSE;
+		rb_library_source_release_child_source (source->priv->parent, source);
+	}
+
+	GDK_THREADS_LEAVE ();
+	return FALSE;
+}
+
+static void
+schedule_release (RBLibraryChildSource *source)
+{
+	int delay;
+
+	if (source->priv->release_id != 0) {
+		g_source_remove (source->priv->release_id);
+		source->priv->release_id = 0;
+	}
+
+	if (eel_gconf_get_boolean (CONF_LIBRARY_LAZY_CHILD_SOURCES) == FALSE)
+		return;
+
+	delay = eel_gconf_get_integer (CONF_LIBRARY_CHILD_RELEASE_DELAY);
+	if (delay <= 0)
+		return;
+
+	source->priv->release_id = g_timeout_add_seconds (delay, (GSourceFunc) release_timeout_cb, source);
+}
+
+/**
+ * rb_library_child_source_ensure_populated:
+ * @source: a #RBLibraryChildSource
+ *
+ * Makes sure the contents of the child source are loaded.  When child
+ * sources are loaded lazily, this is done when the source is selected
+ * or used as a paste or move target.  If the source isn't selected, its
+ * contents will be released again once it has been idle for a while.
+ */
+void
+rb_library_child_source_ensure_populated (RBLibraryChildSource *source)
+{
+	if (source->priv->populated == FALSE) {
+		rb_debug ("populating child source for '%s'", source->priv->uri);
+		source->priv->populated = TRUE;
+		rb_library_source_populate_child_source (source->priv->parent, source);
+	}
+
+	if (source->priv->selected == FALSE) {
+		schedule_release (source);
+	}
+}
+
+static void
+impl_activate (RBSource *asource)
+{
+	RBLibraryChildSource *source = RB_LIBRARY_CHILD_SOURCE (asource);
+
+	source->priv->selected = TRUE;
+	if (source->priv->release_id != 0) {
+		g_source_remove (source->priv->release_id);
+		source->priv->release_id = 0;
+	}
+
+	rb_library_child_source_ensure_populated (source);
+}
+
+static void
+impl_deactivate (RBSource *asource)
+{
+	RBLibraryChildSource *source = RB_LIBRARY_CHILD_SOURCE (asource);
+
+	source->priv->selected = FALSE;
+	schedule_release (source);
+}
+
+static void
+impl_delete_thyself (RBSource *asource)
+{
+	RBLibraryChildSource *source = RB_LIBRARY_CHILD_SOURCE (asource);
+
+	if (source->priv->release_id != 0) {
+		g_source_remove (source->priv->release_id);
+		source->priv->release_id = 0;
+	}
+
+	RB_SOURCE_CLASS (rb_library_child_source_parent_class)->impl_delete_thyself (asource);
+}
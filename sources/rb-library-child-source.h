@@ -56,6 +56,7 @@ typedef struct
 GType		rb_library_child_source_get_type 	(void);
 RBSource *	rb_library_child_source_new		(RBSource *parent_source, const char *uri);
 void		rb_library_child_source_remove_songs_and_state (RBLibraryChildSource *source);
+void		rb_library_child_source_ensure_populated (RBLibraryChildSource *source);
 G_END_DECLS
 
 #endif /* __RB_LIBRARY_CHILD_SOURCE_H */
@@ -137,6 +137,33 @@ rb_library_prefs_locations_column_cell_data_func (GtkTreeViewColumn *column,
 	g_free (escaped_uri);
 }
 
+static void
+rb_library_prefs_songs_column_cell_data_func (GtkTreeViewColumn *column,
+		GtkCellRenderer *cell,
+		GtkTreeModel *model,
+		GtkTreeIter *iter,
+		RBLibrarySource *source)
+{
+	char *uri;
+	char *status;
+
+	gtk_tree_model_get (model, iter, LOCATION_COLUMN_PATH, &uri, -1);
+	status = rb_library_stats_compute_status (source->priv->stats, uri);
+	g_free (uri);
+
+	g_object_set (cell, "text", status ? status : "", NULL);
+	g_free (status);
+}
+
+static void
+rb_library_prefs_stats_changed_cb (RBLibraryStats *stats,
+		const char *location,
+		RBLibrarySource *source)
+{
+	if (source->priv->locations_tree != NULL)
+		gtk_widget_queue_draw (source->priv->locations_tree);
+}
+
 GtkWidget *
 rb_library_prefs_get_config_widget (RBSource *asource, RBShellPreferences *prefs)
 {
@@ -188,6 +215,21 @@ rb_library_prefs_get_config_widget (RBSource *asource, RBShellPreferences *prefs
 	gtk_tree_view_column_set_expand (column, TRUE);
 	gtk_tree_view_append_column (GTK_TREE_VIEW (source->priv->locations_tree), column);
 
+	cell = gtk_cell_renderer_text_new ();
+	column = gtk_tree_view_column_new ();
+	gtk_tree_view_column_pack_start (column, cell, TRUE);
+	gtk_tree_view_column_set_title (column, _("Songs"));
+	gtk_tree_view_column_set_cell_data_func (column,
+			cell,
+			(GtkTreeCellDataFunc) rb_library_prefs_songs_column_cell_data_func,
+			source,
+			NULL);
+	gtk_tree_view_append_column (GTK_TREE_VIEW (source->priv->locations_tree), column);
+	g_signal_connect_object (source->priv->stats,
+			"changed",
+			G_CALLBACK (rb_library_prefs_stats_changed_cb),
+			source, 0);
+
 	cell = gtk_cell_renderer_toggle_new ();
 	gtk_cell_renderer_toggle_set_radio (GTK_CELL_RENDERER_TOGGLE (cell), TRUE);
 	g_signal_connect (G_OBJECT (cell),
@@ -162,6 +162,11 @@ rb_library_source_dispose (GObject *object)
 		source->priv->shell_prefs = NULL;
 	}
 
+	if (source->priv->stats) {
+		g_object_unref (source->priv->stats);
+		source->priv->stats = NULL;
+	}
+
 	if (source->priv->db) {
 		g_object_unref (source->priv->db);
 		source->priv->db = NULL;
@@ -212,6 +217,9 @@ rb_library_source_dispose (GObject *object)
 		source->priv->monitor_library_locations_notify_id = 0;
 	}
 
+	g_list_free (source->priv->unpartitioned_child_sources);
+	source->priv->unpartitioned_child_sources = NULL;
+
 	G_OBJECT_CLASS (rb_library_source_parent_class)->dispose (object);
 }
 
@@ -281,6 +289,117 @@ add_child_sources_idle (RBLibrarySource *source)
 	return FALSE;
 }
 
+/*
+ * Child sources don't run their own queries.  Instead, the entries in the
+ * library source's base query model are split between the child sources
+ * by location in a single pass, once the base query model is complete.
+ * After that, each child model follows database changes using its own
+ * query, so entries added to, removed from or moved between library
+ * locations end up in the right child source.
+ */
+static void
+partition_base_model (RBLibrarySource *source, GList *child_sources)
+{
+	RhythmDBQueryModel *base_model;
+	GtkTreeIter iter;
+	GPtrArray **results;
+	char **roots;
+	GList *l;
+	guint n_children;
+	guint i;
+
+	n_children = g_list_length (child_sources);
+	if (n_children == 0)
+		return;
+
+	roots = g_new0 (char *, n_children);
+	results = g_new0 (GPtrArray *, n_children);
+	for (l = child_sources, i = 0; l != NULL; l = l->next, i++) {
+		g_object_get (l->data, "uri", &roots[i], NULL);
+		results[i] = g_ptr_array_new ();
+	}
+
+	g_object_get (source, "base-query-model", &base_model, NULL);
+	if (gtk_tree_model_get_iter_first (GTK_TREE_MODEL (base_model), &iter)) {
+		do {
+			RhythmDBEntry *entry;
+			const char *location;
+
+			entry = rhythmdb_query_model_iter_to_entry (base_model, &iter);
+			location = rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LOCATION);
+			for (i = 0; i < n_children; i++) {
+				if (g_str_has_prefix (location, roots[i])) {
+					g_ptr_array_add (results[i], entry);
+				}
+			}
+			rhythmdb_entry_unref (entry);
+		} while (gtk_tree_model_iter_next (GTK_TREE_MODEL (base_model), &iter));
+	}
+
+	for (l = child_sources, i = 0; l != NULL; l = l->next, i++) {
+		RhythmDBQueryResults *child_results;
+
+		rb_debug ("routing %d entries to child source for '%s'", results[i]->len, roots[i]);
+		child_results = rb_browser_source_get_base_results (RB_BROWSER_SOURCE (l->data));
+		rhythmdb_query_results_add_results (child_results, results[i]);
+		rhythmdb_query_results_query_complete (child_results);
+		g_free (roots[i]);
+	}
+
+	g_object_unref (base_model);
+	g_free (results);
+	g_free (roots);
+}
+
+/**
+ * rb_library_source_populate_child_source:
+ * @source: the #RBLibrarySource
+ * @child_source: one of its child sources
+ *
+ * Fills the base query model of a child source with the entries from
+ * the library source's base query model that are under its location.
+ * If the library source's own query hasn't finished yet, this happens
+ * when it does.
+ */
+void
+rb_library_source_populate_child_source (RBLibrarySource *source, RBLibraryChildSource *child_source)
+{
+	if (source->priv->base_model_complete) {
+		GList *l = g_list_prepend (NULL, child_source);
+		partition_base_model (source, l);
+		g_list_free (l);
+	} else if (g_list_find (source->priv->unpartitioned_child_sources, child_source) == NULL) {
+		source->priv->unpartitioned_child_sources =
+			g_list_prepend (source->priv->unpartitioned_child_sources, child_source);
+	}
+}
+
+/**
+ * rb_library_source_release_child_source:
+ * @source: the #RBLibrarySource
+ * @child_source: one of its child sources
+ *
+ * Cancels any pending fill of the child source's base query model
+ * and releases its contents.
+ */
+void
+rb_library_source_release_child_source (RBLibrarySource *source, RBLibraryChildSource *child_source)
+{
+	source->priv->unpartitioned_child_sources =
+		g_list_remove (source->priv->unpartitioned_child_sources, child_source);
+	rb_browser_source_release_base_model (RB_BROWSER_SOURCE (child_source));
+}
+
+static void
+base_model_complete_cb (RhythmDBQueryModel *model, RBLibrarySource *source)
+{
+	source->priv->base_model_complete = TRUE;
+
+	partition_base_model (source, source->priv->unpartitioned_child_sources);
+	g_list_free (source->priv->unpartitioned_child_sources);
+	source->priv->unpartitioned_child_sources = NULL;
+}
+
 static void
 db_load_complete_cb (RhythmDB *db, RBLibrarySource *source)
 {
@@ -294,6 +413,7 @@ rb_library_source_constructed (GObject *object)
 	RBLibrarySource *source;
 	RBShell *shell;
 	RBEntryView *songs;
+	RhythmDBQueryModel *base_model;
 	GSList *list, *monitor_locations;
 
 	RB_CHAIN_GOBJECT_METHOD (rb_library_source_parent_class, constructed, object);
@@ -302,8 +422,14 @@ rb_library_source_constructed (GObject *object)
 	g_object_get (source, "shell", &shell, NULL);
 	g_object_get (shell, "db", &source->priv->db, NULL);
 
+	source->priv->stats = rb_library_stats_new (source->priv->db, RHYTHMDB_ENTRY_TYPE_SONG);
+
 	g_signal_connect_object (source->priv->db, "load-complete", G_CALLBACK (db_load_complete_cb), source, 0);
 
+	g_object_get (source, "base-query-model", &base_model, NULL);
+	g_signal_connect_object (base_model, "complete", G_CALLBACK (base_model_complete_cb), source, 0);
+	g_object_unref (base_model);
+
 	rb_library_prefs_ui_prefs_sync (source);
 
 	/* Set up a library location if there's no library location set */
@@ -567,38 +693,205 @@ paste_completed_cb (RhythmDBEntry *entry, const char *dest, guint64 dest_size, G
 	}
 }
 
-static void
-move_completed_cb (RhythmDBEntry *entry, const char *dest, GError *transfer_error, RBLibrarySource *source)
+/*
+ * Moving files between library locations doesn't go through the
+ * transfer queue.  The files are renamed where possible, or copied
+ * and then deleted where the locations are on different filesystems,
+ * and the existing entries are pointed at the new locations, so
+ * nothing needs to be imported again and play counts, ratings etc.
+ * are kept.  Each entry is pointed at its new location as soon as its
+ * file has been moved, as the library monitor may notice the new file
+ * before the rest of the batch is done.
+ */
+
+#define MOVE_THREADS	4
+
+typedef struct {
+	RBLibrarySource *source;
+	GPtrArray *items;
+	GThreadPool *pool;
+	volatile gint remaining;
+} RBLibraryMoveBatch;
+
+typedef struct {
+	RBLibraryMoveBatch *batch;
+	RhythmDBEntry *entry;
+	char *src;
+	char *dest;
+	char *mount_point;
+	GError *error;
+} RBLibraryMoveItem;
+
+static gboolean
+move_file (GFile *src, GFile *dest, GError **error)
 {
-	if (transfer_error != NULL) {
-		if (g_error_matches (transfer_error, G_IO_ERROR, G_IO_ERROR_EXISTS)) {
-			rb_debug ("not displaying 'file exists' error for %s", dest);
-		} else {
-			rb_error_dialog (NULL, _("Error moving track"), "%s", transfer_error->message);
+	GError *move_error = NULL;
+	GFile *parent;
+
+	/* files aren't overwritten, so existing files are reported as errors */
+	parent = g_file_get_parent (dest);
+	if (parent != NULL) {
+		GError *dir_error = NULL;
+		if (g_file_make_directory_with_parents (parent, NULL, &dir_error) == FALSE) {
+			if (g_error_matches (dir_error, G_IO_ERROR, G_IO_ERROR_EXISTS) == FALSE) {
+				g_propagate_error (error, dir_error);
+				g_object_unref (parent);
+				return FALSE;
+			}
+			g_error_free (dir_error);
 		}
-		return;
+		g_object_unref (parent);
 	}
 
-	char *uri;
-	GFile *file;
-	GError *err = NULL;
-
-	uri = g_strdup (rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LOCATION));
-	rhythmdb_entry_delete (source->priv->db, entry);
-	rhythmdb_add_uri (source->priv->db, dest);
-
-	file = g_file_new_for_uri (uri);
-	if (! g_file_delete (file, NULL, &err)) {
-		if (err != NULL) {
-			rb_debug ("Could not delete '%s': %s",
-					uri, err->message);
-			g_error_free (err);
+	/* try a rename first */
+	if (g_file_move (src, dest,
+			 G_FILE_COPY_NO_FALLBACK_FOR_MOVE | G_FILE_COPY_ALL_METADATA,
+			 NULL, NULL, NULL, &move_error)) {
+		return TRUE;
+	}
+
+	if (g_error_matches (move_error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED) == FALSE &&
+	    g_error_matches (move_error, G_IO_ERROR, G_IO_ERROR_WOULD_RECURSE) == FALSE) {
+		g_propagate_error (error, move_error);
+		return FALSE;
+	}
+	g_error_free (move_error);
+
+	/* different filesystems, so copy the file and delete the original */
+	if (g_file_copy (src, dest, G_FILE_COPY_ALL_METADATA, NULL, NULL, NULL, &move_error) == FALSE) {
+		/* don't leave partial copies lying around, but don't
+		 * delete a file that was already there either.
+		 */
+		if (g_error_matches (move_error, G_IO_ERROR, G_IO_ERROR_EXISTS) == FALSE)
+			g_file_delete (dest, NULL, NULL);
+		g_propagate_error (error, move_error);
+		return FALSE;
+	}
+
+	move_error = NULL;
+	if (g_file_delete (src, NULL, &move_error) == FALSE) {
+		char *uri = g_file_get_uri (src);
+		rb_debug ("Could not delete '%s': %s", uri, move_error->message);
+		g_error_free (move_error);
+		g_free (uri);
+	}
+	return TRUE;
+}
+
+static void
+free_move_item (RBLibraryMoveItem *item)
+{
+	rhythmdb_entry_unref (item->entry);
+	g_free (item->src);
+	g_free (item->dest);
+	g_free (item->mount_point);
+	if (item->error != NULL)
+		g_error_free (item->error);
+	g_free (item);
+}
+
+static gboolean
+move_item_complete_idle (RBLibraryMoveItem *item)
+{
+	RhythmDB *db = item->batch->source->priv->db;
+	RhythmDBEntry *existing;
+	GValue value = {0,};
+
+	GDK_THREADS_ENTER ();
+
+	/* if the library monitor has already imported the new file,
+	 * drop that entry in favour of the one we're moving.
+	 */
+	existing = rhythmdb_entry_lookup_by_location (db, item->dest);
+	if (existing != NULL && existing != item->entry) {
+		rb_debug ("removing entry imported from %s while it was being moved", item->dest);
+		rhythmdb_entry_delete (db, existing);
+	}
+
+	g_value_init (&value, G_TYPE_STRING);
+	g_value_set_string (&value, item->dest);
+	rhythmdb_entry_set (db, item->entry, RHYTHMDB_PROP_LOCATION, &value);
+	g_value_unset (&value);
+
+	if (item->mount_point != NULL) {
+		g_value_init (&value, G_TYPE_STRING);
+		g_value_set_string (&value, item->mount_point);
+		rhythmdb_entry_set (db, item->entry, RHYTHMDB_PROP_MOUNTPOINT, &value);
+		g_value_unset (&value);
+	}
+
+	GDK_THREADS_LEAVE ();
+	return FALSE;
+}
+
+static gboolean
+move_batch_complete_idle (RBLibraryMoveBatch *batch)
+{
+	RhythmDB *db = batch->source->priv->db;
+	GError *error = NULL;
+	guint moved = 0;
+	guint i;
+
+	GDK_THREADS_ENTER ();
+
+	g_thread_pool_free (batch->pool, FALSE, TRUE);
+
+	/* the entries have all been updated by now, as their idle
+	 * callbacks were added before this one.
+	 */
+	for (i = 0; i < batch->items->len; i++) {
+		RBLibraryMoveItem *item = g_ptr_array_index (batch->items, i);
+
+		if (item->error == NULL) {
+			moved++;
+		} else if (g_error_matches (item->error, G_IO_ERROR, G_IO_ERROR_EXISTS)) {
+			rb_debug ("not displaying 'file exists' error for %s", item->dest);
+		} else if (error == NULL) {
+			error = g_error_copy (item->error);
 		} else {
-			rb_debug ("Could not delete '%s': unknown error", uri);
+			rb_debug ("error moving to %s: %s", item->dest, item->error->message);
 		}
 	}
-	g_object_unref (file);
-	g_free (uri);
+
+	rb_debug ("moved %u of %u files", moved, batch->items->len);
+	if (moved > 0)
+		rhythmdb_commit (db);
+
+	if (error != NULL) {
+		rb_error_dialog (NULL, _("Error moving track"), "%s", error->message);
+		g_error_free (error);
+	}
+
+	GDK_THREADS_LEAVE ();
+
+	g_ptr_array_foreach (batch->items, (GFunc) free_move_item, NULL);
+	g_ptr_array_free (batch->items, TRUE);
+	g_object_unref (batch->source);
+	g_free (batch);
+	return FALSE;
+}
+
+static void
+move_thread_func (RBLibraryMoveItem *item, RBLibraryMoveBatch *batch)
+{
+	GFile *src;
+	GFile *dest;
+
+	src = g_file_new_for_uri (item->src);
+	dest = g_file_new_for_uri (item->dest);
+
+	rb_debug ("moving %s to %s", item->src, item->dest);
+	if (move_file (src, dest, &item->error)) {
+		item->mount_point = rb_uri_get_mount_point (item->dest);
+		g_idle_add ((GSourceFunc) move_item_complete_idle, item);
+	}
+
+	g_object_unref (src);
+	g_object_unref (dest);
+
+	if (g_atomic_int_dec_and_test (&batch->remaining)) {
+		g_idle_add ((GSourceFunc) move_batch_complete_idle, batch);
+	}
 }
 
 static void
@@ -686,16 +979,70 @@ impl_paste (RBSource *asource, GList *entries)
 void
 rb_library_source_move_files (RBLibrarySource *source, RBLibraryChildSource *dest_source, GList *entries)
 {
-	char *dest;
+	RBLibraryMoveBatch *batch;
+	char *dest_dir;
+	GList *l;
+	guint i;
 
 	g_assert (RB_IS_LIBRARY_SOURCE (source));
 	g_assert (RB_IS_LIBRARY_CHILD_SOURCE (dest_source));
 
-	g_object_get (dest_source, "uri", &dest, NULL);
-	g_assert (dest != NULL);
+	g_object_get (dest_source, "uri", &dest_dir, NULL);
+	g_assert (dest_dir != NULL);
+
+	rb_library_child_source_ensure_populated (dest_source);
+
+	batch = g_new0 (RBLibraryMoveBatch, 1);
+	batch->source = g_object_ref (source);
+	batch->items = g_ptr_array_new ();
+
+	for (l = entries; l != NULL; l = g_list_next (l)) {
+		RhythmDBEntry *entry = (RhythmDBEntry *)l->data;
+		RBLibraryMoveItem *item;
+		const char *location;
+		char *dest;
+
+		location = rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LOCATION);
+		if (g_str_has_prefix (location, dest_dir)) {
+			rb_debug ("%s is already in %s", location, dest_dir);
+			continue;
+		}
+
+		dest = rb_library_build_filename (source->priv->db, dest_dir, entry);
+		if (dest == NULL) {
+			rb_debug ("could not create destination path for entry");
+			continue;
+		}
 
-	do_paste (source, dest, entries, (RBTransferCompleteCallback) move_completed_cb);
-	g_free (dest);
+		item = g_new0 (RBLibraryMoveItem, 1);
+		item->batch = batch;
+		item->entry = rhythmdb_entry_ref (entry);
+		item->src = g_strdup (location);
+		item->dest = rb_sanitize_uri_for_filesystem (dest);
+		g_free (dest);
+		g_ptr_array_add (batch->items, item);
+	}
+	g_free (dest_dir);
+
+	if (batch->items->len == 0) {
+		g_ptr_array_free (batch->items, TRUE);
+		g_object_unref (batch->source);
+		g_free (batch);
+		return;
+	}
+
+	/* renames are cheap, but copies between filesystems aren't,
+	 * so run a few at a time.
+	 */
+	batch->remaining = batch->items->len;
+	batch->pool = g_thread_pool_new ((GFunc) move_thread_func,
+					 batch,
+					 MIN (batch->items->len, MOVE_THREADS),
+					 FALSE,
+					 NULL);
+	for (i = 0; i < batch->items->len; i++) {
+		g_thread_pool_push (batch->pool, g_ptr_array_index (batch->items, i), NULL);
+	}
 }
 
 static guint
@@ -813,6 +1160,13 @@ rb_library_source_add_child_source (RBLibrarySource *library_source, const char
 	rb_shell_append_source (shell, source, RB_SOURCE (library_source));
 	library_source->priv->child_sources = g_list_prepend (library_source->priv->child_sources, source);
 
+	/* in lazy mode, the child source only shows location statistics
+	 * until it's selected or used as a paste target.
+	 */
+	if (eel_gconf_get_boolean (CONF_LIBRARY_LAZY_CHILD_SOURCES) == FALSE) {
+		rb_library_child_source_ensure_populated (RB_LIBRARY_CHILD_SOURCE (source));
+	}
+
 	rb_debug ("added child source [%p] for uri '%s'", source, uri);
 
 	g_object_unref (shell);
@@ -829,6 +1183,8 @@ rb_library_source_remove_child_source (RBLibrarySource *library_source,
 	g_free (uri);
 
 	library_source->priv->child_sources = g_list_remove (library_source->priv->child_sources, child_source);
+	library_source->priv->unpartitioned_child_sources =
+		g_list_remove (library_source->priv->unpartitioned_child_sources, child_source);
 	rb_source_delete_thyself (RB_SOURCE (child_source));
 }
 
@@ -841,6 +1197,8 @@ rb_library_source_sync_child_sources (RBLibrarySource *source)
 	char *uri;
 
 	locations = eel_gconf_get_string_list (CONF_LIBRARY_LOCATION);
+	rb_library_stats_set_locations (source->priv->stats, locations);
+
 	if (g_slist_length (locations) > 1) {
 		locations = g_slist_reverse (locations);
 		for (l = locations; l != NULL; l = g_slist_next (l)) {
@@ -878,6 +1236,20 @@ rb_library_source_sync_child_sources (RBLibrarySource *source)
 	g_list_free (child_sources);
 }
 
+/**
+ * rb_library_source_get_stats:
+ * @source: the #RBLibrarySource
+ *
+ * Returns the object holding statistics for each library location.
+ *
+ * Return value: the #RBLibraryStats, not referenced
+ */
+RBLibraryStats *
+rb_library_source_get_stats (RBLibrarySource *source)
+{
+	return source->priv->stats;
+}
+
 static void
 impl_get_status (RBSource *source, char **text, char **progress_text, float *progress)
 {
@@ -34,6 +34,7 @@
 #include <sources/rb-browser-source.h>
 #include <rhythmdb/rhythmdb.h>
 #include "rb-library-child-source.h"
+#include "rb-library-stats.h"
 
 G_BEGIN_DECLS
 
@@ -71,6 +72,10 @@ struct _RBLibrarySourcePrivate
 	GtkWidget *config_widget;
 
 	GList *child_sources;
+	GList *unpartitioned_child_sources;
+	gboolean base_model_complete;
+
+	RBLibraryStats *stats;
 
 	GtkWidget *library_location_entry;
 	GtkWidget *layout_path_menu;
@@ -98,6 +103,11 @@ RBLibraryChildSource * rb_library_source_get_child_source_for_uri (RBLibrarySour
 
 void rb_library_source_sync_child_sources (RBLibrarySource *source);
 
+RBLibraryStats *rb_library_source_get_stats (RBLibrarySource *source);
+
+void rb_library_source_populate_child_source (RBLibrarySource *source, RBLibraryChildSource *child_source);
+void rb_library_source_release_child_source (RBLibrarySource *source, RBLibraryChildSource *child_source);
+
 void rb_library_source_move_files (RBLibrarySource *source, RBLibraryChildSource *dest_source, GList *entries);
 
 G_END_DECLS
@@ -0,0 +1,572 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ *  Copyright (C) 2010 The Rhythmbox authors
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grants permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+/*
+ * Keeps song counts, total duration and size, a breakdown by media type
+ * and the time of the most recent import for each library location.
+ * Everything is updated incrementally from the database's entry-added,
+ * entry-changed and entry-deleted signals, so the library sources and the
+ * preferences page can show these without walking a query model.
+ *
+ * For each entry counted, we remember which locations it was counted
+ * against and the values it contributed, so it can be taken back out
+ * again exactly when it changes or is deleted.  The database is only
+ * scanned in full once it has finished loading and when the set of
+ * library locations changes.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <gdk/gdk.h>
+
+#include "rb-library-stats.h"
+#include "rb-debug.h"
+#include "rb-util.h"
+
+typedef struct {
+	char *location;
+	RBLibraryLocationStats stats;
+	GHashTable *imports;		/* first seen time -> number of songs */
+} RBLibraryStatsRoot;
+
+typedef struct {
+	GSList *roots;
+	const char *media_type;		/* interned */
+	gulong duration;
+	guint64 size;
+	gulong first_seen;
+} RBLibraryStatsSample;
+
+typedef struct {
+	RhythmDB *db;
+	RhythmDBEntryType entry_type;
+
+	GList *roots;
+	GHashTable *samples;
+	gboolean counted;
+
+	GHashTable *changed_roots;
+	guint emit_changed_id;
+} RBLibraryStatsPrivate;
+
+enum {
+	CHANGED,
+	LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
+
+G_DEFINE_TYPE (RBLibraryStats, rb_library_stats, G_TYPE_OBJECT)
+
+#define GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), RB_TYPE_LIBRARY_STATS, RBLibraryStatsPrivate))
+
+static void
+sample_free (RBLibraryStatsSample *sample)
+{
+	g_slist_free (sample->roots);
+	g_slice_free (RBLibraryStatsSample, sample);
+}
+
+static void
+root_free (RBLibraryStatsRoot *root)
+{
+	g_free (root->location);
+	g_hash_table_destroy (root->stats.formats);
+	g_hash_table_destroy (root->imports);
+	g_slice_free (RBLibraryStatsRoot, root);
+}
+
+static gboolean
+emit_changed_idle_cb (RBLibraryStats *stats)
+{
+	RBLibraryStatsPrivate *priv = GET_PRIVATE (stats);
+	GHashTable *changed;
+	GHashTableIter iter;
+	gpointer location;
+
+	GDK_THREADS_ENTER ();
+
+	priv->emit_changed_id = 0;
+	changed = priv->changed_roots;
+	priv->changed_roots = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	g_hash_table_iter_init (&iter, changed);
+	while (g_hash_table_iter_next (&iter, &location, NULL)) {
+		g_signal_emit (stats, signals[CHANGED], 0, (const char *) location);
+	}
+	g_hash_table_destroy (changed);
+
+	GDK_THREADS_LEAVE ();
+	return FALSE;
+}
+
+static void
+queue_changed (RBLibraryStats *stats, RBLibraryStatsRoot *root)
+{
+	RBLibraryStatsPrivate *priv = GET_PRIVATE (stats);
+
+	/* during a bulk import, a location can change thousands of times
+	 * a second, so only tell listeners about it once per idle.
+	 */
+	if (g_hash_table_lookup (priv->changed_roots, root->location) == NULL) {
+		g_hash_table_insert (priv->changed_roots, g_strdup (root->location), GINT_TO_POINTER (1));
+	}
+
+	if (priv->emit_changed_id == 0) {
+		priv->emit_changed_id = g_idle_add ((GSourceFunc) emit_changed_idle_cb, stats);
+	}
+}
+
+static void
+add_import (RBLibraryStatsRoot *root, gulong first_seen)
+{
+	guint count;
+
+	count = GPOINTER_TO_UINT (g_hash_table_lookup (root->imports, GSIZE_TO_POINTER (first_seen)));
+	g_hash_table_insert (root->imports, GSIZE_TO_POINTER (first_seen), GUINT_TO_POINTER (count + 1));
+
+	if (first_seen > root->stats.last_import)
+		root->stats.last_import = first_seen;
+}
+
+static void
+remove_import (RBLibraryStatsRoot *root, gulong first_seen)
+{
+	GHashTableIter iter;
+	gpointer key;
+	guint count;
+
+	count = GPOINTER_TO_UINT (g_hash_table_lookup (root->imports, GSIZE_TO_POINTER (first_seen)));
+	if (count > 1) {
+		g_hash_table_insert (root->imports, GSIZE_TO_POINTER (first_seen), GUINT_TO_POINTER (count - 1));
+		return;
+	}
+	g_hash_table_remove (root->imports, GSIZE_TO_POINTER (first_seen));
+
+	/* that was the last song from the most recent import, so find the
+	 * one before it.  this only happens when the newest songs are removed.
+	 */
+	if (first_seen == root->stats.last_import) {
+		root->stats.last_import = 0;
+		g_hash_table_iter_init (&iter, root->imports);
+		while (g_hash_table_iter_next (&iter, &key, NULL)) {
+			if (GPOINTER_TO_SIZE (key) > root->stats.last_import)
+				root->stats.last_import = GPOINTER_TO_SIZE (key);
+		}
+	}
+}
+
+static void
+remove_sample (RBLibraryStats *stats, RBLibraryStatsSample *sample)
+{
+	GSList *l;
+
+	for (l = sample->roots; l != NULL; l = l->next) {
+		RBLibraryStatsRoot *root = l->data;
+		guint count;
+
+		root->stats.n_songs--;
+		root->stats.duration -= sample->duration;
+		root->stats.size -= sample->size;
+
+		count = GPOINTER_TO_UINT (g_hash_table_lookup (root->stats.formats, sample->media_type));
+		if (count > 1) {
+			g_hash_table_insert (root->stats.formats, (gpointer) sample->media_type, GUINT_TO_POINTER (count - 1));
+		} else {
+			g_hash_table_remove (root->stats.formats, sample->media_type);
+		}
+
+		remove_import (root, sample->first_seen);
+
+		queue_changed (stats, root);
+	}
+}
+
+static void
+count_entry (RBLibraryStats *stats, RhythmDBEntry *entry)
+{
+	RBLibraryStatsPrivate *priv = GET_PRIVATE (stats);
+	RBLibraryStatsSample *sample;
+	const char *location;
+	const char *media_type;
+	GList *l;
+
+	sample = g_hash_table_lookup (priv->samples, entry);
+	if (sample != NULL) {
+		remove_sample (stats, sample);
+		g_hash_table_remove (priv->samples, entry);
+	}
+
+	/* only count entries that would show up in the library */
+	if (rhythmdb_entry_get_entry_type (entry) != priv->entry_type ||
+	    rhythmdb_entry_get_boolean (entry, RHYTHMDB_PROP_HIDDEN))
+		return;
+
+	location = rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LOCATION);
+	media_type = rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_MIMETYPE);
+	if (media_type == NULL || media_type[0] == '\0')
+		media_type = "unknown";
+
+	sample = NULL;
+	for (l = priv->roots; l != NULL; l = l->next) {
+		RBLibraryStatsRoot *root = l->data;
+		guint count;
+
+		if (g_str_has_prefix (location, root->location) == FALSE)
+			continue;
+
+		if (sample == NULL) {
+			sample = g_slice_new0 (RBLibraryStatsSample);
+			sample->media_type = g_intern_string (media_type);
+			sample->duration = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_DURATION);
+			sample->size = rhythmdb_entry_get_uint64 (entry, RHYTHMDB_PROP_FILE_SIZE);
+			sample->first_seen = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_FIRST_SEEN);
+		}
+		sample->roots = g_slist_prepend (sample->roots, root);
+
+		root->stats.n_songs++;
+		root->stats.duration += sample->duration;
+		root->stats.size += sample->size;
+
+		count = GPOINTER_TO_UINT (g_hash_table_lookup (root->stats.formats, sample->media_type));
+		g_hash_table_insert (root->stats.formats, (gpointer) sample->media_type, GUINT_TO_POINTER (count + 1));
+
+		add_import (root, sample->first_seen);
+
+		queue_changed (stats, root);
+	}
+
+	if (sample != NULL) {
+		g_hash_table_insert (priv->samples, rhythmdb_entry_ref (entry), sample);
+	}
+}
+
+static void
+count_entry_cb (RhythmDBEntry *entry, RBLibraryStats *stats)
+{
+	count_entry (stats, entry);
+}
+
+static void
+recount (RBLibraryStats *stats)
+{
+	RBLibraryStatsPrivate *priv = GET_PRIVATE (stats);
+	GList *l;
+
+	g_hash_table_remove_all (priv->samples);
+	for (l = priv->roots; l != NULL; l = l->next) {
+		RBLibraryStatsRoot *root = l->data;
+
+		root->stats.n_songs = 0;
+		root->stats.duration = 0;
+		root->stats.size = 0;
+		root->stats.last_import = 0;
+		g_hash_table_remove_all (root->stats.formats);
+		g_hash_table_remove_all (root->imports);
+		queue_changed (stats, root);
+	}
+
+	rb_debug ("counting entries for %d library locations", g_list_length (priv->roots));
+	rhythmdb_entry_foreach_by_type (priv->db,
+					priv->entry_type,
+					(GFunc) count_entry_cb,
+					stats);
+	priv->counted = TRUE;
+}
+
+static void
+db_entry_added_cb (RhythmDB *db, RhythmDBEntry *entry, RBLibraryStats *stats)
+{
+	RBLibraryStatsPrivate *priv = GET_PRIVATE (stats);
+
+	if (priv->counted)
+		count_entry (stats, entry);
+}
+
+static void
+db_entry_changed_cb (RhythmDB *db, RhythmDBEntry *entry, GValueArray *changes, RBLibraryStats *stats)
+{
+	RBLibraryStatsPrivate *priv = GET_PRIVATE (stats);
+	gboolean relevant = FALSE;
+	int i;
+
+	if (priv->counted == FALSE)
+		return;
+
+	for (i = 0; i < changes->n_values; i++) {
+		GValue *v = g_value_array_get_nth (changes, i);
+		RhythmDBEntryChange *change = g_value_get_boxed (v);
+
+		switch (change->prop) {
+		case RHYTHMDB_PROP_LOCATION:
+		case RHYTHMDB_PROP_DURATION:
+		case RHYTHMDB_PROP_FILE_SIZE:
+		case RHYTHMDB_PROP_MIMETYPE:
+		case RHYTHMDB_PROP_FIRST_SEEN:
+		case RHYTHMDB_PROP_HIDDEN:
+			relevant = TRUE;
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (relevant)
+		count_entry (stats, entry);
+}
+
+static void
+db_entry_deleted_cb (RhythmDB *db, RhythmDBEntry *entry, RBLibraryStats *stats)
+{
+	RBLibraryStatsPrivate *priv = GET_PRIVATE (stats);
+	RBLibraryStatsSample *sample;
+
+	sample = g_hash_table_lookup (priv->samples, entry);
+	if (sample != NULL) {
+		remove_sample (stats, sample);
+		g_hash_table_remove (priv->samples, entry);
+	}
+}
+
+static void
+db_load_complete_cb (RhythmDB *db, RBLibraryStats *stats)
+{
+	recount (stats);
+}
+
+/**
+ * rb_library_stats_new:
+ * @db: the #RhythmDB
+ * @entry_type: the type of entries to count
+ *
+ * Creates a new statistics tracker for the library locations.  Nothing is
+ * counted until the database finishes loading.
+ *
+ * Return value: the #RBLibraryStats
+ */
+RBLibraryStats *
+rb_library_stats_new (RhythmDB *db, RhythmDBEntryType entry_type)
+{
+	RBLibraryStats *stats;
+	RBLibraryStatsPrivate *priv;
+
+	stats = RB_LIBRARY_STATS (g_object_new (RB_TYPE_LIBRARY_STATS, NULL));
+	priv = GET_PRIVATE (stats);
+
+	priv->db = g_object_ref (db);
+	priv->entry_type = entry_type;
+
+	g_signal_connect_object (db, "entry-added", G_CALLBACK (db_entry_added_cb), stats, 0);
+	g_signal_connect_object (db, "entry-changed", G_CALLBACK (db_entry_changed_cb), stats, 0);
+	g_signal_connect_object (db, "entry-deleted", G_CALLBACK (db_entry_deleted_cb), stats, 0);
+	g_signal_connect_object (db, "load-complete", G_CALLBACK (db_load_complete_cb), stats, 0);
+
+	return stats;
+}
+
+/**
+ * rb_library_stats_set_locations:
+ * @stats: the #RBLibraryStats
+ * @locations: list of library location URIs
+ *
+ * Sets the library locations to keep statistics for.  If the set of
+ * locations has changed and the database has already been loaded, the
+ * statistics are recomputed from scratch.
+ */
+void
+rb_library_stats_set_locations (RBLibraryStats *stats, GSList *locations)
+{
+	RBLibraryStatsPrivate *priv = GET_PRIVATE (stats);
+	GSList *l;
+	GList *r;
+	gboolean same = TRUE;
+
+	if (g_slist_length (locations) != g_list_length (priv->roots)) {
+		same = FALSE;
+	} else {
+		for (r = priv->roots; r != NULL; r = r->next) {
+			RBLibraryStatsRoot *root = r->data;
+			if (rb_string_slist_contains (locations, root->location) == FALSE) {
+				same = FALSE;
+				break;
+			}
+		}
+	}
+	if (same)
+		return;
+
+	/* samples refer to the roots, so they have to go first */
+	g_hash_table_remove_all (priv->samples);
+	g_list_foreach (priv->roots, (GFunc) root_free, NULL);
+	g_list_free (priv->roots);
+	priv->roots = NULL;
+
+	for (l = locations; l != NULL; l = l->next) {
+		RBLibraryStatsRoot *root;
+
+		root = g_slice_new0 (RBLibraryStatsRoot);
+		root->location = g_strdup (l->data);
+		root->stats.formats = g_hash_table_new (g_str_hash, g_str_equal);
+		root->imports = g_hash_table_new (g_direct_hash, g_direct_equal);
+		priv->roots = g_list_prepend (priv->roots, root);
+	}
+
+	if (priv->counted)
+		recount (stats);
+}
+
+/**
+ * rb_library_stats_lookup:
+ * @stats: the #RBLibraryStats
+ * @location: a library location URI
+ *
+ * Returns the current statistics for a library location.  The returned
+ * structure is owned by @stats and is only valid until control returns
+ * to the main loop.
+ *
+ * Return value: the #RBLibraryLocationStats for the location, or NULL
+ * if it is not a library location
+ */
+const RBLibraryLocationStats *
+rb_library_stats_lookup (RBLibraryStats *stats, const char *location)
+{
+	RBLibraryStatsPrivate *priv = GET_PRIVATE (stats);
+	GList *l;
+
+	for (l = priv->roots; l != NULL; l = l->next) {
+		RBLibraryStatsRoot *root = l->data;
+		if (strcmp (root->location, location) == 0)
+			return &root->stats;
+	}
+	return NULL;
+}
+
+/**
+ * rb_library_stats_compute_status:
+ * @stats: the #RBLibraryStats
+ * @location: a library location URI
+ *
+ * Formats the song count, duration and size of a library location
+ * in the same way as #rhythmdb_query_model_compute_status_normal.
+ *
+ * Return value: allocated status string, or NULL if the location
+ * is not a library location
+ */
+char *
+rb_library_stats_compute_status (RBLibraryStats *stats, const char *location)
+{
+	const RBLibraryLocationStats *lstats;
+
+	lstats = rb_library_stats_lookup (stats, location);
+	if (lstats == NULL)
+		return NULL;
+
+	return rhythmdb_compute_status_normal (lstats->n_songs,
+					       lstats->duration,
+					       lstats->size,
+					       "%d song",
+					       "%d songs");
+}
+
+static void
+rb_library_stats_init (RBLibraryStats *stats)
+{
+	RBLibraryStatsPrivate *priv = GET_PRIVATE (stats);
+
+	priv->samples = g_hash_table_new_full (g_direct_hash,
+					       g_direct_equal,
+					       (GDestroyNotify) rhythmdb_entry_unref,
+					       (GDestroyNotify) sample_free);
+	priv->changed_roots = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+}
+
+static void
+impl_dispose (GObject *object)
+{
+	RBLibraryStatsPrivate *priv = GET_PRIVATE (object);
+
+	if (priv->emit_changed_id != 0) {
+		g_source_remove (priv->emit_changed_id);
+		priv->emit_changed_id = 0;
+	}
+
+	if (priv->samples != NULL) {
+		g_hash_table_destroy (priv->samples);
+		priv->samples = NULL;
+	}
+
+	if (priv->db != NULL) {
+		g_object_unref (priv->db);
+		priv->db = NULL;
+	}
+
+	G_OBJECT_CLASS (rb_library_stats_parent_class)->dispose (object);
+}
+
+static void
+impl_finalize (GObject *object)
+{
+	RBLibraryStatsPrivate *priv = GET_PRIVATE (object);
+
+	g_list_foreach (priv->roots, (GFunc) root_free, NULL);
+	g_list_free (priv->roots);
+	g_hash_table_destroy (priv->changed_roots);
+
+	G_OBJECT_CLASS (rb_library_stats_parent_class)->finalize (object);
+}
+
+static void
+rb_library_stats_class_init (RBLibraryStatsClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->dispose = impl_dispose;
+	object_class->finalize = impl_finalize;
+
+	/**
+	 * RBLibraryStats::changed:
+	 * @stats: the #RBLibraryStats
+	 * @location: the library location whose statistics changed
+	 *
+	 * Emitted (at most once per main loop iteration for each location)
+	 * when the statistics for a library location have changed.
+	 */
+	signals[CHANGED] =
+		g_signal_new ("changed",
+			      RB_TYPE_LIBRARY_STATS,
+			      G_SIGNAL_RUN_LAST,
+			      G_STRUCT_OFFSET (RBLibraryStatsClass, changed),
+			      NULL, NULL,
+			      g_cclosure_marshal_VOID__STRING,
+			      G_TYPE_NONE,
+			      1, G_TYPE_STRING);
+
+	g_type_class_add_private (klass, sizeof (RBLibraryStatsPrivate));
+}
@@ -0,0 +1,79 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ *  Copyright (C) 2010 The Rhythmbox authors
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grants permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+#ifndef __RB_LIBRARY_STATS_H
+#define __RB_LIBRARY_STATS_H
+
+#include <glib-object.h>
+
+#include "rhythmdb.h"
+
+G_BEGIN_DECLS
+
+#define RB_TYPE_LIBRARY_STATS         (rb_library_stats_get_type ())
+#define RB_LIBRARY_STATS(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), RB_TYPE_LIBRARY_STATS, RBLibraryStats))
+#define RB_LIBRARY_STATS_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), RB_TYPE_LIBRARY_STATS, RBLibraryStatsClass))
+#define RB_IS_LIBRARY_STATS(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), RB_TYPE_LIBRARY_STATS))
+#define RB_IS_LIBRARY_STATS_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), RB_TYPE_LIBRARY_STATS))
+#define RB_LIBRARY_STATS_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), RB_TYPE_LIBRARY_STATS, RBLibraryStatsClass))
+
+typedef struct
+{
+	guint n_songs;
+	gulong duration;
+	guint64 size;
+	gulong last_import;
+	GHashTable *formats;		/* media type -> number of songs */
+} RBLibraryLocationStats;
+
+typedef struct
+{
+	GObject parent;
+} RBLibraryStats;
+
+typedef struct
+{
+	GObjectClass parent;
+
+	/* signals */
+	void	(*changed) (RBLibraryStats *stats, const char *location);
+} RBLibraryStatsClass;
+
+GType				rb_library_stats_get_type (void);
+
+RBLibraryStats *		rb_library_stats_new (RhythmDB *db, RhythmDBEntryType entry_type);
+
+void				rb_library_stats_set_locations (RBLibraryStats *stats, GSList *locations);
+
+const RBLibraryLocationStats *	rb_library_stats_lookup (RBLibraryStats *stats, const char *location);
+
+char *				rb_library_stats_compute_status (RBLibraryStats *stats, const char *location);
+
+G_END_DECLS
+
+#endif /* __RB_LIBRARY_STATS_H */
@@ -80,6 +80,18 @@ typedef struct {
 	GList *sync_to_add;
 	GList *sync_to_remove;
 
+	/* track uuids, and an index of the tracks on the device by uuid,
+	 * kept up to date as entries change rather than rebuilt for
+	 * each sync.  uuids for library entries are only kept while
+	 * building a sync plan or syncing playlists.
+	 */
+	RhythmDB *db;
+	RhythmDBEntryType entry_type;
+	GHashTable *uuid_cache;		/* RhythmDBEntry -> uuid */
+	GHashTable *device_music;	/* uuid -> RhythmDBEntry */
+	GHashTable *device_podcasts;	/* uuid -> RhythmDBEntry */
+	gboolean device_index_valid;
+	gboolean device_index_duplicates;
 } RBMediaPlayerSourcePrivate;
 
 G_DEFINE_TYPE (RBMediaPlayerSource, rb_media_player_source, RB_TYPE_REMOVABLE_MEDIA_SOURCE);
@@ -114,6 +126,7 @@ static void track_add_done (RBMediaPlayerSource *source, RhythmDBEntry *entry);
 static void update_sync (RBMediaPlayerSource *source);
 static void sync_cmd (GtkAction *action, RBSource *source);
 static char *make_track_uuid  (RhythmDBEntry *entry);
+static const char *get_track_uuid (RBMediaPlayerSource *source, RhythmDBEntry *entry);
 static GHashTable *build_device_state (RBMediaPlayerSource *source);
 
 static GtkActionEntry rb_media_player_source_actions[] = {
@@ -168,6 +181,7 @@ rb_media_player_source_class_init (RBMediaPlayerSourceClass *klass)
 	rms_class->impl_track_add_error = rb_media_player_source_track_add_error;
 
 	klass->impl_get_entries = NULL;
+	klass->impl_get_entry_category = NULL;
 	klass->impl_get_capacity = NULL;
 	klass->impl_get_free_space = NULL;
 	klass->impl_add_playlist = NULL;
@@ -195,12 +209,38 @@ rb_media_player_source_dispose (GObject *object)
 		priv->sync_settings = NULL;
 	}
 
+	if (priv->device_music) {
+		g_hash_table_destroy (priv->device_music);
+		priv->device_music = NULL;
+	}
+	if (priv->device_podcasts) {
+		g_hash_table_destroy (priv->device_podcasts);
+		priv->device_podcasts = NULL;
+	}
+	if (priv->uuid_cache) {
+		g_hash_table_destroy (priv->uuid_cache);
+		priv->uuid_cache = NULL;
+	}
+	if (priv->entry_type) {
+		g_boxed_free (RHYTHMDB_TYPE_ENTRY_TYPE, priv->entry_type);
+		priv->entry_type = NULL;
+	}
+	if (priv->db) {
+		g_object_unref (priv->db);
+		priv->db = NULL;
+	}
+
 	G_OBJECT_CLASS (rb_media_player_source_parent_class)->dispose (object);
 }
 
 static void
 rb_media_player_source_init (RBMediaPlayerSource *source)
 {
+	RBMediaPlayerSourcePrivate *priv = MEDIA_PLAYER_SOURCE_GET_PRIVATE (source);
+
+	priv->uuid_cache = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+						  (GDestroyNotify) rhythmdb_entry_unref,
+						  g_free);
 }
 
 static void
@@ -234,6 +274,190 @@ rb_media_player_source_get_property (GObject *object,
 	}
 }
 
+/* device track index */
+
+static void
+rebuild_device_index (RBMediaPlayerSource *source)
+{
+	RBMediaPlayerSourcePrivate *priv = MEDIA_PLAYER_SOURCE_GET_PRIVATE (source);
+	RBMediaPlayerSourceClass *klass = RB_MEDIA_PLAYER_SOURCE_GET_CLASS (source);
+	GHashTableIter iter;
+	gpointer key, value;
+	int i;
+
+	rb_debug ("building device track index");
+
+	if (priv->device_music)
+		g_hash_table_destroy (priv->device_music);
+	if (priv->device_podcasts)
+		g_hash_table_destroy (priv->device_podcasts);
+
+	priv->device_music = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) rhythmdb_entry_unref);
+	klass->impl_get_entries (source, SYNC_CATEGORY_MUSIC, priv->device_music);
+	priv->device_podcasts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) rhythmdb_entry_unref);
+	klass->impl_get_entries (source, SYNC_CATEGORY_PODCAST, priv->device_podcasts);
+
+	/* remember the uuids, so we can find the entries again when they change */
+	for (i = 0; i < 2; i++) {
+		g_hash_table_iter_init (&iter, i ? priv->device_podcasts : priv->device_music);
+		while (g_hash_table_iter_next (&iter, &key, &value)) {
+			g_hash_table_insert (priv->uuid_cache, rhythmdb_entry_ref (value), g_strdup (key));
+		}
+	}
+
+	/* without a way to categorise single entries, we can only rebuild the index */
+	priv->device_index_valid = (klass->impl_get_entry_category != NULL);
+	priv->device_index_duplicates = FALSE;
+
+	rb_debug ("device track index has %d music and %d podcast entries",
+		  g_hash_table_size (priv->device_music),
+		  g_hash_table_size (priv->device_podcasts));
+}
+
+static void
+device_index_add (RBMediaPlayerSource *source, RhythmDBEntry *entry)
+{
+	RBMediaPlayerSourcePrivate *priv = MEDIA_PLAYER_SOURCE_GET_PRIVATE (source);
+	RBMediaPlayerSourceClass *klass = RB_MEDIA_PLAYER_SOURCE_GET_CLASS (source);
+	GHashTable *index;
+	RhythmDBEntry *existing;
+	const char *category;
+	const char *uuid;
+
+	category = klass->impl_get_entry_category (source, entry);
+	if (g_strcmp0 (category, SYNC_CATEGORY_MUSIC) == 0) {
+		index = priv->device_music;
+	} else if (g_strcmp0 (category, SYNC_CATEGORY_PODCAST) == 0) {
+		index = priv->device_podcasts;
+	} else {
+		rb_debug ("unable to categorise device entry %s",
+			  rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LOCATION));
+		priv->device_index_valid = FALSE;
+		return;
+	}
+
+	uuid = get_track_uuid (source, entry);
+	existing = g_hash_table_lookup (index, uuid);
+	if (existing != NULL && existing != entry) {
+		priv->device_index_duplicates = TRUE;
+	}
+	g_hash_table_insert (index, g_strdup (uuid), rhythmdb_entry_ref (entry));
+}
+
+static void
+device_index_remove (RBMediaPlayerSource *source, RhythmDBEntry *entry, const char *uuid)
+{
+	RBMediaPlayerSourcePrivate *priv = MEDIA_PLAYER_SOURCE_GET_PRIVATE (source);
+	GHashTable *index;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		index = i ? priv->device_podcasts : priv->device_music;
+		if (g_hash_table_lookup (index, uuid) == entry) {
+			g_hash_table_remove (index, uuid);
+
+			/* another entry with the same uuid may have been
+			 * replaced by this one, so we don't know if the track
+			 * is still on the device.
+			 */
+			if (priv->device_index_duplicates)
+				priv->device_index_valid = FALSE;
+		}
+	}
+}
+
+static gboolean
+is_library_uuid (RhythmDBEntry *entry, const char *uuid, RBMediaPlayerSource *source)
+{
+	RBMediaPlayerSourcePrivate *priv = MEDIA_PLAYER_SOURCE_GET_PRIVATE (source);
+	return (rhythmdb_entry_get_entry_type (entry) != priv->entry_type);
+}
+
+/* only device entries need their uuids kept between syncs */
+static void
+forget_library_uuids (RBMediaPlayerSource *source)
+{
+	RBMediaPlayerSourcePrivate *priv = MEDIA_PLAYER_SOURCE_GET_PRIVATE (source);
+	g_hash_table_foreach_remove (priv->uuid_cache, (GHRFunc) is_library_uuid, source);
+}
+
+static gboolean
+is_device_entry (RBMediaPlayerSource *source, RhythmDBEntry *entry)
+{
+	RBMediaPlayerSourcePrivate *priv = MEDIA_PLAYER_SOURCE_GET_PRIVATE (source);
+	return (priv->device_index_valid && rhythmdb_entry_get_entry_type (entry) == priv->entry_type);
+}
+
+static void
+db_entry_added_cb (RhythmDB *db, RhythmDBEntry *entry, RBMediaPlayerSource *source)
+{
+	if (is_device_entry (source, entry)) {
+		device_index_add (source, entry);
+	}
+}
+
+static void
+db_entry_deleted_cb (RhythmDB *db, RhythmDBEntry *entry, RBMediaPlayerSource *source)
+{
+	RBMediaPlayerSourcePrivate *priv = MEDIA_PLAYER_SOURCE_GET_PRIVATE (source);
+	const char *uuid;
+
+	uuid = g_hash_table_lookup (priv->uuid_cache, entry);
+	if (uuid == NULL)
+		return;
+
+	if (is_device_entry (source, entry)) {
+		device_index_remove (source, entry, uuid);
+	}
+	g_hash_table_remove (priv->uuid_cache, entry);
+}
+
+static void
+db_entry_changed_cb (RhythmDB *db, RhythmDBEntry *entry, GValueArray *changes, RBMediaPlayerSource *source)
+{
+	RBMediaPlayerSourcePrivate *priv = MEDIA_PLAYER_SOURCE_GET_PRIVATE (source);
+	gboolean relevant = FALSE;
+	char *old_uuid;
+	int i;
+
+	/* only the properties used in the track uuid (and the genre, which
+	 * some devices use to categorise tracks) matter here.
+	 */
+	for (i = 0; i < changes->n_values; i++) {
+		GValue *v = g_value_array_get_nth (changes, i);
+		RhythmDBEntryChange *change = g_value_get_boxed (v);
+
+		switch (change->prop) {
+		case RHYTHMDB_PROP_TITLE:
+		case RHYTHMDB_PROP_ARTIST:
+		case RHYTHMDB_PROP_GENRE:
+		case RHYTHMDB_PROP_ALBUM:
+		case RHYTHMDB_PROP_DURATION:
+		case RHYTHMDB_PROP_TRACK_NUMBER:
+		case RHYTHMDB_PROP_DISC_NUMBER:
+			relevant = TRUE;
+			break;
+		default:
+			break;
+		}
+	}
+	if (relevant == FALSE)
+		return;
+
+	old_uuid = g_strdup (g_hash_table_lookup (priv->uuid_cache, entry));
+	g_hash_table_remove (priv->uuid_cache, entry);
+
+	if (is_device_entry (source, entry)) {
+		if (old_uuid != NULL) {
+			device_index_remove (source, entry, old_uuid);
+		}
+		if (priv->device_index_valid) {
+			device_index_add (source, entry);
+		}
+	}
+	g_free (old_uuid);
+}
+
 static void
 rb_media_player_source_constructed (GObject *object)
 {
@@ -242,11 +466,16 @@ rb_media_player_source_constructed (GObject *object)
 
 	RB_CHAIN_GOBJECT_METHOD (rb_media_player_source_parent_class, constructed, object);
 
-	g_object_get (object, "shell", &shell, NULL);
+	g_object_get (object, "shell", &shell, "entry-type", &priv->entry_type, NULL);
+	g_object_get (shell, "db", &priv->db, NULL);
 	rb_media_player_source_init_actions (shell);
 	g_object_unref (shell);
 
 	priv->sync_action = gtk_action_group_get_action (action_group, "MediaPlayerSourceSync");
+
+	g_signal_connect_object (priv->db, "entry-added", G_CALLBACK (db_entry_added_cb), object, 0);
+	g_signal_connect_object (priv->db, "entry-deleted", G_CALLBACK (db_entry_deleted_cb), object, 0);
+	g_signal_connect_object (priv->db, "entry-changed", G_CALLBACK (db_entry_changed_cb), object, 0);
 }
 
 static gboolean
@@ -886,18 +1115,23 @@ update_sync_space_needed (RBMediaPlayerSource *source)
 	rb_debug ("space used after sync: %" G_GINT64_FORMAT " bytes", priv->sync_space_needed);
 }
 
+typedef struct {
+	RBMediaPlayerSource *source;
+	GHashTable *target;
+} ItineraryData;
+
 static gboolean
-hash_table_insert_from_tree_model_cb (GtkTreeModel *query_model,
-				      GtkTreePath  *path,
-				      GtkTreeIter  *iter,
-				      GHashTable   *target)
+hash_table_insert_from_tree_model_cb (GtkTreeModel  *query_model,
+				      GtkTreePath   *path,
+				      GtkTreeIter   *iter,
+				      ItineraryData *data)
 {
 	RhythmDBEntry *entry;
 
 	entry = rhythmdb_query_model_iter_to_entry (RHYTHMDB_QUERY_MODEL (query_model), iter);
 	if (!entry_is_undownloaded_podcast (entry)) {
-		g_hash_table_insert (target,
-				     make_track_uuid (entry),
+		g_hash_table_insert (data->target,
+				     g_strdup (get_track_uuid (data->source, entry)),
 				     rhythmdb_entry_ref (entry));
 	}
 
@@ -905,11 +1139,13 @@ hash_table_insert_from_tree_model_cb (GtkTreeModel *query_model,
 }
 
 static void
-itinerary_insert_all_of_type (RhythmDB *db,
+itinerary_insert_all_of_type (RBMediaPlayerSource *source,
+			      RhythmDB *db,
 			      RhythmDBEntryType entry_type,
 			      GHashTable *target)
 {
 	GtkTreeModel *query_model;
+	ItineraryData data;
 
 	query_model = GTK_TREE_MODEL (rhythmdb_query_model_new_empty (db));
 	rhythmdb_do_full_query (db, RHYTHMDB_QUERY_RESULTS (query_model),
@@ -917,9 +1153,12 @@ itinerary_insert_all_of_type (RhythmDB *db,
 				RHYTHMDB_PROP_TYPE, entry_type,
 				RHYTHMDB_QUERY_END);
 
+	data.source = source;
+	data.target = target;
 	gtk_tree_model_foreach (query_model,
 				(GtkTreeModelForeachFunc) hash_table_insert_from_tree_model_cb,
-				target);
+				&data);
+	g_object_unref (query_model);
 }
 
 static void
@@ -930,6 +1169,10 @@ itinerary_insert_some_playlists (RBMediaPlayerSource *source,
 	GList *list_iter;
 	GList *playlists;
 	RBShell *shell;
+	ItineraryData data;
+
+	data.source = source;
+	data.target = target;
 
 	g_object_get (source, "shell", &shell, NULL);
 	playlists = rb_playlist_manager_get_playlists ((RBPlaylistManager *) rb_shell_get_playlist_manager (shell));
@@ -948,7 +1191,7 @@ itinerary_insert_some_playlists (RBMediaPlayerSource *source,
 			g_object_get (RB_SOURCE (list_iter->data), "base-query-model", &query_model, NULL);
 			gtk_tree_model_foreach (query_model,
 						(GtkTreeModelForeachFunc) hash_table_insert_from_tree_model_cb,
-						target);
+						&data);
 			g_object_unref (query_model);
 		} else {
 			rb_debug ("not adding playlist %s to itinerary", name);
@@ -968,6 +1211,10 @@ itinerary_insert_some_podcasts (RBMediaPlayerSource *source,
 	RBMediaPlayerSourcePrivate *priv = MEDIA_PLAYER_SOURCE_GET_PRIVATE (source);
 	GList *podcasts;
 	GList *i;
+	ItineraryData data;
+
+	data.source = source;
+	data.target = target;
 
 	podcasts = rb_media_player_sync_settings_get_enabled_groups (priv->sync_settings, SYNC_CATEGORY_PODCAST);
 	for (i = podcasts; i != NULL; i = i->next) {
@@ -990,7 +1237,7 @@ itinerary_insert_some_podcasts (RBMediaPlayerSource *source,
 
 		gtk_tree_model_foreach (query_model,
 					(GtkTreeModelForeachFunc) hash_table_insert_from_tree_model_cb,
-					target);
+					&data);
 		g_object_unref (query_model);
 	}
 }
@@ -1033,7 +1280,7 @@ build_sync_itinerary (RBMediaPlayerSource *source)
 	if (rb_media_player_sync_settings_sync_category (priv->sync_settings, SYNC_CATEGORY_MUSIC) ||
 	    rb_media_player_sync_settings_sync_group (priv->sync_settings, SYNC_CATEGORY_MUSIC, SYNC_GROUP_ALL_MUSIC)) {
 		rb_debug ("adding all music to the itinerary");
-		itinerary_insert_all_of_type (db, RHYTHMDB_ENTRY_TYPE_SONG, itinerary);
+		itinerary_insert_all_of_type (source, db, RHYTHMDB_ENTRY_TYPE_SONG, itinerary);
 	} else if (rb_media_player_sync_settings_has_enabled_groups (priv->sync_settings, SYNC_CATEGORY_MUSIC)) {
 		rb_debug ("adding selected playlists to the itinerary");
 		itinerary_insert_some_playlists (source, itinerary);
@@ -1047,7 +1294,7 @@ build_sync_itinerary (RBMediaPlayerSource *source)
 		 * equivalent of insert_some_podcasts, iterating through all feeds
 		 * (use a query for all entries of type PODCAST_FEED to find them)
 		 */
-		itinerary_insert_all_of_type (db, RHYTHMDB_ENTRY_TYPE_PODCAST_POST, itinerary);
+		itinerary_insert_all_of_type (source, db, RHYTHMDB_ENTRY_TYPE_PODCAST_POST, itinerary);
 	} else if (rb_media_player_sync_settings_has_enabled_groups (priv->sync_settings, SYNC_CATEGORY_PODCAST)) {
 		rb_debug ("adding selected podcasts to the itinerary");
 		itinerary_insert_some_podcasts (source, db, itinerary);
@@ -1063,7 +1310,7 @@ build_sync_itinerary (RBMediaPlayerSource *source)
 }
 
 static void
-_g_hash_table_transfer_all (GHashTable *target, GHashTable *source)
+_g_hash_table_insert_all (GHashTable *target, GHashTable *source)
 {
 	GHashTableIter iter;
 	gpointer key, value;
@@ -1071,41 +1318,36 @@ _g_hash_table_transfer_all (GHashTable *target, GHashTable *source)
 	g_hash_table_iter_init (&iter, source);
 	while (g_hash_table_iter_next (&iter, &key, &value)) {
 		g_hash_table_insert (target, key, value);
-		g_hash_table_iter_steal (&iter);
 	}
 }
 
+/*
+ * The returned hash table borrows its keys and values from the device
+ * track index, so it must not be used after anything that may change
+ * the database.
+ */
 static GHashTable *
 build_device_state (RBMediaPlayerSource *source)
 {
 	RBMediaPlayerSourcePrivate *priv = MEDIA_PLAYER_SOURCE_GET_PRIVATE (source);
-	RBMediaPlayerSourceClass *klass = RB_MEDIA_PLAYER_SOURCE_GET_CLASS (source);
 	GHashTable *device;
-	GHashTable *entries;
 
-	rb_debug ("building device contents hash");
+	if (priv->device_index_valid == FALSE) {
+		rebuild_device_index (source);
+	}
 
-	device = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)rhythmdb_entry_unref);
+	rb_debug ("building device contents hash");
+	device = g_hash_table_new (g_str_hash, g_str_equal);
 
-	rb_debug ("getting music entries from device");
-	entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) rhythmdb_entry_unref);
-	klass->impl_get_entries (source, SYNC_CATEGORY_MUSIC, entries);
-	priv->total_music_size = _sum_entry_size (entries);
+	priv->total_music_size = _sum_entry_size (priv->device_music);
 	if (rb_media_player_sync_settings_has_enabled_groups (priv->sync_settings, SYNC_CATEGORY_MUSIC)) {
-		_g_hash_table_transfer_all (device, entries);
+		_g_hash_table_insert_all (device, priv->device_music);
 	}
-	g_hash_table_destroy (entries);
-	rb_debug ("done getting music entries from device");
 
-	rb_debug ("getting podcast entries from device");
-	entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) rhythmdb_entry_unref);
-	klass->impl_get_entries (source, SYNC_CATEGORY_PODCAST, entries);
-	priv->total_podcast_size = _sum_entry_size (entries);
+	priv->total_podcast_size = _sum_entry_size (priv->device_podcasts);
 	if (rb_media_player_sync_settings_has_enabled_groups (priv->sync_settings, SYNC_CATEGORY_PODCAST)) {
-		_g_hash_table_transfer_all (device, entries);
+		_g_hash_table_insert_all (device, priv->device_podcasts);
 	}
-	g_hash_table_destroy (entries);
-	rb_debug ("done getting podcast entries from device");
 
 	rb_debug ("done building device contents hash; has %d entries", g_hash_table_size (device));
 	return device;
@@ -1147,6 +1389,7 @@ update_sync (RBMediaPlayerSource *source)
 
 	g_hash_table_destroy (device);
 	g_hash_table_destroy (itinerary);
+	forget_library_uuids (source);
 
 	update_sync_space_needed (source);
 }
@@ -1167,6 +1410,11 @@ sync_playlists (RBMediaPlayerSource *source)
 		return;
 	}
 
+	/* the tracks we just transferred may not have been announced yet,
+	 * in which case the device track index won't include them.
+	 */
+	rhythmdb_flush_entry_signals (priv->db);
+
 	/* build an updated device contents map, so we can find the device entries
 	 * corresponding to the entries in the local playlists.
 	 */
@@ -1207,12 +1455,12 @@ sync_playlists (RBMediaPlayerSource *source)
 		}
 
 		do {
-			char *trackid;
+			const char *trackid;
 			RhythmDBEntry *entry;
 			RhythmDBEntry *device_entry;
 
 			entry = rhythmdb_query_model_iter_to_entry (model, &iter);
-			trackid = make_track_uuid (entry);
+			trackid = get_track_uuid (source, entry);
 
 			device_entry = g_hash_table_lookup (device, trackid);
 			if (device_entry != NULL) {
@@ -1222,7 +1470,6 @@ sync_playlists (RBMediaPlayerSource *source)
 					  rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LOCATION),
 					  trackid);
 			}
-			g_free (trackid);
 
 		} while (gtk_tree_model_iter_next (GTK_TREE_MODEL (model), &iter));
 
@@ -1238,6 +1485,7 @@ sync_playlists (RBMediaPlayerSource *source)
 	}
 
 	g_hash_table_destroy (device);
+	forget_library_uuids (source);
 }
 
 static gboolean
@@ -1257,7 +1505,9 @@ sync_idle_cb_playlists (RBMediaPlayerSource *source)
 {
 	/* Transfer the playlists */
 	rb_debug ("transferring playlists to the device");
+	GDK_THREADS_ENTER ();
 	sync_playlists (source);
+	GDK_THREADS_LEAVE ();
 	g_idle_add ((GSourceFunc)sync_idle_cb_cleanup, source);
 	return FALSE;
 }
@@ -1378,6 +1628,20 @@ make_track_uuid  (RhythmDBEntry *entry)
 	return result;
 }
 
+static const char *
+get_track_uuid (RBMediaPlayerSource *source, RhythmDBEntry *entry)
+{
+	RBMediaPlayerSourcePrivate *priv = MEDIA_PLAYER_SOURCE_GET_PRIVATE (source);
+	char *uuid;
+
+	uuid = g_hash_table_lookup (priv->uuid_cache, entry);
+	if (uuid == NULL) {
+		uuid = make_track_uuid (entry);
+		g_hash_table_insert (priv->uuid_cache, rhythmdb_entry_ref (entry), uuid);
+	}
+	return uuid;
+}
+
 void
 _rb_media_player_source_add_to_map (GHashTable *map, RhythmDBEntry *entry)
 {
@@ -69,6 +69,9 @@ struct _RBMediaPlayerSourceClass
 	void		(*impl_add_playlist)	(RBMediaPlayerSource *source, gchar *name, GList *entries);
 	void		(*impl_remove_playlists) (RBMediaPlayerSource *source);
 	void		(*impl_show_properties)	(RBMediaPlayerSource *source, GtkWidget *info_box, GtkWidget *notebook);
+
+	/* added later; kept at the end so existing members keep their offsets */
+	const char *	(*impl_get_entry_category) (RBMediaPlayerSource *source, RhythmDBEntry *entry);
 };
 
 GType	rb_media_player_source_get_type	(void);
@@ -29,6 +29,7 @@
 
 #include <check.h>
 #include <gtk/gtk.h>
+#include <string.h>
 #include "test-utils.h"
 #include "rhythmdb-query-model.h"
 #include "rhythmdb-property-model.h"
@@ -663,6 +664,110 @@ START_TEST (test_rhythmdb_property_model_empty_strings)
 }
 END_TEST
 
+static void
+_count_row_changed_cb (GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, GHashTable *counts)
+{
+	char *title;
+
+	gtk_tree_model_get (model, iter, RHYTHMDB_PROPERTY_MODEL_COLUMN_TITLE, &title, -1);
+	g_hash_table_insert (counts, title,
+			     GINT_TO_POINTER (GPOINTER_TO_INT (g_hash_table_lookup (counts, title)) + 1));
+}
+
+/* tests the counts of a property model filled from a query model in one
+ * go, and after several entries change at once */
+START_TEST (test_rhythmdb_property_model_batched_counts)
+{
+	RhythmDBQueryModel *model;
+	RhythmDBPropertyModel *propmodel;
+	RhythmDBEntry *entries[10];
+	const char *artists[] = { "x", "y", "z", "x", "y", "z", "x", "y", "z", "x" };
+	const char *order[] = { "x", "y", "z" };
+	GHashTable *changed;
+	GtkTreeIter iter;
+	char *title;
+	char *uri;
+	int i;
+
+	start_test_case ();
+
+	/* setup: the query model has its entries before the property model sees it */
+	model = rhythmdb_query_model_new_empty (db);
+	for (i = 0; i < 10; i++) {
+		uri = g_strdup_printf ("file:///batch-%d.ogg", i);
+		entries[i] = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, uri);
+		g_free (uri);
+		set_entry_string (db, entries[i], RHYTHMDB_PROP_ARTIST, artists[i]);
+	}
+	rhythmdb_commit (db);
+	for (i = 0; i < 10; i++) {
+		rhythmdb_query_model_add_entry (model, entries[i], -1);
+	}
+
+	propmodel = rhythmdb_property_model_new (db, RHYTHMDB_PROP_ARTIST);
+	g_object_set (propmodel, "query-model", model, NULL);
+
+	fail_unless (_get_property_count (propmodel, "x") == 4);
+	fail_unless (_get_property_count (propmodel, "y") == 3);
+	fail_unless (_get_property_count (propmodel, "z") == 3);
+
+	/* one row per value, in order, after the "All" row */
+	fail_unless (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (propmodel), NULL) == 4);
+	for (i = 0; i < 3; i++) {
+		fail_unless (gtk_tree_model_iter_nth_child (GTK_TREE_MODEL (propmodel), &iter, NULL, i + 1));
+		gtk_tree_model_get (GTK_TREE_MODEL (propmodel), &iter,
+				    RHYTHMDB_PROPERTY_MODEL_COLUMN_TITLE, &title, -1);
+		fail_unless (strcmp (title, order[i]) == 0, "property model rows out of order");
+		g_free (title);
+	}
+
+	end_step ();
+
+	/* move three entries from x to y and one from z to a new value */
+	changed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	g_signal_connect (propmodel, "row-changed", G_CALLBACK (_count_row_changed_cb), changed);
+
+	set_waiting_signal (G_OBJECT (db), "entry-changed");
+	set_entry_string (db, entries[0], RHYTHMDB_PROP_ARTIST, "y");
+	set_entry_string (db, entries[3], RHYTHMDB_PROP_ARTIST, "y");
+	set_entry_string (db, entries[6], RHYTHMDB_PROP_ARTIST, "y");
+	set_entry_string (db, entries[2], RHYTHMDB_PROP_ARTIST, "w");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+	end_step ();
+
+	fail_unless (_get_property_count (propmodel, "w") == 1);
+	fail_unless (_get_property_count (propmodel, "x") == 1);
+	fail_unless (_get_property_count (propmodel, "y") == 6);
+	fail_unless (_get_property_count (propmodel, "z") == 2);
+
+	/* each row's count change is announced once */
+	fail_unless (GPOINTER_TO_INT (g_hash_table_lookup (changed, "x")) == 1, "x changes not coalesced");
+	fail_unless (GPOINTER_TO_INT (g_hash_table_lookup (changed, "y")) == 1, "y changes not coalesced");
+	fail_unless (GPOINTER_TO_INT (g_hash_table_lookup (changed, "z")) == 1, "z change not announced");
+
+	end_step ();
+
+	/* removing the last entry for a value removes its row */
+	set_waiting_signal (G_OBJECT (propmodel), "row-deleted");
+	rhythmdb_query_model_remove_entry (model, entries[9]);
+	wait_for_signal ();
+	fail_unless (_get_property_count (propmodel, "x") == 0);
+	fail_unless (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (propmodel), NULL) == 4);
+
+	end_test_case ();
+
+	g_signal_handlers_disconnect_by_func (propmodel, G_CALLBACK (_count_row_changed_cb), changed);
+	g_hash_table_destroy (changed);
+	for (i = 0; i < 10; i++) {
+		rhythmdb_entry_delete (db, entries[i]);
+	}
+	rhythmdb_commit (db);
+	g_object_unref (model);
+	g_object_unref (propmodel);
+}
+END_TEST
+
 static Suite *
 rhythmdb_property_model_suite (void)
 {
@@ -680,6 +785,7 @@ rhythmdb_property_model_suite (void)
 	tcase_add_test (tc_chain, test_rhythmdb_property_model_query);
 	tcase_add_test (tc_chain, test_rhythmdb_property_model_query_chain);
 	tcase_add_test (tc_chain, test_rhythmdb_property_model_sorting);
+	tcase_add_test (tc_chain, test_rhythmdb_property_model_batched_counts);
 
 	/* tests for breakable bug fixes */
 /*	tcase_add_test (tc_bugs, test_hidden_chain_filter);*/
@@ -29,6 +29,7 @@
 
 #include <check.h>
 #include <gtk/gtk.h>
+#include <string.h>
 #include "test-utils.h"
 #include "rhythmdb-query-model.h"
 
@@ -36,6 +37,58 @@
 #include "rb-file-helpers.h"
 #include "rb-util.h"
 
+/* checks that the model's rows are in order according to the sort function */
+static gboolean
+model_is_sorted (RhythmDBQueryModel *model, GCompareDataFunc sort_func, gboolean reverse)
+{
+	GtkTreeIter iter;
+	RhythmDBEntry *prev = NULL;
+	gboolean sorted = TRUE;
+
+	if (!gtk_tree_model_get_iter_first (GTK_TREE_MODEL (model), &iter))
+		return TRUE;
+
+	do {
+		RhythmDBEntry *entry;
+
+		entry = rhythmdb_query_model_iter_to_entry (model, &iter);
+		if (prev != NULL) {
+			int cmp = sort_func (prev, entry, NULL);
+			if (reverse ? (cmp < 0) : (cmp > 0))
+				sorted = FALSE;
+			rhythmdb_entry_unref (prev);
+		}
+		prev = entry;
+	} while (sorted && gtk_tree_model_iter_next (GTK_TREE_MODEL (model), &iter));
+
+	if (prev != NULL)
+		rhythmdb_entry_unref (prev);
+	return sorted;
+}
+
+static void
+_count_signal_cb (GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, int *count)
+{
+	(*count)++;
+}
+
+/* a row must be in the model by the time its row-inserted signal
+ * is emitted, and no other rows may be waiting to be announced.
+ */
+static void
+_count_row_inserted_cb (GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, int *count)
+{
+	RhythmDBEntry *entry;
+
+	(*count)++;
+	fail_unless (gtk_tree_model_iter_n_children (model, NULL) == *count,
+		     "model has rows that haven't been announced");
+
+	entry = rhythmdb_query_model_iter_to_entry (RHYTHMDB_QUERY_MODEL (model), iter);
+	fail_unless (entry != NULL, "inserted row has no entry");
+	rhythmdb_entry_unref (entry);
+}
+
 START_TEST (test_rhythmdb_db_queries)
 {
 	RhythmDBEntry *entry = NULL;
@@ -211,24 +264,517 @@ START_TEST (test_hidden_chain_filter)
 }
 END_TEST
 
+/* this tests that entries move between the main and limited lists
+ * as the model's contents change */
+START_TEST (test_limited_entries)
+{
+	RhythmDBQueryModel *model;
+	RhythmDBEntry *entries[4];
+	GValueArray *limit;
+	GValue val = {0,};
+	GtkTreeIter iter;
+	char *uri;
+	int i;
+
+	start_test_case ();
+
+	/* setup */
+	limit = g_value_array_new (1);
+	g_value_init (&val, G_TYPE_ULONG);
+	g_value_set_ulong (&val, 2);
+	g_value_array_append (limit, &val);
+	g_value_unset (&val);
+
+	model = g_object_new (RHYTHMDB_TYPE_QUERY_MODEL,
+			      "db", db,
+			      "sort-func", rhythmdb_query_model_location_sort_func,
+			      "limit-type", RHYTHMDB_QUERY_MODEL_LIMIT_COUNT,
+			      "limit-value", limit,
+			      NULL);
+	g_value_array_free (limit);
+
+	for (i = 0; i < 4; i++) {
+		uri = g_strdup_printf ("file:///limit-%d.ogg", i);
+		entries[i] = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, uri);
+		g_free (uri);
+	}
+	rhythmdb_commit (db);
+
+	/* add entries in reverse order, only the first two should be visible */
+	for (i = 3; i >= 0; i--) {
+		rhythmdb_query_model_add_entry (model, entries[i], -1);
+	}
+	fail_unless (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL) == 2);
+	fail_unless (rhythmdb_query_model_entry_to_iter (model, entries[0], &iter));
+	fail_unless (rhythmdb_query_model_entry_to_iter (model, entries[1], &iter));
+	fail_if (rhythmdb_query_model_entry_to_iter (model, entries[2], &iter));
+	fail_if (rhythmdb_query_model_entry_to_iter (model, entries[3], &iter));
+
+	end_step ();
+
+	/* remove a visible entry, the next one should take its place */
+	rhythmdb_query_model_remove_entry (model, entries[0]);
+	fail_unless (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL) == 2);
+	fail_unless (rhythmdb_query_model_entry_to_iter (model, entries[1], &iter));
+	fail_unless (rhythmdb_query_model_entry_to_iter (model, entries[2], &iter));
+	fail_if (rhythmdb_query_model_entry_to_iter (model, entries[3], &iter));
+
+	end_step ();
+
+	/* tidy up */
+	for (i = 0; i < 4; i++) {
+		rhythmdb_entry_delete (db, entries[i]);
+	}
+	g_object_unref (model);
+
+	end_test_case ();
+}
+END_TEST
+
+/* this tests that chunks of query results end up in order, whether merged
+ * into an empty model or one that already has entries */
+START_TEST (test_query_model_insert_chunk)
+{
+	RhythmDBQueryModel *model;
+	RhythmDBEntry *entries[40];
+	GPtrArray *chunk;
+	GtkTreeIter iter;
+	char *uri;
+	int inserted = 0;
+	int i;
+
+	start_test_case ();
+
+	/* setup */
+	model = g_object_new (RHYTHMDB_TYPE_QUERY_MODEL,
+			      "db", db,
+			      "sort-func", rhythmdb_query_model_location_sort_func,
+			      NULL);
+	g_signal_connect (model, "row-inserted", G_CALLBACK (_count_row_inserted_cb), &inserted);
+
+	/* create the entries out of order */
+	for (i = 0; i < 40; i++) {
+		uri = g_strdup_printf ("file:///chunk-%02d.ogg", (i * 7) % 40);
+		entries[i] = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, uri);
+		g_free (uri);
+	}
+	rhythmdb_commit (db);
+
+	/* first chunk goes into an empty model */
+	chunk = g_ptr_array_new ();
+	for (i = 0; i < 40; i += 2) {
+		g_ptr_array_add (chunk, entries[i]);
+	}
+	rhythmdb_query_results_add_results (RHYTHMDB_QUERY_RESULTS (model), chunk);
+	end_step ();
+
+	fail_unless (inserted == 20, "wrong number of row-inserted signals");
+	fail_unless (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL) == 20);
+	fail_unless (model_is_sorted (model, (GCompareDataFunc) rhythmdb_query_model_location_sort_func, FALSE),
+		     "first chunk out of order");
+
+	end_step ();
+
+	/* the second chunk is merged in between the existing rows */
+	chunk = g_ptr_array_new ();
+	for (i = 1; i < 40; i += 2) {
+		g_ptr_array_add (chunk, entries[i]);
+	}
+	rhythmdb_query_results_add_results (RHYTHMDB_QUERY_RESULTS (model), chunk);
+	end_step ();
+
+	fail_unless (inserted == 40, "wrong number of row-inserted signals");
+	fail_unless (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL) == 40);
+	fail_unless (model_is_sorted (model, (GCompareDataFunc) rhythmdb_query_model_location_sort_func, FALSE),
+		     "merged chunk out of order");
+	for (i = 0; i < 40; i++) {
+		fail_unless (rhythmdb_query_model_entry_to_iter (model, entries[i], &iter));
+	}
+
+	end_step ();
+
+	/* entries already in the model aren't added again */
+	chunk = g_ptr_array_new ();
+	for (i = 0; i < 20; i++) {
+		g_ptr_array_add (chunk, entries[i]);
+	}
+	rhythmdb_query_results_add_results (RHYTHMDB_QUERY_RESULTS (model), chunk);
+	end_step ();
+
+	fail_unless (inserted == 40, "existing entries inserted again");
+	fail_unless (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL) == 40);
+
+	/* tidy up */
+	for (i = 0; i < 40; i++) {
+		rhythmdb_entry_delete (db, entries[i]);
+	}
+	rhythmdb_commit (db);
+	g_object_unref (model);
+
+	end_test_case ();
+}
+END_TEST
+
+/* this tests that changing a property the sort order depends on
+ * refreshes the cached sort key and moves the entry */
+START_TEST (test_query_model_sort_key_refresh)
+{
+	RhythmDBQueryModel *model;
+	RhythmDBEntry *entries[3];
+	RhythmDBEntry *entry;
+	GtkTreeIter iter;
+	char *old_key;
+	char *uri;
+	int i;
+
+	start_test_case ();
+
+	/* setup */
+	model = g_object_new (RHYTHMDB_TYPE_QUERY_MODEL,
+			      "db", db,
+			      "sort-func", rhythmdb_query_model_album_sort_func,
+			      NULL);
+
+	for (i = 0; i < 3; i++) {
+		uri = g_strdup_printf ("file:///sortkey-%d.ogg", i);
+		entries[i] = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, uri);
+		g_free (uri);
+		set_entry_string (db, entries[i], RHYTHMDB_PROP_ARTIST, "Nine Inch Nails");
+		set_entry_string (db, entries[i], RHYTHMDB_PROP_ALBUM, "Pretty Hate Machine");
+		set_entry_ulong (db, entries[i], RHYTHMDB_PROP_TRACK_NUMBER, i + 1);
+	}
+	rhythmdb_commit (db);
+
+	for (i = 2; i >= 0; i--) {
+		rhythmdb_query_model_add_entry (model, entries[i], -1);
+	}
+	fail_unless (gtk_tree_model_get_iter_first (GTK_TREE_MODEL (model), &iter));
+	entry = rhythmdb_query_model_iter_to_entry (model, &iter);
+	fail_unless (entry == entries[0], "entries not in track order");
+	rhythmdb_entry_unref (entry);
+
+	end_step ();
+
+	/* move the first track to the end of the album */
+	old_key = g_strdup (rhythmdb_entry_get_sort_order_key (entries[0], RHYTHMDB_SORT_ORDER_ALBUM));
+	set_waiting_signal (G_OBJECT (db), "entry-changed");
+	set_entry_ulong (db, entries[0], RHYTHMDB_PROP_TRACK_NUMBER, 4);
+	rhythmdb_commit (db);
+	wait_for_signal ();
+	end_step ();
+
+	fail_if (strcmp (old_key, rhythmdb_entry_get_sort_order_key (entries[0], RHYTHMDB_SORT_ORDER_ALBUM)) == 0,
+		 "sort key not refreshed after track number change");
+	g_free (old_key);
+
+	fail_unless (model_is_sorted (model, (GCompareDataFunc) rhythmdb_query_model_album_sort_func, FALSE));
+	fail_unless (gtk_tree_model_iter_nth_child (GTK_TREE_MODEL (model), &iter, NULL, 2));
+	entry = rhythmdb_query_model_iter_to_entry (model, &iter);
+	fail_unless (entry == entries[0], "changed entry didn't move to the end");
+	rhythmdb_entry_unref (entry);
+
+	end_step ();
+
+	/* and back to the start by renaming its album */
+	set_waiting_signal (G_OBJECT (db), "entry-changed");
+	set_entry_string (db, entries[0], RHYTHMDB_PROP_ALBUM, "Broken");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+	end_step ();
+
+	fail_unless (model_is_sorted (model, (GCompareDataFunc) rhythmdb_query_model_album_sort_func, FALSE));
+	fail_unless (gtk_tree_model_get_iter_first (GTK_TREE_MODEL (model), &iter));
+	entry = rhythmdb_query_model_iter_to_entry (model, &iter);
+	fail_unless (entry == entries[0], "changed entry didn't move to the start");
+	rhythmdb_entry_unref (entry);
+
+	/* tidy up */
+	for (i = 0; i < 3; i++) {
+		rhythmdb_entry_delete (db, entries[i]);
+	}
+	rhythmdb_commit (db);
+	g_object_unref (model);
+
+	end_test_case ();
+}
+END_TEST
+
+/* this tests that large models are resorted in the background, keeping
+ * their old order until the new one is applied in one go */
+#define RESORT_TEST_ENTRIES 5000
+
+START_TEST (test_query_model_background_resort)
+{
+	RhythmDBQueryModel *model;
+	RhythmDBEntry **entries;
+	RhythmDBEntry *added;
+	RhythmDBEntry *entry;
+	GPtrArray *chunk;
+	GtkTreeIter iter;
+	char *uri;
+	int i;
+
+	start_test_case ();
+
+	/* setup */
+	model = g_object_new (RHYTHMDB_TYPE_QUERY_MODEL,
+			      "db", db,
+			      "sort-func", rhythmdb_query_model_location_sort_func,
+			      NULL);
+
+	entries = g_new0 (RhythmDBEntry *, RESORT_TEST_ENTRIES);
+	chunk = g_ptr_array_sized_new (RESORT_TEST_ENTRIES);
+	for (i = 0; i < RESORT_TEST_ENTRIES; i++) {
+		uri = g_strdup_printf ("file:///resort-%04d.ogg", (i * 7) % RESORT_TEST_ENTRIES);
+		entries[i] = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, uri);
+		g_ptr_array_add (chunk, entries[i]);
+		g_free (uri);
+	}
+	rhythmdb_commit (db);
+
+	rhythmdb_query_results_add_results (RHYTHMDB_QUERY_RESULTS (model), chunk);
+	fail_unless (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL) == RESORT_TEST_ENTRIES);
+	fail_unless (model_is_sorted (model, (GCompareDataFunc) rhythmdb_query_model_location_sort_func, FALSE));
+
+	end_step ();
+
+	/* reverse the order; nothing changes until the resort is done */
+	rhythmdb_query_model_set_sort_order (model,
+					     (GCompareDataFunc) rhythmdb_query_model_location_sort_func,
+					     NULL, NULL, TRUE);
+	fail_unless (model_is_sorted (model, (GCompareDataFunc) rhythmdb_query_model_location_sort_func, FALSE),
+		     "model reordered before the resort finished");
+
+	/* entries removed and added while sorting */
+	rhythmdb_query_model_remove_entry (model, entries[0]);
+	added = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///resort-added.ogg");
+	rhythmdb_commit (db);
+	rhythmdb_query_model_add_entry (model, added, -1);
+
+	set_waiting_signal (G_OBJECT (model), "rows-reordered");
+	wait_for_signal ();
+
+	fail_unless (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL) == RESORT_TEST_ENTRIES);
+	fail_unless (model_is_sorted (model, (GCompareDataFunc) rhythmdb_query_model_location_sort_func, TRUE),
+		     "model not in reverse order after the resort");
+	fail_if (rhythmdb_query_model_entry_to_iter (model, entries[0], &iter));
+
+	/* "resort-added" sorts after all the numbered entries */
+	fail_unless (gtk_tree_model_get_iter_first (GTK_TREE_MODEL (model), &iter));
+	entry = rhythmdb_query_model_iter_to_entry (model, &iter);
+	fail_unless (entry == added, "entry added while sorting not in place");
+	rhythmdb_entry_unref (entry);
+
+	end_step ();
+
+	/* tidy up */
+	for (i = 0; i < RESORT_TEST_ENTRIES; i++) {
+		rhythmdb_entry_delete (db, entries[i]);
+	}
+	rhythmdb_entry_delete (db, added);
+	rhythmdb_commit (db);
+	g_free (entries);
+	g_object_unref (model);
+
+	end_test_case ();
+}
+END_TEST
+
+/* this tests that entry changes made in one go are applied to the model
+ * together, and that inserts place entries correctly while changes
+ * are still pending */
+START_TEST (test_query_model_pending_changes)
+{
+	RhythmDBQueryModel *model;
+	RhythmDBEntry *entries[5];
+	RhythmDBEntry *added;
+	RhythmDBEntry *entry;
+	GtkTreeIter iter;
+	const char *titles[] = { "b", "c", "d", "e", "f" };
+	int reordered = 0;
+	int changed = 0;
+	char *uri;
+	int i;
+
+	start_test_case ();
+
+	/* setup */
+	model = g_object_new (RHYTHMDB_TYPE_QUERY_MODEL,
+			      "db", db,
+			      "sort-func", rhythmdb_query_model_title_sort_func,
+			      NULL);
+
+	for (i = 0; i < 5; i++) {
+		uri = g_strdup_printf ("file:///pending-%d.ogg", i);
+		entries[i] = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, uri);
+		g_free (uri);
+		set_entry_string (db, entries[i], RHYTHMDB_PROP_TITLE, titles[i]);
+	}
+	rhythmdb_commit (db);
+
+	for (i = 0; i < 5; i++) {
+		rhythmdb_query_model_add_entry (model, entries[i], -1);
+	}
+	fail_unless (model_is_sorted (model, (GCompareDataFunc) rhythmdb_query_model_title_sort_func, FALSE));
+
+	end_step ();
+
+	/* move the first entry to the end and the last to the start */
+	g_signal_connect (model, "rows-reordered", G_CALLBACK (_count_signal_cb), &reordered);
+	g_signal_connect (model, "row-changed", G_CALLBACK (_count_signal_cb), &changed);
+
+	set_waiting_signal (G_OBJECT (db), "entry-changed");
+	set_entry_string (db, entries[0], RHYTHMDB_PROP_TITLE, "g");
+	set_entry_string (db, entries[4], RHYTHMDB_PROP_TITLE, "a");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+	end_step ();
+
+	fail_unless (reordered == 1, "changes not applied as one reorder");
+	fail_unless (changed == 2, "wrong number of row-changed signals");
+	fail_unless (model_is_sorted (model, (GCompareDataFunc) rhythmdb_query_model_title_sort_func, FALSE));
+
+	fail_unless (gtk_tree_model_get_iter_first (GTK_TREE_MODEL (model), &iter));
+	entry = rhythmdb_query_model_iter_to_entry (model, &iter);
+	fail_unless (entry == entries[4], "changed entry didn't move to the start");
+	rhythmdb_entry_unref (entry);
+	fail_unless (gtk_tree_model_iter_nth_child (GTK_TREE_MODEL (model), &iter, NULL, 4));
+	entry = rhythmdb_query_model_iter_to_entry (model, &iter);
+	fail_unless (entry == entries[0], "changed entry didn't move to the end");
+	rhythmdb_entry_unref (entry);
+
+	end_step ();
+
+	/* with a change pending, a new entry still goes in the right place */
+	set_waiting_signal (G_OBJECT (db), "entry-changed");
+	set_entry_string (db, entries[2], RHYTHMDB_PROP_TITLE, "h");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+
+	added = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///pending-added.ogg");
+	set_entry_string (db, added, RHYTHMDB_PROP_TITLE, "f");
+	rhythmdb_commit (db);
+	rhythmdb_query_model_add_entry (model, added, -1);
+
+	fail_unless (model_is_sorted (model, (GCompareDataFunc) rhythmdb_query_model_title_sort_func, FALSE),
+		     "entry inserted against a stale order");
+	fail_unless (gtk_tree_model_iter_nth_child (GTK_TREE_MODEL (model), &iter, NULL, 3));
+	entry = rhythmdb_query_model_iter_to_entry (model, &iter);
+	fail_unless (entry == added, "new entry not in place");
+	rhythmdb_entry_unref (entry);
+
+	end_step ();
+
+	/* tidy up */
+	for (i = 0; i < 5; i++) {
+		rhythmdb_entry_delete (db, entries[i]);
+	}
+	rhythmdb_entry_delete (db, added);
+	rhythmdb_commit (db);
+	g_object_unref (model);
+
+	end_test_case ();
+}
+END_TEST
+
+/* this tests that entries drop out of time-relative queries when their
+ * time is up, without anything else about them changing */
+START_TEST (test_query_model_expiry)
+{
+	RhythmDBQueryModel *model;
+	RhythmDBQuery *query;
+	RhythmDBEntry *recent;
+	RhythmDBEntry *old;
+	GtkTreeIter iter;
+	GTimeVal now;
+
+	start_test_case ();
+
+	/* setup */
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_EQUALS,
+				        RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_IGNORE,
+				      RHYTHMDB_QUERY_PROP_CURRENT_TIME_WITHIN,
+				        RHYTHMDB_PROP_LAST_PLAYED, (gulong) 1,
+				      RHYTHMDB_QUERY_END);
+	model = rhythmdb_query_model_new (db, query, (GCompareDataFunc)rhythmdb_query_model_location_sort_func, NULL, NULL, FALSE);
+	rhythmdb_query_free (query);
+
+	/* one entry played just now, one played an hour ago */
+	g_get_current_time (&now);
+	set_waiting_signal (G_OBJECT (db), "entry_added");
+	recent = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///recent.ogg");
+	old = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///old.ogg");
+	set_entry_ulong (db, recent, RHYTHMDB_PROP_LAST_PLAYED, now.tv_sec);
+	set_entry_ulong (db, old, RHYTHMDB_PROP_LAST_PLAYED, now.tv_sec - 3600);
+	rhythmdb_commit (db);
+	wait_for_signal ();
+	end_step ();
+
+	fail_unless (rhythmdb_query_model_entry_to_iter (model, recent, &iter), "recent entry not in the model");
+	fail_if (rhythmdb_query_model_entry_to_iter (model, old, &iter));
+
+	end_step ();
+
+	/* a couple of seconds later, the recent entry is no longer recent */
+	set_waiting_signal (G_OBJECT (model), "entry-removed");
+	wait_for_signal ();
+
+	fail_if (rhythmdb_query_model_entry_to_iter (model, recent, &iter));
+	fail_if (rhythmdb_query_model_entry_to_iter (model, old, &iter));
+	fail_unless (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL) == 0);
+
+	end_step ();
+
+	/* playing it again brings it back */
+	g_get_current_time (&now);
+	set_waiting_signal (G_OBJECT (db), "entry-changed");
+	set_entry_ulong (db, recent, RHYTHMDB_PROP_LAST_PLAYED, now.tv_sec);
+	rhythmdb_commit (db);
+	wait_for_signal ();
+
+	fail_unless (rhythmdb_query_model_entry_to_iter (model, recent, &iter), "replayed entry not in the model");
+
+	/* tidy up */
+	rhythmdb_entry_delete (db, recent);
+	rhythmdb_entry_delete (db, old);
+	rhythmdb_commit (db);
+	g_object_unref (model);
+
+	end_test_case ();
+}
+END_TEST
+
 static Suite *
 rhythmdb_query_model_suite (void)
 {
 	Suite *s = suite_create ("rhythmdb-query-model");
 	TCase *tc_chain = tcase_create ("rhythmdb-query-model-core");
 	TCase *tc_bugs = tcase_create ("rhythmdb-query-model-bugs");
+	TCase *tc_slow = tcase_create ("rhythmdb-query-model-slow");
 
 	suite_add_tcase (s, tc_chain);
 	tcase_add_checked_fixture (tc_chain, test_rhythmdb_setup, test_rhythmdb_shutdown);
 	suite_add_tcase (s, tc_bugs);
 	tcase_add_checked_fixture (tc_bugs, test_rhythmdb_setup, test_rhythmdb_shutdown);
+	suite_add_tcase (s, tc_slow);
+	tcase_add_checked_fixture (tc_slow, test_rhythmdb_setup, test_rhythmdb_shutdown);
+	tcase_set_timeout (tc_slow, 30);
 
 	/* test core functionality */
 	tcase_add_test (tc_chain, test_rhythmdb_db_queries);
+	tcase_add_test (tc_chain, test_limited_entries);
+	tcase_add_test (tc_chain, test_query_model_insert_chunk);
+	tcase_add_test (tc_chain, test_query_model_sort_key_refresh);
+	tcase_add_test (tc_chain, test_query_model_pending_changes);
 
 	/* tests for breakable bug fixes */
 	tcase_add_test (tc_bugs, test_hidden_chain_filter);
 
+	/* tests that need large models or real time to pass */
+	tcase_add_test (tc_slow, test_query_model_background_resort);
+	tcase_add_test (tc_slow, test_query_model_expiry);
+
 	return s;
 }
 
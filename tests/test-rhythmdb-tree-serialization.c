@@ -1,4 +1,4 @@
-/* 
+/*
  *  Copyright (C) 2003 Colin Walters <walters@verbum.org>
  *
  *  This program is free software; you can redistribute it and/or modify
@@ -26,135 +26,335 @@
 
 #include "config.h"
 
+#include <check.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <gtk/gtk.h>
 #include <stdlib.h>
 #include <string.h>
 #include <libxml/tree.h>
+
+#include "test-utils.h"
+
+#include "rhythmdb.h"
 #include "rhythmdb-tree.h"
 #include "rb-debug.h"
-#include "rb-thread-helpers.h"
+#include "rb-file-helpers.h"
+#include "rb-preferences.h"
+#include "rb-util.h"
+#include "eel-gconf-extensions.h"
+
+static char *test_dir;
+static char *db_name;
+static char *library_uri;
+static gboolean saved_shard_db;
+static GSList *saved_locations;
 
 static RhythmDBEntry *
-create_entry (RhythmDB *db, const char *name, const char *album,
-	      const char *artist, const char *genre)
+create_entry (RhythmDB *db, const char *location, const char *name)
 {
 	RhythmDBEntry *entry;
-	GValue val = {0, };
-
-	entry = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///yay.ogg");
-	g_assert (entry);
-	g_value_init (&val, G_TYPE_STRING);
-	g_value_set_static_string (&val, genre);
-	rhythmdb_entry_set (db, entry, RHYTHMDB_PROP_GENRE, &val);
-	g_value_unset (&val);
-
-	g_value_init (&val, G_TYPE_STRING);
-	g_value_set_static_string (&val, artist);
-	rhythmdb_entry_set (db, entry, RHYTHMDB_PROP_ARTIST, &val);
-	g_value_unset (&val);
-
-	g_value_init (&val, G_TYPE_STRING);
-	g_value_set_static_string (&val, album);
-	rhythmdb_entry_set (db, entry, RHYTHMDB_PROP_ALBUM, &val);
-	g_value_unset (&val);
-
-	g_value_init (&val, G_TYPE_STRING);
-	g_value_set_static_string (&val, name);
-	rhythmdb_entry_set (db, entry, RHYTHMDB_PROP_TITLE, &val);
-	g_value_unset (&val);
+
+	entry = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_SONG, location);
+	fail_unless (entry != NULL, "failed to create entry");
+	set_entry_string (db, entry, RHYTHMDB_PROP_GENRE, "Rock");
+	set_entry_string (db, entry, RHYTHMDB_PROP_ARTIST, "Nine Inch Nails");
+	set_entry_string (db, entry, RHYTHMDB_PROP_ALBUM, "Pretty Hate Machine");
+	set_entry_string (db, entry, RHYTHMDB_PROP_TITLE, name);
 
 	return entry;
 }
 
-static void
-assert_xml_file_has_entry (const char *entry)
+static gboolean
+xml_file_has_entry (const char *filename, const char *entry)
 {
 	xmlDocPtr doc;
 	xmlNodePtr root, child;
-	
-	doc = xmlParseFile ("test.xml");
-	g_assert (doc != NULL);
+	gboolean found = FALSE;
+
+	doc = xmlParseFile (filename);
+	fail_unless (doc != NULL, "couldn't parse %s", filename);
 
 	root = xmlDocGetRootElement (doc);
-	
+
 	child = root->children;
-	for (; child != NULL; child = child->next) {
+	for (; child != NULL && found == FALSE; child = child->next) {
 		xmlNodePtr sub_child;
 
 		if (child->type != XML_ELEMENT_NODE)
 			continue;
-		
+
 		for (sub_child = child->children; sub_child; sub_child = sub_child->next) {
 			if (sub_child->type != XML_ELEMENT_NODE)
 				continue;
 
-			if (!strcmp (sub_child->name, "title")) {
-				if (!strcmp (sub_child->children->content,
-					     entry))
-					goto out;
+			if (!strcmp ((char *)sub_child->name, "title") &&
+			    !strcmp ((char *)sub_child->children->content, entry)) {
+				found = TRUE;
+				break;
 			}
 		}
 	}
-	
-	g_assert_not_reached ();
-	out:
+
 	xmlFreeDoc (doc);
+	return found;
 }
 
+static char *
+get_shard_file (void)
+{
+	char *dirname;
+	char *filename = NULL;
+	GDir *dir;
+	const char *basename;
 
-int
-main (int argc, char **argv)
+	dirname = g_strconcat (db_name, ".shards", NULL);
+	dir = g_dir_open (dirname, 0, NULL);
+	if (dir != NULL) {
+		while ((basename = g_dir_read_name (dir)) != NULL) {
+			if (g_str_has_suffix (basename, ".xml")) {
+				fail_unless (filename == NULL, "more than one shard file");
+				filename = g_build_filename (dirname, basename, NULL);
+			}
+		}
+		g_dir_close (dir);
+	}
+	g_free (dirname);
+
+	return filename;
+}
+
+static void
+remove_tree (const char *path)
 {
-	RhythmDB *db;
-	RhythmDBEntry *entry;
-	xmlDocPtr doc;
+	GDir *dir;
+	const char *basename;
 
-	gtk_init (&argc, &argv);
-	g_thread_init (NULL);
-	gdk_threads_init ();
-	rb_thread_helpers_init ();
-	rb_debug_init (TRUE);
+	dir = g_dir_open (path, 0, NULL);
+	if (dir != NULL) {
+		while ((basename = g_dir_read_name (dir)) != NULL) {
+			char *child = g_build_filename (path, basename, NULL);
+			remove_tree (child);
+			g_free (child);
+		}
+		g_dir_close (dir);
+		g_rmdir (path);
+	} else {
+		g_unlink (path);
+	}
+}
+
+static void
+open_db (void)
+{
+	db = rhythmdb_tree_new (db_name);
+	fail_unless (db != NULL, "failed to initialise DB");
+	rhythmdb_start_action_thread (db);
+
+	set_waiting_signal (G_OBJECT (db), "load-complete");
+	rhythmdb_load (db);
+	wait_for_signal ();
+}
+
+static void
+test_shard_setup (void)
+{
+	GSList *locations;
+	char *library_dir;
+
+	init_once (TRUE);
 
-	GDK_THREADS_ENTER ();
+	test_dir = g_build_filename (g_get_tmp_dir (), "rb-test-shards-XXXXXX", NULL);
+	fail_unless (mkdtemp (test_dir) != NULL, "couldn't create test directory");
+	db_name = g_build_filename (test_dir, "rhythmdb.xml", NULL);
 
-	db = rhythmdb_tree_new ("test.xml");
+	library_dir = g_build_filename (test_dir, "music", NULL);
+	g_mkdir (library_dir, 0700);
+	library_uri = g_filename_to_uri (library_dir, NULL, NULL);
+	g_free (library_dir);
 
-	/*
-	 *  TEST 1: Save with no entries
-	 */
-	g_print ("Test 1\n");
-	rhythmdb_read_lock (db);
+	saved_shard_db = eel_gconf_get_boolean (CONF_LIBRARY_SHARD_DB);
+	saved_locations = eel_gconf_get_string_list (CONF_LIBRARY_LOCATION);
+
+	locations = g_slist_prepend (NULL, library_uri);
+	eel_gconf_set_string_list (CONF_LIBRARY_LOCATION, locations);
+	eel_gconf_set_boolean (CONF_LIBRARY_SHARD_DB, TRUE);
+	g_slist_free (locations);
+
+	open_db ();
+}
+
+static void
+test_shard_shutdown (void)
+{
+	if (db != NULL)
+		test_rhythmdb_shutdown ();
+
+	eel_gconf_set_string_list (CONF_LIBRARY_LOCATION, saved_locations);
+	eel_gconf_set_boolean (CONF_LIBRARY_SHARD_DB, saved_shard_db);
+	rb_slist_deep_free (saved_locations);
+	saved_locations = NULL;
+
+	remove_tree (test_dir);
+	g_free (test_dir);
+	g_free (db_name);
+	g_free (library_uri);
+}
+
+/* creates one entry inside the library location and one outside it, then saves */
+static void
+save_shard_entries (void)
+{
+	char *uri;
+
+	uri = g_strconcat (library_uri, "/sin.ogg", NULL);
+	create_entry (db, uri, "Sin");
+	g_free (uri);
+	create_entry (db, "file:///elsewhere/terrible-lie.ogg", "Terrible Lie");
+	rhythmdb_commit (db);
+
+	rhythmdb_save (db);
+}
+
+START_TEST (test_rhythmdb_tree_save_empty)
+{
+	xmlDocPtr doc;
 
 	rhythmdb_save (db);
 
-	doc = xmlParseFile ("test.xml");
-	g_assert (doc != NULL);
+	doc = xmlParseFile (db_name);
+	fail_unless (doc != NULL, "empty database not saved");
 	xmlFreeDoc (doc);
+}
+END_TEST
 
-	rhythmdb_read_unlock (db);
-	g_print ("Test 1: PASS\n");
+START_TEST (test_rhythmdb_tree_save_shard)
+{
+	char *shard_file;
+
+	save_shard_entries ();
 
-	/*
-	 *  TEST 2: Save with a single entry
-	 */
-	g_print ("Test 1\n");
-	rhythmdb_write_lock (db);
+	shard_file = get_shard_file ();
+	fail_unless (shard_file != NULL, "shard file not written");
+	fail_unless (xml_file_has_entry (shard_file, "Sin"), "shard entry not in the shard file");
+	fail_if (xml_file_has_entry (shard_file, "Terrible Lie"));
 
-	entry = create_entry (db, "Sin", "Pretty Hate Machine", "Nine Inch Nails", "Rock");
+	fail_unless (xml_file_has_entry (db_name, "Terrible Lie"), "other entry not in the main file");
+	fail_if (xml_file_has_entry (db_name, "Sin"));
+	g_free (shard_file);
+}
+END_TEST
 
+START_TEST (test_rhythmdb_tree_load_shard)
+{
+	char *uri;
+	char *shard_file;
+
+	save_shard_entries ();
+	test_rhythmdb_shutdown ();
+	open_db ();
+
+	uri = g_strconcat (library_uri, "/sin.ogg", NULL);
+	fail_unless (rhythmdb_entry_lookup_by_location (db, uri) != NULL, "shard entry not loaded");
+	g_free (uri);
+	fail_unless (rhythmdb_entry_lookup_by_location (db, "file:///elsewhere/terrible-lie.ogg") != NULL,
+		     "main file entry not loaded");
+
+	/* saving again must not move shard entries into the main file */
+	create_entry (db, "file:///elsewhere/down-in-it.ogg", "Down In It");
+	rhythmdb_commit (db);
 	rhythmdb_save (db);
 
-	assert_xml_file_has_entry ("Sin");
+	fail_unless (xml_file_has_entry (db_name, "Down In It"), "new entry not in the main file");
+	fail_if (xml_file_has_entry (db_name, "Sin"));
+
+	shard_file = get_shard_file ();
+	fail_unless (shard_file != NULL, "shard file removed");
+	fail_unless (xml_file_has_entry (shard_file, "Sin"), "shard entry lost");
+	g_free (shard_file);
+}
+END_TEST
+
+START_TEST (test_rhythmdb_tree_unavailable_shard)
+{
+	char *library_dir;
+	char *uri;
+	char *shard_file;
+
+	save_shard_entries ();
+	test_rhythmdb_shutdown ();
+
+	/* the library location disappears, so its shard is left unloaded */
+	library_dir = g_filename_from_uri (library_uri, NULL, NULL);
+	g_rmdir (library_dir);
+	g_free (library_dir);
+	open_db ();
+
+	uri = g_strconcat (library_uri, "/sin.ogg", NULL);
+	fail_if (rhythmdb_entry_lookup_by_location (db, uri) != NULL);
+	g_free (uri);
+	fail_unless (rhythmdb_entry_lookup_by_location (db, "file:///elsewhere/terrible-lie.ogg") != NULL,
+		     "main file entry not loaded");
+
+	/* and saving leaves the shard file alone */
+	create_entry (db, "file:///elsewhere/down-in-it.ogg", "Down In It");
+	rhythmdb_commit (db);
+	rhythmdb_save (db);
+
+	fail_unless (xml_file_has_entry (db_name, "Down In It"), "new entry not in the main file");
+	fail_if (xml_file_has_entry (db_name, "Sin"));
+
+	shard_file = get_shard_file ();
+	fail_unless (shard_file != NULL, "unloaded shard file removed");
+	fail_unless (xml_file_has_entry (shard_file, "Sin"), "unloaded shard entry lost");
+	g_free (shard_file);
+}
+END_TEST
+
+static Suite *
+rhythmdb_tree_serialization_suite (void)
+{
+	Suite *s = suite_create ("rhythmdb-tree-serialization");
+	TCase *tc_chain = tcase_create ("rhythmdb-tree-serialization-core");
+
+	suite_add_tcase (s, tc_chain);
+	tcase_add_checked_fixture (tc_chain, test_shard_setup, test_shard_shutdown);
+
+	tcase_add_test (tc_chain, test_rhythmdb_tree_save_empty);
+	tcase_add_test (tc_chain, test_rhythmdb_tree_save_shard);
+	tcase_add_test (tc_chain, test_rhythmdb_tree_load_shard);
+	tcase_add_test (tc_chain, test_rhythmdb_tree_unavailable_shard);
+
+	return s;
+}
+
+int
+main (int argc, char **argv)
+{
+	int ret;
+	SRunner *sr;
+	Suite *s;
+
+	g_log_set_always_fatal (G_LOG_LEVEL_WARNING | G_LOG_LEVEL_CRITICAL);
+
+	g_thread_init (NULL);
+	rb_threads_init ();
+	rb_debug_init (TRUE);
+	rb_refstring_system_init ();
+	rb_file_helpers_init (TRUE);
+
+	s = rhythmdb_tree_serialization_suite ();
+	sr = srunner_create (s);
+
+	init_setup (sr, argc, argv);
+	init_once (FALSE);
+
+	srunner_run_all (sr, CK_NORMAL);
+	ret = srunner_ntests_failed (sr);
+	srunner_free (sr);
 
-	rhythmdb_write_unlock (db);
+	rb_file_helpers_shutdown ();
+	rb_refstring_system_shutdown ();
 
-	/*
-	 * THE END
-	 */
-	rhythmdb_shutdown (db);
-	g_object_unref (G_OBJECT (db));
-	GDK_THREADS_LEAVE ();
-	
-	exit (0);
+	return ret;
 }
@@ -507,6 +507,250 @@ START_TEST (test_rhythmdb_commit_change_merging)
 }
 END_TEST
 
+static gboolean
+query_is_subset (RhythmDBQuery *query, RhythmDBQuery *base)
+{
+	gboolean ret;
+
+	rhythmdb_query_preprocess (db, query);
+	rhythmdb_query_preprocess (db, base);
+	ret = rhythmdb_query_is_subset (db, query, base);
+	rhythmdb_query_free (query);
+	rhythmdb_query_free (base);
+	return ret;
+}
+
+START_TEST (test_rhythmdb_query_subset_search)
+{
+	/* typing more of a word narrows the search */
+	fail_unless (query_is_subset (rhythmdb_query_parse (db,
+							    RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_SEARCH_MATCH, "beatles",
+							    RHYTHMDB_QUERY_END),
+				      rhythmdb_query_parse (db,
+							    RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_SEARCH_MATCH, "beat",
+							    RHYTHMDB_QUERY_END)),
+		     "longer search word not a subset");
+	fail_if (query_is_subset (rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_SEARCH_MATCH, "beat",
+							RHYTHMDB_QUERY_END),
+				  rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_SEARCH_MATCH, "beatles",
+							RHYTHMDB_QUERY_END)),
+		 "shorter search word is a subset");
+
+	/* and so does adding another word */
+	fail_unless (query_is_subset (rhythmdb_query_parse (db,
+							    RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_SEARCH_MATCH, "beatles help",
+							    RHYTHMDB_QUERY_END),
+				      rhythmdb_query_parse (db,
+							    RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_SEARCH_MATCH, "Beatles",
+							    RHYTHMDB_QUERY_END)),
+		     "extra search word not a subset");
+	fail_if (query_is_subset (rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_SEARCH_MATCH, "beatles",
+							RHYTHMDB_QUERY_END),
+				  rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_SEARCH_MATCH, "beatles help",
+							RHYTHMDB_QUERY_END)),
+		 "removing a search word is a subset");
+
+	/* replacing a word isn't narrowing */
+	fail_if (query_is_subset (rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_SEARCH_MATCH, "beatles",
+							RHYTHMDB_QUERY_END),
+				  rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_SEARCH_MATCH, "stones",
+							RHYTHMDB_QUERY_END)),
+		 "different search word is a subset");
+}
+END_TEST
+
+START_TEST (test_rhythmdb_query_subset_disjunction)
+{
+	/* dropping an alternative narrows the query */
+	fail_unless (query_is_subset (rhythmdb_query_parse (db,
+							    RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_GENRE, "Rock",
+							    RHYTHMDB_QUERY_END),
+				      rhythmdb_query_parse (db,
+							    RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_GENRE, "Rock",
+							    RHYTHMDB_QUERY_DISJUNCTION,
+							    RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_GENRE, "Jazz",
+							    RHYTHMDB_QUERY_END)),
+		     "single alternative not a subset");
+	fail_if (query_is_subset (rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_GENRE, "Rock",
+							RHYTHMDB_QUERY_DISJUNCTION,
+							RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_GENRE, "Jazz",
+							RHYTHMDB_QUERY_END),
+				  rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_GENRE, "Rock",
+							RHYTHMDB_QUERY_END)),
+		 "added alternative is a subset");
+
+	/* swapping an alternative isn't */
+	fail_if (query_is_subset (rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_GENRE, "Rock",
+							RHYTHMDB_QUERY_DISJUNCTION,
+							RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_GENRE, "Pop",
+							RHYTHMDB_QUERY_END),
+				  rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_GENRE, "Rock",
+							RHYTHMDB_QUERY_DISJUNCTION,
+							RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_GENRE, "Jazz",
+							RHYTHMDB_QUERY_END)),
+		 "different alternative is a subset");
+
+	/* an extra criterion inside a subquery still narrows it */
+	fail_unless (query_is_subset (rhythmdb_query_parse (db,
+							    RHYTHMDB_QUERY_SUBQUERY,
+							    rhythmdb_query_parse (db,
+										  RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_GENRE, "Rock",
+										  RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_ARTIST, "Queen",
+										  RHYTHMDB_QUERY_END),
+							    RHYTHMDB_QUERY_END),
+				      rhythmdb_query_parse (db,
+							    RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_GENRE, "Rock",
+							    RHYTHMDB_QUERY_END)),
+		     "subquery with extra criterion not a subset");
+}
+END_TEST
+
+START_TEST (test_rhythmdb_query_subset_strings)
+{
+	/* a longer LIKE string matches fewer entries */
+	fail_unless (query_is_subset (rhythmdb_query_parse (db,
+							    RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_TITLE, "lovely",
+							    RHYTHMDB_QUERY_END),
+				      rhythmdb_query_parse (db,
+							    RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_TITLE, "love",
+							    RHYTHMDB_QUERY_END)),
+		     "longer LIKE not a subset");
+	fail_if (query_is_subset (rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_TITLE, "lo",
+							RHYTHMDB_QUERY_END),
+				  rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_TITLE, "love",
+							RHYTHMDB_QUERY_END)),
+		 "shorter LIKE is a subset");
+
+	/* but a shorter NOT_LIKE string excludes more */
+	fail_unless (query_is_subset (rhythmdb_query_parse (db,
+							    RHYTHMDB_QUERY_PROP_NOT_LIKE, RHYTHMDB_PROP_TITLE, "lo",
+							    RHYTHMDB_QUERY_END),
+				      rhythmdb_query_parse (db,
+							    RHYTHMDB_QUERY_PROP_NOT_LIKE, RHYTHMDB_PROP_TITLE, "love",
+							    RHYTHMDB_QUERY_END)),
+		     "shorter NOT_LIKE not a subset");
+	fail_if (query_is_subset (rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_NOT_LIKE, RHYTHMDB_PROP_TITLE, "lovely",
+							RHYTHMDB_QUERY_END),
+				  rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_NOT_LIKE, RHYTHMDB_PROP_TITLE, "love",
+							RHYTHMDB_QUERY_END)),
+		 "longer NOT_LIKE is a subset");
+
+	/* prefixes and suffixes */
+	fail_unless (query_is_subset (rhythmdb_query_parse (db,
+							    RHYTHMDB_QUERY_PROP_PREFIX, RHYTHMDB_PROP_TITLE, "love me",
+							    RHYTHMDB_QUERY_END),
+				      rhythmdb_query_parse (db,
+							    RHYTHMDB_QUERY_PROP_PREFIX, RHYTHMDB_PROP_TITLE, "love",
+							    RHYTHMDB_QUERY_END)),
+		     "longer prefix not a subset");
+	fail_if (query_is_subset (rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_PREFIX, RHYTHMDB_PROP_TITLE, "my love",
+							RHYTHMDB_QUERY_END),
+				  rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_PREFIX, RHYTHMDB_PROP_TITLE, "love",
+							RHYTHMDB_QUERY_END)),
+		 "different prefix is a subset");
+	fail_unless (query_is_subset (rhythmdb_query_parse (db,
+							    RHYTHMDB_QUERY_PROP_SUFFIX, RHYTHMDB_PROP_TITLE, "my love",
+							    RHYTHMDB_QUERY_END),
+				      rhythmdb_query_parse (db,
+							    RHYTHMDB_QUERY_PROP_SUFFIX, RHYTHMDB_PROP_TITLE, "love",
+							    RHYTHMDB_QUERY_END)),
+		     "longer suffix not a subset");
+	fail_if (query_is_subset (rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_SUFFIX, RHYTHMDB_PROP_TITLE, "love me",
+							RHYTHMDB_QUERY_END),
+				  rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_SUFFIX, RHYTHMDB_PROP_TITLE, "love",
+							RHYTHMDB_QUERY_END)),
+		 "different suffix is a subset");
+
+	/* criteria on different properties don't imply each other */
+	fail_if (query_is_subset (rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_ALBUM, "lovely",
+							RHYTHMDB_QUERY_END),
+				  rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_TITLE, "love",
+							RHYTHMDB_QUERY_END)),
+		 "criterion on another property is a subset");
+}
+END_TEST
+
+START_TEST (test_rhythmdb_query_subset_bounds)
+{
+	/* raising a lower bound narrows the query */
+	fail_unless (query_is_subset (rhythmdb_query_parse (db,
+							    RHYTHMDB_QUERY_PROP_GREATER, RHYTHMDB_PROP_PLAY_COUNT, (gulong) 10,
+							    RHYTHMDB_QUERY_END),
+				      rhythmdb_query_parse (db,
+							    RHYTHMDB_QUERY_PROP_GREATER, RHYTHMDB_PROP_PLAY_COUNT, (gulong) 5,
+							    RHYTHMDB_QUERY_END)),
+		     "higher lower bound not a subset");
+	fail_if (query_is_subset (rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_GREATER, RHYTHMDB_PROP_PLAY_COUNT, (gulong) 3,
+							RHYTHMDB_QUERY_END),
+				  rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_GREATER, RHYTHMDB_PROP_PLAY_COUNT, (gulong) 5,
+							RHYTHMDB_QUERY_END)),
+		 "lower lower bound is a subset");
+
+	/* lowering an upper bound narrows it too */
+	fail_unless (query_is_subset (rhythmdb_query_parse (db,
+							    RHYTHMDB_QUERY_PROP_LESS, RHYTHMDB_PROP_PLAY_COUNT, (gulong) 50,
+							    RHYTHMDB_QUERY_END),
+				      rhythmdb_query_parse (db,
+							    RHYTHMDB_QUERY_PROP_LESS, RHYTHMDB_PROP_PLAY_COUNT, (gulong) 100,
+							    RHYTHMDB_QUERY_END)),
+		     "lower upper bound not a subset");
+	fail_if (query_is_subset (rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_LESS, RHYTHMDB_PROP_PLAY_COUNT, (gulong) 200,
+							RHYTHMDB_QUERY_END),
+				  rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_LESS, RHYTHMDB_PROP_PLAY_COUNT, (gulong) 100,
+							RHYTHMDB_QUERY_END)),
+		 "higher upper bound is a subset");
+
+	/* a value within the bounds */
+	fail_unless (query_is_subset (rhythmdb_query_parse (db,
+							    RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_PLAY_COUNT, (gulong) 5,
+							    RHYTHMDB_QUERY_END),
+				      rhythmdb_query_parse (db,
+							    RHYTHMDB_QUERY_PROP_GREATER, RHYTHMDB_PROP_PLAY_COUNT, (gulong) 5,
+							    RHYTHMDB_QUERY_END)),
+		     "value on the bound not a subset");
+	fail_if (query_is_subset (rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_PLAY_COUNT, (gulong) 4,
+							RHYTHMDB_QUERY_END),
+				  rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_GREATER, RHYTHMDB_PROP_PLAY_COUNT, (gulong) 5,
+							RHYTHMDB_QUERY_END)),
+		 "value outside the bound is a subset");
+
+	/* a bound in the other direction doesn't narrow anything */
+	fail_if (query_is_subset (rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_LESS, RHYTHMDB_PROP_PLAY_COUNT, (gulong) 10,
+							RHYTHMDB_QUERY_END),
+				  rhythmdb_query_parse (db,
+							RHYTHMDB_QUERY_PROP_GREATER, RHYTHMDB_PROP_PLAY_COUNT, (gulong) 5,
+							RHYTHMDB_QUERY_END)),
+		 "opposite bound is a subset");
+}
+END_TEST
+
 static Suite *
 rhythmdb_suite (void)
 {
@@ -525,6 +769,10 @@ rhythmdb_suite (void)
 	tcase_add_test (tc_chain, test_rhythmdb_multiple);
 	tcase_add_test (tc_chain, test_rhythmdb_mirroring);
 	tcase_add_test (tc_chain, test_rhythmdb_keywords);
+	tcase_add_test (tc_chain, test_rhythmdb_query_subset_search);
+	tcase_add_test (tc_chain, test_rhythmdb_query_subset_disjunction);
+	tcase_add_test (tc_chain, test_rhythmdb_query_subset_strings);
+	tcase_add_test (tc_chain, test_rhythmdb_query_subset_bounds);
 	/*tcase_add_test (tc_chain, test_rhythmdb_signals);*/
 	/*tcase_add_test (tc_chain, test_rhythmdb_query);*/
 	/* FIXME: add some keywords to the deserialisation tests */
@@ -72,8 +72,10 @@ static void rb_library_browser_views_changed (GConfClient *client,
 					      RBLibraryBrowser *widget);
 
 typedef struct _RBLibraryBrowserRebuildData RBLibraryBrowserRebuildData;
+typedef struct _RBLibraryBrowserFilterData RBLibraryBrowserFilterData;
 
 static void destroy_idle_rebuild_model (RBLibraryBrowserRebuildData *data);
+static void cancel_filter (RBLibraryBrowser *widget);
 
 G_DEFINE_TYPE (RBLibraryBrowser, rb_library_browser, GTK_TYPE_HBOX)
 #define RB_LIBRARY_BROWSER_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), RB_TYPE_LIBRARY_BROWSER, RBLibraryBrowserPrivate))
@@ -96,7 +98,10 @@ G_DEFINE_TYPE (RBLibraryBrowser, rb_library_browser, GTK_TYPE_HBOX)
  * When the selection in any of the property views changes, or when
  * #rb_library_browser_reset or #rb_library_browser_set_selection are
  * called to manipulate the selection, the query chain is rebuilt
- * asynchronously to update the property views.
+ * asynchronously to update the property views.  The entries for each
+ * rebuilt query model are picked out of its parent model on one of the
+ * database's worker threads, and the model is only handed to the next
+ * property view once it has been filled.
  */
 
 struct _RBLibraryBrowserRebuildData
@@ -106,6 +111,21 @@ struct _RBLibraryBrowserRebuildData
 	int rebuild_idle_id;
 };
 
+struct _RBLibraryBrowserFilterData
+{
+	RBLibraryBrowser *widget;
+	RhythmDB *db;
+	int property_index;
+
+	/* snapshot of the parent model's entries */
+	GPtrArray *entries;
+	RhythmDBQuery *query;
+	RhythmDBQueryModel *child_model;
+	GPtrArray *results;
+
+	volatile gint cancelled;
+};
+
 typedef struct
 {
 	RhythmDB *db;
@@ -120,6 +140,7 @@ typedef struct
 	GHashTable *selections;
 
 	RBLibraryBrowserRebuildData *rebuild_data;
+	RBLibraryBrowserFilterData *filter_data;
 } RBLibraryBrowserPrivate;
 
 enum
@@ -285,6 +306,8 @@ rb_library_browser_dispose (GObject *object)
 		priv->rebuild_data = NULL;
 		g_source_remove (id);
 	}
+
+	cancel_filter (RB_LIBRARY_BROWSER (object));
 	
 	if (priv->db != NULL) {
 		g_object_unref (priv->db);
@@ -637,6 +660,179 @@ restore_selection (RBLibraryBrowser *widget,
 	}
 }
 
+static void rebuild_child_model (RBLibraryBrowser *widget,
+				 gint property_index,
+				 gboolean query_pending);
+
+/*
+ * installs a rebuilt query model as the input for the next property view,
+ * or as the output model, and continues down the chain.
+ * takes ownership of the reference to @child_model.
+ */
+static void
+child_model_ready (RBLibraryBrowser *widget,
+		   gint property_index,
+		   RhythmDBQueryModel *child_model,
+		   gboolean query_pending)
+{
+	RBLibraryBrowserPrivate *priv = RB_LIBRARY_BROWSER_GET_PRIVATE (widget);
+	RhythmDBPropertyModel *prop_model;
+	RBPropertyView *view;
+
+	/* If this is the last property, use the child model as the output model
+	 * for the browser.  Otherwise, use it as the input for the next property
+	 * view.
+	 */
+	if (property_index == num_browser_properties-1) {
+		if (priv->output_model != NULL) {
+			g_object_unref (priv->output_model);
+		}
+
+		priv->output_model = child_model;
+
+		g_object_notify (G_OBJECT (widget), "output-model");
+
+	} else {
+		view = g_hash_table_lookup (priv->property_views, (gpointer)browser_properties[property_index+1].type);
+		ignore_selection_changes (widget, view, TRUE);
+
+		prop_model = rb_property_view_get_model (view);
+		g_object_set (prop_model, "query-model", child_model, NULL);
+
+		g_object_unref (child_model);
+
+		rebuild_child_model (widget, property_index + 1, query_pending);
+		restore_selection (widget, property_index + 1, query_pending);
+	}
+}
+
+static void
+filter_data_free (RBLibraryBrowserFilterData *data)
+{
+	guint i;
+
+	for (i = 0; i < data->entries->len; i++) {
+		rhythmdb_entry_unref (g_ptr_array_index (data->entries, i));
+	}
+	g_ptr_array_free (data->entries, TRUE);
+	if (data->results != NULL)
+		g_ptr_array_free (data->results, TRUE);
+
+	rhythmdb_query_free (data->query);
+	g_object_unref (data->child_model);
+	g_object_unref (data->db);
+	g_object_unref (data->widget);
+	g_free (data);
+}
+
+static gboolean
+filter_done_cb (RBLibraryBrowserFilterData *data)
+{
+	RBLibraryBrowserPrivate *priv;
+
+	GDK_THREADS_ENTER ();
+
+	if (g_atomic_int_get (&data->cancelled)) {
+		rb_debug ("discarding superseded child model for browser %d", data->property_index);
+		filter_data_free (data);
+		GDK_THREADS_LEAVE ();
+		return FALSE;
+	}
+
+	priv = RB_LIBRARY_BROWSER_GET_PRIVATE (data->widget);
+	priv->filter_data = NULL;
+
+	rb_debug ("filtered %u of %u entries for browser %d",
+		  data->results->len, data->entries->len, data->property_index);
+
+	/* the model takes over the results array.  entries that left the
+	 * parent model since the snapshot was taken are dropped when the
+	 * results are added.
+	 */
+	rhythmdb_query_results_add_results (RHYTHMDB_QUERY_RESULTS (data->child_model), data->results);
+	data->results = NULL;
+	rhythmdb_query_results_query_complete (RHYTHMDB_QUERY_RESULTS (data->child_model));
+
+	child_model_ready (data->widget,
+			   data->property_index,
+			   g_object_ref (data->child_model),
+			   FALSE);
+
+	filter_data_free (data);
+	GDK_THREADS_LEAVE ();
+	return FALSE;
+}
+
+static gpointer
+filter_thread (RBLibraryBrowserFilterData *data)
+{
+	guint i;
+
+	data->results = g_ptr_array_new ();
+	for (i = 0; i < data->entries->len; i++) {
+		RhythmDBEntry *entry = g_ptr_array_index (data->entries, i);
+
+		if (G_UNLIKELY (g_atomic_int_get (&data->cancelled)))
+			break;
+
+		if (rhythmdb_evaluate_query (data->db, data->query, entry))
+			g_ptr_array_add (data->results, entry);
+	}
+
+	g_idle_add ((GSourceFunc) filter_done_cb, data);
+	return NULL;
+}
+
+static void
+cancel_filter (RBLibraryBrowser *widget)
+{
+	RBLibraryBrowserPrivate *priv = RB_LIBRARY_BROWSER_GET_PRIVATE (widget);
+
+	if (priv->filter_data == NULL)
+		return;
+
+	rb_debug ("cancelling child model rebuild for browser %d", priv->filter_data->property_index);
+
+	/* the filter job's idle callback frees it */
+	g_atomic_int_set (&priv->filter_data->cancelled, 1);
+	priv->filter_data = NULL;
+}
+
+static void
+start_filter (RBLibraryBrowser *widget,
+	      gint property_index,
+	      RhythmDBQueryModel *base_model,
+	      RhythmDBQueryModel *child_model,
+	      RhythmDBQuery *query)
+{
+	RBLibraryBrowserPrivate *priv = RB_LIBRARY_BROWSER_GET_PRIVATE (widget);
+	RBLibraryBrowserFilterData *data;
+	GtkTreeIter iter;
+
+	data = g_new0 (RBLibraryBrowserFilterData, 1);
+	data->widget = g_object_ref (widget);
+	data->db = g_object_ref (priv->db);
+	data->property_index = property_index;
+	data->query = rhythmdb_query_copy (query);
+	rhythmdb_query_preprocess (priv->db, data->query);
+	data->child_model = child_model;
+
+	/* the child model can only contain entries from its parent */
+	data->entries = g_ptr_array_new ();
+	if (gtk_tree_model_get_iter_first (GTK_TREE_MODEL (base_model), &iter)) {
+		do {
+			g_ptr_array_add (data->entries,
+					 rhythmdb_query_model_iter_to_entry (base_model, &iter));
+		} while (gtk_tree_model_iter_next (GTK_TREE_MODEL (base_model), &iter));
+	}
+
+	/* the worker pool bounds how many filters run at once when the
+	 * selection changes quickly, and shutdown waits for them.
+	 */
+	priv->filter_data = data;
+	rhythmdb_push_worker_job (priv->db, (GThreadFunc) filter_thread, data);
+}
+
 static void
 rebuild_child_model (RBLibraryBrowser *widget,
 		     gint property_index,
@@ -652,6 +848,9 @@ rebuild_child_model (RBLibraryBrowser *widget,
 	g_assert (property_index >= 0);
 	g_assert (property_index < num_browser_properties);
 
+	/* anything still being built from here on down is out of date */
+	cancel_filter (widget);
+
 	/* get the query model for the previous property view */
 	view = g_hash_table_lookup (priv->property_views, (gpointer)browser_properties[property_index].type);
 	prop_model = rb_property_view_get_model (view);
@@ -681,11 +880,14 @@ rebuild_child_model (RBLibraryBrowser *widget,
 				      "base-model", base_model,
 				      NULL);
 		} else {
-			rb_debug ("rebuilding child model for browser %d; running new query", property_index);
+			rb_debug ("rebuilding child model for browser %d; filtering parent model", property_index);
 			rhythmdb_query_model_chain (child_model, base_model, FALSE);
-			rhythmdb_do_full_query_parsed (priv->db,
-						       RHYTHMDB_QUERY_RESULTS (child_model),
-						       query);
+			start_filter (widget, property_index, base_model, child_model, query);
+
+			/* the rest of the chain is rebuilt once the filter is done */
+			rhythmdb_query_free (query);
+			g_object_unref (base_model);
+			return;
 		}
 		rhythmdb_query_free (query);
 	} else {
@@ -693,31 +895,7 @@ rebuild_child_model (RBLibraryBrowser *widget,
 		child_model = g_object_ref (base_model);
 	}
 
-	/* If this is the last property, use the child model as the output model
-	 * for the browser.  Otherwise, use it as the input for the next property
-	 * view.
-	 */
-	if (property_index == num_browser_properties-1) {
-		if (priv->output_model != NULL) {
-			g_object_unref (priv->output_model);
-		}
-
-		priv->output_model = child_model;
-
-		g_object_notify (G_OBJECT (widget), "output-model");
-
-	} else {
-		view = g_hash_table_lookup (priv->property_views, (gpointer)browser_properties[property_index+1].type);
-		ignore_selection_changes (widget, view, TRUE);
-
-		prop_model = rb_property_view_get_model (view);
-		g_object_set (prop_model, "query-model", child_model, NULL);
-
-		g_object_unref (child_model);
-
-		rebuild_child_model (widget, property_index + 1, query_pending);
-		restore_selection (widget, property_index + 1, query_pending);
-	}
+	child_model_ready (widget, property_index, child_model, query_pending);
 
 	g_object_unref (base_model);
 }
@@ -792,6 +970,15 @@ rb_library_browser_set_selection (RBLibraryBrowser *widget,
 		rebuild_data = NULL;
 	}
 
+	if (priv->filter_data != NULL &&
+	    priv->filter_data->property_index < rebuild_index) {
+		/* the model being filtered is further up the chain, and
+		 * this selection will be picked up when it's done.
+		 */
+		return;
+	}
+	cancel_filter (widget);
+
 	view = g_hash_table_lookup (priv->property_views, (gpointer)type);
 	if (view) {
 		ignore_selection_changes (widget, view, TRUE);